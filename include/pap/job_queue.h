@@ -8,6 +8,23 @@
 #define PATH_MAX 4096
 #endif
 
+#define JQ_UUID_MAX 128
+#define JQ_LEASE_OWNER_MAX 64
+#define JQ_LEASE_DEFAULT_SECONDS 300
+#define JQ_LEVEL_COUNT 8
+#define JQ_LEVEL_AUTO (-1)
+#define JQ_LEVEL_NORMAL 2
+#define JQ_LEVEL_HIGH 6
+#define JQ_LEVEL_WEIGHT_MAX 1024
+#define JQ_BLOB_HASH_MAX 65
+#define JQ_RETRY_DEFAULT_ATTEMPTS 5
+#define JQ_RETRY_DEFAULT_BASE_SECONDS 30
+#define JQ_RETRY_DEFAULT_MAX_SECONDS 3600
+#define JQ_TENANT_MAX 64
+#define JQ_TENANT_NAME_MAX 32
+#define JQ_TENANT_WEIGHT_MAX 1024
+#define JQ_PHASE_MAX 16
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,6 +43,14 @@ typedef enum {
     JQ_STATE_ERROR = 3
 } jq_state_t;
 
+typedef enum {
+    JQ_LAYOUT_FLAT = 0,
+    JQ_LAYOUT_SHARDED = 1,
+    JQ_LAYOUT_MIGRATING = 2,
+    JQ_LAYOUT_DIRECTORY = 3,
+    JQ_LAYOUT_DIRECTORY_MIGRATING = 4
+} jq_layout_t;
+
 typedef struct {
     size_t pdf_jobs;
     size_t metadata_jobs;
@@ -41,6 +66,14 @@ typedef struct {
     unsigned long long report_bytes;
 } jq_state_stats_t;
 
+typedef struct {
+    char name[JQ_TENANT_NAME_MAX];
+    unsigned int max_in_flight;
+    unsigned int weight;
+    size_t depth;
+    size_t in_flight;
+} jq_tenant_stats_t;
+
 typedef struct {
     jq_state_stats_t states[JQ_STATE_ERROR + 1];
     size_t total_jobs;
@@ -49,16 +82,191 @@ typedef struct {
     unsigned long long total_bytes;
     time_t oldest_mtime;
     time_t newest_mtime;
+    time_t oldest_waiting_mtime;
+    unsigned long long oldest_waiting_age_seconds;
+    time_t reconciled_at;
+    unsigned long long events_dropped;
+    size_t tenant_count;
+    jq_tenant_stats_t tenants[JQ_TENANT_MAX];
 } jq_stats_t;
 
+typedef enum {
+    JQ_SUBMIT_COPY = 0,
+    JQ_SUBMIT_LINK = 1,
+    JQ_SUBMIT_BLOB = 2
+} jq_submit_mode_t;
+
+typedef struct {
+    int priority;
+    int level;
+    jq_submit_mode_t mode;
+    unsigned int threads;
+    const char *blob;
+    const char *tenant;
+} jq_submit_options_t;
+
+typedef struct {
+    const char *uuid;
+    const char *pdf_path;
+    const char *metadata_path;
+    int level;
+    jq_result_t result;
+} jq_submit_item_t;
+
+typedef enum {
+    JQ_CLAIM_ORDER_PRIORITY = 0,
+    JQ_CLAIM_ORDER_FIFO = 1,
+    JQ_CLAIM_ORDER_WEIGHTED = 2
+} jq_claim_order_t;
+
+typedef enum {
+    JQ_CLAIM_SIZE_ANY = 0,
+    JQ_CLAIM_SIZE_SMALLEST_FIRST = 1,
+    JQ_CLAIM_SIZE_ROUND_ROBIN = 2
+} jq_claim_size_t;
+
+typedef struct {
+    int prefer_priority;
+    jq_claim_order_t order;
+    const char *owner;
+    unsigned int lease_seconds;
+    unsigned int weights[JQ_LEVEL_COUNT];
+    jq_claim_size_t size;
+    unsigned long long max_bytes;
+    unsigned int max_attempts;
+} jq_claim_options_t;
+
+typedef struct {
+    char owner[JQ_LEASE_OWNER_MAX];
+    jq_state_t state;
+    int level;
+    time_t claimed_at;
+    time_t expires_at;
+    unsigned int lease_seconds;
+    int cancelled;
+} jq_lease_t;
+
+typedef struct {
+    char phase[JQ_PHASE_MAX];
+    unsigned long long bytes_done;
+    unsigned long long bytes_total;
+    time_t started_at;
+    unsigned long long bytes_per_second;
+    long long eta_seconds;
+} jq_progress_t;
+
+typedef struct {
+    unsigned int max_attempts;
+    unsigned int base_delay_seconds;
+    unsigned int max_delay_seconds;
+    const char *owner;
+} jq_retry_options_t;
+
+typedef enum {
+    JQ_EVENT_SUBMIT = 1,
+    JQ_EVENT_CLAIM = 2,
+    JQ_EVENT_RELEASE = 3,
+    JQ_EVENT_RETRY = 4,
+    JQ_EVENT_FINALIZE = 5,
+    JQ_EVENT_MOVE = 6,
+    JQ_EVENT_CANCEL = 7
+} jq_event_kind_t;
+
+typedef struct {
+    unsigned long long cursor;
+    jq_event_kind_t kind;
+    char uuid[JQ_UUID_MAX];
+    int from_state;
+    int to_state;
+    long long at_ms;
+    long long bytes;
+} jq_event_t;
+
+typedef struct {
+    int repair;
+    unsigned int threads;
+    time_t now;
+} jq_fsck_options_t;
+
+typedef struct {
+    size_t entries;
+    size_t temp_files;
+    size_t stale_locks;
+    size_t split_pairs;
+    size_t stray_reports;
+    size_t orphans;
+    size_t busy;
+    size_t repaired;
+} jq_fsck_report_t;
+
+typedef struct {
+    unsigned int max_age_seconds;
+    size_t max_loose;
+    int pack_pdf;
+    size_t max_event_segments;
+} jq_retention_options_t;
+
+typedef enum {
+    JQ_FILE_PDF = 0,
+    JQ_FILE_METADATA = 1,
+    JQ_FILE_REPORT = 2
+} jq_file_kind_t;
+
+typedef struct jq_handle jq_handle_t;
+
+typedef struct jq_cancel_watch jq_cancel_watch_t;
+
+typedef struct jq_progress_slot jq_progress_slot_t;
+
+/*
+ * Calls that block on fdatasync of .jq/journal before renaming any file
+ * (group commit, so concurrent callers share one flush): jq_move,
+ * jq_release, jq_finalize and their jq_handle_* forms, jq_retry when it
+ * dead-letters a job, jq_reap_expired for each job it requeues, and a claim
+ * that hands a job back because its lease could not be written. jq_init,
+ * jq_replay_journal and jq_fsck with repair also syncfs the root and fsync
+ * the journal. A jq_handle_t keeps the journal open and is for one thread at
+ * a time.
+ */
 jq_result_t jq_init(const char *root_path);
 
+jq_state_t jq_level_state(int level);
+
 jq_result_t jq_submit(const char *root_path,
                       const char *uuid,
                       const char *pdf_path,
                       const char *metadata_path,
                       int priority);
 
+void jq_submit_options_init(jq_submit_options_t *options);
+
+jq_result_t jq_submit_with_options(const char *root_path,
+                                   const char *uuid,
+                                   const char *pdf_path,
+                                   const char *metadata_path,
+                                   const jq_submit_options_t *options);
+
+jq_result_t jq_submit_batch(const char *root_path,
+                            jq_submit_item_t *items,
+                            size_t count,
+                            const jq_submit_options_t *options,
+                            size_t *submitted_out);
+
+jq_result_t jq_blob_put(const char *root_path,
+                        const char *src_path,
+                        jq_submit_mode_t mode,
+                        char *hash_out,
+                        size_t hash_out_len);
+
+jq_result_t jq_blob_refs(const char *root_path, const char *hash, size_t *refs_out);
+
+jq_result_t jq_gc_blobs(const char *root_path, time_t now, size_t *removed_out);
+
+jq_result_t jq_tenant_configure(const char *root_path,
+                                const char *tenant,
+                                unsigned int max_in_flight,
+                                unsigned int weight);
+
 jq_result_t jq_move(const char *root_path,
                     const char *uuid,
                     jq_state_t from_state,
@@ -70,10 +278,125 @@ jq_result_t jq_claim_next(const char *root_path,
                           size_t uuid_out_len,
                           jq_state_t *state_out);
 
+void jq_claim_options_init(jq_claim_options_t *options);
+
+jq_result_t jq_claim(const char *root_path,
+                     const jq_claim_options_t *options,
+                     char *uuid_out,
+                     size_t uuid_out_len,
+                     jq_state_t *state_out);
+
+jq_result_t jq_claim_batch(const char *root_path,
+                           const jq_claim_options_t *options,
+                           size_t max_jobs,
+                           char uuids_out[][JQ_UUID_MAX],
+                           jq_state_t *states_out,
+                           size_t *count_out);
+
+jq_result_t jq_claim_wait(const char *root_path,
+                          int prefer_priority,
+                          int timeout_ms,
+                          char *uuid_out,
+                          size_t uuid_out_len,
+                          jq_state_t *state_out);
+
+jq_result_t jq_claim_batch_wait(const char *root_path,
+                                const jq_claim_options_t *options,
+                                int timeout_ms,
+                                size_t max_jobs,
+                                char uuids_out[][JQ_UUID_MAX],
+                                jq_state_t *states_out,
+                                size_t *count_out);
+
 jq_result_t jq_release(const char *root_path,
                        const char *uuid,
                        jq_state_t state);
 
+jq_result_t jq_heartbeat(const char *root_path,
+                         const char *uuid,
+                         jq_state_t state,
+                         const char *owner);
+
+jq_result_t jq_lease_info(const char *root_path,
+                          const char *uuid,
+                          jq_lease_t *lease_out);
+
+void jq_retry_options_init(jq_retry_options_t *options);
+
+jq_result_t jq_retry(const char *root_path,
+                     const char *uuid,
+                     jq_state_t state,
+                     const jq_retry_options_t *options,
+                     unsigned int *attempts_out,
+                     time_t *not_before_out);
+
+jq_result_t jq_attempts(const char *root_path, const char *uuid, unsigned int *attempts_out);
+
+jq_result_t jq_cancel(const char *root_path, const char *uuid);
+
+jq_cancel_watch_t *jq_cancel_watch(const char *root_path, const char *uuid);
+
+int jq_cancel_requested(const jq_cancel_watch_t *watch);
+
+void jq_cancel_unwatch(jq_cancel_watch_t *watch);
+
+jq_progress_slot_t *jq_progress_begin(const char *root_path,
+                                      const char *uuid,
+                                      const char *phase,
+                                      unsigned long long bytes_total);
+
+void jq_progress_update(jq_progress_slot_t *slot, unsigned long long bytes_done);
+
+void jq_progress_end(jq_progress_slot_t *slot);
+
+jq_result_t jq_events_read(const char *root_path,
+                           unsigned long long cursor,
+                           jq_event_t *events_out,
+                           size_t max_events,
+                           size_t *count_out,
+                           unsigned long long *next_cursor_out);
+
+jq_result_t jq_ring_enable(const char *root_path, unsigned int capacity);
+
+jq_result_t jq_ring_disable(const char *root_path);
+
+jq_result_t jq_reap_expired(const char *root_path,
+                            time_t now,
+                            size_t *requeued_out);
+
+jq_result_t jq_replay_journal(const char *root_path,
+                              size_t *repaired_out);
+
+void jq_fsck_options_init(jq_fsck_options_t *options);
+
+jq_result_t jq_fsck(const char *root_path,
+                    const jq_fsck_options_t *options,
+                    jq_fsck_report_t *report_out);
+
+void jq_retention_options_init(jq_retention_options_t *options);
+
+jq_result_t jq_retention_configure(const char *root_path,
+                                   const jq_retention_options_t *options);
+
+jq_result_t jq_retention_disable(const char *root_path);
+
+jq_result_t jq_read_retention(const char *root_path,
+                              jq_retention_options_t *options_out);
+
+jq_result_t jq_compact(const char *root_path,
+                       const jq_retention_options_t *options,
+                       time_t now,
+                       size_t *packed_out);
+
+jq_result_t jq_archive_locate(const char *root_path,
+                              const char *uuid,
+                              jq_file_kind_t kind,
+                              jq_state_t *state_out,
+                              char *path_out,
+                              size_t path_out_len,
+                              unsigned long long *offset_out,
+                              unsigned long long *length_out);
+
 jq_result_t jq_finalize(const char *root_path,
                         const char *uuid,
                         jq_state_t from_state,
@@ -84,6 +407,8 @@ jq_result_t jq_status(const char *root_path,
                       jq_state_t *state_out,
                       int *locked_out);
 
+jq_result_t jq_status_progress(const char *root_path, const char *uuid, jq_progress_t *progress_out);
+
 jq_result_t jq_job_paths(const char *root_path,
                          const char *uuid,
                          jq_state_t state,
@@ -112,9 +437,59 @@ jq_result_t jq_job_report_paths_locked(const char *root_path,
                                        char *report_out,
                                        size_t report_out_len);
 
+jq_result_t jq_read_layout(const char *root_path,
+                           jq_layout_t *layout_out);
+
+jq_result_t jq_migrate_layout(const char *root_path,
+                              size_t *moved_out,
+                              size_t *remaining_out);
+
+jq_result_t jq_migrate_job_dirs(const char *root_path,
+                                size_t *moved_out,
+                                size_t *remaining_out);
+
 jq_result_t jq_collect_stats(const char *root_path,
                              jq_stats_t *stats_out);
 
+jq_result_t jq_read_stats(const char *root_path,
+                          jq_stats_t *stats_out);
+
+jq_handle_t *jq_open(const char *root_path);
+
+void jq_close(jq_handle_t *handle);
+
+jq_result_t jq_handle_move(jq_handle_t *handle,
+                           const char *uuid,
+                           jq_state_t from_state,
+                           jq_state_t to_state);
+
+jq_result_t jq_handle_claim(jq_handle_t *handle,
+                            const jq_claim_options_t *options,
+                            char *uuid_out,
+                            size_t uuid_out_len,
+                            jq_state_t *state_out);
+
+jq_result_t jq_handle_claim_batch(jq_handle_t *handle,
+                                  const jq_claim_options_t *options,
+                                  size_t max_jobs,
+                                  char uuids_out[][JQ_UUID_MAX],
+                                  jq_state_t *states_out,
+                                  size_t *count_out);
+
+jq_result_t jq_handle_release(jq_handle_t *handle,
+                              const char *uuid,
+                              jq_state_t state);
+
+jq_result_t jq_handle_finalize(jq_handle_t *handle,
+                               const char *uuid,
+                               jq_state_t from_state,
+                               jq_state_t to_state);
+
+jq_result_t jq_handle_status(jq_handle_t *handle,
+                             const char *uuid,
+                             jq_state_t *state_out,
+                             int *locked_out);
+
 #ifdef __cplusplus
 }
 #endif
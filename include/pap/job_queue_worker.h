@@ -0,0 +1,51 @@
+#ifndef PAP_JOB_QUEUE_WORKER_H
+#define PAP_JOB_QUEUE_WORKER_H
+
+#include "pap/job_queue.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * What the OCR, redaction and analysis workers share around one claimed
+ * job: writing its files, reporting progress and watching for a cancel
+ * while it runs, and handing it back when it fails or is cancelled.
+ */
+
+/* What a running job reports to: its progress slot and its cancel flag. */
+typedef struct {
+    jq_cancel_watch_t *watch;
+    jq_progress_slot_t *progress;
+} jq_worker_monitor_t;
+
+int jq_worker_write_file(const char *path, const char *buffer, size_t length);
+
+void jq_worker_monitor_begin(jq_worker_monitor_t *monitor,
+                             const char *root,
+                             const char *uuid,
+                             const char *phase,
+                             const char *pdf_path);
+
+void jq_worker_monitor_end(jq_worker_monitor_t *monitor);
+
+/* Progress callback for the pdf_* scanners; returns nonzero once the job is cancelled. */
+int jq_worker_progress(size_t bytes_done, size_t bytes_total, void *monitor_data);
+
+int jq_worker_fail(const char *root,
+                   const char *uuid,
+                   jq_state_t state,
+                   const char *metadata_locked,
+                   const char *error,
+                   const char *detail,
+                   int retryable);
+
+int jq_worker_cancel(const char *root, const char *uuid, jq_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,7 +13,8 @@ typedef enum {
     PDFA_ERR_NOT_FOUND,
     PDFA_ERR_IO,
     PDFA_ERR_PARSE,
-    PDFA_ERR_BUFFER_TOO_SMALL
+    PDFA_ERR_BUFFER_TOO_SMALL,
+    PDFA_ERR_CANCELLED
 } pdfa_result_t;
 
 typedef enum {
@@ -63,8 +64,20 @@ typedef struct {
 
 enum { PDFA_SCAN_CHUNK_SIZE = 4096 };
 
+typedef int (*pdfa_cancel_fn)(void *user_data);
+
+typedef int (*pdfa_progress_fn)(size_t bytes_done, size_t bytes_total, void *user_data);
+
 pdfa_result_t pdfa_report_init(pdfa_report_t *report);
 pdfa_result_t pdfa_analyze_file(const char *path, pdfa_report_t *report);
+pdfa_result_t pdfa_analyze_file_with_cancel(const char *path,
+                                            pdfa_report_t *report,
+                                            pdfa_cancel_fn cancel,
+                                            void *cancel_data);
+pdfa_result_t pdfa_analyze_file_with_progress(const char *path,
+                                              pdfa_report_t *report,
+                                              pdfa_progress_fn progress,
+                                              void *progress_data);
 pdfa_result_t pdfa_report_to_json(const pdfa_report_t *report,
                                   char *buffer,
                                   size_t buffer_len,
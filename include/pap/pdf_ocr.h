@@ -16,7 +16,8 @@ typedef enum {
     POCR_ERR_NOT_FOUND = -5,
     POCR_ERR_PROVIDER_NOT_FOUND = -6,
     POCR_ERR_PROVIDER_EXISTS = -7,
-    POCR_ERR_PROVIDER_LIMIT = -8
+    POCR_ERR_PROVIDER_LIMIT = -8,
+    POCR_ERR_CANCELLED = -9
 } pocr_result_t;
 
 typedef struct {
@@ -37,6 +38,10 @@ typedef enum {
 
 typedef void (*pocr_log_fn)(pocr_log_level_t level, const char *message, void *user_data);
 
+typedef int (*pocr_cancel_fn)(void *user_data);
+
+typedef int (*pocr_progress_fn)(size_t bytes_done, size_t bytes_total, void *user_data);
+
 typedef struct {
     const char *name;
     pocr_result_t (*scan_file)(const char *path, pocr_report_t *report, void *user_data);
@@ -51,6 +56,12 @@ pocr_result_t pocr_scan_file_with_provider(const char *provider_name,
                                            const char *path,
                                            pocr_report_t *report);
 
+pocr_result_t pocr_scan_file_with_progress(const char *provider_name,
+                                           const char *path,
+                                           pocr_report_t *report,
+                                           pocr_progress_fn progress,
+                                           void *progress_data);
+
 pocr_result_t pocr_report_to_json(const pocr_report_t *report,
                                   char *buffer,
                                   size_t buffer_len,
@@ -62,6 +73,12 @@ void pocr_set_logger(pocr_log_fn logger, void *user_data);
 
 const char *pocr_log_level_str(pocr_log_level_t level);
 
+void pocr_set_cancel(pocr_cancel_fn cancel, void *user_data);
+
+int pocr_cancel_requested(void);
+
+int pocr_report_progress(size_t bytes_done, size_t bytes_total);
+
 pocr_result_t pocr_register_provider(const pocr_provider_t *provider);
 
 const pocr_provider_t *pocr_find_provider(const char *name);
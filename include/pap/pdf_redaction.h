@@ -16,7 +16,8 @@ typedef enum {
     PDRX_ERR_IO = -2,
     PDRX_ERR_PARSE = -3,
     PDRX_ERR_BUFFER_TOO_SMALL = -4,
-    PDRX_ERR_NOT_FOUND = -5
+    PDRX_ERR_NOT_FOUND = -5,
+    PDRX_ERR_CANCELLED = -6
 } pdrx_result_t;
 
 typedef struct {
@@ -33,6 +34,10 @@ typedef struct {
     size_t bytes_scanned;
 } pdrx_report_t;
 
+typedef int (*pdrx_cancel_fn)(void *user_data);
+
+typedef int (*pdrx_progress_fn)(size_t bytes_done, size_t bytes_total, void *user_data);
+
 pdrx_result_t pdrx_plan_init(pdrx_plan_t *plan);
 
 pdrx_result_t pdrx_plan_from_json(const char *json, size_t length, pdrx_plan_t *plan);
@@ -42,6 +47,20 @@ pdrx_result_t pdrx_apply_file(const char *input_path,
                               const pdrx_plan_t *plan,
                               pdrx_report_t *report);
 
+pdrx_result_t pdrx_apply_file_with_cancel(const char *input_path,
+                                          const char *output_path,
+                                          const pdrx_plan_t *plan,
+                                          pdrx_report_t *report,
+                                          pdrx_cancel_fn cancel,
+                                          void *cancel_data);
+
+pdrx_result_t pdrx_apply_file_with_progress(const char *input_path,
+                                            const char *output_path,
+                                            const pdrx_plan_t *plan,
+                                            pdrx_report_t *report,
+                                            pdrx_progress_fn progress,
+                                            void *progress_data);
+
 pdrx_result_t pdrx_report_to_json(const pdrx_report_t *report,
                                   const pdrx_plan_t *plan,
                                   char *buffer,
@@ -1,17 +1,425 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* copy_file_range(2) and renameat2(2) are only declared for GNU builds. */
+#define _GNU_SOURCE
+#endif
+
 #include "pap/job_queue.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <dirent.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#define JQ_INDEX_DIR ".jq"
+#define JQ_READY_MAGIC 0x4a515244u
+#define JQ_READY_RECORD_MAGIC 0x4a515252u
+#define JQ_READY_VERSION 4u
+#define JQ_READY_UUID_MAX 224
+#define JQ_READY_COMPACT_RECORDS 65536
+#define JQ_READY_LOCK_SUFFIX ".ready.lock"
+#define JQ_READY_RESCAN_SUFFIX ".rescan"
+#define JQ_LEVELS_PER_STATE (JQ_LEVEL_COUNT / 2)
+#define JQ_SIZE_CLASS_COUNT 4
+#define JQ_SIZE_LANE(size_class) (-1 - (size_class))
+#define JQ_LEASE_DIR "leases"
+#define JQ_LAYOUT_FILE "layout"
+#define JQ_LAYOUT_CACHE_ROOTS 8
+#define JQ_SUBMIT_BATCH_THREADS 4
+#define JQ_SUBMIT_BATCH_THREADS_MAX 32
+#define JQ_STATUS_INDEX_FILE "status"
+#define JQ_STATUS_INDEX_MAGIC 0x4a515358u
+#define JQ_STATUS_INDEX_VERSION 1u
+#define JQ_STATUS_INITIAL_SLOTS 4096u
+#define JQ_STATUS_MAX_PROBES 64u
+#define JQ_STATUS_TAG_BUSY 1u
+#define JQ_STATUS_TAG_FIRST 2u
+#define JQ_STATUS_TAG_GONE 0xffffffffu
+#define JQ_STATUS_CACHE_ROOTS 8
+#define JQ_JOURNAL_FILE "journal"
+#define JQ_JOURNAL_MAGIC 0x4a514a48u
+#define JQ_JOURNAL_RECORD_MAGIC 0x4a514a52u
+#define JQ_JOURNAL_VERSION 1u
+#define JQ_JOURNAL_UUID_MAX 232
+#define JQ_JOURNAL_CHECKPOINT_BYTES (1u << 20)
+#define JQ_LEASE_MAGIC 0x4a514c53u
+#define JQ_LEASE_VERSION 6u
+#define JQ_STATS_MAGIC 0x4a515354u
+#define JQ_STATS_VERSION 1u
+#define JQ_CLAIM_WAIT_POLL_MS 100
+#define JQ_ATTEMPTS_DIR "attempts"
+#define JQ_ATTEMPTS_MAGIC 0x4a514154u
+#define JQ_DELAY_DIR "delay"
+#define JQ_DELAY_CURSOR_FILE "next"
+#define JQ_RETRY_OWNER "jq-retry"
+#define JQ_TENANTS_FILE "tenants"
+#define JQ_TENANTS_MAGIC 0x4a515454u
+#define JQ_TENANTS_VERSION 1u
+#define JQ_CANCEL_ATTEMPTS 8
+#define JQ_EVENTS_DIR "events"
+#define JQ_EVENTS_COUNTER "events.next"
+#define JQ_EVENT_MAGIC 0x4a514556u
+#define JQ_EVENT_SEGMENT_RECORDS 16384u
+#define JQ_EVENT_HOLE_MS 2000
+#define JQ_RING_FILE "ready.ring"
+#define JQ_RING_MAGIC 0x4a515247u
+#define JQ_RING_VERSION 1u
+#define JQ_RING_DEFAULT_CAPACITY 1024u
+#define JQ_RING_MAX_CAPACITY (1u << 20)
+#define JQ_ARCHIVE_DIR "archive"
+#define JQ_ARCHIVE_INDEX_MAGIC 0x4a514149u
+#define JQ_ARCHIVE_INDEX_VERSION 1u
+#define JQ_ARCHIVE_INITIAL_SLOTS 4096u
+#define JQ_ARCHIVE_TAG_BUSY 1u
+#define JQ_ARCHIVE_TAG_FIRST 2u
+#define JQ_ARCHIVE_HAS_REPORT 1u
+#define JQ_ARCHIVE_PDF_LOOSE 2u
+#define JQ_ARCHIVE_SEGMENT_BYTES ((uint64_t)256 << 20)
+#define JQ_ARCHIVE_BATCH 256
+#define JQ_RETENTION_FILE "retention"
+#define JQ_RETENTION_MAGIC 0x4a515250u
+#define JQ_RETENTION_VERSION 2u
+#define JQ_RETENTION_INTERVAL_SECONDS 60
+#define JQ_RETENTION_ROUND_JOBS 1024
+
+/*
+ * Ready log: an append-only file of fixed-size records per priority level,
+ * consumed through a shared cursor in the mmap'd header. Levels below
+ * JQ_LEVELS_PER_STATE live in jobs/, the rest in priority_jobs/, so each
+ * directory is split into lanes without moving any job files. Submitters append
+ * with O_APPEND, claimers advance the cursor with a CAS, so a claim costs the
+ * same no matter how deep the queue is. Records carry a sequence number from
+ * the root-wide counter, so logs are consumed in submission order and FIFO
+ * claims can merge lanes by comparing heads. The directories stay the source
+ * of truth: stale records are skipped when their rename fails, and a missing
+ * or torn log is rebuilt from a directory scan. A drained log is only rescanned
+ * when .jq/<state>.rescan says the directory may hold jobs the lanes lack
+ * (an append failed, a claim failed after taking its records, a name was too
+ * long for a record, or jq_init ran), so polling an empty queue costs one
+ * access() instead of a readdir. The reaper appends jobs lost by a claimer
+ * that died between the CAS and its rename, and a lane that grows past
+ * JQ_READY_COMPACT_RECORDS is rewritten even if the queue never drains.
+ *
+ * Header and records are both 256 bytes, so no record straddles a page and a
+ * reader that maps up to the file size never sees half of an append. Appends
+ * hold .jq/<state>.ready.lock shared and rebuilds hold it exclusive, so no
+ * append lands in a log that is being replaced.
+ *
+ * Records also carry the PDF size. Every untagged job is mirrored into a
+ * size-class lane of its level (<state>.<level>.s<class>.ready, classes split
+ * at 1 MiB, 16 MiB and 256 MiB) with the same sequence number, so size-aware
+ * claims can pick small jobs without scanning a level for them. A job claimed
+ * through one lane leaves a stale record in the other.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    _Atomic uint64_t head;
+    unsigned char padding[232];
+} jq_ready_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t uuid_len;
+    uint64_t seq;
+    int64_t enqueued_at;
+    int64_t bytes;
+    char uuid[JQ_READY_UUID_MAX];
+} jq_ready_record_t;
+
+/*
+ * Event log: every transition appends one fixed-size record to
+ * .jq/events/<segment>.events. A record's position in the log is its
+ * cursor: writers reserve it from the .jq/events.next counter and pwrite the
+ * record into slot cursor % JQ_EVENT_SEGMENT_RECORDS of segment
+ * cursor / JQ_EVENT_SEGMENT_RECORDS, so concurrent writers never share a
+ * slot and readers find any cursor with one pread. A zero slot is a record
+ * still being written; one left behind by a writer that died is skipped once
+ * a record after it is JQ_EVENT_HOLE_MS old. The log is a change feed, not a
+ * journal: records are not synced, and a state of -1 means the job is not
+ * in any state (before submission, after cancellation).
+ */
+typedef struct {
+    uint32_t magic;
+    uint8_t kind;
+    int8_t from_state;
+    int8_t to_state;
+    uint8_t uuid_len;
+    int64_t at_ms;
+    int64_t bytes;
+    char uuid[JQ_UUID_MAX];
+} jq_event_record_t;
+
+/*
+ * Ready ring: an optional same-host fast path in front of the untagged ready
+ * logs. .jq/ready.ring holds one bounded lock-free MPMC ring per level (each
+ * slot carries a sequence number that says whether it is free or published
+ * for the current lap), so a claimer takes the next job with one CAS on the
+ * lane's dequeue position instead of mapping every lane's log. Every append
+ * to an untagged log is mirrored here, and the logs and directories stay the
+ * source of truth: a popped uuid is still locked with the usual rename, and
+ * stale entries are skipped when it fails. A lane whose log may hold jobs the
+ * ring lacks (the ring was full, or a rescan indexed jobs from the directory)
+ * is flagged dirty, and claims fall back to the logs from that level down.
+ * The ring is rebuilt from the logs once claims find the queue drained, and
+ * after a crash by jq_replay_journal. A rebuild publishes a new file and sets
+ * retired in the old one so mapped users move over.
+ */
+typedef struct {
+    _Atomic uint64_t sequence;
+    uint32_t uuid_len;
+    char uuid[JQ_READY_UUID_MAX];
+} jq_ring_slot_t;
+
+typedef struct {
+    _Atomic uint64_t enqueue_pos;
+    unsigned char enqueue_padding[56];
+    _Atomic uint64_t dequeue_pos;
+    unsigned char dequeue_padding[56];
+} jq_ring_lane_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;
+    _Atomic uint32_t retired;
+    _Atomic uint32_t dirty;
+    unsigned char padding[40];
+    jq_ring_lane_t lanes[JQ_LEVEL_COUNT];
+} jq_ring_file_t;
+
+/*
+ * Monotonic counter shared by every queue in the root: .jq/sequence orders
+ * submissions and .jq/schedule hands out weighted claim tickets.
+ */
+typedef struct {
+    _Atomic uint64_t last;
+    unsigned char padding[56];
+} jq_sequence_file_t;
+
+/*
+ * On-disk lease, one file per claimed job. Heartbeats rewrite expires_at in
+ * place. The sizes are the ones the stats file counted when the job was
+ * claimed, so finishing the job can retire exactly those bytes. tenant is
+ * the lane the job was claimed from (0 for untagged jobs), and max_attempts
+ * the claimer's retry limit (0 when it named none). jq_cancel sets
+ * cancelled in place too; the worker holding the job watches it through a
+ * read-only mapping of this file. The trailing progress slot is written by
+ * that worker through its own mapping: phase, total and start once per
+ * phase under the progress_seq seqlock (odd while a phase is being
+ * written), then a single store to bytes_done per chunk.
+ * progress_started_ms (wall clock) is zero until the first phase begins.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t state;
+    uint32_t lease_seconds;
+    int32_t level;
+    uint32_t tenant;
+    uint32_t max_attempts;
+    _Atomic uint32_t cancelled;
+    _Atomic uint32_t progress_seq;
+    int64_t claimed_at;
+    int64_t expires_at;
+    int64_t pdf_bytes;
+    int64_t metadata_bytes;
+    char owner[JQ_LEASE_OWNER_MAX];
+    char phase[JQ_PHASE_MAX];
+    int64_t progress_started_ms;
+    uint64_t bytes_total;
+    _Atomic uint64_t bytes_done;
+} jq_lease_record_t;
+
+/*
+ * Tenant table: .jq/tenants gives every tenant a slot whose index names its
+ * ready lanes (.jq/<state>.<level>.t<index>.ready) and is kept in the leases
+ * of its claimed jobs. Slot 0 stands for untagged jobs. Next to the name
+ * each slot holds the fair-share state all claimers share: the weight and
+ * in-flight cap set by jq_tenant_configure, the deficit left from the
+ * tenant's current turn, and the number of its jobs claimed right now.
+ * Slots are only ever appended, under an exclusive flock on the file.
+ */
+typedef struct {
+    char name[JQ_TENANT_NAME_MAX];
+    _Atomic uint32_t weight;
+    _Atomic uint32_t max_in_flight;
+    _Atomic int64_t deficit;
+    _Atomic int64_t in_flight;
+    unsigned char padding[8];
+} jq_tenant_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t count;
+    uint32_t reserved;
+    _Atomic uint64_t cursor;
+    unsigned char padding[40];
+    jq_tenant_slot_t slots[JQ_TENANT_MAX];
+} jq_tenant_file_t;
+
+/*
+ * Stats file: per-state counters kept current by every queue operation, so
+ * reading queue stats costs one mmap instead of a walk over every state
+ * directory. jq_collect_stats stays the authoritative full scan and rewrites
+ * the counters, which repairs any drift from crashes or outside writers.
+ */
+enum {
+    JQ_STAT_PDF = 0,
+    JQ_STAT_METADATA,
+    JQ_STAT_REPORT,
+    JQ_STAT_PDF_LOCKED,
+    JQ_STAT_METADATA_LOCKED,
+    JQ_STAT_REPORT_LOCKED,
+    JQ_STAT_PDF_BYTES,
+    JQ_STAT_METADATA_BYTES,
+    JQ_STAT_REPORT_BYTES,
+    JQ_STAT_ORPHAN_PDF,
+    JQ_STAT_ORPHAN_METADATA,
+    JQ_STAT_ORPHAN_REPORT,
+    JQ_STAT_COUNT
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t reconciled_at;
+    _Atomic int64_t oldest_mtime;
+    _Atomic int64_t newest_mtime;
+    int64_t oldest_waiting_mtime;
+    _Atomic uint64_t events_dropped;
+    unsigned char padding[16];
+    _Atomic int64_t counters[JQ_STATE_ERROR + 1][JQ_STAT_COUNT];
+} jq_stats_file_t;
+
+typedef struct {
+    jq_state_t state;
+    int64_t counters[JQ_STAT_COUNT];
+} jq_stats_change_t;
+
+/* Sizes of a job's files as seen at one transition; missing files count as zero. */
+typedef struct {
+    int64_t pdf;
+    int64_t metadata;
+    int64_t report;
+    int has_report;
+    time_t mtime;
+} jq_job_sizes_t;
+
+/*
+ * Transition journal: move, release and finalize append their intent to
+ * .jq/journal and wait for it to be durable before renaming any file, so a
+ * crash between the renames of a pair can be finished (or undone) by
+ * jq_replay_journal. Concurrent transitions share fdatasync calls: whoever
+ * takes the sync lock first flushes every record written so far and
+ * publishes the synced offset in the mmap'd header, and the writers queued
+ * behind it find their record already covered. Transitions hold a shared
+ * flock on the journal while they run; replay and checkpoints take it
+ * exclusively, flush the renames with syncfs and truncate the journal.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    _Atomic uint64_t synced;
+    unsigned char padding[40];
+} jq_journal_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t uuid_len;
+    int32_t from_state;
+    int32_t to_state;
+    uint32_t from_locked;
+    uint32_t checksum;
+    char uuid[JQ_JOURNAL_UUID_MAX];
+} jq_journal_record_t;
+
+/*
+ * An open journal. A handle keeps one open for its lifetime (pid records the
+ * process that opened it, so a forked child opens its own); a transition
+ * borrowing it sets cached and only drops its flock when done.
+ */
+typedef struct {
+    int fd;
+    int sync_fd;
+    jq_journal_header_t *header;
+    pid_t pid;
+    int cached;
+} jq_journal_t;
+
+/*
+ * Where a writer puts its events: the mapped events.next counter and the
+ * segment it last wrote. A handle keeps one for its lifetime; neither the
+ * mapping nor the descriptor carries a lock, so a forked child can go on
+ * using them.
+ */
+typedef struct {
+    jq_sequence_file_t *counter;
+    int fd;
+    uint64_t segment;
+} jq_event_writer_t;
+
+static jq_result_t jq_ready_append(const char *root_path, int tenant, int level, const char *uuid, int64_t bytes);
+static void jq_ready_mark_rescan(const char *root_path, jq_state_t state);
+static int jq_ready_pending_tenant(const char *root_path, jq_state_t state, const char *uuid);
+static void jq_ring_publish(const char *root_path, int level, const char *uuid, size_t uuid_len);
+static void jq_ring_mark_dirty(const char *root_path, jq_state_t state);
+static int jq_tenant_name_valid(const char *name);
+static jq_result_t jq_tenant_index(const char *root_path, const char *name, int *index_out);
+typedef struct jq_root jq_root_t;
+static jq_result_t jq_event_append(const jq_root_t *root,
+                                   jq_event_kind_t kind,
+                                   const char *uuid,
+                                   int from_state,
+                                   int to_state,
+                                   int64_t bytes);
+static jq_result_t jq_journal_begin(const jq_root_t *root,
+                                    const char *uuid,
+                                    jq_state_t from_state,
+                                    int from_locked,
+                                    jq_state_t to_state,
+                                    jq_journal_t *journal);
+static void jq_journal_end(const jq_root_t *root, jq_journal_t *journal);
+static jq_result_t jq_journal_hold(const jq_root_t *root, jq_journal_t *journal);
+static void jq_journal_close(jq_journal_t *journal);
+static void jq_status_index_set(const char *root_path, const char *uuid, jq_state_t state, int locked);
+static int jq_status_index_get(const char *root_path, const char *uuid, jq_state_t *state_out, int *locked_out);
+static void jq_stats_apply(const char *root_path, const jq_stats_change_t *changes, size_t count, time_t mtime);
+static jq_result_t jq_status_archived(const char *root_path,
+                                      const char *uuid,
+                                      jq_result_t miss,
+                                      jq_state_t *state_out,
+                                      int *locked_out);
+static void jq_retention_tick(const char *root_path, time_t now);
+
 static const char *jq_state_dir(jq_state_t state) {
     switch (state) {
         case JQ_STATE_JOBS:
@@ -27,6 +435,26 @@ static const char *jq_state_dir(jq_state_t state) {
     }
 }
 
+jq_state_t jq_level_state(int level) {
+    return level >= JQ_LEVELS_PER_STATE ? JQ_STATE_PRIORITY : JQ_STATE_JOBS;
+}
+
+/* Level given to jobs that enter a queue directory without one; -1 for the terminal states. */
+static int jq_state_default_level(jq_state_t state) {
+    switch (state) {
+        case JQ_STATE_JOBS:
+            return JQ_LEVEL_NORMAL;
+        case JQ_STATE_PRIORITY:
+            return JQ_LEVEL_HIGH;
+        default:
+            return -1;
+    }
+}
+
+static int jq_state_first_level(jq_state_t state) {
+    return state == JQ_STATE_PRIORITY ? JQ_LEVELS_PER_STATE : 0;
+}
+
 static jq_result_t jq_ensure_dir(const char *path) {
     if (!path) {
         return JQ_ERR_INVALID_ARGUMENT;
@@ -81,62 +509,112 @@ jq_result_t jq_init(const char *root_path) {
         }
     }
 
-    return JQ_OK;
+    const char *index_dirs[] = {JQ_INDEX_DIR, JQ_INDEX_DIR "/" JQ_LEASE_DIR};
+    for (size_t i = 0; i < sizeof(index_dirs) / sizeof(index_dirs[0]); ++i) {
+        int written = snprintf(path, sizeof(path), "%s/%s", root_path, index_dirs[i]);
+        if (written < 0 || (size_t)written >= sizeof(path)) {
+            return JQ_ERR_INVALID_ARGUMENT;
+        }
+        jq_result_t result = jq_ensure_dir(path);
+        if (result != JQ_OK) {
+            return result;
+        }
+    }
+    /* Jobs dropped into the queue directories by hand are picked up by the next claim. */
+    jq_ready_mark_rescan(root_path, JQ_STATE_PRIORITY);
+    jq_ready_mark_rescan(root_path, JQ_STATE_JOBS);
+    return jq_replay_journal(root_path, NULL);
 }
 
-static jq_result_t jq_copy_file(const char *src_path, const char *dst_path) {
-    if (!src_path || !dst_path) {
-        return JQ_ERR_INVALID_ARGUMENT;
+static jq_result_t jq_write_all(int fd, const void *data, size_t length) {
+    const unsigned char *cursor = data;
+    while (length > 0) {
+        ssize_t chunk = write(fd, cursor, length);
+        if (chunk < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return JQ_ERR_IO;
+        }
+        cursor += chunk;
+        length -= (size_t)chunk;
     }
+    return JQ_OK;
+}
 
-    char tmp_path[PATH_MAX];
-    int tmp_written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", dst_path);
-    if (tmp_written < 0 || (size_t)tmp_written >= sizeof(tmp_path)) {
-        return JQ_ERR_INVALID_ARGUMENT;
-    }
+/* Outcome of one stage of the jq_copy_file fallback chain. */
+typedef enum {
+    JQ_COPY_DONE = 0,
+    JQ_COPY_UNSUPPORTED = 1,
+    JQ_COPY_FAILED = 2
+} jq_copy_status_t;
 
-    int src_fd = open(src_path, O_RDONLY);
-    if (src_fd < 0) {
-        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
-    }
+#define JQ_COPY_CHUNK (1024 * 1024 * 1024)
 
-    struct stat src_stat;
-    if (fstat(src_fd, &src_stat) != 0) {
-        close(src_fd);
-        return JQ_ERR_IO;
+static jq_copy_status_t jq_copy_reflink(int src_fd, int dst_fd) {
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        return JQ_COPY_DONE;
     }
+#else
+    (void)src_fd;
+    (void)dst_fd;
+#endif
+    return JQ_COPY_UNSUPPORTED;
+}
 
-    int dst_fd = mkstemp(tmp_path);
-    if (dst_fd < 0) {
-        close(src_fd);
-        return JQ_ERR_IO;
-    }
+static int jq_copy_errno_unsupported(int error) {
+    return error == EXDEV || error == ENOSYS || error == EINVAL || error == EOPNOTSUPP || error == ENOTSUP;
+}
 
-    mode_t mode = src_stat.st_mode & 0777;
-    if (fchmod(dst_fd, mode) != 0) {
-        close(src_fd);
-        close(dst_fd);
-        unlink(tmp_path);
-        return JQ_ERR_IO;
+/* In-kernel copy; stops at EOF so a source that grows is copied like the read loop would. */
+static jq_copy_status_t jq_copy_range(int src_fd, int dst_fd, off_t *copied) {
+#if defined(__linux__)
+    while (1) {
+        ssize_t chunk = copy_file_range(src_fd, NULL, dst_fd, NULL, JQ_COPY_CHUNK, 0);
+        if (chunk < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return *copied == 0 && jq_copy_errno_unsupported(errno) ? JQ_COPY_UNSUPPORTED : JQ_COPY_FAILED;
+        }
+        if (chunk == 0) {
+            return JQ_COPY_DONE;
+        }
+        *copied += chunk;
     }
-#if defined(POSIX_FADV_SEQUENTIAL)
-    (void)posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    (void)src_fd;
+    (void)dst_fd;
+    (void)copied;
+    return JQ_COPY_UNSUPPORTED;
 #endif
-#if defined(POSIX_FADV_NOREUSE)
-    (void)posix_fadvise(src_fd, 0, 0, POSIX_FADV_NOREUSE);
-#endif
-    if (src_stat.st_size > 0) {
-        int fallocate_result = posix_fallocate(dst_fd, 0, src_stat.st_size);
-        if (fallocate_result != 0 && fallocate_result != EINTR) {
-            if (ftruncate(dst_fd, src_stat.st_size) != 0) {
-                close(src_fd);
-                close(dst_fd);
-                unlink(tmp_path);
-                return JQ_ERR_IO;
+}
+
+static jq_copy_status_t jq_copy_sendfile(int src_fd, int dst_fd, off_t *copied) {
+#if defined(__linux__)
+    while (1) {
+        ssize_t chunk = sendfile(dst_fd, src_fd, NULL, JQ_COPY_CHUNK);
+        if (chunk < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return *copied == 0 && jq_copy_errno_unsupported(errno) ? JQ_COPY_UNSUPPORTED : JQ_COPY_FAILED;
         }
+        if (chunk == 0) {
+            return JQ_COPY_DONE;
+        }
+        *copied += chunk;
     }
+#else
+    (void)src_fd;
+    (void)dst_fd;
+    (void)copied;
+    return JQ_COPY_UNSUPPORTED;
+#endif
+}
 
+static jq_copy_status_t jq_copy_buffered(int src_fd, int dst_fd, off_t *copied) {
     char stack_buffer[16 * 1024];
     size_t buffer_size = 1024 * 1024;
     char *buffer = malloc(buffer_size);
@@ -144,468 +622,8883 @@ static jq_result_t jq_copy_file(const char *src_path, const char *dst_path) {
         buffer = stack_buffer;
         buffer_size = sizeof(stack_buffer);
     }
-    ssize_t bytes_read;
+
+    jq_copy_status_t status = JQ_COPY_DONE;
     while (1) {
-        bytes_read = read(src_fd, buffer, buffer_size);
+        ssize_t bytes_read = read(src_fd, buffer, buffer_size);
         if (bytes_read < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            close(src_fd);
-            close(dst_fd);
-            if (buffer != stack_buffer) {
-                free(buffer);
-            }
-            unlink(tmp_path);
-            return JQ_ERR_IO;
+            status = JQ_COPY_FAILED;
+            break;
         }
         if (bytes_read == 0) {
             break;
         }
-        ssize_t bytes_written = 0;
-        while (bytes_written < bytes_read) {
-            ssize_t chunk = write(dst_fd, buffer + bytes_written, (size_t)(bytes_read - bytes_written));
-            if (chunk < 0) {
-                if (errno == EINTR) {
-                    continue;
-                }
-                close(src_fd);
-                close(dst_fd);
-                if (buffer != stack_buffer) {
-                    free(buffer);
-                }
-                unlink(tmp_path);
-                return JQ_ERR_IO;
-            }
-            bytes_written += chunk;
-        }
-    }
-
-    if (fsync(dst_fd) != 0) {
-        close(src_fd);
-        close(dst_fd);
-        if (buffer != stack_buffer) {
-            free(buffer);
+        if (jq_write_all(dst_fd, buffer, (size_t)bytes_read) != JQ_OK) {
+            status = JQ_COPY_FAILED;
+            break;
         }
-        unlink(tmp_path);
-        return JQ_ERR_IO;
+        *copied += bytes_read;
     }
 
-    close(src_fd);
-    close(dst_fd);
     if (buffer != stack_buffer) {
         free(buffer);
     }
+    return status;
+}
 
-    if (rename(tmp_path, dst_path) != 0) {
-        unlink(tmp_path);
-        return JQ_ERR_IO;
+/*
+ * Copy file contents without bouncing them through user space where the
+ * kernel allows it: a reflink shares the source extents outright (btrfs, xfs),
+ * copy_file_range lets the filesystem or kernel move the data, and sendfile
+ * and a buffered loop cover everything else. Each stage continues from the
+ * file offsets the previous one left behind.
+ */
+static jq_result_t jq_copy_contents(int src_fd, int dst_fd, off_t src_size) {
+    if (jq_copy_reflink(src_fd, dst_fd) == JQ_COPY_DONE) {
+        return JQ_OK;
     }
 
-    const char *slash = strrchr(dst_path, '/');
-    if (slash) {
-        size_t dir_len = (size_t)(slash - dst_path);
-        if (dir_len > 0 && dir_len < PATH_MAX) {
-            char dir_path[PATH_MAX];
-            memcpy(dir_path, dst_path, dir_len);
-            dir_path[dir_len] = '\0';
-            int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
-            if (dir_fd >= 0) {
-                (void)fsync(dir_fd);
-                close(dir_fd);
+#if defined(POSIX_FADV_SEQUENTIAL)
+    (void)posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#if defined(POSIX_FADV_NOREUSE)
+    (void)posix_fadvise(src_fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif
+    if (src_size > 0) {
+        int fallocate_result = posix_fallocate(dst_fd, 0, src_size);
+        if (fallocate_result != 0 && fallocate_result != EINTR) {
+            if (ftruncate(dst_fd, src_size) != 0) {
+                return JQ_ERR_IO;
             }
         }
     }
-    return JQ_OK;
-}
 
-jq_result_t jq_job_paths_locked(const char *root_path,
-                                const char *uuid,
-                                jq_state_t state,
-                                char *pdf_out,
-                                size_t pdf_out_len,
-                                char *metadata_out,
-                                size_t metadata_out_len) {
-    if (!root_path || !uuid || !pdf_out || !metadata_out) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    off_t copied = 0;
+    jq_copy_status_t status = jq_copy_range(src_fd, dst_fd, &copied);
+    if (status == JQ_COPY_UNSUPPORTED) {
+        status = jq_copy_sendfile(src_fd, dst_fd, &copied);
     }
-
-    const char *dir = jq_state_dir(state);
-    if (!dir) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (status == JQ_COPY_UNSUPPORTED) {
+        status = jq_copy_buffered(src_fd, dst_fd, &copied);
     }
-
-    int pdf_written = snprintf(pdf_out, pdf_out_len, "%s/%s/%s.pdf.job.lock", root_path, dir, uuid);
-    int metadata_written =
-        snprintf(metadata_out, metadata_out_len, "%s/%s/%s.metadata.job.lock", root_path, dir, uuid);
-
-    if (pdf_written < 0 || metadata_written < 0 ||
-        (size_t)pdf_written >= pdf_out_len || (size_t)metadata_written >= metadata_out_len) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (status != JQ_COPY_DONE) {
+        return JQ_ERR_IO;
     }
 
+    /* The preallocation assumed the size at open time; trim if the source shrank. */
+    if (copied < src_size && ftruncate(dst_fd, copied) != 0) {
+        return JQ_ERR_IO;
+    }
     return JQ_OK;
 }
 
-jq_result_t jq_job_report_paths(const char *root_path,
-                                const char *uuid,
-                                jq_state_t state,
-                                char *report_out,
-                                size_t report_out_len) {
-    if (!root_path || !uuid || !report_out) {
-        return JQ_ERR_INVALID_ARGUMENT;
+static void jq_sync_parent_dir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        return;
+    }
+    size_t dir_len = (size_t)(slash - path);
+    if (dir_len > 0 && dir_len < PATH_MAX) {
+        char dir_path[PATH_MAX];
+        memcpy(dir_path, path, dir_len);
+        dir_path[dir_len] = '\0';
+        int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+        if (dir_fd >= 0) {
+            (void)fsync(dir_fd);
+            close(dir_fd);
+        }
     }
+}
 
-    const char *dir = jq_state_dir(state);
-    if (!dir) {
+/* With durable == 0 the caller owns the flush (jq_submit_batch ends with one syncfs). */
+static jq_result_t jq_copy_file(const char *src_path, const char *dst_path, int durable) {
+    if (!src_path || !dst_path) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    int written = snprintf(report_out, report_out_len, "%s/%s/%s.report.html", root_path, dir, uuid);
-    if (written < 0 || (size_t)written >= report_out_len) {
+    char tmp_path[PATH_MAX];
+    int tmp_written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", dst_path);
+    if (tmp_written < 0 || (size_t)tmp_written >= sizeof(tmp_path)) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    return JQ_OK;
-}
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
 
-jq_result_t jq_job_report_paths_locked(const char *root_path,
-                                       const char *uuid,
-                                       jq_state_t state,
-                                       char *report_out,
-                                       size_t report_out_len) {
-    if (!root_path || !uuid || !report_out) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    struct stat src_stat;
+    if (fstat(src_fd, &src_stat) != 0) {
+        close(src_fd);
+        return JQ_ERR_IO;
     }
 
-    const char *dir = jq_state_dir(state);
-    if (!dir) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    int dst_fd = mkstemp(tmp_path);
+    if (dst_fd < 0) {
+        close(src_fd);
+        return JQ_ERR_IO;
     }
 
-    int written = snprintf(report_out, report_out_len, "%s/%s/%s.report.html.lock", root_path, dir, uuid);
-    if (written < 0 || (size_t)written >= report_out_len) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    mode_t mode = src_stat.st_mode & 0777;
+    jq_result_t result = JQ_OK;
+    if (fchmod(dst_fd, mode) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK) {
+        result = jq_copy_contents(src_fd, dst_fd, src_stat.st_size);
+    }
+    if (result == JQ_OK && durable && fsync(dst_fd) != 0) {
+        result = JQ_ERR_IO;
+    }
+    close(src_fd);
+    close(dst_fd);
+
+    if (result == JQ_OK && rename(tmp_path, dst_path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+        return result;
     }
 
+    if (durable) {
+        jq_sync_parent_dir(dst_path);
+    }
     return JQ_OK;
 }
 
-jq_result_t jq_job_paths(const char *root_path,
-                         const char *uuid,
-                         jq_state_t state,
-                         char *pdf_out,
-                         size_t pdf_out_len,
-                         char *metadata_out,
-                         size_t metadata_out_len) {
-    if (!root_path || !uuid || !pdf_out || !metadata_out) {
+/*
+ * Hard-link src_path into place. Sets *unsupported_out when the source lives
+ * on another filesystem (or the filesystem has no hard links), so the caller
+ * can fall back to a copy.
+ */
+static jq_result_t jq_link_file(const char *src_path, const char *dst_path, int durable, int *unsupported_out) {
+    *unsupported_out = 0;
+
+    char tmp_path[PATH_MAX];
+    int tmp_written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", dst_path);
+    if (tmp_written < 0 || (size_t)tmp_written >= sizeof(tmp_path)) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    const char *dir = jq_state_dir(state);
-    if (!dir) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    /* Reserve a unique name, then link over it; the rename keeps replacement atomic. */
+    int tmp_fd = mkstemp(tmp_path);
+    if (tmp_fd < 0) {
+        return JQ_ERR_IO;
     }
+    close(tmp_fd);
+    unlink(tmp_path);
 
-    int pdf_written = snprintf(pdf_out, pdf_out_len, "%s/%s/%s.pdf.job", root_path, dir, uuid);
-    int metadata_written =
-        snprintf(metadata_out, metadata_out_len, "%s/%s/%s.metadata.job", root_path, dir, uuid);
+    if (linkat(AT_FDCWD, src_path, AT_FDCWD, tmp_path, AT_SYMLINK_FOLLOW) != 0) {
+        if (errno == ENOENT) {
+            return JQ_ERR_NOT_FOUND;
+        }
+        if (errno == EXDEV || errno == EPERM || errno == EMLINK || errno == EOPNOTSUPP) {
+            *unsupported_out = 1;
+        }
+        return JQ_ERR_IO;
+    }
 
-    if (pdf_written < 0 || metadata_written < 0 ||
-        (size_t)pdf_written >= pdf_out_len || (size_t)metadata_written >= metadata_out_len) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (rename(tmp_path, dst_path) != 0) {
+        unlink(tmp_path);
+        return JQ_ERR_IO;
     }
 
+    if (durable) {
+        jq_sync_parent_dir(dst_path);
+    }
     return JQ_OK;
 }
 
-jq_result_t jq_submit(const char *root_path,
-                      const char *uuid,
-                      const char *pdf_path,
-                      const char *metadata_path,
-                      int priority) {
-    if (!root_path || !uuid || !pdf_path || !metadata_path) {
-        return JQ_ERR_INVALID_ARGUMENT;
-    }
+/*
+ * Blob store: PDFs submitted with JQ_SUBMIT_BLOB are kept once under
+ * .jq/blobs/ab/<sha256> and every job's PDF is a hard link to its blob, so
+ * identical uploads and the several stages fed from one upload share one
+ * physical copy. The link count is the reference count: a blob whose only
+ * remaining name is its own is unreferenced and jq_gc_blobs removes it. The
+ * hash is computed in the same pass that copies the source into the store.
+ */
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} jq_sha256_t;
+
+static const uint32_t jq_sha256_k[64] = {
+    0x428a2f98u, 0x71374491u, 0xb5c0fbcfu, 0xe9b5dba5u, 0x3956c25bu, 0x59f111f1u, 0x923f82a4u, 0xab1c5ed5u,
+    0xd807aa98u, 0x12835b01u, 0x243185beu, 0x550c7dc3u, 0x72be5d74u, 0x80deb1feu, 0x9bdc06a7u, 0xc19bf174u,
+    0xe49b69c1u, 0xefbe4786u, 0x0fc19dc6u, 0x240ca1ccu, 0x2de92c6fu, 0x4a7484aau, 0x5cb0a9dcu, 0x76f988dau,
+    0x983e5152u, 0xa831c66du, 0xb00327c8u, 0xbf597fc7u, 0xc6e00bf3u, 0xd5a79147u, 0x06ca6351u, 0x14292967u,
+    0x27b70a85u, 0x2e1b2138u, 0x4d2c6dfcu, 0x53380d13u, 0x650a7354u, 0x766a0abbu, 0x81c2c92eu, 0x92722c85u,
+    0xa2bfe8a1u, 0xa81a664bu, 0xc24b8b70u, 0xc76c51a3u, 0xd192e819u, 0xd6990624u, 0xf40e3585u, 0x106aa070u,
+    0x19a4c116u, 0x1e376c08u, 0x2748774cu, 0x34b0bcb5u, 0x391c0cb3u, 0x4ed8aa4au, 0x5b9cca4fu, 0x682e6ff3u,
+    0x748f82eeu, 0x78a5636fu, 0x84c87814u, 0x8cc70208u, 0x90befffau, 0xa4506cebu, 0xbef9a3f7u, 0xc67178f2u,
+};
+
+static uint32_t jq_rotr32(uint32_t value, unsigned int bits) {
+    return (value >> bits) | (value << (32u - bits));
+}
 
-    jq_state_t state = priority ? JQ_STATE_PRIORITY : JQ_STATE_JOBS;
-    char pdf_dest[PATH_MAX];
-    char metadata_dest[PATH_MAX];
+static void jq_sha256_init(jq_sha256_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667u, 0xbb67ae85u, 0x3c6ef372u, 0xa54ff53au, 0x510e527fu, 0x9b05688cu, 0x1f83d9abu, 0x5be0cd19u,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
 
-    jq_result_t path_result =
-        jq_job_paths(root_path, uuid, state, pdf_dest, sizeof(pdf_dest), metadata_dest, sizeof(metadata_dest));
-    if (path_result != JQ_OK) {
-        return path_result;
+static void jq_sha256_block(jq_sha256_t *ctx, const unsigned char *block) {
+    uint32_t w[64];
+    for (size_t i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 |
+               (uint32_t)block[i * 4 + 3];
     }
-
-    jq_result_t pdf_result = jq_copy_file(pdf_path, pdf_dest);
-    if (pdf_result != JQ_OK) {
-        return pdf_result;
+    for (size_t i = 16; i < 64; ++i) {
+        uint32_t s0 = jq_rotr32(w[i - 15], 7) ^ jq_rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = jq_rotr32(w[i - 2], 17) ^ jq_rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
     }
 
-    jq_result_t metadata_result = jq_copy_file(metadata_path, metadata_dest);
-    if (metadata_result != JQ_OK) {
-        unlink(pdf_dest);
-        return metadata_result;
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (size_t i = 0; i < 64; ++i) {
+        uint32_t s1 = jq_rotr32(e, 6) ^ jq_rotr32(e, 11) ^ jq_rotr32(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + jq_sha256_k[i] + w[i];
+        uint32_t s0 = jq_rotr32(a, 2) ^ jq_rotr32(a, 13) ^ jq_rotr32(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
     }
-
-    return JQ_OK;
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
 }
 
-static jq_result_t jq_rename(const char *src, const char *dst) {
-    if (rename(src, dst) == 0) {
-        return JQ_OK;
+static void jq_sha256_update(jq_sha256_t *ctx, const unsigned char *data, size_t length) {
+    ctx->length += length;
+    if (ctx->used > 0) {
+        size_t take = sizeof(ctx->block) - ctx->used;
+        if (take > length) {
+            take = length;
+        }
+        memcpy(ctx->block + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        length -= take;
+        if (ctx->used < sizeof(ctx->block)) {
+            return;
+        }
+        jq_sha256_block(ctx, ctx->block);
+        ctx->used = 0;
     }
-
-    if (errno == ENOENT) {
-        return JQ_ERR_NOT_FOUND;
+    while (length >= sizeof(ctx->block)) {
+        jq_sha256_block(ctx, data);
+        data += sizeof(ctx->block);
+        length -= sizeof(ctx->block);
     }
-
-    return JQ_ERR_IO;
+    memcpy(ctx->block, data, length);
+    ctx->used = length;
 }
 
-static jq_result_t jq_move_report_if_present(const char *report_src, const char *report_dst) {
-    if (!report_src || !report_dst) {
-        return JQ_ERR_INVALID_ARGUMENT;
+static void jq_sha256_hex(jq_sha256_t *ctx, char out[JQ_BLOB_HASH_MAX]) {
+    uint64_t bits = ctx->length * 8u;
+    unsigned char padding[72] = {0x80};
+    size_t pad_len = ctx->used < 56 ? 56 - ctx->used : 120 - ctx->used;
+    for (size_t i = 0; i < 8; ++i) {
+        padding[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
     }
-    if (access(report_src, F_OK) != 0) {
-        if (errno == ENOENT) {
-            return JQ_OK;
+    jq_sha256_update(ctx, padding, pad_len + 8);
+
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < 8; ++i) {
+        for (size_t byte = 0; byte < 4; ++byte) {
+            unsigned int value = (ctx->state[i] >> (24 - 8 * byte)) & 0xffu;
+            out[i * 8 + byte * 2] = digits[value >> 4];
+            out[i * 8 + byte * 2 + 1] = digits[value & 0xfu];
         }
-        return JQ_ERR_IO;
     }
-    return jq_rename(report_src, report_dst);
+    out[64] = '\0';
 }
 
-static jq_result_t jq_check_pair_exists(const char *pdf_path, const char *metadata_path, int *present_out) {
-    if (!pdf_path || !metadata_path || !present_out) {
-        return JQ_ERR_INVALID_ARGUMENT;
-    }
-
-    int pdf_ok = access(pdf_path, F_OK) == 0;
-    int pdf_errno = errno;
-    int metadata_ok = access(metadata_path, F_OK) == 0;
-    int metadata_errno = errno;
+#define JQ_BLOB_DIR "blobs"
+#define JQ_BLOB_GRACE_SECONDS 3600
 
-    if (pdf_ok && metadata_ok) {
-        *present_out = 1;
-        return JQ_OK;
+static int jq_blob_hash_valid(const char *hash) {
+    if (!hash) {
+        return 0;
     }
-
-    if (!pdf_ok && !metadata_ok) {
-        if (pdf_errno != ENOENT || metadata_errno != ENOENT) {
-            return JQ_ERR_IO;
+    for (size_t i = 0; i < JQ_BLOB_HASH_MAX - 1; ++i) {
+        if (!((hash[i] >= '0' && hash[i] <= '9') || (hash[i] >= 'a' && hash[i] <= 'f'))) {
+            return 0;
         }
-        *present_out = 0;
-        return JQ_OK;
     }
+    return hash[JQ_BLOB_HASH_MAX - 1] == '\0';
+}
 
-    return JQ_ERR_IO;
+static int jq_blob_path(const char *root_path, const char *hash, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s/%.2s/%s", root_path, JQ_INDEX_DIR, JQ_BLOB_DIR, hash, hash);
+    return written >= 0 && (size_t)written < out_len;
 }
 
-jq_result_t jq_move(const char *root_path,
-                    const char *uuid,
-                    jq_state_t from_state,
-                    jq_state_t to_state) {
-    if (!root_path || !uuid) {
-        return JQ_ERR_INVALID_ARGUMENT;
+/* Hashes everything left in src_fd, copying it to dst_fd on the way unless dst_fd is -1. */
+static jq_result_t jq_blob_hash_contents(int src_fd, int dst_fd, char hash_out[JQ_BLOB_HASH_MAX]) {
+    char stack_buffer[16 * 1024];
+    size_t buffer_size = 1024 * 1024;
+    char *buffer = malloc(buffer_size);
+    if (!buffer) {
+        buffer = stack_buffer;
+        buffer_size = sizeof(stack_buffer);
     }
 
-    jq_result_t ensure_result = jq_ensure_state_dir(root_path, to_state);
-    if (ensure_result != JQ_OK) {
-        return ensure_result;
+#if defined(POSIX_FADV_SEQUENTIAL)
+    (void)posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    jq_sha256_t ctx;
+    jq_sha256_init(&ctx);
+    jq_result_t result = JQ_OK;
+    while (1) {
+        ssize_t bytes_read = read(src_fd, buffer, buffer_size);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = JQ_ERR_IO;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        jq_sha256_update(&ctx, (const unsigned char *)buffer, (size_t)bytes_read);
+        if (dst_fd >= 0 && jq_write_all(dst_fd, buffer, (size_t)bytes_read) != JQ_OK) {
+            result = JQ_ERR_IO;
+            break;
+        }
     }
 
-    char pdf_src[PATH_MAX];
-    char metadata_src[PATH_MAX];
-    char pdf_dst[PATH_MAX];
-    char metadata_dst[PATH_MAX];
-    char report_src[PATH_MAX];
-    char report_dst[PATH_MAX];
+    if (buffer != stack_buffer) {
+        free(buffer);
+    }
+    if (result == JQ_OK) {
+        jq_sha256_hex(&ctx, hash_out);
+    }
+    return result;
+}
 
-    jq_result_t src_result =
-        jq_job_paths(root_path, uuid, from_state, pdf_src, sizeof(pdf_src), metadata_src, sizeof(metadata_src));
-    if (src_result != JQ_OK) {
-        return src_result;
+/*
+ * Stores src_path and returns its hash. The source is only ever read: the
+ * store holds its own copy and jobs link outward from it. Most modes copy
+ * through a temp file while hashing and drop it when the blob already
+ * exists. JQ_SUBMIT_LINK hashes first and copies (a reflink where the
+ * filesystem has one) only when the content is new, so a duplicate costs
+ * one read. A hit refreshes the blob's ctime, which keeps jq_gc_blobs away
+ * from a blob that is about to gain a link.
+ */
+static jq_result_t jq_blob_store(const char *root_path,
+                                 const char *src_path,
+                                 jq_submit_mode_t mode,
+                                 int durable,
+                                 char hash_out[JQ_BLOB_HASH_MAX]) {
+    char dir_path[PATH_MAX];
+    int dir_written = snprintf(dir_path, sizeof(dir_path), "%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_BLOB_DIR);
+    if (dir_written < 0 || (size_t)dir_written + 4 >= sizeof(dir_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    char tmp_path[PATH_MAX];
+    int tmp_written = snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp.XXXXXX", dir_path);
+    if (tmp_written < 0 || (size_t)tmp_written >= sizeof(tmp_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    jq_result_t dst_result =
-        jq_job_paths(root_path, uuid, to_state, pdf_dst, sizeof(pdf_dst), metadata_dst, sizeof(metadata_dst));
-    if (dst_result != JQ_OK) {
-        return dst_result;
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    struct stat src_stat;
+    if (fstat(src_fd, &src_stat) != 0) {
+        close(src_fd);
+        return JQ_ERR_IO;
     }
 
-    jq_result_t report_src_result =
-        jq_job_report_paths(root_path, uuid, from_state, report_src, sizeof(report_src));
-    if (report_src_result != JQ_OK) {
-        return report_src_result;
+    /* .jq first: a root from before the blob store has no blobs/ yet. */
+    char *slash = strrchr(dir_path, '/');
+    *slash = '\0';
+    jq_result_t result = jq_ensure_dir(dir_path);
+    *slash = '/';
+    if (result == JQ_OK) {
+        result = jq_ensure_dir(dir_path);
+    }
+    if (result != JQ_OK) {
+        close(src_fd);
+        return result;
     }
 
-    jq_result_t report_dst_result =
-        jq_job_report_paths(root_path, uuid, to_state, report_dst, sizeof(report_dst));
-    if (report_dst_result != JQ_OK) {
-        return report_dst_result;
+    int hash_first = mode == JQ_SUBMIT_LINK;
+    int tmp_created = !hash_first;
+    int tmp_fd = -1;
+    if (!hash_first) {
+        tmp_fd = mkstemp(tmp_path);
+        if (tmp_fd < 0) {
+            close(src_fd);
+            return JQ_ERR_IO;
+        }
+        if (fchmod(tmp_fd, src_stat.st_mode & 0777) != 0) {
+            result = JQ_ERR_IO;
+        }
+    }
+    if (result == JQ_OK) {
+        result = jq_blob_hash_contents(src_fd, tmp_fd, hash_out);
+    }
+    if (result == JQ_OK && tmp_fd >= 0 && durable && fsync(tmp_fd) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (tmp_fd >= 0) {
+        close(tmp_fd);
+        tmp_fd = -1;
     }
 
-    jq_result_t pdf_move = jq_rename(pdf_src, pdf_dst);
-    if (pdf_move != JQ_OK) {
-        return pdf_move;
+    char blob_path[PATH_MAX];
+    if (result == JQ_OK && !jq_blob_path(root_path, hash_out, blob_path, sizeof(blob_path))) {
+        result = JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (result == JQ_OK) {
+        slash = strrchr(blob_path, '/');
+        *slash = '\0';
+        result = jq_ensure_dir(blob_path);
+        *slash = '/';
+    }
+    if (result == JQ_OK && hash_first) {
+        if (utimensat(AT_FDCWD, blob_path, NULL, 0) == 0) {
+            close(src_fd);
+            return JQ_OK;
+        }
+        result = errno == ENOENT ? JQ_OK : JQ_ERR_IO;
+        if (result == JQ_OK && (tmp_fd = mkstemp(tmp_path)) < 0) {
+            close(src_fd);
+            return JQ_ERR_IO;
+        }
+        tmp_created = tmp_fd >= 0;
+        struct stat copied_stat = src_stat;
+        if (result == JQ_OK &&
+            (fchmod(tmp_fd, src_stat.st_mode & 0777) != 0 || lseek(src_fd, 0, SEEK_SET) != 0 ||
+             jq_copy_contents(src_fd, tmp_fd, src_stat.st_size) != JQ_OK || (durable && fsync(tmp_fd) != 0) ||
+             fstat(src_fd, &copied_stat) != 0)) {
+            result = JQ_ERR_IO;
+        }
+        if (tmp_fd >= 0) {
+            close(tmp_fd);
+        }
+        /* A source rewritten between the hash and the copy is stored the slow way instead. */
+        if (result == JQ_OK && (copied_stat.st_size != src_stat.st_size ||
+                                copied_stat.st_mtim.tv_sec != src_stat.st_mtim.tv_sec ||
+                                copied_stat.st_mtim.tv_nsec != src_stat.st_mtim.tv_nsec)) {
+            unlink(tmp_path);
+            close(src_fd);
+            return jq_blob_store(root_path, src_path, JQ_SUBMIT_COPY, durable, hash_out);
+        }
+    }
+    close(src_fd);
+    if (result != JQ_OK) {
+        if (tmp_created) {
+            unlink(tmp_path);
+        }
+        return result;
     }
 
-    jq_result_t metadata_move = jq_rename(metadata_src, metadata_dst);
-    if (metadata_move != JQ_OK) {
-        jq_rename(pdf_dst, pdf_src);
-        return metadata_move;
+    int stored = linkat(AT_FDCWD, tmp_path, AT_FDCWD, blob_path, 0) == 0;
+    int link_error = errno;
+    unlink(tmp_path);
+    if (stored) {
+        if (durable) {
+            jq_sync_parent_dir(blob_path);
+        }
+        return JQ_OK;
+    }
+    if (link_error != EEXIST) {
+        return JQ_ERR_IO;
+    }
+    if (utimensat(AT_FDCWD, blob_path, NULL, 0) != 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
     }
+    return JQ_OK;
+}
 
-    jq_result_t report_move = jq_move_report_if_present(report_src, report_dst);
-    if (report_move != JQ_OK) {
-        jq_rename(metadata_dst, metadata_src);
-        jq_rename(pdf_dst, pdf_src);
-        return report_move;
+jq_result_t jq_blob_put(const char *root_path,
+                        const char *src_path,
+                        jq_submit_mode_t mode,
+                        char *hash_out,
+                        size_t hash_out_len) {
+    if (!root_path || !src_path || !hash_out || hash_out_len < JQ_BLOB_HASH_MAX) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (mode != JQ_SUBMIT_COPY && mode != JQ_SUBMIT_LINK && mode != JQ_SUBMIT_BLOB) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
+    return jq_blob_store(root_path, src_path, mode, 1, hash_out);
+}
 
+jq_result_t jq_blob_refs(const char *root_path, const char *hash, size_t *refs_out) {
+    if (!root_path || !jq_blob_hash_valid(hash) || !refs_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    char blob_path[PATH_MAX];
+    if (!jq_blob_path(root_path, hash, blob_path, sizeof(blob_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    struct stat st;
+    if (stat(blob_path, &st) != 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    *refs_out = st.st_nlink > 0 ? (size_t)st.st_nlink - 1 : 0;
     return JQ_OK;
 }
 
-jq_result_t jq_status(const char *root_path,
-                      const char *uuid,
-                      jq_state_t *state_out,
-                      int *locked_out) {
-    if (!root_path || !uuid || !state_out || !locked_out) {
+/* Drops unreferenced blobs and temp files of interrupted stores once they are older than the grace period. */
+jq_result_t jq_gc_blobs(const char *root_path, time_t now, size_t *removed_out) {
+    if (!root_path) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
+    if (now == 0) {
+        now = time(NULL);
+    }
 
-    const jq_state_t states[] = {JQ_STATE_PRIORITY, JQ_STATE_JOBS, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    char dir_path[PATH_MAX];
+    int written = snprintf(dir_path, sizeof(dir_path), "%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_BLOB_DIR);
+    if (written < 0 || (size_t)written >= sizeof(dir_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
 
-    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
-        char pdf_path[PATH_MAX];
-        char metadata_path[PATH_MAX];
-        jq_result_t path_result =
-            jq_job_paths(root_path, uuid, states[i], pdf_path, sizeof(pdf_path), metadata_path, sizeof(metadata_path));
-        if (path_result != JQ_OK) {
-            return path_result;
+    size_t removed = 0;
+    jq_result_t result = JQ_OK;
+    DIR *dir = opendir(dir_path);
+    if (!dir && errno != ENOENT) {
+        return JQ_ERR_IO;
+    }
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (strncmp(entry->d_name, ".tmp.", 5) == 0) {
+            if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                st.st_mtime + (time_t)JQ_BLOB_GRACE_SECONDS <= now && unlinkat(dirfd(dir), entry->d_name, 0) == 0) {
+                removed++;
+            }
+            continue;
+        }
+        if (strlen(entry->d_name) != 2 || entry->d_name[0] == '.') {
+            continue;
         }
 
-        int present = 0;
-        jq_result_t check_result = jq_check_pair_exists(pdf_path, metadata_path, &present);
-        if (check_result != JQ_OK) {
-            return check_result;
+        int shard_fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *shard = shard_fd >= 0 ? fdopendir(shard_fd) : NULL;
+        if (!shard) {
+            if (shard_fd >= 0) {
+                close(shard_fd);
+            }
+            result = JQ_ERR_IO;
+            continue;
         }
-        if (present) {
-            *state_out = states[i];
-            *locked_out = 0;
-            return JQ_OK;
+        struct dirent *blob;
+        while ((blob = readdir(shard)) != NULL) {
+            if (!jq_blob_hash_valid(blob->d_name) ||
+                fstatat(shard_fd, blob->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            /* Linking a job to a blob updates its ctime, so a fresh ctime means it was just used. */
+            if (st.st_nlink <= 1 && st.st_ctime + (time_t)JQ_BLOB_GRACE_SECONDS <= now) {
+                if (unlinkat(shard_fd, blob->d_name, 0) == 0) {
+                    removed++;
+                } else if (errno != ENOENT) {
+                    result = JQ_ERR_IO;
+                }
+            }
         }
+        closedir(shard);
+    }
+    if (dir) {
+        closedir(dir);
+    }
 
-        char pdf_locked[PATH_MAX];
-        char metadata_locked[PATH_MAX];
-        jq_result_t locked_result =
-            jq_job_paths_locked(root_path, uuid, states[i], pdf_locked, sizeof(pdf_locked),
-                                metadata_locked, sizeof(metadata_locked));
-        if (locked_result != JQ_OK) {
-            return locked_result;
-        }
+    if (removed_out) {
+        *removed_out = removed;
+    }
+    return result;
+}
 
-        present = 0;
-        check_result = jq_check_pair_exists(pdf_locked, metadata_locked, &present);
-        if (check_result != JQ_OK) {
-            return check_result;
-        }
-        if (present) {
-            *state_out = states[i];
-            *locked_out = 1;
-            return JQ_OK;
+/*
+ * Layout: a root starts flat (<state>/<uuid>.pdf.job). Sharded roots nest
+ * every job two levels down by a hash of its uuid (<state>/ab/cd/<uuid>...)
+ * so no directory grows past a few dozen entries. While jq_migrate_layout
+ * runs the root is "migrating": a file is looked up in its shard first and
+ * in the flat directory second, and anything new goes to the shard.
+ *
+ * The directory layout gives every job its own directory in the shard
+ * (<state>/ab/cd/<uuid>/<uuid>.pdf.job, <uuid>.lock/ while claimed), so a
+ * claim or transition is a single rename of that directory. While
+ * jq_migrate_job_dirs runs, a file is looked up in the job directory first
+ * and as a loose file second; files of a job that is still loose stay next
+ * to its pdf, and new jobs get a directory.
+ */
+static jq_layout_t jq_layout_read(int fd) {
+    if (fd < 0) {
+        return JQ_LAYOUT_FLAT;
+    }
+    char buffer[32];
+    ssize_t bytes = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (bytes <= 0) {
+        return JQ_LAYOUT_FLAT;
+    }
+    buffer[bytes] = '\0';
+    if (strncmp(buffer, "sharded", strlen("sharded")) == 0) {
+        return JQ_LAYOUT_SHARDED;
+    }
+    if (strncmp(buffer, "migrating", strlen("migrating")) == 0) {
+        return JQ_LAYOUT_MIGRATING;
+    }
+    if (strncmp(buffer, "directories-migrating", strlen("directories-migrating")) == 0) {
+        return JQ_LAYOUT_DIRECTORY_MIGRATING;
+    }
+    if (strncmp(buffer, "directories", strlen("directories")) == 0) {
+        return JQ_LAYOUT_DIRECTORY;
+    }
+    return JQ_LAYOUT_FLAT;
+}
+
+/*
+ * The layout last read for a root. jq_write_layout renames a new file into
+ * place, so a file with the same inode and mtime still says the same thing
+ * and one stat stands in for opening and reading it.
+ */
+typedef struct {
+    char root_path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    jq_layout_t layout;
+} jq_layout_cache_t;
+
+static pthread_mutex_t jq_layout_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static jq_layout_cache_t jq_layout_caches[JQ_LAYOUT_CACHE_ROOTS];
+static size_t jq_layout_cache_next;
+
+static jq_layout_cache_t *jq_layout_cache_find(const char *root_path) {
+    for (size_t i = 0; i < JQ_LAYOUT_CACHE_ROOTS; ++i) {
+        if (jq_layout_caches[i].root_path[0] != '\0' && strcmp(jq_layout_caches[i].root_path, root_path) == 0) {
+            return &jq_layout_caches[i];
         }
     }
+    return NULL;
+}
+
+/* Reads the layout file name under dirfd, unless the copy cached for root_path is still current. */
+static jq_layout_t jq_layout_lookup(const char *root_path, int dirfd, const char *name) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) != 0 || strlen(root_path) >= PATH_MAX) {
+        return jq_layout_read(openat(dirfd, name, O_RDONLY | O_CLOEXEC));
+    }
 
-    return JQ_ERR_NOT_FOUND;
+    pthread_mutex_lock(&jq_layout_cache_lock);
+    jq_layout_cache_t *cache = jq_layout_cache_find(root_path);
+    if (cache && cache->dev == st.st_dev && cache->ino == st.st_ino && cache->mtime.tv_sec == st.st_mtim.tv_sec &&
+        cache->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        jq_layout_t layout = cache->layout;
+        pthread_mutex_unlock(&jq_layout_cache_lock);
+        return layout;
+    }
+    pthread_mutex_unlock(&jq_layout_cache_lock);
+
+    /* A file replaced since the stat is read here but cached under the old inode, so the next call rereads it. */
+    jq_layout_t layout = jq_layout_read(openat(dirfd, name, O_RDONLY | O_CLOEXEC));
+    pthread_mutex_lock(&jq_layout_cache_lock);
+    cache = jq_layout_cache_find(root_path);
+    if (!cache) {
+        cache = &jq_layout_caches[jq_layout_cache_next++ % JQ_LAYOUT_CACHE_ROOTS];
+        snprintf(cache->root_path, sizeof(cache->root_path), "%s", root_path);
+    }
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->mtime = st.st_mtim;
+    cache->layout = layout;
+    pthread_mutex_unlock(&jq_layout_cache_lock);
+    return layout;
 }
 
-static int jq_has_suffix(const char *name, const char *suffix) {
-    if (!name || !suffix) {
+static jq_layout_t jq_layout_of(const char *root_path) {
+    char path[PATH_MAX];
+    int written = snprintf(path, sizeof(path), "%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_LAYOUT_FILE);
+    if (written < 0 || (size_t)written >= sizeof(path)) {
+        return JQ_LAYOUT_FLAT;
+    }
+    return jq_layout_lookup(root_path, AT_FDCWD, path);
+}
+
+static uint32_t jq_shard_hash(const char *uuid) {
+    /* FNV-1a: cheap and spreads sequential uuids evenly. */
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *cursor = (const unsigned char *)uuid; *cursor; ++cursor) {
+        hash ^= *cursor;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * A root as the transition code sees it. Roots built from a path name every
+ * job file by its full path; roots opened with jq_open carry a descriptor per
+ * state directory, and job files are named relative to it so each syscall
+ * resolves one or three components instead of the whole path. Those roots
+ * also carry the handle's open journal and event writer, and keep the ready
+ * ring mapped; path roots map it per call.
+ */
+struct jq_root {
+    const char *path;
+    int state_fds[JQ_STATE_ERROR + 1];
+    int index_fd;
+    jq_layout_t layout;
+    jq_journal_t *journal;
+    jq_event_writer_t *events;
+    jq_ring_file_t *ring;
+};
+
+/* One job file: a name to hand to the *at() calls together with dirfd. */
+typedef struct {
+    int dirfd;
+    int job_dir;
+    char name[PATH_MAX];
+} jq_file_t;
+
+static void jq_root_from_path(jq_root_t *root, const char *root_path) {
+    root->path = root_path;
+    for (size_t i = 0; i < sizeof(root->state_fds) / sizeof(root->state_fds[0]); ++i) {
+        root->state_fds[i] = -1;
+    }
+    root->index_fd = -1;
+    root->layout = jq_layout_of(root_path);
+    root->journal = NULL;
+    root->events = NULL;
+    root->ring = NULL;
+}
+
+static int jq_is_job_dir_layout(jq_layout_t layout) {
+    return layout == JQ_LAYOUT_DIRECTORY || layout == JQ_LAYOUT_DIRECTORY_MIGRATING;
+}
+
+static jq_result_t jq_mkdirs_at(int dirfd, char *dir, int levels) {
+    if (mkdirat(dirfd, dir, 0755) == 0 || errno == EEXIST) {
+        return JQ_OK;
+    }
+    if (errno != ENOENT || levels <= 1) {
+        return JQ_ERR_IO;
+    }
+
+    char *slash = strrchr(dir, '/');
+    if (!slash) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    *slash = '\0';
+    jq_result_t result = jq_mkdirs_at(dirfd, dir, levels - 1);
+    *slash = '/';
+    if (result != JQ_OK) {
+        return result;
+    }
+    return mkdirat(dirfd, dir, 0755) == 0 || errno == EEXIST ? JQ_OK : JQ_ERR_IO;
+}
+
+/* The directory holding a job file: its shard, or its job directory in the directory layout. */
+static int jq_parent_file(const jq_file_t *file, jq_file_t *out) {
+    *out = *file;
+    char *slash = strrchr(out->name, '/');
+    if (!slash) {
         return 0;
     }
-    size_t name_len = strlen(name);
+    *slash = '\0';
+    return 1;
+}
+
+/*
+ * Create the shard and job directories above a job file, up to three levels;
+ * the state directory itself must exist.
+ */
+static jq_result_t jq_ensure_shard_dirs(const jq_file_t *file) {
+    jq_file_t dir;
+    if (!jq_parent_file(file, &dir)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    return jq_mkdirs_at(dir.dirfd, dir.name, 3);
+}
+
+static int jq_format_job_file(const jq_root_t *root,
+                              jq_state_t state,
+                              const char *shard,
+                              const char *uuid,
+                              const char *suffix,
+                              jq_file_t *out) {
+    int fd = root->state_fds[state];
+    int written = fd >= 0
+                      ? snprintf(out->name, sizeof(out->name), "%s%s%s", shard, uuid, suffix)
+                      : snprintf(out->name, sizeof(out->name), "%s/%s/%s%s%s", root->path, jq_state_dir(state),
+                                 shard, uuid, suffix);
+    out->dirfd = fd >= 0 ? fd : AT_FDCWD;
+    out->job_dir = 0;
+    return written >= 0 && (size_t)written < sizeof(out->name);
+}
+
+/* <shard><uuid>[.lock]/<uuid><suffix>: the lock marker moves from the file to its job directory. */
+static int jq_format_dir_file(const jq_root_t *root,
+                              jq_state_t state,
+                              const char *shard,
+                              const char *uuid,
+                              const char *suffix,
+                              jq_file_t *out) {
     size_t suffix_len = strlen(suffix);
-    if (suffix_len > name_len) {
+    size_t lock_len = strlen(".lock");
+    int locked = suffix_len > lock_len && strcmp(suffix + suffix_len - lock_len, ".lock") == 0;
+    char inner[PATH_MAX];
+    int written = snprintf(inner, sizeof(inner), "%s%s/%s%.*s", uuid, locked ? ".lock" : "", uuid,
+                           (int)(locked ? suffix_len - lock_len : suffix_len), suffix);
+    if (written < 0 || (size_t)written >= sizeof(inner) || !jq_format_job_file(root, state, shard, inner, "", out)) {
         return 0;
     }
-    return strcmp(name + name_len - suffix_len, suffix) == 0;
+    out->job_dir = 1;
+    return 1;
 }
 
-static void jq_update_mtime(time_t mtime, time_t *oldest, time_t *newest) {
-    if (mtime <= 0) {
+static void jq_shard_prefix(const char *uuid, char shard[8]) {
+    uint32_t hash = jq_shard_hash(uuid);
+    snprintf(shard, 8, "%02x/%02x/", (unsigned int)(hash >> 24), (unsigned int)((hash >> 16) & 0xffu));
+}
+
+/* A loose file in its shard or, failing that, in the flat directory; returns whether either exists. */
+static int jq_find_loose_file(const jq_root_t *root,
+                              jq_state_t state,
+                              const char *shard,
+                              const char *uuid,
+                              const char *suffix,
+                              jq_file_t *out) {
+    if (jq_format_job_file(root, state, shard, uuid, suffix, out) && faccessat(out->dirfd, out->name, F_OK, 0) == 0) {
+        return 1;
+    }
+    jq_file_t flat;
+    if (jq_format_job_file(root, state, "", uuid, suffix, &flat) &&
+        faccessat(flat.dirfd, flat.name, F_OK, 0) == 0) {
+        *out = flat;
+        return 1;
+    }
+    return 0;
+}
+
+/* Directory-layout lookup while loose jobs remain: see the layout notes above. */
+static void jq_resolve_migrating_dir_file(const jq_root_t *root,
+                                          jq_state_t state,
+                                          const char *shard,
+                                          const char *uuid,
+                                          const char *suffix,
+                                          jq_file_t *out) {
+    if (faccessat(out->dirfd, out->name, F_OK, 0) == 0) {
+        return;
+    }
+    jq_file_t loose;
+    if (jq_find_loose_file(root, state, shard, uuid, suffix, &loose)) {
+        *out = loose;
         return;
     }
-    if (*oldest == 0 || mtime < *oldest) {
-        *oldest = mtime;
+
+    size_t suffix_len = strlen(suffix);
+    size_t lock_len = strlen(".lock");
+    int locked = suffix_len > lock_len && strcmp(suffix + suffix_len - lock_len, ".lock") == 0;
+    const char *pdf_suffix = locked ? ".pdf.job.lock" : ".pdf.job";
+    if (strcmp(suffix, pdf_suffix) == 0 || !jq_find_loose_file(root, state, shard, uuid, pdf_suffix, &loose)) {
+        return;
+    }
+    size_t base_len = strlen(loose.name) - strlen(pdf_suffix);
+    if (base_len + suffix_len < sizeof(loose.name)) {
+        memcpy(loose.name + base_len, suffix, suffix_len + 1);
+        *out = loose;
+    }
+}
+
+static int jq_job_file(const jq_root_t *root,
+                       jq_state_t state,
+                       const char *uuid,
+                       const char *suffix,
+                       jq_file_t *out) {
+    if (!jq_state_dir(state)) {
+        return 0;
+    }
+    if (root->layout == JQ_LAYOUT_FLAT) {
+        return jq_format_job_file(root, state, "", uuid, suffix, out);
+    }
+
+    char shard[8];
+    jq_shard_prefix(uuid, shard);
+    if (jq_is_job_dir_layout(root->layout)) {
+        if (!jq_format_dir_file(root, state, shard, uuid, suffix, out)) {
+            return 0;
+        }
+        if (root->layout == JQ_LAYOUT_DIRECTORY_MIGRATING) {
+            jq_resolve_migrating_dir_file(root, state, shard, uuid, suffix, out);
+        }
+        return 1;
+    }
+
+    if (!jq_format_job_file(root, state, shard, uuid, suffix, out)) {
+        return 0;
+    }
+    if (root->layout == JQ_LAYOUT_MIGRATING && faccessat(out->dirfd, out->name, F_OK, 0) != 0) {
+        jq_file_t flat;
+        if (jq_format_job_file(root, state, "", uuid, suffix, &flat) &&
+            faccessat(flat.dirfd, flat.name, F_OK, 0) == 0) {
+            /* Not moved yet. */
+            *out = flat;
+        } else {
+            /* A new file: workers create reports without going through jq_rename. */
+            (void)jq_ensure_shard_dirs(out);
+        }
+    }
+    return 1;
+}
+
+static jq_result_t jq_pair_paths(const jq_root_t *root,
+                                 const char *uuid,
+                                 jq_state_t state,
+                                 int locked,
+                                 jq_file_t *pdf_out,
+                                 jq_file_t *metadata_out) {
+    if (!root->path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    if (!jq_job_file(root, state, uuid, locked ? ".pdf.job.lock" : ".pdf.job", pdf_out) ||
+        !jq_job_file(root, state, uuid, locked ? ".metadata.job.lock" : ".metadata.job", metadata_out)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    return JQ_OK;
+}
+
+static jq_result_t jq_report_path(const jq_root_t *root,
+                                  const char *uuid,
+                                  jq_state_t state,
+                                  int locked,
+                                  jq_file_t *report_out) {
+    if (!root->path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    if (!jq_job_file(root, state, uuid, locked ? ".report.html.lock" : ".report.html", report_out)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    return JQ_OK;
+}
+
+static jq_result_t jq_copy_file_name(const jq_file_t *file, char *out, size_t out_len) {
+    size_t length = strlen(file->name);
+    if (!out || length >= out_len) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    memcpy(out, file->name, length + 1);
+    return JQ_OK;
+}
+
+static jq_result_t jq_public_pair_paths(const char *root_path,
+                                        const char *uuid,
+                                        jq_state_t state,
+                                        int locked,
+                                        char *pdf_out,
+                                        size_t pdf_out_len,
+                                        char *metadata_out,
+                                        size_t metadata_out_len) {
+    if (!root_path) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    jq_file_t pdf;
+    jq_file_t metadata;
+    jq_result_t result = jq_pair_paths(&root, uuid, state, locked, &pdf, &metadata);
+    if (result == JQ_OK) {
+        result = jq_copy_file_name(&pdf, pdf_out, pdf_out_len);
+    }
+    if (result == JQ_OK) {
+        result = jq_copy_file_name(&metadata, metadata_out, metadata_out_len);
+    }
+    return result;
+}
+
+static jq_result_t jq_public_report_path(const char *root_path,
+                                         const char *uuid,
+                                         jq_state_t state,
+                                         int locked,
+                                         char *report_out,
+                                         size_t report_out_len) {
+    if (!root_path) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    jq_file_t report;
+    jq_result_t result = jq_report_path(&root, uuid, state, locked, &report);
+    return result == JQ_OK ? jq_copy_file_name(&report, report_out, report_out_len) : result;
+}
+
+jq_result_t jq_job_paths_locked(const char *root_path,
+                                const char *uuid,
+                                jq_state_t state,
+                                char *pdf_out,
+                                size_t pdf_out_len,
+                                char *metadata_out,
+                                size_t metadata_out_len) {
+    return jq_public_pair_paths(root_path, uuid, state, 1, pdf_out, pdf_out_len, metadata_out, metadata_out_len);
+}
+
+jq_result_t jq_job_report_paths(const char *root_path,
+                                const char *uuid,
+                                jq_state_t state,
+                                char *report_out,
+                                size_t report_out_len) {
+    return jq_public_report_path(root_path, uuid, state, 0, report_out, report_out_len);
+}
+
+jq_result_t jq_job_report_paths_locked(const char *root_path,
+                                       const char *uuid,
+                                       jq_state_t state,
+                                       char *report_out,
+                                       size_t report_out_len) {
+    return jq_public_report_path(root_path, uuid, state, 1, report_out, report_out_len);
+}
+
+jq_result_t jq_job_paths(const char *root_path,
+                         const char *uuid,
+                         jq_state_t state,
+                         char *pdf_out,
+                         size_t pdf_out_len,
+                         char *metadata_out,
+                         size_t metadata_out_len) {
+    return jq_public_pair_paths(root_path, uuid, state, 0, pdf_out, pdf_out_len, metadata_out, metadata_out_len);
+}
+
+static void jq_job_sizes(const jq_file_t *pdf,
+                         const jq_file_t *metadata,
+                         const jq_file_t *report,
+                         jq_job_sizes_t *sizes_out) {
+    memset(sizes_out, 0, sizeof(*sizes_out));
+    struct stat st;
+    if (pdf && fstatat(pdf->dirfd, pdf->name, &st, 0) == 0) {
+        sizes_out->pdf = (int64_t)st.st_size;
+        sizes_out->mtime = st.st_mtime;
+    }
+    if (metadata && fstatat(metadata->dirfd, metadata->name, &st, 0) == 0) {
+        sizes_out->metadata = (int64_t)st.st_size;
+    }
+    if (report && fstatat(report->dirfd, report->name, &st, 0) == 0) {
+        sizes_out->report = (int64_t)st.st_size;
+        sizes_out->has_report = 1;
+    }
+}
+
+/* Add (sign 1) or retire (sign -1) one job's files in a stats change. */
+static void jq_stats_add_job(jq_stats_change_t *change,
+                             int64_t sign,
+                             int locked,
+                             int64_t pdf_bytes,
+                             int64_t metadata_bytes,
+                             int has_report,
+                             int64_t report_bytes) {
+    change->counters[locked ? JQ_STAT_PDF_LOCKED : JQ_STAT_PDF] += sign;
+    change->counters[locked ? JQ_STAT_METADATA_LOCKED : JQ_STAT_METADATA] += sign;
+    change->counters[JQ_STAT_PDF_BYTES] += sign * pdf_bytes;
+    change->counters[JQ_STAT_METADATA_BYTES] += sign * metadata_bytes;
+    if (has_report) {
+        change->counters[locked ? JQ_STAT_REPORT_LOCKED : JQ_STAT_REPORT] += sign;
+        change->counters[JQ_STAT_REPORT_BYTES] += sign * report_bytes;
+    }
+}
+
+void jq_submit_options_init(jq_submit_options_t *options) {
+    if (!options) {
+        return;
+    }
+    memset(options, 0, sizeof(*options));
+    options->level = JQ_LEVEL_AUTO;
+    options->mode = JQ_SUBMIT_COPY;
+}
+
+static int jq_submit_options_valid(const jq_submit_options_t *options) {
+    if (options->mode != JQ_SUBMIT_COPY && options->mode != JQ_SUBMIT_LINK && options->mode != JQ_SUBMIT_BLOB) {
+        return 0;
+    }
+    if (options->tenant && !jq_tenant_name_valid(options->tenant)) {
+        return 0;
+    }
+    return !options->blob || jq_blob_hash_valid(options->blob);
+}
+
+static int jq_submit_level(const jq_submit_options_t *options, int level) {
+    if (level == JQ_LEVEL_AUTO) {
+        level = options->level;
+    }
+    if (level == JQ_LEVEL_AUTO) {
+        level = options->priority ? JQ_LEVEL_HIGH : JQ_LEVEL_NORMAL;
+    }
+    return level >= 0 && level < JQ_LEVEL_COUNT ? level : -1;
+}
+
+static void jq_remove_job_dir(const jq_file_t *file);
+
+/* Places one job's files and counts them; publishing it on the ready log is left to the caller. */
+static jq_result_t jq_submit_files(const jq_root_t *root,
+                                   const char *uuid,
+                                   const char *pdf_path,
+                                   const char *metadata_path,
+                                   int level,
+                                   jq_submit_mode_t mode,
+                                   const char *blob,
+                                   int durable,
+                                   int64_t *pdf_bytes_out) {
+    char blob_hash[JQ_BLOB_HASH_MAX];
+    if (!blob && mode == JQ_SUBMIT_BLOB) {
+        jq_result_t blob_result = jq_blob_store(root->path, pdf_path, JQ_SUBMIT_COPY, durable, blob_hash);
+        if (blob_result != JQ_OK) {
+            return blob_result;
+        }
+        blob = blob_hash;
+    }
+    char blob_path[PATH_MAX];
+    if (blob) {
+        if (!jq_blob_path(root->path, blob, blob_path, sizeof(blob_path))) {
+            return JQ_ERR_INVALID_ARGUMENT;
+        }
+        pdf_path = blob_path;
+        mode = JQ_SUBMIT_LINK;
+    }
+
+    jq_state_t state = jq_level_state(level);
+    jq_file_t pdf_dest;
+    jq_file_t metadata_dest;
+
+    jq_result_t path_result = jq_pair_paths(root, uuid, state, 0, &pdf_dest, &metadata_dest);
+    if (path_result != JQ_OK) {
+        return path_result;
+    }
+    if ((root->layout == JQ_LAYOUT_SHARDED || pdf_dest.job_dir) && jq_ensure_shard_dirs(&pdf_dest) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+    jq_file_t job_dir;
+    if (durable && pdf_dest.job_dir && jq_parent_file(&pdf_dest, &job_dir)) {
+        jq_sync_parent_dir(job_dir.name);
+    }
+
+    /*
+     * Only the PDF is ever linked: workers rewrite metadata in place, while
+     * the PDF is only replaced through rename, so a shared inode never sees
+     * a worker's writes. A blob is linked the same way.
+     */
+    jq_result_t pdf_result = JQ_ERR_IO;
+    int link_unsupported = 1;
+    if (mode == JQ_SUBMIT_LINK) {
+        pdf_result = jq_link_file(pdf_path, pdf_dest.name, durable, &link_unsupported);
+    }
+    if (link_unsupported) {
+        pdf_result = jq_copy_file(pdf_path, pdf_dest.name, durable);
+    }
+    if (pdf_result != JQ_OK) {
+        return pdf_result;
+    }
+
+    jq_result_t metadata_result = jq_copy_file(metadata_path, metadata_dest.name, durable);
+    if (metadata_result != JQ_OK) {
+        unlink(pdf_dest.name);
+        jq_remove_job_dir(&pdf_dest);
+        return metadata_result;
+    }
+
+    jq_job_sizes_t sizes;
+    jq_job_sizes(&pdf_dest, &metadata_dest, NULL, &sizes);
+    jq_stats_change_t change = {.state = state};
+    jq_stats_add_job(&change, 1, 0, sizes.pdf, sizes.metadata, 0, 0);
+    jq_stats_apply(root->path, &change, 1, sizes.mtime);
+    jq_status_index_set(root->path, uuid, state, 0);
+    (void)jq_event_append(root, JQ_EVENT_SUBMIT, uuid, -1, state, sizes.pdf + sizes.metadata);
+    *pdf_bytes_out = sizes.pdf;
+    return JQ_OK;
+}
+
+jq_result_t jq_submit_with_options(const char *root_path,
+                                   const char *uuid,
+                                   const char *pdf_path,
+                                   const char *metadata_path,
+                                   const jq_submit_options_t *options) {
+    jq_submit_options_t defaults;
+    if (!options) {
+        jq_submit_options_init(&defaults);
+        options = &defaults;
+    }
+    if (!root_path || !uuid || (!pdf_path && !options->blob) || !metadata_path ||
+        !jq_submit_options_valid(options)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int level = jq_submit_level(options, JQ_LEVEL_AUTO);
+    if (level < 0) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int tenant = 0;
+    if (options->tenant) {
+        jq_result_t tenant_result = jq_tenant_index(root_path, options->tenant, &tenant);
+        if (tenant_result != JQ_OK) {
+            return tenant_result;
+        }
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    int64_t pdf_bytes = 0;
+    jq_result_t result =
+        jq_submit_files(&root, uuid, pdf_path, metadata_path, level, options->mode, options->blob, 1, &pdf_bytes);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    (void)jq_ready_append(root_path, tenant, level, uuid, pdf_bytes);
+    return JQ_OK;
+}
+
+typedef struct {
+    jq_root_t root;
+    const jq_submit_options_t *options;
+    jq_submit_item_t *items;
+    int64_t *pdf_bytes;
+    size_t count;
+    _Atomic size_t next;
+} jq_submit_batch_t;
+
+static void *jq_submit_batch_worker(void *arg) {
+    jq_submit_batch_t *batch = arg;
+    size_t index;
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        jq_submit_item_t *item = &batch->items[index];
+        int level = jq_submit_level(batch->options, item->level);
+        if (!item->uuid || (!item->pdf_path && !batch->options->blob) || !item->metadata_path || level < 0) {
+            item->result = JQ_ERR_INVALID_ARGUMENT;
+            continue;
+        }
+        item->result = jq_submit_files(&batch->root, item->uuid, item->pdf_path, item->metadata_path, level,
+                                       batch->options->mode, batch->options->blob, 0, &batch->pdf_bytes[index]);
+    }
+    return NULL;
+}
+
+/*
+ * Bulk ingest: a few threads place the files without any per-file fsync,
+ * then one syncfs makes the whole batch durable. Jobs are published on the
+ * ready logs only after that, in item order, so nothing is claimed before it
+ * is on disk. If the barrier fails every placed item reports JQ_ERR_IO; its
+ * files stay where they are and the ready logs are marked for a rescan, so
+ * the job is still found but may not survive a crash.
+ */
+jq_result_t jq_submit_batch(const char *root_path,
+                            jq_submit_item_t *items,
+                            size_t count,
+                            const jq_submit_options_t *options,
+                            size_t *submitted_out) {
+    if (!root_path || (!items && count > 0)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_submit_options_t defaults;
+    if (!options) {
+        jq_submit_options_init(&defaults);
+        options = &defaults;
+    }
+    if (!jq_submit_options_valid(options)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int tenant = 0;
+    if (options->tenant && count > 0) {
+        jq_result_t tenant_result = jq_tenant_index(root_path, options->tenant, &tenant);
+        if (tenant_result != JQ_OK) {
+            return tenant_result;
+        }
+    }
+
+    jq_submit_batch_t batch = {
+        .options = options,
+        .items = items,
+        .pdf_bytes = calloc(count > 0 ? count : 1, sizeof(int64_t)),
+        .count = count,
+    };
+    if (!batch.pdf_bytes) {
+        return JQ_ERR_IO;
+    }
+    jq_root_from_path(&batch.root, root_path);
+    atomic_init(&batch.next, 0);
+
+    size_t threads = options->threads > 0 ? options->threads : JQ_SUBMIT_BATCH_THREADS;
+    if (threads > JQ_SUBMIT_BATCH_THREADS_MAX) {
+        threads = JQ_SUBMIT_BATCH_THREADS_MAX;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    /* The calling thread works too, so a failed pthread_create only costs parallelism. */
+    pthread_t workers[JQ_SUBMIT_BATCH_THREADS_MAX];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; ++i) {
+        if (pthread_create(&workers[started], NULL, jq_submit_batch_worker, &batch) != 0) {
+            break;
+        }
+        started++;
+    }
+    jq_submit_batch_worker(&batch);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    size_t submitted = 0;
+    for (size_t i = 0; i < count; ++i) {
+        submitted += items[i].result == JQ_OK;
+    }
+    if (submitted_out) {
+        *submitted_out = submitted;
+    }
+    if (submitted == 0) {
+        free(batch.pdf_bytes);
+        return JQ_OK;
+    }
+
+    /* One barrier for every file and directory entry the batch wrote. */
+    int root_fd = open(root_path, O_RDONLY | O_DIRECTORY);
+    int sync_failed = root_fd < 0;
+    if (root_fd >= 0) {
+#if defined(__linux__)
+        sync_failed = syncfs(root_fd) != 0;
+#else
+        sync();
+#endif
+        close(root_fd);
+    }
+    if (sync_failed) {
+        for (size_t i = 0; i < count; ++i) {
+            if (items[i].result == JQ_OK) {
+                items[i].result = JQ_ERR_IO;
+                jq_ready_mark_rescan(root_path, jq_level_state(jq_submit_level(options, items[i].level)));
+            }
+        }
+        if (submitted_out) {
+            *submitted_out = 0;
+        }
+        free(batch.pdf_bytes);
+        return JQ_ERR_IO;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (items[i].result == JQ_OK) {
+            (void)jq_ready_append(root_path, tenant, jq_submit_level(options, items[i].level), items[i].uuid,
+                                  batch.pdf_bytes[i]);
+        }
+    }
+    free(batch.pdf_bytes);
+    return JQ_OK;
+}
+
+jq_result_t jq_submit(const char *root_path,
+                      const char *uuid,
+                      const char *pdf_path,
+                      const char *metadata_path,
+                      int priority) {
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.priority = priority;
+    return jq_submit_with_options(root_path, uuid, pdf_path, metadata_path, &options);
+}
+
+/*
+ * Transitions never replace a file already at the destination: a uuid that
+ * somehow exists in two states is left for fsck instead of being clobbered.
+ * Filesystems without RENAME_NOREPLACE fall back to a plain rename.
+ */
+static int jq_renameat(const jq_file_t *src, const jq_file_t *dst) {
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    if (renameat2(src->dirfd, src->name, dst->dirfd, dst->name, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+#endif
+    return renameat(src->dirfd, src->name, dst->dirfd, dst->name);
+}
+
+static jq_result_t jq_rename(const jq_file_t *src, const jq_file_t *dst) {
+    if (jq_renameat(src, dst) == 0) {
+        return JQ_OK;
+    }
+
+    if (errno == ENOENT) {
+        /* The source is there, so the destination's shard has not been created yet. */
+        if (faccessat(src->dirfd, src->name, F_OK, 0) == 0 && jq_ensure_shard_dirs(dst) == JQ_OK &&
+            jq_renameat(src, dst) == 0) {
+            return JQ_OK;
+        }
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    return JQ_ERR_IO;
+}
+
+static jq_result_t jq_rename_path(const char *src, const char *dst) {
+    if (rename(src, dst) == 0) {
+        return JQ_OK;
+    }
+    return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+}
+
+static jq_result_t jq_move_report_if_present(const jq_file_t *report_src, const jq_file_t *report_dst) {
+    if (faccessat(report_src->dirfd, report_src->name, F_OK, 0) != 0) {
+        if (errno == ENOENT) {
+            return JQ_OK;
+        }
+        return JQ_ERR_IO;
+    }
+    return jq_rename(report_src, report_dst);
+}
+
+/* Removes a job directory emptied by a file-by-file move; anything left in it keeps it. */
+static void jq_remove_job_dir(const jq_file_t *file) {
+    jq_file_t dir;
+    if (file->job_dir && jq_parent_file(file, &dir)) {
+        (void)unlinkat(dir.dirfd, dir.name, AT_REMOVEDIR);
+    }
+}
+
+/*
+ * Renames a job's pdf, metadata and optional report, putting back whatever
+ * already moved if one fails. A job kept whole in its own directory moves
+ * with one rename of the directory instead.
+ */
+static jq_result_t jq_move_job_files(const jq_file_t *pdf_src,
+                                     const jq_file_t *metadata_src,
+                                     const jq_file_t *report_src,
+                                     const jq_file_t *pdf_dst,
+                                     const jq_file_t *metadata_dst,
+                                     const jq_file_t *report_dst) {
+    jq_file_t src_dir;
+    jq_file_t dst_dir;
+    if (pdf_src->job_dir && metadata_src->job_dir && report_src->job_dir && pdf_dst->job_dir &&
+        jq_parent_file(pdf_src, &src_dir) && jq_parent_file(pdf_dst, &dst_dir)) {
+        return jq_rename(&src_dir, &dst_dir);
+    }
+
+    jq_result_t pdf_move = jq_rename(pdf_src, pdf_dst);
+    if (pdf_move != JQ_OK) {
+        return pdf_move;
+    }
+
+    jq_result_t metadata_move = jq_rename(metadata_src, metadata_dst);
+    if (metadata_move != JQ_OK) {
+        jq_rename(pdf_dst, pdf_src);
+        jq_remove_job_dir(pdf_dst);
+        return metadata_move;
+    }
+
+    jq_result_t report_move = jq_move_report_if_present(report_src, report_dst);
+    if (report_move != JQ_OK) {
+        jq_rename(metadata_dst, metadata_src);
+        jq_rename(pdf_dst, pdf_src);
+        jq_remove_job_dir(pdf_dst);
+        return report_move;
+    }
+    jq_remove_job_dir(pdf_src);
+    return JQ_OK;
+}
+
+static jq_result_t jq_check_pair_exists(const jq_file_t *pdf, const jq_file_t *metadata, int *present_out) {
+    if (!pdf || !metadata || !present_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int pdf_ok = faccessat(pdf->dirfd, pdf->name, F_OK, 0) == 0;
+    int pdf_errno = errno;
+    int metadata_ok = faccessat(metadata->dirfd, metadata->name, F_OK, 0) == 0;
+    int metadata_errno = errno;
+
+    if (pdf_ok && metadata_ok) {
+        *present_out = 1;
+        return JQ_OK;
+    }
+
+    if (!pdf_ok && !metadata_ok) {
+        if (pdf_errno != ENOENT || metadata_errno != ENOENT) {
+            return JQ_ERR_IO;
+        }
+        *present_out = 0;
+        return JQ_OK;
+    }
+
+    return JQ_ERR_IO;
+}
+
+/* Handle roots keep every state directory open, so only path roots need to create one. */
+static jq_result_t jq_root_ensure_state_dir(const jq_root_t *root, jq_state_t state) {
+    if (state >= JQ_STATE_JOBS && state <= JQ_STATE_ERROR && root->state_fds[state] >= 0) {
+        return JQ_OK;
+    }
+    return jq_ensure_state_dir(root->path, state);
+}
+
+static jq_result_t jq_move_at(const jq_root_t *root,
+                              const char *uuid,
+                              jq_state_t from_state,
+                              jq_state_t to_state) {
+    const char *root_path = root->path;
+    jq_result_t ensure_result = jq_root_ensure_state_dir(root, to_state);
+    if (ensure_result != JQ_OK) {
+        return ensure_result;
+    }
+
+    jq_file_t pdf_src;
+    jq_file_t metadata_src;
+    jq_file_t pdf_dst;
+    jq_file_t metadata_dst;
+    jq_file_t report_src;
+    jq_file_t report_dst;
+
+    jq_result_t src_result = jq_pair_paths(root, uuid, from_state, 0, &pdf_src, &metadata_src);
+    if (src_result != JQ_OK) {
+        return src_result;
+    }
+
+    jq_result_t dst_result = jq_pair_paths(root, uuid, to_state, 0, &pdf_dst, &metadata_dst);
+    if (dst_result != JQ_OK) {
+        return dst_result;
+    }
+
+    jq_result_t report_src_result = jq_report_path(root, uuid, from_state, 0, &report_src);
+    if (report_src_result != JQ_OK) {
+        return report_src_result;
+    }
+
+    jq_result_t report_dst_result = jq_report_path(root, uuid, to_state, 0, &report_dst);
+    if (report_dst_result != JQ_OK) {
+        return report_dst_result;
+    }
+
+    /* Read before the move: once the files are gone a claimer may step over the record. */
+    int tenant = jq_ready_pending_tenant(root_path, from_state, uuid);
+
+    jq_journal_t journal;
+    jq_result_t journal_result = jq_journal_begin(root, uuid, from_state, 0, to_state, &journal);
+    if (journal_result != JQ_OK) {
+        return journal_result;
+    }
+    jq_result_t move_result =
+        jq_move_job_files(&pdf_src, &metadata_src, &report_src, &pdf_dst, &metadata_dst, &report_dst);
+    jq_journal_end(root, &journal);
+    if (move_result != JQ_OK) {
+        return move_result;
+    }
+
+    jq_job_sizes_t sizes;
+    jq_job_sizes(&pdf_dst, &metadata_dst, &report_dst, &sizes);
+    jq_stats_change_t changes[2] = {{.state = from_state}, {.state = to_state}};
+    jq_stats_add_job(&changes[0], -1, 0, sizes.pdf, sizes.metadata, sizes.has_report, sizes.report);
+    jq_stats_add_job(&changes[1], 1, 0, sizes.pdf, sizes.metadata, sizes.has_report, sizes.report);
+    jq_stats_apply(root_path, changes, 2, 0);
+    jq_status_index_set(root_path, uuid, to_state, 0);
+    (void)jq_event_append(root, JQ_EVENT_MOVE, uuid, from_state, to_state, sizes.pdf + sizes.metadata);
+
+    (void)jq_ready_append(root_path, tenant, jq_state_default_level(to_state), uuid, sizes.pdf);
+    return JQ_OK;
+}
+
+jq_result_t jq_move(const char *root_path,
+                    const char *uuid,
+                    jq_state_t from_state,
+                    jq_state_t to_state) {
+    if (!root_path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_move_at(&root, uuid, from_state, to_state);
+}
+
+/*
+ * A hit in the status index is confirmed against the files before it is
+ * the answer, and a miss or a stale hit falls back to probing every state.
+ * With trust_index set the check is one access() of the pdf; callers about
+ * to act on the job pass 0 and get both files checked.
+ */
+static jq_result_t jq_status_at(const jq_root_t *root,
+                                const char *uuid,
+                                int trust_index,
+                                jq_state_t *state_out,
+                                int *locked_out) {
+    const char *root_path = root->path;
+    jq_state_t indexed_state;
+    int indexed_locked = 0;
+    if (jq_status_index_get(root_path, uuid, &indexed_state, &indexed_locked)) {
+        jq_file_t pdf;
+        jq_file_t metadata;
+        int present = 0;
+        if (jq_pair_paths(root, uuid, indexed_state, indexed_locked, &pdf, &metadata) == JQ_OK) {
+            if (trust_index) {
+                present = faccessat(pdf.dirfd, pdf.name, F_OK, 0) == 0;
+            } else if (jq_check_pair_exists(&pdf, &metadata, &present) != JQ_OK) {
+                present = 0;
+            }
+        }
+        if (present) {
+            *state_out = indexed_state;
+            *locked_out = indexed_locked;
+            return JQ_OK;
+        }
+    }
+
+    const jq_state_t states[] = {JQ_STATE_PRIORITY, JQ_STATE_JOBS, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        jq_file_t pdf;
+        jq_file_t metadata;
+        jq_result_t path_result = jq_pair_paths(root, uuid, states[i], 0, &pdf, &metadata);
+        if (path_result != JQ_OK) {
+            return path_result;
+        }
+
+        int present = 0;
+        jq_result_t check_result = jq_check_pair_exists(&pdf, &metadata, &present);
+        if (check_result != JQ_OK) {
+            return jq_status_archived(root_path, uuid, check_result, state_out, locked_out);
+        }
+        if (present) {
+            *state_out = states[i];
+            *locked_out = 0;
+            jq_status_index_set(root_path, uuid, states[i], 0);
+            return JQ_OK;
+        }
+
+        jq_result_t locked_result = jq_pair_paths(root, uuid, states[i], 1, &pdf, &metadata);
+        if (locked_result != JQ_OK) {
+            return locked_result;
+        }
+
+        present = 0;
+        check_result = jq_check_pair_exists(&pdf, &metadata, &present);
+        if (check_result != JQ_OK) {
+            return jq_status_archived(root_path, uuid, check_result, state_out, locked_out);
+        }
+        if (present) {
+            *state_out = states[i];
+            *locked_out = 1;
+            jq_status_index_set(root_path, uuid, states[i], 1);
+            return JQ_OK;
+        }
+    }
+
+    return jq_status_archived(root_path, uuid, JQ_ERR_NOT_FOUND, state_out, locked_out);
+}
+
+jq_result_t jq_status(const char *root_path,
+                      const char *uuid,
+                      jq_state_t *state_out,
+                      int *locked_out) {
+    if (!root_path || !uuid || !state_out || !locked_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_status_at(&root, uuid, 1, state_out, locked_out);
+}
+
+static int jq_has_suffix(const char *name, const char *suffix) {
+    if (!name || !suffix) {
+        return 0;
+    }
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    if (suffix_len > name_len) {
+        return 0;
+    }
+    return strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+static void jq_update_mtime(time_t mtime, time_t *oldest, time_t *newest) {
+    if (mtime <= 0) {
+        return;
+    }
+    if (*oldest == 0 || mtime < *oldest) {
+        *oldest = mtime;
+    }
+    if (*newest == 0 || mtime > *newest) {
+        *newest = mtime;
+    }
+}
+
+static int jq_build_dir_path(const char *root_path, const char *dir_name, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s", root_path, dir_name);
+    if (written < 0 || (size_t)written >= out_len) {
+        return 0;
+    }
+    return 1;
+}
+
+static int jq_build_entry_path(const char *dir_path, const char *name, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s", dir_path, name);
+    if (written < 0 || (size_t)written >= out_len) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Walks the files of a state directory and of any shard directories under
+ * it, so scans see the same jobs in flat, sharded and migrating roots. Job
+ * directories below the shards are walked too, and the files of a claimed
+ * one are reported with the .lock suffix they would carry as loose files.
+ * After jq_dir_iter_next returns a name, jq_dir_iter_dir/jq_dir_iter_path
+ * describe the directory holding it and jq_dir_iter_entry gives its name
+ * there.
+ */
+typedef struct {
+    DIR *dirs[4];
+    char paths[4][PATH_MAX];
+    int depth;
+    int job_depth;
+    int job_locked;
+    const char *entry;
+    char name[NAME_MAX + 8];
+} jq_dir_iter_t;
+
+static int jq_is_shard_name(const char *name) {
+    for (int i = 0; i < 2; ++i) {
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return name[2] == '\0';
+}
+
+static jq_result_t jq_dir_iter_open(jq_dir_iter_t *iter, const char *root_path, jq_state_t state) {
+    const char *dir_name = jq_state_dir(state);
+    if (!dir_name || !jq_build_dir_path(root_path, dir_name, iter->paths[0], sizeof(iter->paths[0]))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    iter->depth = 0;
+    iter->job_depth = -1;
+    iter->job_locked = 0;
+    iter->entry = NULL;
+    iter->dirs[0] = opendir(iter->paths[0]);
+    if (!iter->dirs[0]) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+static int jq_dir_iter_is_dir(jq_dir_iter_t *iter, const struct dirent *entry) {
+#if defined(_DIRENT_HAVE_D_TYPE)
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type == DT_DIR;
+    }
+#endif
+    struct stat st;
+    return fstatat(dirfd(iter->dirs[iter->depth]), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+           S_ISDIR(st.st_mode);
+}
+
+static int jq_dir_iter_descend(jq_dir_iter_t *iter, const char *name) {
+    char path[PATH_MAX];
+    if (!jq_build_entry_path(iter->paths[iter->depth], name, path, sizeof(path))) {
+        return 0;
+    }
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    iter->depth++;
+    iter->dirs[iter->depth] = dir;
+    memcpy(iter->paths[iter->depth], path, sizeof(path));
+    return 1;
+}
+
+static const char *jq_dir_iter_next(jq_dir_iter_t *iter) {
+    while (1) {
+        struct dirent *entry = readdir(iter->dirs[iter->depth]);
+        if (!entry) {
+            if (iter->depth == 0) {
+                return NULL;
+            }
+            if (iter->depth == iter->job_depth) {
+                iter->job_depth = -1;
+            }
+            closedir(iter->dirs[iter->depth--]);
+            continue;
+        }
+
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        if (iter->job_depth < 0) {
+            if (iter->depth < 2 && jq_is_shard_name(name)) {
+                (void)jq_dir_iter_descend(iter, name);
+                continue;
+            }
+            if (iter->depth == 2 && jq_dir_iter_is_dir(iter, entry)) {
+                int locked = jq_has_suffix(name, ".lock");
+                if (jq_dir_iter_descend(iter, name)) {
+                    iter->job_depth = iter->depth;
+                    iter->job_locked = locked;
+                }
+                continue;
+            }
+        }
+
+        iter->entry = name;
+        if (iter->job_depth >= 0 && iter->job_locked) {
+            int written = snprintf(iter->name, sizeof(iter->name), "%s.lock", name);
+            if (written < 0 || (size_t)written >= sizeof(iter->name)) {
+                continue;
+            }
+            return iter->name;
+        }
+        return name;
+    }
+}
+
+static DIR *jq_dir_iter_dir(jq_dir_iter_t *iter) {
+    return iter->dirs[iter->depth];
+}
+
+static const char *jq_dir_iter_path(const jq_dir_iter_t *iter) {
+    return iter->paths[iter->depth];
+}
+
+static const char *jq_dir_iter_entry(const jq_dir_iter_t *iter) {
+    return iter->entry;
+}
+
+static int jq_dir_iter_in_job(const jq_dir_iter_t *iter) {
+    return iter->job_depth >= 0;
+}
+
+/* Renames update ctime on the job's directory in the directory layout, on the file otherwise. */
+static int jq_dir_iter_stat_job(jq_dir_iter_t *iter, struct stat *st) {
+    if (iter->job_depth >= 0) {
+        return stat(iter->paths[iter->job_depth], st);
+    }
+    return fstatat(dirfd(jq_dir_iter_dir(iter)), iter->entry, st, 0);
+}
+
+static void jq_dir_iter_close(jq_dir_iter_t *iter) {
+    for (; iter->depth >= 0; --iter->depth) {
+        closedir(iter->dirs[iter->depth]);
+    }
+}
+
+/*
+ * Full-scan engine. Each directory is read in one pass with large
+ * getdents64 buffers (readdir elsewhere), d_type decides which entries are
+ * shard or job directories, and job files are stat'ed with fstatat relative
+ * to the directory's fd. Orphans are found by sorting the directory's job
+ * files by uuid and walking the groups, instead of probing each file's
+ * counterpart by path. Names follow jq_dir_iter: files of a claimed job
+ * directory are classified as if they carried .lock.
+ *
+ * Threads take directories from a shared pool: the four state directories
+ * to begin with, then the top-level shard directories each of those turns
+ * up, so a sharded root keeps every thread busy. An fsck scan also counts
+ * leftover temporary files and notes every job location that is incomplete
+ * or claimed, for jq_fsck to settle once the whole root has been read.
+ */
+#define JQ_SCAN_BUFFER_BYTES (256 * 1024)
+#define JQ_SCAN_THREADS 4
+#define JQ_SCAN_THREADS_MAX 32
+#define JQ_FSCK_GRACE_SECONDS 60
+
+typedef enum {
+    JQ_SCAN_PDF = 0,
+    JQ_SCAN_METADATA = 1,
+    JQ_SCAN_REPORT = 2,
+    JQ_SCAN_TEMP = 3
+} jq_scan_kind_t;
+
+typedef struct {
+    size_t name;
+    uint32_t base_len;
+    uint8_t kind;
+    uint8_t locked;
+} jq_scan_entry_t;
+
+/* Subdirectories are kept as a kind byte ('s' shard, 'j' job) followed by the name and its NUL. */
+typedef struct {
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    jq_scan_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *subdirs;
+    size_t subdirs_len;
+    size_t subdirs_cap;
+} jq_scan_dir_t;
+
+/* A state directory (empty shard) or one top-level shard directory below it. */
+typedef struct {
+    jq_state_t state;
+    char shard[3];
+} jq_scan_unit_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    jq_scan_unit_t *units;
+    size_t count;
+    size_t capacity;
+    size_t next;
+    size_t active;
+    int fan_out;
+    int failed;
+} jq_scan_pool_t;
+
+/* One location of a job for fsck to look at again; present has a bit per jq_scan_kind_t found there. */
+typedef struct {
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    uint8_t locked;
+    uint8_t present;
+    time_t ctime;
+} jq_fsck_finding_t;
+
+typedef struct {
+    const char *root_path;
+    jq_scan_pool_t *pool;
+    jq_state_t state;
+    jq_state_stats_t stats[JQ_STATE_ERROR + 1];
+    jq_scan_dir_t dirs[4];
+    char *buffer;
+    time_t job_ctime;
+    time_t oldest_mtime;
+    time_t newest_mtime;
+    time_t oldest_waiting_mtime;
+    const jq_fsck_options_t *fsck;
+    jq_fsck_report_t report;
+    jq_fsck_finding_t *findings;
+    size_t finding_count;
+    size_t finding_capacity;
+    jq_result_t result;
+} jq_scan_state_t;
+
+static const struct {
+    const char *suffix;
+    jq_scan_kind_t kind;
+    int locked;
+} jq_scan_suffixes[] = {
+    {".pdf.job.lock", JQ_SCAN_PDF, 1},
+    {".pdf.job", JQ_SCAN_PDF, 0},
+    {".metadata.job.lock", JQ_SCAN_METADATA, 1},
+    {".metadata.job", JQ_SCAN_METADATA, 0},
+    {".report.html.lock", JQ_SCAN_REPORT, 1},
+    {".report.html", JQ_SCAN_REPORT, 0}
+};
+
+/*
+ * Classifies name (plus .lock when in_locked_dir) and records it. Names that
+ * are not job files are skipped, except temporary files when keep_temp is set.
+ */
+static int jq_scan_dir_add(jq_scan_dir_t *dir, const char *name, int in_locked_dir, int keep_temp) {
+    size_t name_len = strlen(name);
+    char marked[NAME_MAX + 8];
+    const char *classified = name;
+    size_t classified_len = name_len;
+    if (in_locked_dir) {
+        int written = snprintf(marked, sizeof(marked), "%s.lock", name);
+        if (written < 0 || (size_t)written >= sizeof(marked)) {
+            return 1;
+        }
+        classified = marked;
+        classified_len = (size_t)written;
+    }
+
+    size_t match = 0;
+    for (; match < sizeof(jq_scan_suffixes) / sizeof(jq_scan_suffixes[0]); ++match) {
+        if (jq_has_suffix(classified, jq_scan_suffixes[match].suffix)) {
+            break;
+        }
+    }
+    jq_scan_kind_t kind = JQ_SCAN_TEMP;
+    size_t base_len = name_len;
+    int locked = in_locked_dir;
+    if (match < sizeof(jq_scan_suffixes) / sizeof(jq_scan_suffixes[0])) {
+        kind = jq_scan_suffixes[match].kind;
+        base_len = classified_len - strlen(jq_scan_suffixes[match].suffix);
+        locked = jq_scan_suffixes[match].locked;
+    } else if (!keep_temp || !strstr(name, ".tmp.")) {
+        return 1;
+    }
+
+    if (dir->count == dir->capacity) {
+        size_t capacity = dir->capacity ? dir->capacity * 2 : 1024;
+        jq_scan_entry_t *entries = realloc(dir->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            return 0;
+        }
+        dir->entries = entries;
+        dir->capacity = capacity;
+    }
+    if (dir->names_len + name_len + 1 > dir->names_cap) {
+        size_t capacity = dir->names_cap ? dir->names_cap * 2 : 64 * 1024;
+        while (capacity < dir->names_len + name_len + 1) {
+            capacity *= 2;
+        }
+        char *names = realloc(dir->names, capacity);
+        if (!names) {
+            return 0;
+        }
+        dir->names = names;
+        dir->names_cap = capacity;
+    }
+
+    jq_scan_entry_t *entry = &dir->entries[dir->count++];
+    entry->name = dir->names_len;
+    entry->base_len = (uint32_t)base_len;
+    entry->kind = (uint8_t)kind;
+    entry->locked = (uint8_t)locked;
+    memcpy(dir->names + dir->names_len, name, name_len + 1);
+    dir->names_len += name_len + 1;
+    return 1;
+}
+
+static int jq_scan_dir_add_subdir(jq_scan_dir_t *dir, char kind, const char *name) {
+    size_t name_len = strlen(name);
+    if (dir->subdirs_len + name_len + 2 > dir->subdirs_cap) {
+        size_t capacity = dir->subdirs_cap ? dir->subdirs_cap * 2 : 4096;
+        while (capacity < dir->subdirs_len + name_len + 2) {
+            capacity *= 2;
+        }
+        char *subdirs = realloc(dir->subdirs, capacity);
+        if (!subdirs) {
+            return 0;
+        }
+        dir->subdirs = subdirs;
+        dir->subdirs_cap = capacity;
+    }
+    dir->subdirs[dir->subdirs_len++] = kind;
+    memcpy(dir->subdirs + dir->subdirs_len, name, name_len + 1);
+    dir->subdirs_len += name_len + 1;
+    return 1;
+}
+
+static int jq_scan_pool_push(jq_scan_pool_t *pool, jq_state_t state, const char *shard) {
+    pthread_mutex_lock(&pool->lock);
+    int pushed = 1;
+    if (pool->count == pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : 64;
+        jq_scan_unit_t *units = realloc(pool->units, capacity * sizeof(*units));
+        if (units) {
+            pool->units = units;
+            pool->capacity = capacity;
+        } else {
+            pushed = 0;
+        }
+    }
+    if (pushed) {
+        jq_scan_unit_t *unit = &pool->units[pool->count++];
+        unit->state = state;
+        snprintf(unit->shard, sizeof(unit->shard), "%s", shard);
+        pthread_cond_signal(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return pushed;
+}
+
+/* Comparators read the name arena through this; qsort has no context argument. */
+static _Thread_local const char *jq_scan_sort_names;
+
+static int jq_scan_entry_compare(const void *left, const void *right) {
+    const jq_scan_entry_t *a = left;
+    const jq_scan_entry_t *b = right;
+    uint32_t common = a->base_len < b->base_len ? a->base_len : b->base_len;
+    int order = memcmp(jq_scan_sort_names + a->name, jq_scan_sort_names + b->name, common);
+    if (order != 0) {
+        return order;
+    }
+    if (a->base_len != b->base_len) {
+        return a->base_len < b->base_len ? -1 : 1;
+    }
+    if (a->locked != b->locked) {
+        return a->locked < b->locked ? -1 : 1;
+    }
+    return (int)a->kind - (int)b->kind;
+}
+
+/* Same uuid and same lock state: the files one job should have side by side. */
+static int jq_scan_same_job(const jq_scan_dir_t *dir, const jq_scan_entry_t *a, const jq_scan_entry_t *b) {
+    return a->base_len == b->base_len && a->locked == b->locked &&
+           memcmp(dir->names + a->name, dir->names + b->name, a->base_len) == 0;
+}
+
+static int jq_scan_add_finding(jq_scan_state_t *scan, const char *uuid, size_t uuid_len, int locked,
+                               unsigned int present, time_t ctime) {
+    if (uuid_len == 0 || uuid_len >= JQ_UUID_MAX) {
+        return 1;
+    }
+    if (scan->finding_count == scan->finding_capacity) {
+        size_t capacity = scan->finding_capacity ? scan->finding_capacity * 2 : 64;
+        jq_fsck_finding_t *findings = realloc(scan->findings, capacity * sizeof(*findings));
+        if (!findings) {
+            return 0;
+        }
+        scan->findings = findings;
+        scan->finding_capacity = capacity;
+    }
+    jq_fsck_finding_t *finding = &scan->findings[scan->finding_count++];
+    memcpy(finding->uuid, uuid, uuid_len);
+    finding->uuid[uuid_len] = '\0';
+    finding->state = scan->state;
+    finding->locked = (uint8_t)locked;
+    finding->present = (uint8_t)present;
+    finding->ctime = ctime;
+    return 1;
+}
+
+/* fsck: a temporary file nobody has touched for the grace period is left over from a copy that died. */
+static void jq_scan_temp(jq_scan_state_t *scan, int fd, const char *name, const struct stat *st) {
+    scan->report.temp_files++;
+    time_t touched = st->st_mtime > st->st_ctime ? st->st_mtime : st->st_ctime;
+    if (touched + (time_t)JQ_FSCK_GRACE_SECONDS > scan->fsck->now) {
+        scan->report.busy++;
+    } else if (scan->fsck->repair && unlinkat(fd, name, 0) == 0) {
+        scan->report.repaired++;
+    }
+}
+
+/* Stats and orphan counts for the job files of one directory, open as fd. */
+static jq_result_t jq_scan_dir_tally(jq_scan_state_t *scan, int fd, jq_scan_dir_t *dir) {
+    jq_state_stats_t *stats = &scan->stats[scan->state];
+    jq_scan_sort_names = dir->names;
+    if (dir->count > 1) {
+        qsort(dir->entries, dir->count, sizeof(*dir->entries), jq_scan_entry_compare);
+    }
+
+    size_t group = 0;
+    while (group < dir->count) {
+        size_t end = group + 1;
+        while (end < dir->count && jq_scan_same_job(dir, &dir->entries[group], &dir->entries[end])) {
+            end++;
+        }
+        int present[4] = {0, 0, 0, 0};
+        for (size_t i = group; i < end; ++i) {
+            present[dir->entries[i].kind] = 1;
+        }
+
+        time_t ctime = scan->job_ctime;
+        for (size_t i = group; i < end; ++i) {
+            const jq_scan_entry_t *entry = &dir->entries[i];
+            struct stat st;
+            if (fstatat(fd, dir->names + entry->name, &st, 0) != 0) {
+                if (errno == ENOENT) {
+                    continue;
+                }
+                return JQ_ERR_IO;
+            }
+            if (scan->fsck) {
+                scan->report.entries++;
+                if (st.st_ctime > ctime) {
+                    ctime = st.st_ctime;
+                }
+            }
+            if (entry->kind == JQ_SCAN_TEMP) {
+                jq_scan_temp(scan, fd, dir->names + entry->name, &st);
+                continue;
+            }
+            jq_update_mtime(st.st_mtime, &scan->oldest_mtime, &scan->newest_mtime);
+            unsigned long long bytes = (unsigned long long)st.st_size;
+            if (entry->kind == JQ_SCAN_PDF) {
+                if (entry->locked) {
+                    stats->pdf_locked++;
+                } else {
+                    stats->pdf_jobs++;
+                    if (scan->state == JQ_STATE_JOBS || scan->state == JQ_STATE_PRIORITY) {
+                        time_t ignored = 0;
+                        jq_update_mtime(st.st_mtime, &scan->oldest_waiting_mtime, &ignored);
+                    }
+                }
+                stats->pdf_bytes += bytes;
+                stats->orphan_pdf += !present[JQ_SCAN_METADATA];
+            } else if (entry->kind == JQ_SCAN_METADATA) {
+                *(entry->locked ? &stats->metadata_locked : &stats->metadata_jobs) += 1;
+                stats->metadata_bytes += bytes;
+                stats->orphan_metadata += !present[JQ_SCAN_PDF];
+            } else {
+                *(entry->locked ? &stats->report_locked : &stats->report_jobs) += 1;
+                stats->report_bytes += bytes;
+                stats->orphan_report += !present[JQ_SCAN_PDF];
+            }
+        }
+
+        const jq_scan_entry_t *first = &dir->entries[group];
+        int complete = present[JQ_SCAN_PDF] && present[JQ_SCAN_METADATA];
+        int claimed = first->locked && (scan->state == JQ_STATE_JOBS || scan->state == JQ_STATE_PRIORITY);
+        if (scan->fsck && first->kind != JQ_SCAN_TEMP && (!complete || claimed)) {
+            unsigned int mask = (unsigned int)present[JQ_SCAN_PDF] << JQ_SCAN_PDF |
+                                (unsigned int)present[JQ_SCAN_METADATA] << JQ_SCAN_METADATA |
+                                (unsigned int)present[JQ_SCAN_REPORT] << JQ_SCAN_REPORT;
+            if (!jq_scan_add_finding(scan, dir->names + first->name, first->base_len, first->locked, mask, ctime)) {
+                return JQ_ERR_IO;
+            }
+        }
+        group = end;
+    }
+    return JQ_OK;
+}
+
+/* Sorts one directory entry into shard or job directories to visit and job files to tally. */
+static int jq_scan_visit(jq_scan_state_t *scan, jq_scan_dir_t *dir, int fd, int depth, int in_job, int job_locked,
+                         const char *name, unsigned char type) {
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return 1;
+    }
+    if (!in_job) {
+        if (depth < 2 && jq_is_shard_name(name)) {
+            if (depth == 0 && scan->pool->fan_out) {
+                return jq_scan_pool_push(scan->pool, scan->state, name);
+            }
+            return jq_scan_dir_add_subdir(dir, 's', name);
+        }
+        if (depth == 2) {
+            int is_dir = type == DT_DIR;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (is_dir) {
+                return jq_scan_dir_add_subdir(dir, 'j', name);
+            }
+        }
+    }
+    return jq_scan_dir_add(dir, name, in_job && job_locked, scan->fsck != NULL);
+}
+
+#if defined(__linux__)
+struct jq_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/* Reads every entry of the directory open as fd before anything is stat'ed or descended into. */
+static jq_result_t jq_scan_read_dir(jq_scan_state_t *scan, jq_scan_dir_t *dir, int fd, int depth, int in_job,
+                                    int job_locked) {
+#if defined(__linux__)
+    while (1) {
+        long bytes = syscall(SYS_getdents64, fd, scan->buffer, JQ_SCAN_BUFFER_BYTES);
+        if (bytes < 0) {
+            return JQ_ERR_IO;
+        }
+        if (bytes == 0) {
+            return JQ_OK;
+        }
+        for (long offset = 0; offset < bytes;) {
+            const struct jq_dirent64 *entry = (const struct jq_dirent64 *)(scan->buffer + offset);
+            if (!jq_scan_visit(scan, dir, fd, depth, in_job, job_locked, entry->d_name, entry->d_type)) {
+                return JQ_ERR_IO;
+            }
+            offset += entry->d_reclen;
+        }
+    }
+#else
+    int dup_fd = dup(fd);
+    DIR *handle = dup_fd >= 0 ? fdopendir(dup_fd) : NULL;
+    if (!handle) {
+        if (dup_fd >= 0) {
+            close(dup_fd);
+        }
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = JQ_OK;
+    struct dirent *entry;
+    while (result == JQ_OK && (entry = readdir(handle)) != NULL) {
+#if defined(_DIRENT_HAVE_D_TYPE)
+        unsigned char type = entry->d_type;
+#else
+        unsigned char type = DT_UNKNOWN;
+#endif
+        if (!jq_scan_visit(scan, dir, fd, depth, in_job, job_locked, entry->d_name, type)) {
+            result = JQ_ERR_IO;
+        }
+    }
+    closedir(handle);
+    return result;
+#endif
+}
+
+static jq_result_t jq_scan_walk(jq_scan_state_t *scan, int fd, int depth, int in_job, int job_locked) {
+    jq_scan_dir_t *dir = &scan->dirs[depth];
+    dir->count = 0;
+    dir->names_len = 0;
+    dir->subdirs_len = 0;
+    jq_result_t result = jq_scan_read_dir(scan, dir, fd, depth, in_job, job_locked);
+    if (result == JQ_OK) {
+        result = jq_scan_dir_tally(scan, fd, dir);
+    }
+
+    /* Nested walks reuse the deeper slots, so this level's subdirectory list stays intact. */
+    for (size_t offset = 0; result == JQ_OK && offset < dir->subdirs_len;) {
+        char kind = dir->subdirs[offset];
+        const char *name = dir->subdirs + offset + 1;
+        offset += strlen(name) + 2;
+        if (depth + 1 >= (int)(sizeof(scan->dirs) / sizeof(scan->dirs[0]))) {
+            continue;
+        }
+        int child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (child < 0) {
+            continue;
+        }
+        if (kind == 'j') {
+            /* Claims rename the job's directory, so its ctime is the one that moves. */
+            struct stat st;
+            scan->job_ctime = fstat(child, &st) == 0 ? st.st_ctime : 0;
+            result = jq_scan_walk(scan, child, depth + 1, 1, jq_has_suffix(name, ".lock"));
+            scan->job_ctime = 0;
+        } else {
+            result = jq_scan_walk(scan, child, depth + 1, in_job, job_locked);
+        }
+        close(child);
+    }
+    return result;
+}
+
+static jq_result_t jq_scan_unit(jq_scan_state_t *scan, const jq_scan_unit_t *unit) {
+    char path[PATH_MAX];
+    char shard_path[PATH_MAX];
+    const char *dir_name = jq_state_dir(unit->state);
+    if (!dir_name || !jq_build_dir_path(scan->root_path, dir_name, path, sizeof(path)) ||
+        !jq_build_entry_path(path, unit->shard, shard_path, sizeof(shard_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int fd = open(unit->shard[0] ? shard_path : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    scan->state = unit->state;
+    jq_result_t result = jq_scan_walk(scan, fd, unit->shard[0] ? 1 : 0, 0, 0);
+    close(fd);
+    return result;
+}
+
+static void *jq_scan_worker(void *arg) {
+    jq_scan_state_t *scan = arg;
+    jq_scan_pool_t *pool = scan->pool;
+    scan->buffer = malloc(JQ_SCAN_BUFFER_BYTES);
+    scan->result = scan->buffer ? JQ_OK : JQ_ERR_IO;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->failed |= scan->result != JQ_OK;
+    while (!pool->failed) {
+        if (pool->next < pool->count) {
+            jq_scan_unit_t unit = pool->units[pool->next++];
+            pool->active++;
+            pthread_mutex_unlock(&pool->lock);
+            jq_result_t result = jq_scan_unit(scan, &unit);
+            pthread_mutex_lock(&pool->lock);
+            pool->active--;
+            /* A shard directory can be emptied and removed by a migration while the scan runs. */
+            if (result != JQ_OK && !(result == JQ_ERR_NOT_FOUND && unit.shard[0])) {
+                scan->result = result;
+                pool->failed = 1;
+            }
+            pthread_cond_broadcast(&pool->changed);
+        } else if (pool->active == 0) {
+            break;
+        } else {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void jq_scan_free(jq_scan_state_t *scans, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(scans[i].buffer);
+        free(scans[i].findings);
+        for (size_t j = 0; j < sizeof(scans[i].dirs) / sizeof(scans[i].dirs[0]); ++j) {
+            free(scans[i].dirs[j].names);
+            free(scans[i].dirs[j].entries);
+            free(scans[i].dirs[j].subdirs);
+        }
+    }
+    free(scans);
+}
+
+/*
+ * Scans the four state directories on up to threads threads, the calling
+ * one included; a thread that cannot be started only costs parallelism.
+ * On success *scans_out holds count_out per-thread results for the caller
+ * to merge and hand to jq_scan_free.
+ */
+static jq_result_t jq_scan_run(const char *root_path,
+                               unsigned int threads,
+                               const jq_fsck_options_t *fsck,
+                               jq_scan_state_t **scans_out,
+                               size_t *count_out) {
+    size_t count = threads > 0 ? threads : JQ_SCAN_THREADS;
+    if (count > JQ_SCAN_THREADS_MAX) {
+        count = JQ_SCAN_THREADS_MAX;
+    }
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    jq_scan_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.capacity = sizeof(states) / sizeof(states[0]);
+    pool.units = calloc(pool.capacity, sizeof(*pool.units));
+    pool.fan_out = count > 1;
+    jq_scan_state_t *scans = calloc(count, sizeof(*scans));
+    if (!pool.units || !scans) {
+        free(pool.units);
+        free(scans);
+        return JQ_ERR_IO;
+    }
+    for (size_t i = 0; i < pool.capacity; ++i) {
+        pool.units[pool.count++].state = states[i];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        scans[i].root_path = root_path;
+        scans[i].pool = &pool;
+        scans[i].fsck = fsck;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+
+    pthread_t workers[JQ_SCAN_THREADS_MAX];
+    size_t started = 0;
+    for (size_t i = 1; i < count; ++i) {
+        if (pthread_create(&workers[started], NULL, jq_scan_worker, &scans[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    jq_scan_worker(&scans[0]);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.units);
+
+    jq_result_t result = JQ_OK;
+    for (size_t i = 0; i <= started && result == JQ_OK; ++i) {
+        result = scans[i].result;
+    }
+    if (result != JQ_OK) {
+        jq_scan_free(scans, count);
+        return result;
+    }
+    *scans_out = scans;
+    *count_out = count;
+    return JQ_OK;
+}
+
+static void jq_state_stats_add(jq_state_stats_t *total, const jq_state_stats_t *part) {
+    total->pdf_jobs += part->pdf_jobs;
+    total->metadata_jobs += part->metadata_jobs;
+    total->report_jobs += part->report_jobs;
+    total->pdf_locked += part->pdf_locked;
+    total->metadata_locked += part->metadata_locked;
+    total->report_locked += part->report_locked;
+    total->orphan_pdf += part->orphan_pdf;
+    total->orphan_metadata += part->orphan_metadata;
+    total->orphan_report += part->orphan_report;
+    total->pdf_bytes += part->pdf_bytes;
+    total->metadata_bytes += part->metadata_bytes;
+    total->report_bytes += part->report_bytes;
+}
+
+static jq_result_t jq_scan_states(const char *root_path, unsigned int threads, jq_stats_t *stats_out) {
+    jq_scan_state_t *scans = NULL;
+    size_t count = 0;
+    jq_result_t result = jq_scan_run(root_path, threads, NULL, &scans, &count);
+    if (result != JQ_OK) {
+        return result;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t state = 0; state <= JQ_STATE_ERROR; ++state) {
+            jq_state_stats_add(&stats_out->states[state], &scans[i].stats[state]);
+        }
+        time_t ignored = 0;
+        jq_update_mtime(scans[i].oldest_mtime, &stats_out->oldest_mtime, &stats_out->newest_mtime);
+        jq_update_mtime(scans[i].newest_mtime, &stats_out->oldest_mtime, &stats_out->newest_mtime);
+        jq_update_mtime(scans[i].oldest_waiting_mtime, &stats_out->oldest_waiting_mtime, &ignored);
+    }
+    jq_scan_free(scans, count);
+    return JQ_OK;
+}
+
+static int jq_build_index_path(const char *root_path, const char *name, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s", root_path, JQ_INDEX_DIR, name);
+    if (written < 0 || (size_t)written >= out_len) {
+        return 0;
+    }
+    return 1;
+}
+
+static jq_result_t jq_ensure_index_dir(const char *root_path) {
+    char path[PATH_MAX];
+    int written = snprintf(path, sizeof(path), "%s/%s", root_path, JQ_INDEX_DIR);
+    if (written < 0 || (size_t)written >= sizeof(path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    return jq_ensure_dir(path);
+}
+
+/*
+ * Status index: an open-addressing hash table in .jq/status mapping each
+ * uuid to its state and lock bit, written on every transition so jq_status
+ * is one probe sequence through shared memory. Slots are claimed with a CAS
+ * and never freed; a slot being written reads as a miss, and a discarded
+ * job's slot is left as a tombstone that also reads as a miss. Any miss
+ * falls back to probing the state directories, which re-records what it
+ * finds.
+ *
+ * Each process keeps the table of every root it touches mapped. The table
+ * doubles by rehashing into a fresh file renamed over the old one, then
+ * sets retired in the old header; a process that sees the flag maps the
+ * file again. Updates hold a shared flock on status.lock and a grow holds
+ * it exclusively, so no update lands in a table while it is being copied.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    _Atomic uint32_t retired;
+    uint64_t capacity;
+    _Atomic uint64_t used;
+    unsigned char padding[32];
+} jq_status_header_t;
+
+typedef struct {
+    _Atomic uint32_t tag;
+    uint32_t hash;
+    char uuid[JQ_UUID_MAX];
+} jq_status_slot_t;
+
+typedef struct {
+    void *base;
+    size_t length;
+    jq_status_header_t *header;
+    jq_status_slot_t *slots;
+} jq_status_map_t;
+
+static int jq_status_index_path(const char *root_path, char *out, size_t out_len) {
+    return jq_build_index_path(root_path, JQ_STATUS_INDEX_FILE, out, out_len);
+}
+
+static uint32_t jq_status_tag(jq_state_t state, int locked) {
+    return JQ_STATUS_TAG_FIRST + ((uint32_t)state << 1) + (locked ? 1u : 0u);
+}
+
+static void jq_status_unmap(jq_status_map_t *map) {
+    if (map->base) {
+        munmap(map->base, map->length);
+        map->base = NULL;
+    }
+}
+
+static jq_result_t jq_status_map_fd(int fd, jq_status_map_t *map_out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(jq_status_header_t)) {
+        return JQ_ERR_IO;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+
+    jq_status_header_t *header = base;
+    uint64_t capacity = header->capacity;
+    if (header->magic != JQ_STATUS_INDEX_MAGIC || header->version != JQ_STATUS_INDEX_VERSION ||
+        header->slot_size != sizeof(jq_status_slot_t) || capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        (size_t)st.st_size < sizeof(jq_status_header_t) + capacity * sizeof(jq_status_slot_t)) {
+        munmap(base, (size_t)st.st_size);
+        return JQ_ERR_IO;
+    }
+    map_out->base = base;
+    map_out->length = (size_t)st.st_size;
+    map_out->header = header;
+    map_out->slots = (jq_status_slot_t *)((unsigned char *)base + sizeof(jq_status_header_t));
+    return JQ_OK;
+}
+
+static jq_result_t jq_status_map(const char *root_path, jq_status_map_t *map_out) {
+    char path[PATH_MAX];
+    if (!jq_status_index_path(root_path, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    jq_result_t result = jq_status_map_fd(fd, map_out);
+    close(fd);
+    return result;
+}
+
+/* Returns the slot holding uuid, or with insert set the free slot claimed for it; NULL when neither. */
+static jq_status_slot_t *jq_status_find(jq_status_map_t *map, const char *uuid, uint32_t hash, int insert) {
+    uint64_t mask = map->header->capacity - 1;
+    for (uint64_t probe = 0; probe < JQ_STATUS_MAX_PROBES && probe <= mask; ++probe) {
+        jq_status_slot_t *slot = &map->slots[(hash + probe) & mask];
+        uint32_t tag = atomic_load(&slot->tag);
+        if (tag == 0) {
+            if (!insert) {
+                return NULL;
+            }
+            uint32_t expected = 0;
+            if (atomic_compare_exchange_strong(&slot->tag, &expected, JQ_STATUS_TAG_BUSY)) {
+                slot->hash = hash;
+                snprintf(slot->uuid, sizeof(slot->uuid), "%s", uuid);
+                atomic_fetch_add(&map->header->used, 1);
+                return slot;
+            }
+            tag = expected;
+        }
+        if (tag != JQ_STATUS_TAG_BUSY && slot->hash == hash && strcmp(slot->uuid, uuid) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static jq_result_t jq_status_create(const char *root_path, const jq_status_map_t *old_map, uint64_t capacity) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_status_index_path(root_path, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, JQ_STATUS_INDEX_FILE ".tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_status_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JQ_STATUS_INDEX_MAGIC;
+    header.version = JQ_STATUS_INDEX_VERSION;
+    header.slot_size = (uint32_t)sizeof(jq_status_slot_t);
+    header.capacity = capacity;
+    atomic_init(&header.retired, 0);
+    atomic_init(&header.used, 0);
+
+    jq_status_map_t map = {0};
+    jq_result_t result = jq_write_all(fd, &header, sizeof(header));
+    if (result == JQ_OK && ftruncate(fd, (off_t)(sizeof(header) + capacity * sizeof(jq_status_slot_t))) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK) {
+        result = jq_status_map_fd(fd, &map);
+    }
+    close(fd);
+
+    if (result == JQ_OK && old_map) {
+        for (uint64_t i = 0; i < old_map->header->capacity; ++i) {
+            const jq_status_slot_t *old_slot = &old_map->slots[i];
+            uint32_t tag = atomic_load(&old_slot->tag);
+            if (tag < JQ_STATUS_TAG_FIRST || tag == JQ_STATUS_TAG_GONE) {
+                continue;
+            }
+            jq_status_slot_t *slot = jq_status_find(&map, old_slot->uuid, old_slot->hash, 1);
+            if (slot) {
+                atomic_store(&slot->tag, tag);
+            }
+        }
+    }
+    jq_status_unmap(&map);
+
+    /* A new table only takes the place of a missing one; a grown one replaces its source. */
+    if (result == JQ_OK && old_map && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK && !old_map && link(tmp_path, path) != 0 && errno != EEXIST) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK || !old_map) {
+        unlink(tmp_path);
+    }
+    return result;
+}
+
+/*
+ * One cached root. holders counts this process's updates in flight so the
+ * shared flock on lock_fd, which all threads share, is taken by the first
+ * and dropped by the last.
+ */
+typedef struct {
+    char root_path[PATH_MAX];
+    jq_status_map_t map;
+    int lock_fd;
+    pthread_mutex_t holders_lock;
+    unsigned int holders;
+} jq_status_cache_t;
+
+/* Lookups and updates hold the rwlock shared; remapping or growing a table holds it exclusively. */
+static pthread_rwlock_t jq_status_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t jq_status_cache_once = PTHREAD_ONCE_INIT;
+static jq_status_cache_t jq_status_caches[JQ_STATUS_CACHE_ROOTS];
+static size_t jq_status_cache_next;
+
+/* A forked child shares the parent's lock descriptors, and unlocking one would drop the parent's flock. */
+static void jq_status_cache_after_fork(void) {
+    for (size_t i = 0; i < JQ_STATUS_CACHE_ROOTS; ++i) {
+        if (jq_status_caches[i].lock_fd >= 0) {
+            close(jq_status_caches[i].lock_fd);
+            jq_status_caches[i].lock_fd = -1;
+        }
+        jq_status_caches[i].holders = 0;
+    }
+}
+
+static void jq_status_cache_setup(void) {
+    for (size_t i = 0; i < JQ_STATUS_CACHE_ROOTS; ++i) {
+        jq_status_caches[i].lock_fd = -1;
+        pthread_mutex_init(&jq_status_caches[i].holders_lock, NULL);
+    }
+    pthread_atfork(NULL, NULL, jq_status_cache_after_fork);
+}
+
+static jq_status_cache_t *jq_status_cache_find(const char *root_path) {
+    for (size_t i = 0; i < JQ_STATUS_CACHE_ROOTS; ++i) {
+        if (jq_status_caches[i].root_path[0] != '\0' && strcmp(jq_status_caches[i].root_path, root_path) == 0) {
+            return &jq_status_caches[i];
+        }
+    }
+    return NULL;
+}
+
+static int jq_status_cache_current(const jq_status_cache_t *cache) {
+    return cache && cache->map.base && atomic_load(&cache->map.header->retired) == 0;
+}
+
+/* Maps the table afresh; the caller holds the rwlock exclusively. */
+static jq_status_cache_t *jq_status_cache_load(const char *root_path, int create) {
+    jq_status_cache_t *cache = jq_status_cache_find(root_path);
+    if (jq_status_cache_current(cache)) {
+        return cache;
+    }
+    if (!cache) {
+        cache = &jq_status_caches[jq_status_cache_next++ % JQ_STATUS_CACHE_ROOTS];
+        if (cache->lock_fd >= 0) {
+            close(cache->lock_fd);
+            cache->lock_fd = -1;
+        }
+        snprintf(cache->root_path, sizeof(cache->root_path), "%s", root_path);
+    }
+    jq_status_unmap(&cache->map);
+
+    jq_result_t result = jq_status_map(root_path, &cache->map);
+    if (result == JQ_ERR_NOT_FOUND && create && jq_status_create(root_path, NULL, JQ_STATUS_INITIAL_SLOTS) == JQ_OK) {
+        result = jq_status_map(root_path, &cache->map);
+    }
+    char lock_path[PATH_MAX];
+    if (result == JQ_OK && cache->lock_fd < 0 &&
+        (!jq_build_index_path(root_path, JQ_STATUS_INDEX_FILE ".lock", lock_path, sizeof(lock_path)) ||
+         (cache->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        jq_status_unmap(&cache->map);
+        return NULL;
+    }
+    return cache;
+}
+
+/* Returns the root's current table with the rwlock held shared, or NULL with nothing held. */
+static jq_status_cache_t *jq_status_cache_acquire(const char *root_path, int create) {
+    pthread_once(&jq_status_cache_once, jq_status_cache_setup);
+    if (strlen(root_path) >= PATH_MAX) {
+        return NULL;
+    }
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        pthread_rwlock_rdlock(&jq_status_cache_lock);
+        jq_status_cache_t *cache = jq_status_cache_find(root_path);
+        if (jq_status_cache_current(cache)) {
+            return cache;
+        }
+        pthread_rwlock_unlock(&jq_status_cache_lock);
+
+        pthread_rwlock_wrlock(&jq_status_cache_lock);
+        cache = jq_status_cache_load(root_path, create);
+        pthread_rwlock_unlock(&jq_status_cache_lock);
+        if (!cache) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void jq_status_cache_release(void) {
+    pthread_rwlock_unlock(&jq_status_cache_lock);
+}
+
+static int jq_status_cache_hold(jq_status_cache_t *cache) {
+    int ok = 1;
+    pthread_mutex_lock(&cache->holders_lock);
+    if (cache->holders == 0 && flock(cache->lock_fd, LOCK_SH) != 0) {
+        ok = 0;
+    } else {
+        cache->holders++;
+    }
+    pthread_mutex_unlock(&cache->holders_lock);
+    return ok;
+}
+
+static void jq_status_cache_unhold(jq_status_cache_t *cache) {
+    pthread_mutex_lock(&cache->holders_lock);
+    if (--cache->holders == 0) {
+        (void)flock(cache->lock_fd, LOCK_UN);
+    }
+    pthread_mutex_unlock(&cache->holders_lock);
+}
+
+/* Doubles the table unless another writer already did; waits out every update in flight. */
+static void jq_status_cache_grow(const char *root_path, uint64_t capacity) {
+    pthread_rwlock_wrlock(&jq_status_cache_lock);
+    jq_status_cache_t *cache = jq_status_cache_load(root_path, 0);
+    if (cache && cache->map.header->capacity == capacity && flock(cache->lock_fd, LOCK_EX) == 0) {
+        jq_status_map_t current = {0};
+        /* Another process may have grown it first; only the table that is still live is copied. */
+        if (jq_status_map(root_path, &current) == JQ_OK && current.header->capacity == capacity &&
+            jq_status_create(root_path, &current, capacity * 2) == JQ_OK) {
+            atomic_store(&current.header->retired, 1);
+        }
+        jq_status_unmap(&current);
+        (void)flock(cache->lock_fd, LOCK_UN);
+        (void)jq_status_cache_load(root_path, 0);
+    }
+    pthread_rwlock_unlock(&jq_status_cache_lock);
+}
+
+static void jq_status_index_store(const char *root_path, const char *uuid, uint32_t tag, int insert) {
+    size_t uuid_len = strlen(uuid);
+    if (uuid_len == 0 || uuid_len >= JQ_UUID_MAX) {
+        return;
+    }
+
+    uint32_t hash = jq_shard_hash(uuid);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        jq_status_cache_t *cache = jq_status_cache_acquire(root_path, insert);
+        if (!cache) {
+            return;
+        }
+        if (!jq_status_cache_hold(cache)) {
+            jq_status_cache_release();
+            return;
+        }
+        /* A grow that finished before the flock was granted leaves this table retired. */
+        int retired = atomic_load(&cache->map.header->retired) != 0;
+        jq_status_slot_t *slot = retired ? NULL : jq_status_find(&cache->map, uuid, hash, insert);
+        if (slot) {
+            atomic_store(&slot->tag, tag);
+        }
+        uint64_t capacity = cache->map.header->capacity;
+        int full = atomic_load(&cache->map.header->used) * 4 > capacity * 3;
+        jq_status_cache_unhold(cache);
+        jq_status_cache_release();
+
+        /* Grow at three quarters full, or when a probe sequence ran out. */
+        if (!retired && (full || (!slot && insert))) {
+            jq_status_cache_grow(root_path, capacity);
+        }
+        if (slot || (!retired && !insert)) {
+            return;
+        }
+    }
+}
+
+static void jq_status_index_set(const char *root_path, const char *uuid, jq_state_t state, int locked) {
+    jq_status_index_store(root_path, uuid, jq_status_tag(state, locked), 1);
+}
+
+/* Leaves a tombstone for a job that no longer exists, so lookups fall back to probing. */
+static void jq_status_index_clear(const char *root_path, const char *uuid) {
+    jq_status_index_store(root_path, uuid, JQ_STATUS_TAG_GONE, 0);
+}
+
+/*
+ * Drops the table for fsck --repair, which may have found jobs moved behind
+ * the library's back. Every process mapping it sees it retired, and the
+ * next update starts a fresh one.
+ */
+static void jq_status_index_reset(const char *root_path) {
+    char path[PATH_MAX];
+    char lock_path[PATH_MAX];
+    if (!jq_status_index_path(root_path, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, JQ_STATUS_INDEX_FILE ".lock", lock_path, sizeof(lock_path))) {
+        return;
+    }
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        return;
+    }
+    jq_status_map_t map = {0};
+    if (flock(lock_fd, LOCK_EX) == 0 && jq_status_map(root_path, &map) == JQ_OK) {
+        atomic_store(&map.header->retired, 1);
+        (void)unlink(path);
+        jq_status_unmap(&map);
+    }
+    close(lock_fd);
+}
+
+static int jq_status_index_get(const char *root_path, const char *uuid, jq_state_t *state_out, int *locked_out) {
+    if (strlen(uuid) >= JQ_UUID_MAX) {
+        return 0;
+    }
+    jq_status_cache_t *cache = jq_status_cache_acquire(root_path, 0);
+    if (!cache) {
+        return 0;
+    }
+    jq_status_slot_t *slot = jq_status_find(&cache->map, uuid, jq_shard_hash(uuid), 0);
+    uint32_t tag = slot ? atomic_load(&slot->tag) : 0;
+    jq_status_cache_release();
+
+    uint32_t code = tag - JQ_STATUS_TAG_FIRST;
+    if (tag < JQ_STATUS_TAG_FIRST || (code >> 1) > JQ_STATE_ERROR) {
+        return 0;
+    }
+    *state_out = (jq_state_t)(code >> 1);
+    *locked_out = (int)(code & 1u);
+    return 1;
+}
+
+static jq_result_t jq_counter_map(const char *root_path, const char *name, jq_sequence_file_t **counter_out) {
+    char path[PATH_MAX];
+    if (!jq_build_index_path(root_path, name, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 && errno == ENOENT && jq_ensure_index_dir(root_path) == JQ_OK) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+    }
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(jq_sequence_file_t) && ftruncate(fd, sizeof(jq_sequence_file_t)) != 0)) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+
+    jq_sequence_file_t *counter =
+        mmap(NULL, sizeof(jq_sequence_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (counter == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+    *counter_out = counter;
+    return JQ_OK;
+}
+
+static jq_result_t jq_counter_reserve(const char *root_path,
+                                      const char *name,
+                                      uint64_t count,
+                                      uint64_t *first_out) {
+    jq_sequence_file_t *counter = NULL;
+    jq_result_t result = jq_counter_map(root_path, name, &counter);
+    if (result != JQ_OK) {
+        return result;
+    }
+    *first_out = atomic_fetch_add(&counter->last, count) + 1;
+    munmap(counter, sizeof(jq_sequence_file_t));
+    return JQ_OK;
+}
+
+/* The last value handed out, without reserving one; 0 if the counter was never used. */
+static uint64_t jq_counter_peek(const char *root_path, const char *name) {
+    char path[PATH_MAX];
+    uint64_t last = 0;
+    if (!jq_build_index_path(root_path, name, path, sizeof(path))) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    if (pread(fd, &last, sizeof(last), offsetof(jq_sequence_file_t, last)) != (ssize_t)sizeof(last)) {
+        last = 0;
+    }
+    close(fd);
+    return last;
+}
+
+static jq_result_t jq_sequence_reserve(const char *root_path, uint64_t count, uint64_t *first_out) {
+    return jq_counter_reserve(root_path, "sequence", count, first_out);
+}
+
+static int jq_tenant_name_valid(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= JQ_TENANT_NAME_MAX || name[0] == '.') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = (unsigned char)name[i];
+        if (!isalnum(ch) && ch != '-' && ch != '_' && ch != '.') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Map the tenant table. Creating it takes the flock and leaves it held in
+ * *fd_out so the caller can append a slot; otherwise the descriptor is closed
+ * and fd_out may be NULL. A root without a table has no tenants.
+ */
+static jq_result_t jq_tenants_map(const char *root_path, int create, int *fd_out, jq_tenant_file_t **file_out) {
+    char path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_TENANTS_FILE, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0 && errno == ENOENT && create && jq_ensure_index_dir(root_path) == JQ_OK) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+    }
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    if (create && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+
+    struct stat st;
+    jq_result_t result = JQ_OK;
+    if (fstat(fd, &st) != 0) {
+        result = JQ_ERR_IO;
+    } else if ((size_t)st.st_size < sizeof(jq_tenant_file_t)) {
+        if (!create) {
+            result = JQ_ERR_NOT_FOUND;
+        } else if (ftruncate(fd, sizeof(jq_tenant_file_t)) != 0) {
+            result = JQ_ERR_IO;
+        }
+    }
+    jq_tenant_file_t *file = MAP_FAILED;
+    if (result == JQ_OK) {
+        file = mmap(NULL, sizeof(jq_tenant_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (file == MAP_FAILED) {
+            result = JQ_ERR_IO;
+        }
+    }
+    if (result == JQ_OK && create && file->magic == 0) {
+        /* version is written last: readers ignore the table until the untagged slot is set up. */
+        atomic_store(&file->slots[0].weight, 1);
+        atomic_store(&file->count, 1);
+        file->magic = JQ_TENANTS_MAGIC;
+        atomic_thread_fence(memory_order_release);
+        file->version = JQ_TENANTS_VERSION;
+    }
+    if (result == JQ_OK && (file->magic != JQ_TENANTS_MAGIC || file->version != JQ_TENANTS_VERSION)) {
+        munmap(file, sizeof(jq_tenant_file_t));
+        result = JQ_ERR_NOT_FOUND;
+    }
+
+    if (result != JQ_OK || !create || !fd_out) {
+        close(fd);
+        fd = -1;
+    }
+    if (result != JQ_OK) {
+        return result;
+    }
+    if (fd_out) {
+        *fd_out = fd;
+    }
+    *file_out = file;
+    return JQ_OK;
+}
+
+static void jq_tenants_unmap(jq_tenant_file_t *file) {
+    if (file) {
+        munmap(file, sizeof(jq_tenant_file_t));
+    }
+}
+
+static uint32_t jq_tenants_count(const jq_tenant_file_t *file) {
+    uint32_t count = atomic_load(&file->count);
+    return count < JQ_TENANT_MAX ? count : JQ_TENANT_MAX;
+}
+
+/* Slot of a tenant, appending one on first use. */
+static jq_result_t jq_tenant_index(const char *root_path, const char *name, int *index_out) {
+    if (!jq_tenant_name_valid(name)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_tenant_file_t *file = NULL;
+    jq_result_t result = jq_tenants_map(root_path, 0, NULL, &file);
+    if (result == JQ_OK) {
+        uint32_t count = jq_tenants_count(file);
+        for (uint32_t i = 1; i < count; ++i) {
+            if (strncmp(file->slots[i].name, name, JQ_TENANT_NAME_MAX) == 0) {
+                *index_out = (int)i;
+                jq_tenants_unmap(file);
+                return JQ_OK;
+            }
+        }
+        jq_tenants_unmap(file);
+    } else if (result != JQ_ERR_NOT_FOUND) {
+        return result;
+    }
+
+    int fd = -1;
+    result = jq_tenants_map(root_path, 1, &fd, &file);
+    if (result != JQ_OK) {
+        return result;
+    }
+    /* Look again under the lock: another submitter may have added the tenant meanwhile. */
+    uint32_t count = jq_tenants_count(file);
+    result = JQ_ERR_INVALID_ARGUMENT;
+    for (uint32_t i = 1; i < count; ++i) {
+        if (strncmp(file->slots[i].name, name, JQ_TENANT_NAME_MAX) == 0) {
+            *index_out = (int)i;
+            result = JQ_OK;
+            break;
+        }
+    }
+    if (result != JQ_OK && count < JQ_TENANT_MAX) {
+        jq_tenant_slot_t *slot = &file->slots[count];
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+        atomic_store(&slot->weight, 1);
+        atomic_store(&file->count, count + 1);
+        *index_out = (int)count;
+        result = JQ_OK;
+    }
+    close(fd);
+    jq_tenants_unmap(file);
+    return result;
+}
+
+jq_result_t jq_tenant_configure(const char *root_path,
+                                const char *tenant,
+                                unsigned int max_in_flight,
+                                unsigned int weight) {
+    if (!root_path || !tenant || weight == 0 || weight > JQ_TENANT_WEIGHT_MAX) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int index = 0;
+    jq_result_t result = jq_tenant_index(root_path, tenant, &index);
+    if (result != JQ_OK) {
+        return result;
+    }
+    jq_tenant_file_t *file = NULL;
+    result = jq_tenants_map(root_path, 0, NULL, &file);
+    if (result != JQ_OK) {
+        return result;
+    }
+    atomic_store(&file->slots[index].max_in_flight, max_in_flight);
+    atomic_store(&file->slots[index].weight, weight);
+    jq_tenants_unmap(file);
+    return JQ_OK;
+}
+
+/* Hand back a claimed job's in-flight slot once its lease is gone. */
+static void jq_tenant_settle(const char *root_path, int tenant) {
+    jq_tenant_file_t *file = NULL;
+    if (tenant <= 0 || tenant >= JQ_TENANT_MAX || jq_tenants_map(root_path, 0, NULL, &file) != JQ_OK) {
+        return;
+    }
+    atomic_fetch_sub(&file->slots[tenant].in_flight, 1);
+    jq_tenants_unmap(file);
+}
+
+static const int64_t jq_size_class_limits[JQ_SIZE_CLASS_COUNT - 1] = {
+    (int64_t)1 << 20,
+    (int64_t)16 << 20,
+    (int64_t)256 << 20
+};
+
+static int jq_size_class(int64_t bytes) {
+    int size_class = 0;
+    while (size_class < JQ_SIZE_CLASS_COUNT - 1 && bytes >= jq_size_class_limits[size_class]) {
+        size_class++;
+    }
+    return size_class;
+}
+
+/* Smallest PDF a class can hold. */
+static uint64_t jq_size_class_floor(int size_class) {
+    return size_class > 0 ? (uint64_t)jq_size_class_limits[size_class - 1] : 0;
+}
+
+/* tenant is a tenant index, or JQ_SIZE_LANE(class) for a size-class lane of the untagged jobs. */
+static int jq_ready_log_path(const char *root_path, int tenant, int level, char *out, size_t out_len) {
+    if (level < 0 || level >= JQ_LEVEL_COUNT || tenant < JQ_SIZE_LANE(JQ_SIZE_CLASS_COUNT - 1) ||
+        tenant >= JQ_TENANT_MAX) {
+        return 0;
+    }
+    char name[64];
+    const char *state_dir = jq_state_dir(jq_level_state(level));
+    int written = tenant > 0   ? snprintf(name, sizeof(name), "%s.%d.t%d.ready", state_dir, level, tenant)
+                  : tenant < 0 ? snprintf(name, sizeof(name), "%s.%d.s%d.ready", state_dir, level, -1 - tenant)
+                               : snprintf(name, sizeof(name), "%s.%d.ready", state_dir, level);
+    if (written < 0 || (size_t)written >= sizeof(name)) {
+        return 0;
+    }
+    return jq_build_index_path(root_path, name, out, out_len);
+}
+
+/* .jq/<state><suffix>: the per-queue lock and rescan marker files. */
+static int jq_ready_state_file(const char *root_path, jq_state_t state, const char *suffix, char *out, size_t out_len) {
+    char name[64];
+    int written = snprintf(name, sizeof(name), "%s%s", jq_state_dir(state), suffix);
+    if (written < 0 || (size_t)written >= sizeof(name)) {
+        return 0;
+    }
+    return jq_build_index_path(root_path, name, out, out_len);
+}
+
+/* Returns the locked descriptor, or -1; close it to unlock. */
+static int jq_ready_lock(const char *root_path, jq_state_t state, int operation) {
+    char path[PATH_MAX];
+    if (!jq_ready_state_file(root_path, state, JQ_READY_LOCK_SUFFIX, path, sizeof(path))) {
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && jq_ensure_index_dir(root_path) == JQ_OK) {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (fd >= 0 && flock(fd, operation) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void jq_ready_mark_rescan(const char *root_path, jq_state_t state) {
+    char path[PATH_MAX];
+    if (!jq_ready_state_file(root_path, state, JQ_READY_RESCAN_SUFFIX, path, sizeof(path))) {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static int jq_ready_rescan_due(const char *root_path, jq_state_t state) {
+    char path[PATH_MAX];
+    return jq_ready_state_file(root_path, state, JQ_READY_RESCAN_SUFFIX, path, sizeof(path)) &&
+           access(path, F_OK) == 0;
+}
+
+static void jq_ready_clear_rescan(const char *root_path, jq_state_t state) {
+    char path[PATH_MAX];
+    if (jq_ready_state_file(root_path, state, JQ_READY_RESCAN_SUFFIX, path, sizeof(path))) {
+        unlink(path);
+    }
+}
+
+static int jq_ready_fill_record(jq_ready_record_t *record, const char *uuid, size_t uuid_len) {
+    if (uuid_len == 0 || uuid_len >= JQ_READY_UUID_MAX) {
+        return 0;
+    }
+    memset(record, 0, sizeof(*record));
+    record->magic = JQ_READY_RECORD_MAGIC;
+    record->uuid_len = (uint32_t)uuid_len;
+    memcpy(record->uuid, uuid, uuid_len);
+    return 1;
+}
+
+static int jq_ready_record_valid(const jq_ready_record_t *record) {
+    return record->magic == JQ_READY_RECORD_MAGIC && record->uuid_len > 0 &&
+           record->uuid_len < JQ_READY_UUID_MAX;
+}
+
+static void jq_ready_fill_header(jq_ready_header_t *header) {
+    memset(header, 0, sizeof(*header));
+    header->magic = JQ_READY_MAGIC;
+    header->version = JQ_READY_VERSION;
+    header->record_size = (uint32_t)sizeof(jq_ready_record_t);
+    atomic_init(&header->head, 0);
+}
+
+static jq_result_t jq_ready_write_log(const char *log_path,
+                                      const jq_ready_record_t *records,
+                                      size_t count) {
+    char tmp_path[PATH_MAX];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", log_path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+
+    jq_ready_header_t header;
+    jq_ready_fill_header(&header);
+
+    jq_result_t result = jq_write_all(fd, &header, sizeof(header));
+    if (result == JQ_OK && count > 0) {
+        result = jq_write_all(fd, records, count * sizeof(*records));
+    }
+    if (result == JQ_OK && fsync(fd) != 0) {
+        result = JQ_ERR_IO;
+    }
+    close(fd);
+
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+        return result;
+    }
+    if (rename(tmp_path, log_path) != 0) {
+        unlink(tmp_path);
+        return JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+/*
+ * Create an empty lane so the first job at a level keeps it. The log is
+ * published with link() so a racing creator or appender never loses records;
+ * jobs already in the directory are still picked up by the next rebuild.
+ */
+static jq_result_t jq_ready_create_log(const char *root_path, const char *log_path) {
+    char tmp_path[PATH_MAX];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", log_path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_ready_header_t header;
+    jq_ready_fill_header(&header);
+    jq_result_t result = jq_write_all(fd, &header, sizeof(header));
+    close(fd);
+    if (result == JQ_OK && link(tmp_path, log_path) != 0 && errno != EEXIST) {
+        result = JQ_ERR_IO;
+    }
+    unlink(tmp_path);
+    return result;
+}
+
+/*
+ * The size-class mirror is only appended to while it exists: a missing one
+ * makes the next size-aware claim rebuild every lane of the state, which
+ * also picks up the jobs it never saw.
+ */
+static void jq_ready_mirror(const char *root_path, int level, const jq_ready_record_t *record) {
+    char log_path[PATH_MAX];
+    if (!jq_ready_log_path(root_path, JQ_SIZE_LANE(jq_size_class(record->bytes)), level, log_path, sizeof(log_path))) {
+        return;
+    }
+    int fd = open(log_path, O_WRONLY | O_APPEND);
+    if (fd >= 0) {
+        (void)jq_write_all(fd, record, sizeof(*record));
+        close(fd);
+    }
+}
+
+/*
+ * bytes is the PDF size, which picks the job's size-class lane. A job that
+ * cannot be indexed marks its queue for a rescan, so claims still find it.
+ */
+static jq_result_t jq_ready_append(const char *root_path, int tenant, int level, const char *uuid, int64_t bytes) {
+    char log_path[PATH_MAX];
+    if (!jq_ready_log_path(root_path, tenant, level, log_path, sizeof(log_path))) {
+        return JQ_OK;
+    }
+    jq_state_t state = jq_level_state(level);
+
+    jq_ready_record_t record;
+    if (!jq_ready_fill_record(&record, uuid, strlen(uuid))) {
+        jq_ready_mark_rescan(root_path, state);
+        return JQ_OK;
+    }
+    record.bytes = bytes;
+
+    int lock_fd = jq_ready_lock(root_path, state, LOCK_SH);
+    if (lock_fd < 0) {
+        jq_ready_mark_rescan(root_path, state);
+        return JQ_ERR_IO;
+    }
+    int fd = open(log_path, O_WRONLY | O_APPEND);
+    if (fd < 0 && errno == ENOENT && jq_ready_create_log(root_path, log_path) == JQ_OK) {
+        fd = open(log_path, O_WRONLY | O_APPEND);
+    }
+    jq_result_t result = fd >= 0 ? jq_sequence_reserve(root_path, 1, &record.seq) : JQ_ERR_IO;
+    if (result == JQ_OK) {
+        record.enqueued_at = (int64_t)time(NULL);
+        /* A single O_APPEND write keeps records whole even with concurrent appenders. */
+        result = jq_write_all(fd, &record, sizeof(record));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (result == JQ_OK && tenant == 0) {
+        jq_ready_mirror(root_path, level, &record);
+    }
+    close(lock_fd);
+    if (result != JQ_OK) {
+        jq_ready_mark_rescan(root_path, state);
+    } else if (tenant == 0) {
+        jq_ring_publish(root_path, level, record.uuid, record.uuid_len);
+    }
+    return result;
+}
+
+typedef struct {
+    void *base;
+    size_t length;
+    jq_ready_header_t *header;
+    const jq_ready_record_t *records;
+    uint64_t count;
+} jq_ready_map_t;
+
+static jq_result_t jq_ready_map(const char *root_path, int tenant, int level, jq_ready_map_t *map_out) {
+    char log_path[PATH_MAX];
+    if (!jq_ready_log_path(root_path, tenant, level, log_path, sizeof(log_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = open(log_path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+    if ((size_t)st.st_size < sizeof(jq_ready_header_t)) {
+        close(fd);
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+
+    jq_ready_header_t *header = base;
+    if (header->magic != JQ_READY_MAGIC || header->version != JQ_READY_VERSION ||
+        header->record_size != sizeof(jq_ready_record_t)) {
+        munmap(base, length);
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    map_out->base = base;
+    map_out->length = length;
+    map_out->header = header;
+    map_out->records = (const jq_ready_record_t *)((unsigned char *)base + sizeof(jq_ready_header_t));
+    map_out->count = (uint64_t)((length - sizeof(jq_ready_header_t)) / sizeof(jq_ready_record_t));
+    return JQ_OK;
+}
+
+static void jq_ready_unmap(jq_ready_map_t *map) {
+    munmap(map->base, map->length);
+}
+
+static size_t jq_ring_length(uint32_t capacity) {
+    return sizeof(jq_ring_file_t) + (size_t)JQ_LEVEL_COUNT * capacity * sizeof(jq_ring_slot_t);
+}
+
+static int jq_ring_capacity_valid(uint32_t capacity) {
+    return capacity >= 2 && capacity <= JQ_RING_MAX_CAPACITY && (capacity & (capacity - 1)) == 0;
+}
+
+static jq_ring_slot_t *jq_ring_slot(jq_ring_file_t *ring, int level, uint64_t pos) {
+    jq_ring_slot_t *slots = (jq_ring_slot_t *)(ring + 1);
+    return &slots[(size_t)level * ring->capacity + (size_t)(pos & (ring->capacity - 1))];
+}
+
+/* Maps .jq/ready.ring relative to dirfd (AT_FDCWD for a full path); NULL when the root has none. */
+static jq_ring_file_t *jq_ring_map_at(int dirfd, const char *path) {
+    int fd = openat(dirfd, path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(jq_ring_file_t)) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    jq_ring_file_t *ring = base;
+    if (ring->magic != JQ_RING_MAGIC || ring->version != JQ_RING_VERSION ||
+        ring->slot_size != sizeof(jq_ring_slot_t) || !jq_ring_capacity_valid(ring->capacity) ||
+        jq_ring_length(ring->capacity) != (size_t)st.st_size) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    return ring;
+}
+
+static jq_ring_file_t *jq_ring_map(const char *root_path) {
+    char path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_RING_FILE, path, sizeof(path))) {
+        return NULL;
+    }
+    return jq_ring_map_at(AT_FDCWD, path);
+}
+
+static void jq_ring_unmap(jq_ring_file_t *ring) {
+    if (ring) {
+        munmap(ring, jq_ring_length(ring->capacity));
+    }
+}
+
+/* Returns 0 when the lane is full (or a crashed claimer left a slot unreleased). */
+static int jq_ring_push(jq_ring_file_t *ring, int level, const char *uuid, size_t uuid_len) {
+    jq_ring_lane_t *lane = &ring->lanes[level];
+    uint64_t pos = atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed);
+    jq_ring_slot_t *slot;
+    while (1) {
+        slot = jq_ring_slot(ring, level, pos);
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lane->enqueue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    slot->uuid_len = (uint32_t)uuid_len;
+    memcpy(slot->uuid, uuid, uuid_len);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+typedef enum {
+    JQ_RING_POPPED = 0,
+    JQ_RING_EMPTY = 1,
+    JQ_RING_BUSY = 2
+} jq_ring_pop_t;
+
+/*
+ * Takes the oldest uuid of a lane with one CAS. JQ_RING_BUSY means the head
+ * slot is reserved but not yet published (or its producer died), or holds a
+ * uuid too long for the caller; either way the logs are the place to look.
+ */
+static jq_ring_pop_t jq_ring_pop(jq_ring_file_t *ring, int level, char *uuid_out, size_t uuid_out_len) {
+    jq_ring_lane_t *lane = &ring->lanes[level];
+    uint64_t pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+    jq_ring_slot_t *slot;
+    while (1) {
+        slot = jq_ring_slot(ring, level, pos);
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - (pos + 1));
+        if (diff == 0) {
+            if (slot->uuid_len == 0 || slot->uuid_len >= uuid_out_len || slot->uuid_len >= JQ_READY_UUID_MAX) {
+                return JQ_RING_BUSY;
+            }
+            if (atomic_compare_exchange_weak_explicit(&lane->dequeue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed) > pos ? JQ_RING_BUSY
+                                                                                         : JQ_RING_EMPTY;
+        } else {
+            pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    memcpy(uuid_out, slot->uuid, slot->uuid_len);
+    uuid_out[slot->uuid_len] = '\0';
+    atomic_store_explicit(&slot->sequence, pos + ring->capacity, memory_order_release);
+    return JQ_RING_POPPED;
+}
+
+static int jq_ring_idle(jq_ring_file_t *ring) {
+    if (atomic_load(&ring->dirty) != 0) {
+        return 0;
+    }
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        if (atomic_load(&ring->lanes[level].enqueue_pos) != atomic_load(&ring->lanes[level].dequeue_pos)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* A rebuild that raced this push retired the file; publish into its successor too. */
+static void jq_ring_publish(const char *root_path, int level, const char *uuid, size_t uuid_len) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        jq_ring_file_t *ring = jq_ring_map(root_path);
+        if (!ring) {
+            return;
+        }
+        if (!jq_ring_push(ring, level, uuid, uuid_len)) {
+            atomic_fetch_or(&ring->dirty, 1u << level);
+        }
+        int retired = atomic_load(&ring->retired) != 0;
+        jq_ring_unmap(ring);
+        if (!retired) {
+            return;
+        }
+    }
+}
+
+static void jq_ring_mark_dirty(const char *root_path, jq_state_t state) {
+    jq_ring_file_t *ring = jq_ring_map(root_path);
+    if (!ring) {
+        return;
+    }
+    int first = jq_state_first_level(state);
+    for (int level = first; level < first + JQ_LEVELS_PER_STATE; ++level) {
+        atomic_fetch_or(&ring->dirty, 1u << level);
+    }
+    jq_ring_unmap(ring);
+}
+
+/*
+ * Writes a fresh ring holding what the untagged logs still have queued and
+ * renames it into place. Lanes whose backlog does not fit start dirty.
+ */
+static jq_result_t jq_ring_create(const char *root_path, uint32_t capacity) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_RING_FILE, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, JQ_RING_FILE ".tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    size_t length = jq_ring_length(capacity);
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)length) == 0) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        unlink(tmp_path);
+        return JQ_ERR_IO;
+    }
+
+    jq_ring_file_t *ring = base;
+    ring->magic = JQ_RING_MAGIC;
+    ring->version = JQ_RING_VERSION;
+    ring->capacity = capacity;
+    ring->slot_size = (uint32_t)sizeof(jq_ring_slot_t);
+    atomic_init(&ring->retired, 0);
+    atomic_init(&ring->dirty, 0);
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        atomic_init(&ring->lanes[level].enqueue_pos, 0);
+        atomic_init(&ring->lanes[level].dequeue_pos, 0);
+        for (uint64_t pos = 0; pos < capacity; ++pos) {
+            atomic_init(&jq_ring_slot(ring, level, pos)->sequence, pos);
+        }
+
+        jq_ready_map_t map;
+        if (jq_ready_map(root_path, 0, level, &map) != JQ_OK) {
+            continue;
+        }
+        for (uint64_t head = atomic_load(&map.header->head); head < map.count; ++head) {
+            const jq_ready_record_t *record = &map.records[head];
+            if (!jq_ready_record_valid(record) || !jq_ring_push(ring, level, record->uuid, record->uuid_len)) {
+                atomic_fetch_or(&ring->dirty, 1u << level);
+                break;
+            }
+        }
+        jq_ready_unmap(&map);
+    }
+    munmap(base, length);
+
+    jq_ring_file_t *old = jq_ring_map_at(AT_FDCWD, path);
+    jq_result_t result = rename(tmp_path, path) == 0 ? JQ_OK : JQ_ERR_IO;
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+    } else if (old) {
+        atomic_store(&old->retired, 1);
+    }
+    jq_ring_unmap(old);
+    return result;
+}
+
+/* Rebuilds an existing ring at its current capacity; roots without one are left alone. */
+static jq_result_t jq_ring_rebuild(const char *root_path) {
+    jq_ring_file_t *ring = jq_ring_map(root_path);
+    if (!ring) {
+        return JQ_OK;
+    }
+    uint32_t capacity = ring->capacity;
+    jq_ring_unmap(ring);
+    return jq_ring_create(root_path, capacity);
+}
+
+jq_result_t jq_ring_enable(const char *root_path, unsigned int capacity) {
+    if (!root_path) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (capacity == 0) {
+        capacity = JQ_RING_DEFAULT_CAPACITY;
+    }
+    if (!jq_ring_capacity_valid((uint32_t)capacity)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    return jq_ring_create(root_path, (uint32_t)capacity);
+}
+
+jq_result_t jq_ring_disable(const char *root_path) {
+    char path[PATH_MAX];
+    if (!root_path || !jq_build_index_path(root_path, JQ_RING_FILE, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_ring_file_t *old = jq_ring_map_at(AT_FDCWD, path);
+    if (unlink(path) != 0) {
+        jq_ring_unmap(old);
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    if (old) {
+        atomic_store(&old->retired, 1);
+    }
+    jq_ring_unmap(old);
+    return JQ_OK;
+}
+
+typedef struct {
+    jq_ready_record_t record;
+    struct timespec mtime;
+    int tenant;
+    int level;
+} jq_ready_candidate_t;
+
+static int jq_ready_candidate_compare(const void *left, const void *right) {
+    const jq_ready_candidate_t *a = left;
+    const jq_ready_candidate_t *b = right;
+    if (a->mtime.tv_sec != b->mtime.tv_sec) {
+        return a->mtime.tv_sec < b->mtime.tv_sec ? -1 : 1;
+    }
+    if (a->mtime.tv_nsec != b->mtime.tv_nsec) {
+        return a->mtime.tv_nsec < b->mtime.tv_nsec ? -1 : 1;
+    }
+    return strcmp(a->record.uuid, b->record.uuid);
+}
+
+/* Lane by lane (tenant, then level), each in sequence order. */
+static int jq_ready_candidate_lane_compare(const void *left, const void *right) {
+    const jq_ready_candidate_t *a = left;
+    const jq_ready_candidate_t *b = right;
+    if (a->tenant != b->tenant) {
+        return a->tenant < b->tenant ? -1 : 1;
+    }
+    if (a->level != b->level) {
+        return a->level < b->level ? -1 : 1;
+    }
+    if (a->record.seq != b->record.seq) {
+        return a->record.seq < b->record.seq ? -1 : 1;
+    }
+    return 0;
+}
+
+static int jq_ready_candidate_uuid_compare(const void *left, const void *right) {
+    const jq_ready_candidate_t *a = left;
+    const jq_ready_candidate_t *b = right;
+    return strcmp(a->record.uuid, b->record.uuid);
+}
+
+static int jq_ready_candidate_push(jq_ready_candidate_t **items, size_t *count, size_t *capacity) {
+    if (*count == *capacity) {
+        size_t next_capacity = *capacity ? *capacity * 2 : 64;
+        jq_ready_candidate_t *resized = realloc(*items, next_capacity * sizeof(**items));
+        if (!resized) {
+            return 0;
+        }
+        *items = resized;
+        *capacity = next_capacity;
+    }
+    memset(&(*items)[*count], 0, sizeof(**items));
+    (*count)++;
+    return 1;
+}
+
+/* Lanes per level: the untagged one plus one per tenant. */
+static int jq_ready_tenant_count(const char *root_path) {
+    jq_tenant_file_t *file = NULL;
+    if (jq_tenants_map(root_path, 0, NULL, &file) != JQ_OK) {
+        return 1;
+    }
+    int count = (int)jq_tenants_count(file);
+    jq_tenants_unmap(file);
+    return count;
+}
+
+/*
+ * The tenant whose lane still holds a queued job, so a move keeps it in that
+ * tenant's lanes; 0 when no tenant lane names it. Roots without tenants
+ * never map a log here.
+ */
+static int jq_ready_pending_tenant(const char *root_path, jq_state_t state, const char *uuid) {
+    int tenants = jq_ready_tenant_count(root_path);
+    if (tenants <= 1) {
+        return 0;
+    }
+    size_t uuid_len = strlen(uuid);
+    if (uuid_len == 0 || uuid_len >= JQ_READY_UUID_MAX) {
+        return 0;
+    }
+    int first = jq_state_first_level(state);
+    for (int lane = JQ_LEVELS_PER_STATE; lane < tenants * JQ_LEVELS_PER_STATE; ++lane) {
+        int tenant = lane / JQ_LEVELS_PER_STATE;
+        jq_ready_map_t map;
+        if (jq_ready_map(root_path, tenant, first + lane % JQ_LEVELS_PER_STATE, &map) != JQ_OK) {
+            continue;
+        }
+        uint64_t head = atomic_load(&map.header->head);
+        for (uint64_t i = head; i < map.count && jq_ready_record_valid(&map.records[i]); ++i) {
+            if (map.records[i].uuid_len == uuid_len && memcmp(map.records[i].uuid, uuid, uuid_len) == 0) {
+                jq_ready_unmap(&map);
+                return tenant;
+            }
+        }
+        jq_ready_unmap(&map);
+    }
+    return 0;
+}
+
+/*
+ * Records still pending in the lanes of a state, sorted by uuid, so a rebuild
+ * can keep each job in the lane and position it was enqueued at.
+ */
+static jq_result_t jq_ready_load_pending(const char *root_path,
+                                         jq_state_t state,
+                                         int tenants,
+                                         jq_ready_candidate_t **pending_out,
+                                         size_t *count_out) {
+    jq_ready_candidate_t *pending = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int first = jq_state_first_level(state);
+    for (int lane = 0; lane < tenants * JQ_LEVELS_PER_STATE; ++lane) {
+        int tenant = lane / JQ_LEVELS_PER_STATE;
+        int level = first + lane % JQ_LEVELS_PER_STATE;
+        jq_ready_map_t map;
+        if (jq_ready_map(root_path, tenant, level, &map) != JQ_OK) {
+            continue;
+        }
+        /* Stop at a torn record; whatever follows it is found by the directory scan. */
+        uint64_t head = atomic_load(&map.header->head);
+        for (uint64_t i = head; i < map.count && jq_ready_record_valid(&map.records[i]); ++i) {
+            if (!jq_ready_candidate_push(&pending, &count, &capacity)) {
+                jq_ready_unmap(&map);
+                free(pending);
+                return JQ_ERR_IO;
+            }
+            pending[count - 1].record = map.records[i];
+            pending[count - 1].record.uuid[JQ_READY_UUID_MAX - 1] = '\0';
+            pending[count - 1].tenant = tenant;
+            pending[count - 1].level = level;
+        }
+        jq_ready_unmap(&map);
+    }
+    if (count > 1) {
+        qsort(pending, count, sizeof(*pending), jq_ready_candidate_uuid_compare);
+    }
+    *pending_out = pending;
+    *count_out = count;
+    return JQ_OK;
+}
+
+/*
+ * Rescan a queue directory into its lanes. Jobs still pending in some lane
+ * keep that lane and their sequence number; jobs the logs do not know about
+ * (placed by hand, or lost with a torn log) go to the state's default level,
+ * untagged. A PDF without its metadata is not a job yet and is left out.
+ * replace rewrites every lane of the state, otherwise only unknown jobs are
+ * appended.
+ */
+static jq_result_t jq_ready_rescan(const char *root_path,
+                                   jq_state_t state,
+                                   int replace,
+                                   size_t *indexed_out,
+                                   int *unindexed_out) {
+    jq_ready_candidate_t *pending = NULL;
+    size_t pending_count = 0;
+    int tenants = jq_ready_tenant_count(root_path);
+    jq_result_t result = jq_ready_load_pending(root_path, state, tenants, &pending, &pending_count);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    jq_dir_iter_t iter;
+    result = jq_dir_iter_open(&iter, root_path, state);
+    if (result != JQ_OK) {
+        free(pending);
+        return result;
+    }
+
+    jq_ready_candidate_t *candidates = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t unknown = 0;
+    const char *name;
+    while ((name = jq_dir_iter_next(&iter)) != NULL) {
+        if (!jq_has_suffix(name, ".pdf.job")) {
+            continue;
+        }
+        size_t base_len = strlen(name) - strlen(".pdf.job");
+        if (base_len == 0 || base_len >= JQ_READY_UUID_MAX) {
+            *unindexed_out = 1;
+            continue;
+        }
+
+        char metadata_name[JQ_READY_UUID_MAX + sizeof(".metadata.job")];
+        snprintf(metadata_name, sizeof(metadata_name), "%.*s.metadata.job", (int)base_len, name);
+        if (faccessat(dirfd(jq_dir_iter_dir(&iter)), metadata_name, F_OK, 0) != 0) {
+            continue;
+        }
+
+        jq_ready_candidate_t key;
+        jq_ready_fill_record(&key.record, name, base_len);
+        const jq_ready_candidate_t *known =
+            pending_count > 0
+                ? bsearch(&key, pending, pending_count, sizeof(*pending), jq_ready_candidate_uuid_compare)
+                : NULL;
+        if (known && !replace) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(jq_dir_iter_dir(&iter)), jq_dir_iter_entry(&iter), &st, 0) != 0) {
+            continue;
+        }
+        if (!jq_ready_candidate_push(&candidates, &count, &capacity)) {
+            result = JQ_ERR_IO;
+            break;
+        }
+        jq_ready_candidate_t *candidate = &candidates[count - 1];
+        if (known) {
+            candidate->record = known->record;
+            candidate->tenant = known->tenant;
+            candidate->level = known->level;
+        } else {
+            candidate->record = key.record;
+            candidate->record.enqueued_at = (int64_t)st.st_mtime;
+            candidate->level = jq_state_default_level(state);
+            unknown++;
+        }
+        candidate->record.bytes = (int64_t)st.st_size;
+        candidate->mtime = st.st_mtim;
+    }
+    jq_dir_iter_close(&iter);
+    free(pending);
+
+    /* Unknown jobs get fresh sequence numbers in submission order, after every known one. */
+    if (result == JQ_OK && count > 1) {
+        qsort(candidates, count, sizeof(*candidates), jq_ready_candidate_compare);
+    }
+    if (result == JQ_OK && unknown > 0) {
+        uint64_t next_seq = 0;
+        result = jq_sequence_reserve(root_path, unknown, &next_seq);
+        for (size_t i = 0; result == JQ_OK && i < count; ++i) {
+            if (candidates[i].record.seq == 0) {
+                candidates[i].record.seq = next_seq++;
+            }
+        }
+    }
+    if (result == JQ_OK && count > 1) {
+        qsort(candidates, count, sizeof(*candidates), jq_ready_candidate_lane_compare);
+    }
+
+    jq_ready_record_t *records = NULL;
+    if (result == JQ_OK && count > 0) {
+        records = malloc(count * sizeof(*records));
+        if (!records) {
+            result = JQ_ERR_IO;
+        }
+    }
+    if (result == JQ_OK) {
+        result = jq_ensure_index_dir(root_path);
+    }
+
+    int first = jq_state_first_level(state);
+    size_t next = 0;
+    for (int lane = 0; result == JQ_OK && lane < tenants * JQ_LEVELS_PER_STATE; ++lane) {
+        int tenant = lane / JQ_LEVELS_PER_STATE;
+        int level = first + lane % JQ_LEVELS_PER_STATE;
+        size_t lane_count = 0;
+        while (next < count && candidates[next].tenant == tenant && candidates[next].level == level) {
+            records[lane_count++] = candidates[next++].record;
+        }
+        if (!replace && lane_count == 0) {
+            continue;
+        }
+
+        char log_path[PATH_MAX];
+        if (!jq_ready_log_path(root_path, tenant, level, log_path, sizeof(log_path))) {
+            result = JQ_ERR_INVALID_ARGUMENT;
+            break;
+        }
+        /* Tenants only get lanes at the levels they submit to. */
+        if (tenant > 0 && lane_count == 0 && access(log_path, F_OK) != 0) {
+            continue;
+        }
+        int fd = replace ? -1 : open(log_path, O_WRONLY | O_APPEND);
+        if (fd >= 0) {
+            result = jq_write_all(fd, records, lane_count * sizeof(*records));
+            close(fd);
+        } else {
+            result = jq_ready_write_log(log_path, records, lane_count);
+        }
+    }
+
+    /* The size-class mirrors of the untagged lanes, from the same candidates (still in lane order). */
+    for (int lane = 0; result == JQ_OK && lane < JQ_LEVELS_PER_STATE * JQ_SIZE_CLASS_COUNT; ++lane) {
+        int level = first + lane / JQ_SIZE_CLASS_COUNT;
+        int size_class = lane % JQ_SIZE_CLASS_COUNT;
+        size_t lane_count = 0;
+        for (size_t i = 0; i < count && candidates[i].tenant == 0; ++i) {
+            if (candidates[i].level == level && jq_size_class(candidates[i].record.bytes) == size_class) {
+                records[lane_count++] = candidates[i].record;
+            }
+        }
+        if (!replace && lane_count == 0) {
+            continue;
+        }
+
+        char log_path[PATH_MAX];
+        if (!jq_ready_log_path(root_path, JQ_SIZE_LANE(size_class), level, log_path, sizeof(log_path))) {
+            result = JQ_ERR_INVALID_ARGUMENT;
+            break;
+        }
+        int fd = replace ? -1 : open(log_path, O_WRONLY | O_APPEND);
+        if (fd >= 0) {
+            result = jq_write_all(fd, records, lane_count * sizeof(*records));
+            close(fd);
+        } else if (replace) {
+            result = jq_ready_write_log(log_path, records, lane_count);
+        }
+    }
+    free(candidates);
+    free(records);
+
+    if (result == JQ_OK) {
+        *indexed_out = count;
+        if (count > 0) {
+            jq_ring_mark_dirty(root_path, state);
+        }
+    }
+    return result;
+}
+
+/*
+ * Rescan holding the state's ready lock exclusive, so appends wait until the
+ * lanes they write to have been replaced. The marker is cleared first, so a
+ * failed append racing the scan marks the queue again; jobs too long for a
+ * record can only be found by scanning, so the marker stays while any are
+ * queued.
+ */
+static jq_result_t jq_ready_rebuild_locked(const char *root_path,
+                                           jq_state_t state,
+                                           int replace,
+                                           size_t *indexed_out,
+                                           int *unindexed_out) {
+    jq_ready_clear_rescan(root_path, state);
+    int unindexed = 0;
+    jq_result_t result = jq_ready_rescan(root_path, state, replace, indexed_out, &unindexed);
+    if (unindexed || (result != JQ_OK && result != JQ_ERR_NOT_FOUND)) {
+        jq_ready_mark_rescan(root_path, state);
+    }
+    *unindexed_out |= unindexed;
+    return result;
+}
+
+static jq_result_t jq_ready_rebuild(const char *root_path,
+                                    jq_state_t state,
+                                    int replace,
+                                    size_t *indexed_out,
+                                    int *unindexed_out) {
+    int lock_fd = jq_ready_lock(root_path, state, LOCK_EX);
+    if (lock_fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = jq_ready_rebuild_locked(root_path, state, replace, indexed_out, unindexed_out);
+    close(lock_fd);
+    return result;
+}
+
+/*
+ * A lane past JQ_READY_COMPACT_RECORDS is rewritten while claims still find
+ * work in it, so a queue that never drains does not grow its logs forever.
+ * Only one claimer compacts: the others skip it while the lock is held, and
+ * the lane is measured again under the lock.
+ */
+static void jq_ready_compact(const char *root_path, int tenant, int level) {
+    jq_state_t state = jq_level_state(level);
+    int lock_fd = jq_ready_lock(root_path, state, LOCK_EX | LOCK_NB);
+    if (lock_fd < 0) {
+        return;
+    }
+    char log_path[PATH_MAX];
+    struct stat st;
+    if (jq_ready_log_path(root_path, tenant, level, log_path, sizeof(log_path)) && stat(log_path, &st) == 0 &&
+        (size_t)st.st_size >= sizeof(jq_ready_header_t) + JQ_READY_COMPACT_RECORDS * sizeof(jq_ready_record_t)) {
+        size_t indexed = 0;
+        int unindexed = 0;
+        (void)jq_ready_rebuild_locked(root_path, state, 1, &indexed, &unindexed);
+    }
+    close(lock_fd);
+}
+
+/*
+ * Appends the unlocked jobs of both queues that no lane holds any more:
+ * records consumed by a claimer that failed or died before its rename. Run
+ * by the reaper and fsck; a job whose claim is still in flight may be
+ * appended twice, and the second record is skipped when its rename fails.
+ */
+static void jq_ready_reindex(const char *root_path) {
+    const jq_state_t states[] = {JQ_STATE_PRIORITY, JQ_STATE_JOBS};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        size_t indexed = 0;
+        int unindexed = 0;
+        (void)jq_ready_rebuild(root_path, states[i], 0, &indexed, &unindexed);
+    }
+}
+
+static jq_result_t jq_claim_pair(const jq_root_t *root, const char *uuid, jq_state_t state) {
+    jq_file_t pdf_src;
+    jq_file_t metadata_src;
+    jq_file_t pdf_locked;
+    jq_file_t metadata_locked;
+
+    jq_result_t src_paths = jq_pair_paths(root, uuid, state, 0, &pdf_src, &metadata_src);
+    if (src_paths != JQ_OK) {
+        return src_paths;
+    }
+
+    jq_result_t locked_paths = jq_pair_paths(root, uuid, state, 1, &pdf_locked, &metadata_locked);
+    if (locked_paths != JQ_OK) {
+        return locked_paths;
+    }
+
+    if (faccessat(metadata_src.dirfd, metadata_src.name, F_OK, 0) != 0) {
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    jq_file_t src_dir;
+    jq_file_t locked_dir;
+    if (pdf_src.job_dir && metadata_src.job_dir && pdf_locked.job_dir && jq_parent_file(&pdf_src, &src_dir) &&
+        jq_parent_file(&pdf_locked, &locked_dir)) {
+        jq_result_t dir_lock = jq_rename(&src_dir, &locked_dir);
+        if (dir_lock == JQ_OK) {
+            jq_status_index_set(root->path, uuid, state, 1);
+        }
+        return dir_lock;
+    }
+
+    /* Split pairs are claimed under the journal lock, so a replay never sees one half locked. */
+    jq_journal_t journal;
+    jq_result_t hold = jq_journal_hold(root, &journal);
+    if (hold != JQ_OK) {
+        return hold;
+    }
+    jq_result_t pdf_lock = jq_rename(&pdf_src, &pdf_locked);
+    if (pdf_lock != JQ_OK) {
+        jq_journal_close(&journal);
+        return pdf_lock;
+    }
+
+    jq_result_t metadata_lock = jq_rename(&metadata_src, &metadata_locked);
+    if (metadata_lock != JQ_OK) {
+        jq_rename(&pdf_locked, &pdf_src);
+        jq_remove_job_dir(&pdf_locked);
+        jq_journal_close(&journal);
+        return metadata_lock;
+    }
+    jq_journal_close(&journal);
+    jq_remove_job_dir(&pdf_src);
+
+    jq_status_index_set(root->path, uuid, state, 1);
+    return JQ_OK;
+}
+
+typedef enum {
+    JQ_READY_CLAIMED = 0,
+    JQ_READY_PENDING = 1,
+    JQ_READY_SKIPPED = 2,
+    JQ_READY_DRAINED = 3,
+    JQ_READY_UNUSABLE = 4
+} jq_ready_status_t;
+
+static jq_ready_status_t jq_ready_peek(const char *root_path,
+                                       int tenant,
+                                       int level,
+                                       uint64_t *seq_out,
+                                       int64_t *enqueued_at_out,
+                                       uint64_t *records_out) {
+    *records_out = 0;
+    jq_ready_map_t map;
+    if (jq_ready_map(root_path, tenant, level, &map) != JQ_OK) {
+        return JQ_READY_UNUSABLE;
+    }
+
+    *records_out = map.count;
+    jq_ready_status_t status = JQ_READY_DRAINED;
+    uint64_t head = atomic_load(&map.header->head);
+    if (head < map.count) {
+        const jq_ready_record_t *record = &map.records[head];
+        if (jq_ready_record_valid(record)) {
+            *seq_out = record->seq;
+            *enqueued_at_out = record->enqueued_at;
+            status = JQ_READY_PENDING;
+        } else {
+            status = JQ_READY_UNUSABLE;
+        }
+    }
+    jq_ready_unmap(&map);
+    return status;
+}
+
+/*
+ * Consume records from the head of a ready log until max_claims jobs are
+ * claimed, the log is drained, or max_records records have been consumed
+ * (0 means no limit). Runs of records are reserved with a single CAS so a
+ * batch claim pays for the mapping once. A head whose PDF is larger than
+ * max_bytes (0 means no limit) is left in place and reported as skipped.
+ * uuids_out holds max_claims buffers of uuid_out_len bytes each.
+ */
+static jq_result_t jq_claim_from_log(const jq_root_t *root,
+                                     int tenant,
+                                     int level,
+                                     size_t max_claims,
+                                     size_t max_records,
+                                     uint64_t max_bytes,
+                                     char *uuids_out,
+                                     size_t uuid_out_len,
+                                     size_t *claimed_out,
+                                     jq_ready_status_t *status_out,
+                                     uint64_t *records_out) {
+    *claimed_out = 0;
+    *status_out = JQ_READY_UNUSABLE;
+    *records_out = 0;
+
+    jq_ready_map_t map;
+    jq_result_t map_result = jq_ready_map(root->path, tenant, level, &map);
+    if (map_result != JQ_OK) {
+        return map_result;
+    }
+    *records_out = map.count;
+
+    jq_result_t result = JQ_ERR_NOT_FOUND;
+    size_t claimed = 0;
+    size_t consumed = 0;
+    while (1) {
+        if (claimed == max_claims) {
+            *status_out = JQ_READY_CLAIMED;
+            break;
+        }
+        if (max_records > 0 && consumed == max_records) {
+            *status_out = JQ_READY_SKIPPED;
+            break;
+        }
+        uint64_t head = atomic_load(&map.header->head);
+        if (head >= map.count) {
+            *status_out = JQ_READY_DRAINED;
+            break;
+        }
+
+        size_t wanted = max_claims - claimed;
+        if (max_records > 0 && wanted > max_records - consumed) {
+            wanted = max_records - consumed;
+        }
+        if ((uint64_t)wanted > map.count - head) {
+            wanted = (size_t)(map.count - head);
+        }
+        size_t run = 0;
+        while (run < wanted && jq_ready_record_valid(&map.records[head + run]) &&
+               (size_t)map.records[head + run].uuid_len < uuid_out_len &&
+               (max_bytes == 0 || (uint64_t)map.records[head + run].bytes <= max_bytes)) {
+            run++;
+        }
+        if (run == 0) {
+            if (jq_ready_record_valid(&map.records[head]) && max_bytes > 0 &&
+                (uint64_t)map.records[head].bytes > max_bytes) {
+                *status_out = JQ_READY_SKIPPED;
+            } else if (jq_ready_record_valid(&map.records[head])) {
+                if (claimed == 0) {
+                    result = JQ_ERR_INVALID_ARGUMENT;
+                }
+                *status_out = JQ_READY_CLAIMED;
+            }
+            /* Otherwise a torn append: let the caller rebuild the log from the directory. */
+            break;
+        }
+        if (!atomic_compare_exchange_weak(&map.header->head, &head, head + run)) {
+            continue;
+        }
+        consumed += run;
+
+        jq_result_t claim_result = JQ_OK;
+        for (size_t i = 0; i < run; ++i) {
+            const jq_ready_record_t *record = &map.records[head + i];
+            char *uuid_out = uuids_out + claimed * uuid_out_len;
+            memcpy(uuid_out, record->uuid, record->uuid_len);
+            uuid_out[record->uuid_len] = '\0';
+
+            claim_result = jq_claim_pair(root, uuid_out, jq_level_state(level));
+            if (claim_result == JQ_OK) {
+                claimed++;
+            } else if (claim_result != JQ_ERR_NOT_FOUND) {
+                /* The rest of this run is off the log now: have the next drained pass rescan for it. */
+                jq_ready_mark_rescan(root->path, jq_level_state(level));
+                break;
+            }
+        }
+        if (claim_result != JQ_OK && claim_result != JQ_ERR_NOT_FOUND) {
+            if (claimed == 0) {
+                result = claim_result;
+            }
+            *status_out = JQ_READY_CLAIMED;
+            break;
+        }
+    }
+
+    jq_ready_unmap(&map);
+    if (claimed > 0 && map.count >= JQ_READY_COMPACT_RECORDS) {
+        jq_ready_compact(root->path, tenant, level);
+    }
+    *claimed_out = claimed;
+    return claimed > 0 ? JQ_OK : result;
+}
+
+/* A lane that is missing, torn or grown large gets its whole state rewritten. */
+static int jq_ready_needs_replace(jq_ready_status_t status, uint64_t records) {
+    return status == JQ_READY_UNUSABLE || records >= JQ_READY_COMPACT_RECORDS;
+}
+
+/*
+ * Drained lanes: rescan the directory when the lanes are missing, torn or
+ * large enough to compact, or when the queue is marked for a rescan.
+ * Otherwise the queue is simply empty.
+ */
+static jq_result_t jq_ready_refresh(const char *root_path,
+                                    jq_state_t state,
+                                    int replace,
+                                    size_t *indexed_out,
+                                    int *unindexed_out) {
+    *indexed_out = 0;
+    if (!replace && !jq_ready_rescan_due(root_path, state)) {
+        return JQ_OK;
+    }
+    jq_result_t result = jq_ready_rebuild(root_path, state, replace, indexed_out, unindexed_out);
+    return result == JQ_ERR_NOT_FOUND ? JQ_OK : result;
+}
+
+/* Refresh both queue directories from the per-level statuses of a pass that found nothing. */
+static jq_result_t jq_ready_refresh_queues(const char *root_path,
+                                           const jq_ready_status_t *statuses,
+                                           const uint64_t *records,
+                                           size_t *indexed_out,
+                                           int *unindexed_out) {
+    const jq_state_t states[] = {JQ_STATE_PRIORITY, JQ_STATE_JOBS};
+    *indexed_out = 0;
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        int first = jq_state_first_level(states[i]);
+        int replace = 0;
+        for (int level = first; level < first + JQ_LEVELS_PER_STATE; ++level) {
+            replace |= jq_ready_needs_replace(statuses[level], records[level]);
+        }
+        size_t indexed = 0;
+        jq_result_t result = jq_ready_refresh(root_path, states[i], replace, &indexed, unindexed_out);
+        if (result != JQ_OK) {
+            return result;
+        }
+        *indexed_out += indexed;
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_claim_in_dir(const jq_root_t *root,
+                                   jq_state_t state,
+                                   char *uuid_out,
+                                   size_t uuid_out_len) {
+    if (!uuid_out || uuid_out_len == 0) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_dir_iter_t iter;
+    jq_result_t open_result = jq_dir_iter_open(&iter, root->path, state);
+    if (open_result != JQ_OK) {
+        return open_result;
+    }
+
+    const char *name;
+    jq_result_t result = JQ_ERR_NOT_FOUND;
+    while ((name = jq_dir_iter_next(&iter)) != NULL) {
+        if (!jq_has_suffix(name, ".pdf.job")) {
+            continue;
+        }
+
+        size_t base_len = strlen(name) - strlen(".pdf.job");
+        if (base_len + 1 > uuid_out_len) {
+            result = JQ_ERR_INVALID_ARGUMENT;
+            break;
+        }
+
+        memcpy(uuid_out, name, base_len);
+        uuid_out[base_len] = '\0';
+
+        jq_result_t claim_result = jq_claim_pair(root, uuid_out, state);
+        if (claim_result == JQ_ERR_NOT_FOUND) {
+            continue;
+        }
+        result = claim_result;
+        break;
+    }
+
+    jq_dir_iter_close(&iter);
+    return result;
+}
+
+/* Credit for up to wanted claims; a tenant arriving with none left gets its weight. */
+static size_t jq_tenant_credit(jq_tenant_slot_t *slot, size_t wanted) {
+    uint32_t weight = atomic_load(&slot->weight);
+    int64_t deficit = atomic_load(&slot->deficit);
+    while (1) {
+        int64_t available = deficit > 0 ? deficit : (int64_t)(weight > 0 ? weight : 1);
+        int64_t take = (int64_t)wanted < available ? (int64_t)wanted : available;
+        if (atomic_compare_exchange_weak(&slot->deficit, &deficit, available - take)) {
+            return (size_t)take;
+        }
+    }
+}
+
+/* Reserve in-flight slots under the tenant's cap before claiming, so racing claimers cannot overshoot it. */
+static size_t jq_tenant_reserve(jq_tenant_slot_t *slot, size_t wanted) {
+    uint32_t cap = atomic_load(&slot->max_in_flight);
+    int64_t in_flight = atomic_load(&slot->in_flight);
+    while (1) {
+        int64_t allowed = (int64_t)wanted;
+        if (cap > 0) {
+            if (in_flight >= (int64_t)cap) {
+                return 0;
+            }
+            if (allowed > (int64_t)cap - in_flight) {
+                allowed = (int64_t)cap - in_flight;
+            }
+        }
+        if (atomic_compare_exchange_weak(&slot->in_flight, &in_flight, in_flight + allowed)) {
+            return (size_t)allowed;
+        }
+    }
+}
+
+/*
+ * Deficit round-robin over the tenant lanes of one level. The shared cursor
+ * names the lane whose turn it is; each turn the tenant may claim as many
+ * jobs as its weight, so one tenant with 100k jobs queued gets the same
+ * share per round as a tenant with ten. A lane that runs dry, or whose
+ * tenant is at its in-flight cap, gives up what is left of its turn. Lane 0
+ * (untagged jobs) takes part from first_lane 0; its status is passed back
+ * so the caller can rebuild it as before, and records_out is the largest
+ * lane seen so any of them can trigger a compaction. A lane whose head is
+ * larger than max_bytes (0 means no limit) sits out the turn.
+ */
+static jq_result_t jq_claim_fair(const jq_root_t *root,
+                                 jq_tenant_file_t *tenants,
+                                 int first_lane,
+                                 int level,
+                                 uint64_t max_bytes,
+                                 size_t max_claims,
+                                 char *uuids_out,
+                                 size_t uuid_out_len,
+                                 int *tenants_out,
+                                 size_t *claimed_out,
+                                 jq_ready_status_t *status_out,
+                                 uint64_t *records_out) {
+    *claimed_out = 0;
+    *status_out = JQ_READY_DRAINED;
+    *records_out = 0;
+    uint32_t count = jq_tenants_count(tenants);
+    if (count <= (uint32_t)first_lane) {
+        return JQ_ERR_NOT_FOUND;
+    }
+    uint32_t lanes = count - (uint32_t)first_lane;
+
+    jq_result_t result = JQ_ERR_NOT_FOUND;
+    size_t total = 0;
+    uint32_t idle = 0;
+    while (total < max_claims && idle < lanes) {
+        uint64_t turn = atomic_load(&tenants->cursor);
+        int lane = first_lane + (int)(turn % lanes);
+        jq_tenant_slot_t *slot = &tenants->slots[lane];
+        size_t allowed = jq_tenant_credit(slot, max_claims - total);
+        size_t reserved = lane > 0 ? jq_tenant_reserve(slot, allowed) : allowed;
+
+        size_t claimed = 0;
+        jq_ready_status_t status = JQ_READY_DRAINED;
+        uint64_t records = 0;
+        jq_result_t lane_result = JQ_ERR_NOT_FOUND;
+        if (reserved > 0) {
+            lane_result = jq_claim_from_log(root, lane, level, reserved, 0, max_bytes,
+                                            uuids_out + total * uuid_out_len, uuid_out_len, &claimed, &status,
+                                            &records);
+        }
+        if (lane > 0 && claimed < reserved) {
+            atomic_fetch_sub(&slot->in_flight, (int64_t)(reserved - claimed));
+        }
+        for (size_t i = 0; i < claimed; ++i) {
+            tenants_out[total + i] = lane;
+        }
+        total += claimed;
+        if (lane == 0 && status == JQ_READY_UNUSABLE) {
+            *status_out = status;
+        }
+        if (records > *records_out) {
+            *records_out = records;
+        }
+        if (lane_result != JQ_OK && lane_result != JQ_ERR_NOT_FOUND) {
+            result = lane_result;
+            break;
+        }
+
+        if (claimed == allowed && atomic_load(&slot->deficit) > 0) {
+            /* Still this tenant's turn. */
+            idle = 0;
+            continue;
+        }
+        if (claimed < allowed) {
+            atomic_store(&slot->deficit, 0);
+        }
+        idle = claimed > 0 ? 0 : idle + 1;
+        atomic_compare_exchange_strong(&tenants->cursor, &turn, turn + 1);
+    }
+
+    *claimed_out = total;
+    return total > 0 ? JQ_OK : result;
+}
+
+static jq_result_t jq_claim_in_state(const jq_root_t *root,
+                                     jq_tenant_file_t *tenants,
+                                     jq_state_t state,
+                                     size_t max_claims,
+                                     char *uuids_out,
+                                     size_t uuid_out_len,
+                                     int *levels_out,
+                                     int *tenants_out,
+                                     size_t *claimed_out) {
+    size_t total = 0;
+    int unindexed = 0;
+    int rebuilt = 0;
+    int first = jq_state_first_level(state);
+    *claimed_out = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        int replace = 0;
+        for (int level = first + JQ_LEVELS_PER_STATE - 1; level >= first; --level) {
+            jq_ready_status_t status = JQ_READY_UNUSABLE;
+            uint64_t records = 0;
+            size_t claimed = 0;
+            jq_result_t result =
+                tenants ? jq_claim_fair(root, tenants, 0, level, 0, max_claims - total,
+                                        uuids_out + total * uuid_out_len, uuid_out_len, tenants_out + total, &claimed,
+                                        &status, &records)
+                        : jq_claim_from_log(root, 0, level, max_claims - total, 0, 0, uuids_out + total * uuid_out_len,
+                                            uuid_out_len, &claimed, &status, &records);
+            for (size_t i = 0; i < claimed; ++i) {
+                levels_out[total + i] = level;
+                if (!tenants) {
+                    tenants_out[total + i] = 0;
+                }
+            }
+            total += claimed;
+            if (total == max_claims || status == JQ_READY_CLAIMED) {
+                *claimed_out = total;
+                return total > 0 ? JQ_OK : result;
+            }
+            if (result != JQ_OK && result != JQ_ERR_NOT_FOUND) {
+                *claimed_out = total;
+                return total > 0 ? JQ_OK : result;
+            }
+            if (status == JQ_READY_UNUSABLE && !rebuilt) {
+                /* Rebuild before moving on, or lower levels would overtake this lane's jobs. */
+                size_t indexed = 0;
+                rebuilt = 1;
+                if (jq_ready_refresh(root->path, state, 1, &indexed, &unindexed) == JQ_OK) {
+                    level++;
+                    continue;
+                }
+            }
+            replace |= jq_ready_needs_replace(status, records);
+        }
+        if (pass == 1) {
+            break;
+        }
+
+        size_t indexed = 0;
+        jq_result_t refresh_result = jq_ready_refresh(root->path, state, replace, &indexed, &unindexed);
+        if (refresh_result != JQ_OK) {
+            *claimed_out = total;
+            return total > 0 ? JQ_OK : refresh_result;
+        }
+        if (indexed == 0) {
+            break;
+        }
+    }
+
+    if (total == 0 && unindexed) {
+        jq_result_t result = jq_claim_in_dir(root, state, uuids_out, uuid_out_len);
+        if (result != JQ_OK) {
+            return result;
+        }
+        levels_out[0] = jq_state_default_level(state);
+        tenants_out[0] = 0;
+        total = 1;
+    }
+    *claimed_out = total;
+    return total > 0 ? JQ_OK : JQ_ERR_NOT_FOUND;
+}
+
+/* Last resort for jobs whose names are too long for a ready record. */
+static jq_result_t jq_claim_unindexed(const jq_root_t *root,
+                                      char *uuid_out,
+                                      size_t uuid_out_len,
+                                      jq_state_t *state_out,
+                                      int *level_out) {
+    const jq_state_t states[] = {JQ_STATE_PRIORITY, JQ_STATE_JOBS};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        jq_result_t result = jq_claim_in_dir(root, states[i], uuid_out, uuid_out_len);
+        if (result == JQ_OK) {
+            *state_out = states[i];
+            *level_out = jq_state_default_level(states[i]);
+        }
+        if (result != JQ_ERR_NOT_FOUND) {
+            return result;
+        }
+    }
+    return JQ_ERR_NOT_FOUND;
+}
+
+static jq_result_t jq_claim_fifo(const jq_root_t *root,
+                                 char *uuid_out,
+                                 size_t uuid_out_len,
+                                 jq_state_t *state_out,
+                                 int *level_out) {
+    jq_ready_status_t statuses[JQ_LEVEL_COUNT];
+    uint64_t records[JQ_LEVEL_COUNT];
+    int unindexed = 0;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        while (1) {
+            int best = -1;
+            int unusable = 0;
+            uint64_t best_seq = 0;
+            for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+                uint64_t seq = 0;
+                int64_t enqueued_at = 0;
+                statuses[level] = jq_ready_peek(root->path, 0, level, &seq, &enqueued_at, &records[level]);
+                unusable |= statuses[level] == JQ_READY_UNUSABLE;
+                if (statuses[level] == JQ_READY_PENDING && (best < 0 || seq < best_seq)) {
+                    best = level;
+                    best_seq = seq;
+                }
+            }
+            /* An unreadable lane may hold the oldest job: rebuild before comparing heads. */
+            if (best < 0 || (unusable && pass == 0)) {
+                break;
+            }
+
+            /* One record at a time so a stale head never lets a newer job jump the queue. */
+            jq_ready_status_t status = JQ_READY_UNUSABLE;
+            size_t claimed = 0;
+            jq_result_t result = jq_claim_from_log(root, 0, best, 1, 1, 0, uuid_out, uuid_out_len,
+                                                   &claimed, &status, &records[best]);
+            if (status == JQ_READY_CLAIMED) {
+                if (result == JQ_OK) {
+                    *state_out = jq_level_state(best);
+                    *level_out = best;
+                }
+                return result;
+            }
+            if (result != JQ_OK && result != JQ_ERR_NOT_FOUND) {
+                return result;
+            }
+            if (status == JQ_READY_UNUSABLE) {
+                statuses[best] = status;
+                break;
+            }
+        }
+        if (pass == 1) {
+            break;
+        }
+
+        size_t indexed = 0;
+        jq_result_t refresh_result = jq_ready_refresh_queues(root->path, statuses, records, &indexed, &unindexed);
+        if (refresh_result != JQ_OK) {
+            return refresh_result;
+        }
+        if (indexed == 0) {
+            break;
+        }
+    }
+
+    return unindexed ? jq_claim_unindexed(root, uuid_out, uuid_out_len, state_out, level_out)
+                     : JQ_ERR_NOT_FOUND;
+}
+
+/*
+ * Smooth weighted round-robin: replaying the schedule up to the ticket's slot
+ * spreads each level's turns evenly over a cycle of sum(weights) claims
+ * instead of serving them in bursts. Ties go to the higher level.
+ */
+static int jq_weighted_level(const unsigned int *weights, uint64_t ticket) {
+    int64_t total = 0;
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        total += (int64_t)weights[level];
+    }
+
+    int64_t current[JQ_LEVEL_COUNT] = {0};
+    uint64_t slot = ticket % (uint64_t)total;
+    int picked = JQ_LEVEL_COUNT - 1;
+    for (uint64_t step = 0; step <= slot; ++step) {
+        picked = -1;
+        for (int level = JQ_LEVEL_COUNT - 1; level >= 0; --level) {
+            current[level] += (int64_t)weights[level];
+            if (picked < 0 || current[level] > current[picked]) {
+                picked = level;
+            }
+        }
+        current[picked] -= total;
+    }
+    return picked;
+}
+
+static int jq_weights_valid(const unsigned int *weights) {
+    unsigned int total = 0;
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        if (weights[level] > JQ_LEVEL_WEIGHT_MAX) {
+            return 0;
+        }
+        total += weights[level];
+    }
+    return total > 0;
+}
+
+/*
+ * Weighted claims take a ticket from the root-wide schedule counter, so every
+ * worker advances the same cycle. The ticket picks the preferred level; when
+ * it is empty the claim falls through the other levels from the top, so no
+ * worker idles while any job is waiting.
+ */
+static jq_result_t jq_claim_weighted(const jq_root_t *root,
+                                     const unsigned int *weights,
+                                     uint64_t ticket,
+                                     char *uuid_out,
+                                     size_t uuid_out_len,
+                                     jq_state_t *state_out,
+                                     int *level_out) {
+    int order[JQ_LEVEL_COUNT];
+    size_t order_count = 0;
+    order[order_count++] = jq_weighted_level(weights, ticket);
+    for (int level = JQ_LEVEL_COUNT - 1; level >= 0; --level) {
+        if (level != order[0]) {
+            order[order_count++] = level;
+        }
+    }
+
+    jq_ready_status_t statuses[JQ_LEVEL_COUNT];
+    uint64_t records[JQ_LEVEL_COUNT];
+    int unindexed = 0;
+    int rebuilt[2] = {0, 0};
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < order_count; ++i) {
+            int level = order[i];
+            size_t claimed = 0;
+            jq_result_t result = jq_claim_from_log(root, 0, level, 1, 0, 0, uuid_out, uuid_out_len,
+                                                   &claimed, &statuses[level], &records[level]);
+            if (statuses[level] == JQ_READY_CLAIMED) {
+                if (result == JQ_OK) {
+                    *state_out = jq_level_state(level);
+                    *level_out = level;
+                }
+                return result;
+            }
+            if (result != JQ_OK && result != JQ_ERR_NOT_FOUND) {
+                return result;
+            }
+            jq_state_t state = jq_level_state(level);
+            if (statuses[level] == JQ_READY_UNUSABLE && !rebuilt[state]) {
+                size_t indexed = 0;
+                rebuilt[state] = 1;
+                if (jq_ready_refresh(root->path, state, 1, &indexed, &unindexed) == JQ_OK) {
+                    i--;
+                }
+            }
+        }
+        if (pass == 1) {
+            break;
+        }
+
+        size_t indexed = 0;
+        jq_result_t refresh_result = jq_ready_refresh_queues(root->path, statuses, records, &indexed, &unindexed);
+        if (refresh_result != JQ_OK) {
+            return refresh_result;
+        }
+        if (indexed == 0) {
+            break;
+        }
+    }
+
+    return unindexed ? jq_claim_unindexed(root, uuid_out, uuid_out_len, state_out, level_out)
+                     : JQ_ERR_NOT_FOUND;
+}
+
+/*
+ * Size-aware claims read the size-class lanes instead of the level lanes.
+ * States and levels keep their usual order; within a level the classes are
+ * tried smallest first, or starting from the ticket's class so each class
+ * gets every fourth turn and a burst of large files cannot hold the small
+ * ones back. A byte cap leaves out classes that start above it and stops at
+ * a class head that is too large. Lanes that are missing, torn or large get
+ * every lane of their state rebuilt, as do level lanes that the size-aware
+ * claims have left full of stale records.
+ */
+static jq_result_t jq_claim_sized(const jq_root_t *root,
+                                  const jq_claim_options_t *options,
+                                  const jq_state_t *states,
+                                  size_t state_count,
+                                  uint64_t ticket,
+                                  char *uuid_out,
+                                  size_t uuid_out_len,
+                                  jq_state_t *state_out,
+                                  int *level_out) {
+    int order[JQ_SIZE_CLASS_COUNT];
+    for (int i = 0; i < JQ_SIZE_CLASS_COUNT; ++i) {
+        order[i] = options->size == JQ_CLAIM_SIZE_SMALLEST_FIRST
+                       ? i
+                       : (int)((ticket + (uint64_t)i) % JQ_SIZE_CLASS_COUNT);
+    }
+
+    int unindexed = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        int replace[2] = {0, 0};
+        for (size_t i = 0; i < state_count; ++i) {
+            int first = jq_state_first_level(states[i]);
+            for (int level = first + JQ_LEVELS_PER_STATE - 1; level >= first; --level) {
+                for (int k = 0; k < JQ_SIZE_CLASS_COUNT; ++k) {
+                    if (options->max_bytes > 0 && jq_size_class_floor(order[k]) > options->max_bytes) {
+                        continue;
+                    }
+                    jq_ready_status_t status = JQ_READY_UNUSABLE;
+                    uint64_t records = 0;
+                    size_t claimed = 0;
+                    jq_result_t result = jq_claim_from_log(root, JQ_SIZE_LANE(order[k]), level, 1, 0,
+                                                           options->max_bytes, uuid_out, uuid_out_len, &claimed,
+                                                           &status, &records);
+                    if (status == JQ_READY_CLAIMED) {
+                        if (result == JQ_OK) {
+                            *state_out = states[i];
+                            *level_out = level;
+                        }
+                        return result;
+                    }
+                    if (result != JQ_OK && result != JQ_ERR_NOT_FOUND) {
+                        return result;
+                    }
+                    replace[states[i]] |= jq_ready_needs_replace(status, records);
+                }
+            }
+        }
+        if (pass == 1) {
+            break;
+        }
+
+        size_t indexed = 0;
+        for (size_t i = 0; i < state_count; ++i) {
+            int first = jq_state_first_level(states[i]);
+            for (int level = first; level < first + JQ_LEVELS_PER_STATE; ++level) {
+                uint64_t seq = 0;
+                int64_t enqueued_at = 0;
+                uint64_t records = 0;
+                jq_ready_status_t status = jq_ready_peek(root->path, 0, level, &seq, &enqueued_at, &records);
+                replace[states[i]] |= jq_ready_needs_replace(status, records);
+            }
+            size_t state_indexed = 0;
+            jq_result_t result = jq_ready_refresh(root->path, states[i], replace[states[i]], &state_indexed,
+                                                  &unindexed);
+            if (result != JQ_OK) {
+                return result;
+            }
+            indexed += state_indexed;
+        }
+        if (indexed == 0) {
+            break;
+        }
+    }
+    /* Jobs without a record have no known size, so only uncapped claims take them. */
+    return unindexed && options->max_bytes == 0
+               ? jq_claim_unindexed(root, uuid_out, uuid_out_len, state_out, level_out)
+               : JQ_ERR_NOT_FOUND;
+}
+
+/*
+ * Leases: every claim records who holds the job and until when in
+ * .jq/leases/<uuid>.lease. Workers extend the expiry with jq_heartbeat, and
+ * jq_reap_expired puts jobs whose lease ran out back on their queue. Leases
+ * are written with rename so readers never see a partial record.
+ */
+static int jq_lease_path(const char *root_path, const char *uuid, const char *suffix, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s/%s%s", root_path, JQ_INDEX_DIR, JQ_LEASE_DIR, uuid, suffix);
+    if (written < 0 || (size_t)written >= out_len) {
+        return 0;
+    }
+    return 1;
+}
+
+static jq_result_t jq_ensure_lease_dir(const char *root_path) {
+    jq_result_t result = jq_ensure_index_dir(root_path);
+    if (result != JQ_OK) {
+        return result;
+    }
+    char path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_LEASE_DIR, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    return jq_ensure_dir(path);
+}
+
+static void jq_lease_default_owner(char *out, size_t out_len) {
+    /* Leave room for ":<pid>". */
+    char host[JQ_LEASE_OWNER_MAX - 16];
+    if (gethostname(host, sizeof(host)) != 0) {
+        snprintf(host, sizeof(host), "localhost");
+    }
+    host[sizeof(host) - 1] = '\0';
+    snprintf(out, out_len, "%s:%ld", host, (long)getpid());
+}
+
+/* The owner a caller names, or the default a claim in this process records when it names none. */
+static void jq_lease_expected_owner(const char *owner, char *out, size_t out_len) {
+    if (owner && owner[0] != '\0') {
+        snprintf(out, out_len, "%s", owner);
+    } else {
+        jq_lease_default_owner(out, out_len);
+    }
+}
+
+static int jq_lease_record_valid(const jq_lease_record_t *record) {
+    return record->magic == JQ_LEASE_MAGIC && record->version == JQ_LEASE_VERSION &&
+           (record->state == JQ_STATE_JOBS || record->state == JQ_STATE_PRIORITY) &&
+           record->level >= 0 && record->level < JQ_LEVEL_COUNT &&
+           jq_level_state(record->level) == (jq_state_t)record->state;
+}
+
+static jq_result_t jq_lease_read(const char *path, jq_lease_record_t *record_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    ssize_t bytes = pread(fd, record_out, sizeof(*record_out), 0);
+    close(fd);
+    if (bytes != (ssize_t)sizeof(*record_out) || !jq_lease_record_valid(record_out)) {
+        return JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_lease_write(const char *root_path,
+                                  const char *uuid,
+                                  jq_state_t state,
+                                  int level,
+                                  int tenant,
+                                  const char *owner,
+                                  unsigned int lease_seconds,
+                                  unsigned int max_attempts,
+                                  const jq_job_sizes_t *sizes) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_lease_path(root_path, uuid, ".lease", path, sizeof(path)) ||
+        !jq_lease_path(root_path, uuid, ".lease.tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_lease_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = JQ_LEASE_MAGIC;
+    record.version = JQ_LEASE_VERSION;
+    record.state = (int32_t)state;
+    record.level = (int32_t)level;
+    record.tenant = (uint32_t)tenant;
+    record.max_attempts = max_attempts;
+    record.lease_seconds = lease_seconds > 0 ? lease_seconds : JQ_LEASE_DEFAULT_SECONDS;
+    record.claimed_at = (int64_t)time(NULL);
+    record.expires_at = record.claimed_at + (int64_t)record.lease_seconds;
+    record.pdf_bytes = sizes->pdf;
+    record.metadata_bytes = sizes->metadata;
+    if (owner && owner[0] != '\0') {
+        snprintf(record.owner, sizeof(record.owner), "%s", owner);
+    } else {
+        jq_lease_default_owner(record.owner, sizeof(record.owner));
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0 && errno == ENOENT && jq_ensure_lease_dir(root_path) == JQ_OK) {
+        jq_lease_path(root_path, uuid, ".lease.tmp.XXXXXX", tmp_path, sizeof(tmp_path));
+        fd = mkstemp(tmp_path);
+    }
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+
+    jq_result_t result = jq_write_all(fd, &record, sizeof(record));
+    if (close(fd) != 0 && result == JQ_OK) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+    }
+    return result;
+}
+
+/* Sizes, level and tenant recorded at claim time; a lease being reaped still counts. */
+static int jq_lease_claimed(const char *root_path,
+                            const char *uuid,
+                            jq_job_sizes_t *sizes_out,
+                            int *level_out,
+                            int *tenant_out) {
+    const char *suffixes[] = {".lease", ".reaping"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+        char path[PATH_MAX];
+        jq_lease_record_t record;
+        if (jq_lease_path(root_path, uuid, suffixes[i], path, sizeof(path)) &&
+            jq_lease_read(path, &record) == JQ_OK) {
+            sizes_out->pdf = record.pdf_bytes;
+            sizes_out->metadata = record.metadata_bytes;
+            *level_out = record.level;
+            *tenant_out = record.tenant < JQ_TENANT_MAX ? (int)record.tenant : 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void jq_lease_remove(const char *root_path, const char *uuid) {
+    char path[PATH_MAX];
+    if (jq_lease_path(root_path, uuid, ".lease", path, sizeof(path))) {
+        unlink(path);
+    }
+}
+
+/* Whether jq_cancel marked the job's lease, counting a lease being reaped. */
+static int jq_lease_cancelled(const char *root_path, const char *uuid) {
+    const char *suffixes[] = {".lease", ".reaping"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+        char path[PATH_MAX];
+        jq_lease_record_t record;
+        if (jq_lease_path(root_path, uuid, suffixes[i], path, sizeof(path)) &&
+            jq_lease_read(path, &record) == JQ_OK) {
+            return atomic_load(&record.cancelled) != 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Only the lease's owner may extend it. A NULL or empty owner stands for the
+ * default a claim records (host:pid), so it matches claims made by this
+ * process without an owner.
+ */
+jq_result_t jq_heartbeat(const char *root_path,
+                         const char *uuid,
+                         jq_state_t state,
+                         const char *owner) {
+    if (!root_path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    char path[PATH_MAX];
+    if (!jq_lease_path(root_path, uuid, ".lease", path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    char expected[JQ_LEASE_OWNER_MAX];
+    jq_lease_expected_owner(owner, expected, sizeof(expected));
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        /* No lease: the job was never claimed, already finished, or reaped. */
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    jq_lease_record_t record;
+    jq_result_t result = JQ_OK;
+    if (pread(fd, &record, sizeof(record), 0) != (ssize_t)sizeof(record) || !jq_lease_record_valid(&record)) {
+        result = JQ_ERR_IO;
+    } else if (record.state != (int32_t)state || strncmp(record.owner, expected, sizeof(record.owner)) != 0) {
+        result = JQ_ERR_NOT_FOUND;
+    } else {
+        int64_t expires_at = (int64_t)time(NULL) + (int64_t)record.lease_seconds;
+        if (pwrite(fd, &expires_at, sizeof(expires_at), offsetof(jq_lease_record_t, expires_at)) !=
+            (ssize_t)sizeof(expires_at)) {
+            result = JQ_ERR_IO;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+jq_result_t jq_lease_info(const char *root_path,
+                          const char *uuid,
+                          jq_lease_t *lease_out) {
+    if (!root_path || !uuid || !lease_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    char path[PATH_MAX];
+    if (!jq_lease_path(root_path, uuid, ".lease", path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_lease_record_t record;
+    jq_result_t result = jq_lease_read(path, &record);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    memset(lease_out, 0, sizeof(*lease_out));
+    memcpy(lease_out->owner, record.owner, sizeof(lease_out->owner));
+    lease_out->owner[sizeof(lease_out->owner) - 1] = '\0';
+    lease_out->state = (jq_state_t)record.state;
+    lease_out->level = record.level;
+    lease_out->claimed_at = (time_t)record.claimed_at;
+    lease_out->expires_at = (time_t)record.expires_at;
+    lease_out->lease_seconds = record.lease_seconds;
+    lease_out->cancelled = atomic_load(&record.cancelled) != 0;
+    return JQ_OK;
+}
+
+/*
+ * Attempts: .jq/attempts/<uuid> counts the failed runs of a job that is
+ * still in flight: jq_retry and the reaper (for a worker that died holding
+ * the job) add one, and finalizing the job removes the file. max_attempts
+ * is the limit the last failure was judged against, so the reaper applies
+ * the same policy as the worker; records written before it existed end at
+ * updated_at and read as 0.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t attempts;
+    int64_t updated_at;
+    uint32_t max_attempts;
+    uint32_t reserved;
+} jq_attempts_record_t;
+
+static int jq_attempts_path(const char *root_path, const char *uuid, const char *suffix, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s/%s%s", root_path, JQ_INDEX_DIR, JQ_ATTEMPTS_DIR, uuid, suffix);
+    return written >= 0 && (size_t)written < out_len;
+}
+
+static unsigned int jq_attempts_read(const char *root_path, const char *uuid, unsigned int *max_attempts_out) {
+    if (max_attempts_out) {
+        *max_attempts_out = 0;
+    }
+    char path[PATH_MAX];
+    if (!jq_attempts_path(root_path, uuid, "", path, sizeof(path))) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    jq_attempts_record_t record;
+    memset(&record, 0, sizeof(record));
+    ssize_t bytes = pread(fd, &record, sizeof(record), 0);
+    close(fd);
+    if (bytes < (ssize_t)offsetof(jq_attempts_record_t, max_attempts) || record.magic != JQ_ATTEMPTS_MAGIC) {
+        return 0;
+    }
+    if (max_attempts_out) {
+        *max_attempts_out = record.max_attempts;
+    }
+    return record.attempts;
+}
+
+static jq_result_t jq_attempts_write(const char *root_path,
+                                     const char *uuid,
+                                     unsigned int attempts,
+                                     unsigned int max_attempts) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_attempts_path(root_path, uuid, "", path, sizeof(path)) ||
+        !jq_attempts_path(root_path, uuid, ".tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0 && errno == ENOENT) {
+        char dir_path[PATH_MAX];
+        if (jq_ensure_index_dir(root_path) != JQ_OK ||
+            !jq_build_index_path(root_path, JQ_ATTEMPTS_DIR, dir_path, sizeof(dir_path)) ||
+            jq_ensure_dir(dir_path) != JQ_OK) {
+            return JQ_ERR_IO;
+        }
+        jq_attempts_path(root_path, uuid, ".tmp.XXXXXX", tmp_path, sizeof(tmp_path));
+        fd = mkstemp(tmp_path);
+    }
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+
+    jq_attempts_record_t record = {
+        .magic = JQ_ATTEMPTS_MAGIC,
+        .attempts = attempts,
+        .updated_at = (int64_t)time(NULL),
+        .max_attempts = max_attempts,
+    };
+    jq_result_t result = jq_write_all(fd, &record, sizeof(record));
+    if (close(fd) != 0 && result == JQ_OK) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+    }
+    return result;
+}
+
+static void jq_attempts_remove(const char *root_path, const char *uuid) {
+    char path[PATH_MAX];
+    if (jq_attempts_path(root_path, uuid, "", path, sizeof(path))) {
+        unlink(path);
+    }
+}
+
+/* The limit a failure is judged against: the caller's, else the claimer's, else the last one recorded. */
+static unsigned int jq_retry_limit(unsigned int requested, unsigned int leased, unsigned int recorded) {
+    if (requested > 0) {
+        return requested;
+    }
+    if (leased > 0) {
+        return leased;
+    }
+    return recorded > 0 ? recorded : JQ_RETRY_DEFAULT_ATTEMPTS;
+}
+
+jq_result_t jq_attempts(const char *root_path, const char *uuid, unsigned int *attempts_out) {
+    if (!root_path || !uuid || !attempts_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    *attempts_out = jq_attempts_read(root_path, uuid, NULL);
+    return JQ_OK;
+}
+
+static int jq_event_segment_path(const char *root_path, uint64_t segment, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s/%016llx.events", root_path, JQ_INDEX_DIR, JQ_EVENTS_DIR,
+                           (unsigned long long)segment);
+    return written >= 0 && (size_t)written < out_len;
+}
+
+static int64_t jq_wall_clock_ms(void);
+static void jq_stats_count_dropped_event(const char *root_path);
+
+static void jq_event_writer_close(jq_event_writer_t *writer) {
+    if (writer->fd >= 0) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    if (writer->counter) {
+        munmap(writer->counter, sizeof(jq_sequence_file_t));
+        writer->counter = NULL;
+    }
+}
+
+/* Reserves the next slot and writes the record there, reopening only when the slot is in another segment. */
+static jq_result_t jq_event_write(const char *root_path, jq_event_writer_t *writer, jq_event_record_t *record) {
+    if (!writer->counter) {
+        jq_result_t result = jq_counter_map(root_path, JQ_EVENTS_COUNTER, &writer->counter);
+        if (result != JQ_OK) {
+            return result;
+        }
+    }
+    uint64_t cursor = atomic_fetch_add(&writer->counter->last, 1);
+    uint64_t segment = cursor / JQ_EVENT_SEGMENT_RECORDS;
+    if (writer->fd >= 0 && writer->segment != segment) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    if (writer->fd < 0) {
+        char path[PATH_MAX];
+        if (!jq_event_segment_path(root_path, segment, path, sizeof(path))) {
+            return JQ_ERR_INVALID_ARGUMENT;
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0 && errno == ENOENT) {
+            char dir[PATH_MAX];
+            int written = snprintf(dir, sizeof(dir), "%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_EVENTS_DIR);
+            if (written >= 0 && (size_t)written < sizeof(dir) && jq_ensure_dir(dir) == JQ_OK) {
+                fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            }
+        }
+        if (fd < 0) {
+            return JQ_ERR_IO;
+        }
+        writer->fd = fd;
+        writer->segment = segment;
+    }
+    record->at_ms = jq_wall_clock_ms();
+    off_t offset = (off_t)(cursor % JQ_EVENT_SEGMENT_RECORDS) * (off_t)sizeof(*record);
+    if (pwrite(writer->fd, record, sizeof(*record), offset) != (ssize_t)sizeof(*record)) {
+        return JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+/*
+ * The transition an event records has already happened by the time it is
+ * appended, so callers carry on regardless; a record that could not be
+ * written is counted in the stats file as dropped instead.
+ */
+static jq_result_t jq_event_append(const jq_root_t *root,
+                                   jq_event_kind_t kind,
+                                   const char *uuid,
+                                   int from_state,
+                                   int to_state,
+                                   int64_t bytes) {
+    size_t uuid_len = strlen(uuid);
+    if (uuid_len == 0 || uuid_len >= JQ_UUID_MAX) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_event_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = JQ_EVENT_MAGIC;
+    record.kind = (uint8_t)kind;
+    record.from_state = (int8_t)from_state;
+    record.to_state = (int8_t)to_state;
+    record.uuid_len = (uint8_t)uuid_len;
+    record.bytes = bytes;
+    memcpy(record.uuid, uuid, uuid_len);
+
+    jq_event_writer_t local = {.counter = NULL, .fd = -1, .segment = 0};
+    jq_event_writer_t *writer = root->events ? root->events : &local;
+    jq_result_t result = jq_event_write(root->path, writer, &record);
+    if (writer == &local) {
+        jq_event_writer_close(&local);
+    }
+    if (result != JQ_OK) {
+        jq_stats_count_dropped_event(root->path);
+    }
+    return result;
+}
+
+static int jq_event_record_valid(const jq_event_record_t *record) {
+    return record->magic == JQ_EVENT_MAGIC && record->uuid_len > 0 && record->uuid_len < JQ_UUID_MAX;
+}
+
+static ssize_t jq_event_pread(const char *root_path, uint64_t cursor, jq_event_record_t *records, size_t max_records) {
+    char path[PATH_MAX];
+    if (!jq_event_segment_path(root_path, cursor / JQ_EVENT_SEGMENT_RECORDS, path, sizeof(path))) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    uint64_t slot = cursor % JQ_EVENT_SEGMENT_RECORDS;
+    if (max_records > JQ_EVENT_SEGMENT_RECORDS - slot) {
+        max_records = (size_t)(JQ_EVENT_SEGMENT_RECORDS - slot);
+    }
+    ssize_t bytes_read = pread(fd, records, max_records * sizeof(*records), (off_t)(slot * sizeof(*records)));
+    close(fd);
+    return bytes_read < 0 ? -1 : bytes_read / (ssize_t)sizeof(*records);
+}
+
+/* A hole is abandoned once the first record written after it has been there a while. */
+static int jq_event_hole_abandoned(const char *root_path, uint64_t hole, int64_t now_ms) {
+    jq_event_record_t records[16];
+    uint64_t cursor = hole + 1;
+    for (int reads = 0; reads < 4; ++reads) {
+        ssize_t count = jq_event_pread(root_path, cursor, records, sizeof(records) / sizeof(records[0]));
+        if (count <= 0) {
+            return 0;
+        }
+        for (ssize_t i = 0; i < count; ++i) {
+            if (jq_event_record_valid(&records[i])) {
+                return now_ms - records[i].at_ms >= JQ_EVENT_HOLE_MS;
+            }
+        }
+        cursor += (uint64_t)count;
+    }
+    return 0;
+}
+
+jq_result_t jq_events_read(const char *root_path,
+                           unsigned long long cursor,
+                           jq_event_t *events_out,
+                           size_t max_events,
+                           size_t *count_out,
+                           unsigned long long *next_cursor_out) {
+    if (!root_path || !events_out || max_events == 0 || !count_out || !next_cursor_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    *count_out = 0;
+    *next_cursor_out = cursor;
+
+    enum { JQ_EVENT_READ_BATCH = 256 };
+    jq_event_record_t records[JQ_EVENT_READ_BATCH];
+    int64_t now_ms = jq_wall_clock_ms();
+    size_t count = 0;
+    while (count < max_events) {
+        size_t wanted = JQ_EVENT_READ_BATCH;
+        if (wanted > JQ_EVENT_SEGMENT_RECORDS - cursor % JQ_EVENT_SEGMENT_RECORDS) {
+            wanted = (size_t)(JQ_EVENT_SEGMENT_RECORDS - cursor % JQ_EVENT_SEGMENT_RECORDS);
+        }
+        ssize_t read_count = jq_event_pread(root_path, cursor, records, wanted);
+        if (read_count < 0 && errno == ENOENT) {
+            /* Not written yet, or pruned by retention if later segments were handed out. */
+            uint64_t next_segment = (cursor / JQ_EVENT_SEGMENT_RECORDS + 1) * JQ_EVENT_SEGMENT_RECORDS;
+            if (jq_counter_peek(root_path, JQ_EVENTS_COUNTER) > next_segment) {
+                cursor = next_segment;
+                continue;
+            }
+            read_count = 0;
+        }
+        if (read_count < 0) {
+            return errno == EINVAL ? JQ_ERR_INVALID_ARGUMENT : JQ_ERR_IO;
+        }
+        size_t available = (size_t)read_count;
+
+        size_t used = 0;
+        while (used < available && count < max_events) {
+            const jq_event_record_t *record = &records[used];
+            if (!jq_event_record_valid(record)) {
+                if (!jq_event_hole_abandoned(root_path, cursor + used, now_ms)) {
+                    break;
+                }
+                used++;
+                continue;
+            }
+            jq_event_t *event = &events_out[count++];
+            memset(event, 0, sizeof(*event));
+            event->cursor = cursor + used;
+            event->kind = (jq_event_kind_t)record->kind;
+            memcpy(event->uuid, record->uuid, record->uuid_len);
+            event->from_state = record->from_state;
+            event->to_state = record->to_state;
+            event->at_ms = record->at_ms;
+            event->bytes = record->bytes;
+            used++;
+        }
+        cursor += used;
+        if (used < available || available < wanted) {
+            break;
+        }
+    }
+    *count_out = count;
+    *next_cursor_out = cursor;
+    return JQ_OK;
+}
+
+void jq_claim_options_init(jq_claim_options_t *options) {
+    if (!options) {
+        return;
+    }
+    memset(options, 0, sizeof(*options));
+    options->order = JQ_CLAIM_ORDER_PRIORITY;
+    /* Each level gets twice the turns of the one below it. */
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        options->weights[level] = 1u << level;
+    }
+}
+
+static jq_result_t jq_release_at(const jq_root_t *root, const char *uuid, jq_state_t state);
+static void jq_delay_promote(const char *root_path, time_t now);
+static time_t jq_delay_next(const char *root_path);
+
+/* One untagged job in the order the options ask for: by size class, oldest first, or by level weight. */
+static jq_result_t jq_claim_untagged(const jq_root_t *root,
+                                     const jq_claim_options_t *options,
+                                     const jq_state_t *states,
+                                     size_t state_count,
+                                     uint64_t ticket,
+                                     char *uuid_out,
+                                     size_t uuid_out_len,
+                                     jq_state_t *state_out,
+                                     int *level_out) {
+    if (options->size != JQ_CLAIM_SIZE_ANY || options->max_bytes > 0) {
+        return jq_claim_sized(root, options, states, state_count, ticket, uuid_out, uuid_out_len, state_out,
+                              level_out);
+    }
+    if (options->order == JQ_CLAIM_ORDER_FIFO) {
+        return jq_claim_fifo(root, uuid_out, uuid_out_len, state_out, level_out);
+    }
+    return jq_claim_weighted(root, options->weights, ticket, uuid_out, uuid_out_len, state_out, level_out);
+}
+
+/*
+ * FIFO, weighted and size-ordered claims take one job at a time from the
+ * same deficit round-robin jq_claim_fair runs per level, with the untagged
+ * jobs as lane 0: that lane's turn claims in the order the options ask for,
+ * and a tenant's turn takes its highest level first. A lane with nothing
+ * to give, or a tenant at its cap, passes the turn on, so neither untagged
+ * work nor any one tenant can starve the others.
+ */
+static jq_result_t jq_claim_tenant_lanes(const jq_root_t *root,
+                                         const jq_claim_options_t *options,
+                                         jq_tenant_file_t *tenants,
+                                         const jq_state_t *states,
+                                         size_t state_count,
+                                         uint64_t ticket,
+                                         char *uuid_out,
+                                         size_t uuid_out_len,
+                                         jq_state_t *state_out,
+                                         int *level_out,
+                                         int *tenant_out) {
+    *tenant_out = 0;
+    uint32_t lanes = tenants ? jq_tenants_count(tenants) : 0;
+    if (lanes <= 1) {
+        return jq_claim_untagged(root, options, states, state_count, ticket, uuid_out, uuid_out_len, state_out,
+                                 level_out);
+    }
+
+    for (uint32_t idle = 0; idle < lanes;) {
+        uint64_t turn = atomic_load(&tenants->cursor);
+        int lane = (int)(turn % lanes);
+        jq_tenant_slot_t *slot = &tenants->slots[lane];
+        size_t allowed = jq_tenant_credit(slot, 1);
+        size_t reserved = lane > 0 ? jq_tenant_reserve(slot, allowed) : allowed;
+
+        jq_result_t result = JQ_ERR_NOT_FOUND;
+        if (reserved > 0 && lane == 0) {
+            result = jq_claim_untagged(root, options, states, state_count, ticket, uuid_out, uuid_out_len,
+                                       state_out, level_out);
+        }
+        for (int level = JQ_LEVEL_COUNT - 1; reserved > 0 && lane > 0 && level >= 0; --level) {
+            size_t claimed = 0;
+            jq_ready_status_t status;
+            uint64_t records;
+            result = jq_claim_from_log(root, lane, level, 1, 0, options->max_bytes, uuid_out, uuid_out_len,
+                                       &claimed, &status, &records);
+            if (result == JQ_OK && claimed == 1) {
+                *state_out = jq_level_state(level);
+                *level_out = level;
+                break;
+            }
+            if (result == JQ_OK) {
+                result = JQ_ERR_NOT_FOUND;
+            }
+            if (result != JQ_ERR_NOT_FOUND) {
+                break;
+            }
+        }
+        if (lane > 0 && reserved > 0 && result != JQ_OK) {
+            atomic_fetch_sub(&slot->in_flight, (int64_t)reserved);
+        }
+
+        if (result == JQ_OK) {
+            *tenant_out = lane;
+            if (atomic_load(&slot->deficit) <= 0) {
+                atomic_compare_exchange_strong(&tenants->cursor, &turn, turn + 1);
+            }
+            return JQ_OK;
+        }
+        if (result != JQ_ERR_NOT_FOUND) {
+            return result;
+        }
+        atomic_store(&slot->deficit, 0);
+        idle++;
+        atomic_compare_exchange_strong(&tenants->cursor, &turn, turn + 1);
+    }
+    return JQ_ERR_NOT_FOUND;
+}
+
+/*
+ * Priority-order claims try the ready ring first, in the same level order as
+ * the logs. The first dirty or busy lane hands over to the logs so nothing
+ * queued there is overtaken by a lower level.
+ */
+static size_t jq_ring_claim(const jq_root_t *root,
+                            const jq_state_t *states,
+                            size_t state_count,
+                            size_t max_jobs,
+                            char *uuids_out,
+                            size_t uuid_out_len,
+                            jq_state_t *states_out,
+                            int *levels_out,
+                            int *tenants_out) {
+    jq_ring_file_t *ring = root->ring ? root->ring : jq_ring_map(root->path);
+    if (!ring) {
+        return 0;
+    }
+    uint32_t dirty = atomic_load(&ring->dirty);
+    size_t count = 0;
+    for (size_t i = 0; i < state_count && count < max_jobs; ++i) {
+        int first = jq_state_first_level(states[i]);
+        for (int level = first + JQ_LEVELS_PER_STATE - 1; level >= first && count < max_jobs; --level) {
+            if (dirty & (1u << level)) {
+                goto done;
+            }
+            while (count < max_jobs) {
+                char *uuid_out = uuids_out + count * uuid_out_len;
+                jq_ring_pop_t popped = jq_ring_pop(ring, level, uuid_out, uuid_out_len);
+                if (popped == JQ_RING_EMPTY) {
+                    break;
+                }
+                if (popped == JQ_RING_BUSY) {
+                    goto done;
+                }
+                jq_result_t claim_result = jq_claim_pair(root, uuid_out, states[i]);
+                if (claim_result == JQ_ERR_NOT_FOUND) {
+                    continue;
+                }
+                if (claim_result != JQ_OK) {
+                    /* The job is still in its log. */
+                    goto done;
+                }
+                states_out[count] = states[i];
+                levels_out[count] = level;
+                tenants_out[count] = 0;
+                count++;
+            }
+        }
+    }
+done:
+    if (ring != root->ring) {
+        jq_ring_unmap(ring);
+    }
+    return count;
+}
+
+/* Once claims find nothing, a ring that is dirty or out of step with the drained logs is rebuilt. */
+static void jq_ring_settle(const jq_root_t *root) {
+    jq_ring_file_t *ring = root->ring ? root->ring : jq_ring_map(root->path);
+    if (!ring) {
+        return;
+    }
+    int idle = jq_ring_idle(ring);
+    if (ring != root->ring) {
+        jq_ring_unmap(ring);
+    }
+    if (!idle) {
+        (void)jq_ring_rebuild(root->path);
+    }
+}
+
+static jq_result_t jq_claim_collect(const jq_root_t *root,
+                                    const jq_claim_options_t *options,
+                                    jq_tenant_file_t *tenants,
+                                    size_t max_jobs,
+                                    char *uuids_out,
+                                    size_t uuid_out_len,
+                                    jq_state_t *states_out,
+                                    int *levels_out,
+                                    int *tenants_out,
+                                    size_t *count_out) {
+    size_t count = 0;
+    *count_out = 0;
+    const jq_state_t states[] = {
+        options->prefer_priority ? JQ_STATE_PRIORITY : JQ_STATE_JOBS,
+        options->prefer_priority ? JQ_STATE_JOBS : JQ_STATE_PRIORITY
+    };
+
+    /*
+     * A byte cap on its own takes the classes in turn. Tenant lanes have no
+     * size mirror: they take their turns beside the untagged classes, and a
+     * capped worker skips a lane whose head is over the cap.
+     */
+    int sized = options->size != JQ_CLAIM_SIZE_ANY || options->max_bytes > 0;
+    if (sized || options->order == JQ_CLAIM_ORDER_FIFO || options->order == JQ_CLAIM_ORDER_WEIGHTED) {
+        uint64_t ticket = 0;
+        const char *counter = NULL;
+        if (sized) {
+            if (options->order != JQ_CLAIM_ORDER_PRIORITY || options->size > JQ_CLAIM_SIZE_ROUND_ROBIN) {
+                return JQ_ERR_INVALID_ARGUMENT;
+            }
+            counter = options->size != JQ_CLAIM_SIZE_SMALLEST_FIRST ? "size" : NULL;
+        } else if (options->order == JQ_CLAIM_ORDER_WEIGHTED) {
+            if (!jq_weights_valid(options->weights)) {
+                return JQ_ERR_INVALID_ARGUMENT;
+            }
+            counter = "schedule";
+        }
+        if (counter) {
+            jq_result_t ticket_result = jq_counter_reserve(root->path, counter, max_jobs, &ticket);
+            if (ticket_result != JQ_OK) {
+                return ticket_result;
+            }
+        }
+        while (count < max_jobs) {
+            jq_result_t result = jq_claim_tenant_lanes(root, options, tenants, states,
+                                                       sizeof(states) / sizeof(states[0]), ticket + count,
+                                                       uuids_out + count * uuid_out_len, uuid_out_len,
+                                                       &states_out[count], &levels_out[count], &tenants_out[count]);
+            if (result != JQ_OK) {
+                if (count == 0) {
+                    return result;
+                }
+                break;
+            }
+            count++;
+        }
+        *count_out = count;
+        return JQ_OK;
+    }
+    if (options->order != JQ_CLAIM_ORDER_PRIORITY) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    if (!tenants) {
+        count = jq_ring_claim(root, states, sizeof(states) / sizeof(states[0]), max_jobs, uuids_out, uuid_out_len,
+                              states_out, levels_out, tenants_out);
+    }
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]) && count < max_jobs; ++i) {
+        size_t claimed = 0;
+        jq_result_t result = jq_claim_in_state(root, tenants, states[i], max_jobs - count,
+                                               uuids_out + count * uuid_out_len, uuid_out_len,
+                                               levels_out + count, tenants_out + count, &claimed);
+        for (size_t j = 0; j < claimed; ++j) {
+            states_out[count + j] = states[i];
+        }
+        count += claimed;
+        if (result != JQ_OK && result != JQ_ERR_NOT_FOUND) {
+            if (count == 0) {
+                return result;
+            }
+            break;
+        }
+    }
+    if (count == 0 && !tenants) {
+        jq_ring_settle(root);
+    }
+
+    *count_out = count;
+    return count > 0 ? JQ_OK : JQ_ERR_NOT_FOUND;
+}
+
+static jq_result_t jq_claim_many(const jq_root_t *root,
+                                 const jq_claim_options_t *options,
+                                 size_t max_jobs,
+                                 char *uuids_out,
+                                 size_t uuid_out_len,
+                                 jq_state_t *states_out,
+                                 size_t *count_out) {
+    jq_claim_options_t defaults;
+    if (!options) {
+        jq_claim_options_init(&defaults);
+        options = &defaults;
+    }
+    jq_delay_promote(root->path, time(NULL));
+
+    /* levels[max_jobs..] holds the tenant lane each job came from. */
+    int *levels = malloc(2 * max_jobs * sizeof(*levels));
+    if (!levels) {
+        return JQ_ERR_IO;
+    }
+    int *lanes = levels + max_jobs;
+    jq_tenant_file_t *tenants = NULL;
+    if (jq_tenants_map(root->path, 0, NULL, &tenants) != JQ_OK) {
+        tenants = NULL;
+    }
+
+    size_t count = 0;
+    jq_result_t result = jq_claim_collect(root, options, tenants, max_jobs, uuids_out, uuid_out_len, states_out,
+                                          levels, lanes, &count);
+    if (result != JQ_OK) {
+        jq_tenants_unmap(tenants);
+        free(levels);
+        *count_out = 0;
+        return result;
+    }
+
+    /* Counted before any lease failure hands a job back, so the release's own update balances it. */
+    jq_stats_change_t changes[2] = {{.state = JQ_STATE_JOBS}, {.state = JQ_STATE_PRIORITY}};
+    for (size_t i = 0; i < count; ++i) {
+        jq_stats_change_t *change = &changes[states_out[i] == JQ_STATE_PRIORITY ? 1 : 0];
+        jq_stats_add_job(change, -1, 0, 0, 0, 0, 0);
+        jq_stats_add_job(change, 1, 1, 0, 0, 0, 0);
+    }
+    jq_stats_apply(root->path, changes, 2, 0);
+
+    size_t leased = 0;
+    for (size_t i = 0; i < count; ++i) {
+        char *uuid = uuids_out + i * uuid_out_len;
+        jq_file_t pdf_locked;
+        jq_file_t metadata_locked;
+        jq_job_sizes_t sizes;
+        memset(&sizes, 0, sizeof(sizes));
+        if (jq_pair_paths(root, uuid, states_out[i], 1, &pdf_locked, &metadata_locked) == JQ_OK) {
+            jq_job_sizes(&pdf_locked, &metadata_locked, NULL, &sizes);
+        }
+        result = jq_lease_write(root->path, uuid, states_out[i], levels[i], lanes[i], options->owner,
+                                options->lease_seconds, options->max_attempts, &sizes);
+        if (result != JQ_OK) {
+            /* A claim without a lease could only be recovered by hand, so give the job back. */
+            if (lanes[i] > 0) {
+                atomic_fetch_sub(&tenants->slots[lanes[i]].in_flight, 1);
+            }
+            (void)jq_release_at(root, uuid, states_out[i]);
+            continue;
+        }
+        (void)jq_event_append(root, JQ_EVENT_CLAIM, uuid, states_out[i], states_out[i],
+                              sizes.pdf + sizes.metadata);
+        if (leased != i) {
+            memmove(uuids_out + leased * uuid_out_len, uuid, uuid_out_len);
+            states_out[leased] = states_out[i];
+        }
+        leased++;
+    }
+    jq_tenants_unmap(tenants);
+    free(levels);
+
+    *count_out = leased;
+    return leased > 0 ? JQ_OK : result;
+}
+
+jq_result_t jq_claim(const char *root_path,
+                     const jq_claim_options_t *options,
+                     char *uuid_out,
+                     size_t uuid_out_len,
+                     jq_state_t *state_out) {
+    if (!root_path || !uuid_out || uuid_out_len == 0 || !state_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    size_t count = 0;
+    return jq_claim_many(&root, options, 1, uuid_out, uuid_out_len, state_out, &count);
+}
+
+jq_result_t jq_claim_batch(const char *root_path,
+                           const jq_claim_options_t *options,
+                           size_t max_jobs,
+                           char uuids_out[][JQ_UUID_MAX],
+                           jq_state_t *states_out,
+                           size_t *count_out) {
+    if (!root_path || max_jobs == 0 || !uuids_out || !states_out || !count_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_claim_many(&root, options, max_jobs, uuids_out[0], JQ_UUID_MAX, states_out, count_out);
+}
+
+jq_result_t jq_claim_next(const char *root_path,
+                          int prefer_priority,
+                          char *uuid_out,
+                          size_t uuid_out_len,
+                          jq_state_t *state_out) {
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.prefer_priority = prefer_priority;
+    return jq_claim(root_path, &options, uuid_out, uuid_out_len, state_out);
+}
+
+static int64_t jq_monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+#if defined(__linux__)
+/*
+ * A job becomes claimable when its files are renamed into a state directory
+ * or when its record is appended to a ready log; the log covers sharded and
+ * job-directory roots, whose files land in subdirectories inotify does not
+ * see. Temp files and other workers' claims (.lock) are not worth a wakeup.
+ */
+static int jq_claim_wait_event_wakes(const struct inotify_event *event, int index_wd) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        return 1;
+    }
+    if (event->len == 0) {
+        return 0;
+    }
+    if (event->wd == index_wd) {
+        return jq_has_suffix(event->name, ".ready");
+    }
+    return jq_has_suffix(event->name, ".job");
+}
+
+static int jq_claim_wait_open(const char *root_path, int *index_wd_out) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        if (!jq_build_dir_path(root_path, jq_state_dir(states[i]), path, sizeof(path)) ||
+            inotify_add_watch(fd, path, IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    (void)jq_ensure_index_dir(root_path);
+    *index_wd_out = -1;
+    if (jq_build_dir_path(root_path, JQ_INDEX_DIR, path, sizeof(path))) {
+        *index_wd_out = inotify_add_watch(fd, path, IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+    }
+    return fd;
+}
+
+/* Waits up to timeout_ms (forever when negative) for an event that may mean a new job; 0 on timeout. */
+static int jq_claim_wait_event(int fd, int index_wd, int timeout_ms) {
+    int64_t deadline = timeout_ms >= 0 ? jq_monotonic_ms() + timeout_ms : -1;
+    _Alignas(struct inotify_event) char buffer[4096];
+    while (1) {
+        int remaining = -1;
+        if (deadline >= 0) {
+            int64_t left = deadline - jq_monotonic_ms();
+            remaining = left > 0 ? (int)left : 0;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, remaining);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return 0;
+        }
+
+        int wakes = 0;
+        ssize_t bytes;
+        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char *cursor = buffer; cursor < buffer + bytes;) {
+                const struct inotify_event *event = (const struct inotify_event *)cursor;
+                wakes |= jq_claim_wait_event_wakes(event, index_wd);
+                cursor += sizeof(*event) + event->len;
+            }
+        }
+        if (wakes) {
+            return 1;
+        }
+    }
+}
+#endif
+
+/*
+ * Blocking claim: the watches go up before the first attempt, so a job
+ * submitted between a failed attempt and the wait still wakes the caller.
+ * Every wakeup is followed by a real claim, which may lose to another worker
+ * and go back to waiting. Without inotify the wait falls back to polling.
+ */
+static jq_result_t jq_claim_wait_many(const jq_root_t *root,
+                                      const jq_claim_options_t *options,
+                                      int timeout_ms,
+                                      size_t max_jobs,
+                                      char *uuids_out,
+                                      size_t uuid_out_len,
+                                      jq_state_t *states_out,
+                                      size_t *count_out) {
+    int64_t deadline = timeout_ms >= 0 ? jq_monotonic_ms() + timeout_ms : -1;
+    int fd = -1;
+    int index_wd = -1;
+#if defined(__linux__)
+    if (timeout_ms != 0) {
+        fd = jq_claim_wait_open(root->path, &index_wd);
+    }
+#endif
+
+    jq_result_t result;
+    while (1) {
+        result = jq_claim_many(root, options, max_jobs, uuids_out, uuid_out_len, states_out, count_out);
+        if (result != JQ_ERR_NOT_FOUND) {
+            break;
+        }
+        int remaining = -1;
+        if (deadline >= 0) {
+            int64_t left = deadline - jq_monotonic_ms();
+            if (left <= 0) {
+                break;
+            }
+            remaining = (int)left;
+        }
+        /* A job backing off becomes claimable without any file event, so wake when it is due. */
+        time_t due = jq_delay_next(root->path);
+        if (due > 0) {
+            int64_t until_due = ((int64_t)due - (int64_t)time(NULL)) * 1000;
+            if (until_due < 0) {
+                until_due = 0;
+            }
+            if (remaining < 0 || until_due < remaining) {
+                remaining = (int)until_due;
+            }
+        }
+#if defined(__linux__)
+        if (fd >= 0) {
+            (void)jq_claim_wait_event(fd, index_wd, remaining);
+            continue;
+        }
+#endif
+        if (remaining < 0 || remaining > JQ_CLAIM_WAIT_POLL_MS) {
+            remaining = JQ_CLAIM_WAIT_POLL_MS;
+        }
+        struct timespec pause = {.tv_sec = remaining / 1000, .tv_nsec = (long)(remaining % 1000) * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return result;
+}
+
+jq_result_t jq_claim_wait(const char *root_path,
+                          int prefer_priority,
+                          int timeout_ms,
+                          char *uuid_out,
+                          size_t uuid_out_len,
+                          jq_state_t *state_out) {
+    if (!root_path || !uuid_out || uuid_out_len == 0 || !state_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.prefer_priority = prefer_priority;
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    size_t count = 0;
+    return jq_claim_wait_many(&root, &options, timeout_ms, 1, uuid_out, uuid_out_len, state_out, &count);
+}
+
+jq_result_t jq_claim_batch_wait(const char *root_path,
+                                const jq_claim_options_t *options,
+                                int timeout_ms,
+                                size_t max_jobs,
+                                char uuids_out[][JQ_UUID_MAX],
+                                jq_state_t *states_out,
+                                size_t *count_out) {
+    if (!root_path || max_jobs == 0 || !uuids_out || !states_out || !count_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_claim_wait_many(&root, options, timeout_ms, max_jobs, uuids_out[0], JQ_UUID_MAX, states_out,
+                              count_out);
+}
+
+/*
+ * Deletes a locked job outright, for cancellation. counted_locked says
+ * whether the stats file already counts it as locked (it was claimed) or
+ * still as waiting (jq_cancel locked it only to delete it). The metadata
+ * goes first so a crash part way leaves an orphan PDF for the stats scan
+ * rather than a job that looks runnable.
+ */
+static jq_result_t jq_discard_at(const jq_root_t *root, const char *uuid, jq_state_t state, int counted_locked) {
+    const char *root_path = root->path;
+    jq_file_t pdf_locked;
+    jq_file_t metadata_locked;
+    jq_file_t report_locked;
+    jq_result_t locked_result = jq_pair_paths(root, uuid, state, 1, &pdf_locked, &metadata_locked);
+    if (locked_result != JQ_OK) {
+        return locked_result;
+    }
+    jq_result_t report_result = jq_report_path(root, uuid, state, 1, &report_locked);
+    if (report_result != JQ_OK) {
+        return report_result;
+    }
+
+    jq_job_sizes_t sizes;
+    jq_job_sizes(&pdf_locked, &metadata_locked, NULL, &sizes);
+    jq_job_sizes_t claimed = sizes;
+    int level = 0;
+    int tenant = 0;
+    int leased = jq_lease_claimed(root_path, uuid, &claimed, &level, &tenant);
+
+    if (unlinkat(metadata_locked.dirfd, metadata_locked.name, 0) != 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    (void)unlinkat(pdf_locked.dirfd, pdf_locked.name, 0);
+    (void)unlinkat(report_locked.dirfd, report_locked.name, 0);
+    jq_remove_job_dir(&pdf_locked);
+
+    jq_stats_change_t change = {.state = state};
+    if (counted_locked) {
+        jq_stats_add_job(&change, -1, 1, claimed.pdf, claimed.metadata, 0, 0);
+    } else {
+        jq_stats_add_job(&change, -1, 0, sizes.pdf, sizes.metadata, 0, 0);
+    }
+    jq_stats_apply(root_path, &change, 1, 0);
+
+    jq_lease_remove(root_path, uuid);
+    if (leased) {
+        jq_tenant_settle(root_path, tenant);
+    }
+    jq_attempts_remove(root_path, uuid);
+    jq_status_index_clear(root_path, uuid);
+    (void)jq_event_append(root, JQ_EVENT_CANCEL, uuid, state, -1, sizes.pdf + sizes.metadata);
+    return JQ_OK;
+}
+
+static jq_result_t jq_release_at(const jq_root_t *root, const char *uuid, jq_state_t state) {
+    const char *root_path = root->path;
+    jq_result_t ensure_result = jq_root_ensure_state_dir(root, state);
+    if (ensure_result != JQ_OK) {
+        return ensure_result;
+    }
+    if (jq_lease_cancelled(root_path, uuid)) {
+        /* A worker giving back a cancelled job ends it instead of requeueing it. */
+        return jq_discard_at(root, uuid, state, 1);
+    }
+
+    jq_file_t pdf_locked;
+    jq_file_t metadata_locked;
+    jq_file_t pdf_dest;
+    jq_file_t metadata_dest;
+    jq_file_t report_locked;
+    jq_file_t report_dest;
+
+    jq_result_t locked_result = jq_pair_paths(root, uuid, state, 1, &pdf_locked, &metadata_locked);
+    if (locked_result != JQ_OK) {
+        return locked_result;
+    }
+
+    jq_result_t dest_result = jq_pair_paths(root, uuid, state, 0, &pdf_dest, &metadata_dest);
+    if (dest_result != JQ_OK) {
+        return dest_result;
+    }
+
+    jq_result_t report_locked_result = jq_report_path(root, uuid, state, 1, &report_locked);
+    if (report_locked_result != JQ_OK) {
+        return report_locked_result;
+    }
+
+    jq_result_t report_dest_result = jq_report_path(root, uuid, state, 0, &report_dest);
+    if (report_dest_result != JQ_OK) {
+        return report_dest_result;
+    }
+
+    jq_journal_t journal;
+    jq_result_t journal_result = jq_journal_begin(root, uuid, state, 1, state, &journal);
+    if (journal_result != JQ_OK) {
+        return journal_result;
+    }
+    jq_result_t release_result =
+        jq_move_job_files(&pdf_locked, &metadata_locked, &report_locked, &pdf_dest, &metadata_dest, &report_dest);
+    jq_journal_end(root, &journal);
+    if (release_result != JQ_OK) {
+        return release_result;
+    }
+
+    jq_job_sizes_t sizes;
+    jq_job_sizes(&pdf_dest, &metadata_dest, &report_dest, &sizes);
+    jq_job_sizes_t claimed = sizes;
+    int level = jq_state_default_level(state);
+    int tenant = 0;
+    (void)jq_lease_claimed(root_path, uuid, &claimed, &level, &tenant);
+    jq_stats_change_t change = {.state = state};
+    jq_stats_add_job(&change, -1, 1, claimed.pdf, claimed.metadata, 0, 0);
+    jq_stats_add_job(&change, 1, 0, sizes.pdf, sizes.metadata, sizes.has_report, sizes.report);
+    jq_stats_apply(root_path, &change, 1, 0);
+    jq_status_index_set(root_path, uuid, state, 0);
+
+    jq_lease_remove(root_path, uuid);
+    jq_tenant_settle(root_path, tenant);
+    (void)jq_event_append(root, JQ_EVENT_RELEASE, uuid, state, state, sizes.pdf + sizes.metadata);
+    (void)jq_ready_append(root_path, tenant, jq_level_state(level) == state ? level : jq_state_default_level(state),
+                          uuid, sizes.pdf);
+    return JQ_OK;
+}
+
+jq_result_t jq_release(const char *root_path,
+                       const char *uuid,
+                       jq_state_t state) {
+    if (!root_path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_release_at(&root, uuid, state);
+}
+
+static jq_result_t jq_finalize_at(const jq_root_t *root,
+                                  const char *uuid,
+                                  jq_state_t from_state,
+                                  jq_state_t to_state) {
+    const char *root_path = root->path;
+    jq_result_t ensure_result = jq_root_ensure_state_dir(root, to_state);
+    if (ensure_result != JQ_OK) {
+        return ensure_result;
+    }
+
+    jq_file_t pdf_locked;
+    jq_file_t metadata_locked;
+    jq_file_t pdf_dest;
+    jq_file_t metadata_dest;
+    jq_file_t report_locked;
+    jq_file_t report_dest;
+
+    jq_result_t locked_result = jq_pair_paths(root, uuid, from_state, 1, &pdf_locked, &metadata_locked);
+    if (locked_result != JQ_OK) {
+        return locked_result;
+    }
+
+    jq_result_t dest_result = jq_pair_paths(root, uuid, to_state, 0, &pdf_dest, &metadata_dest);
+    if (dest_result != JQ_OK) {
+        return dest_result;
+    }
+
+    jq_result_t report_locked_result = jq_report_path(root, uuid, from_state, 1, &report_locked);
+    if (report_locked_result != JQ_OK) {
+        return report_locked_result;
+    }
+
+    jq_result_t report_dest_result = jq_report_path(root, uuid, to_state, 0, &report_dest);
+    if (report_dest_result != JQ_OK) {
+        return report_dest_result;
+    }
+
+    jq_journal_t journal;
+    jq_result_t journal_result = jq_journal_begin(root, uuid, from_state, 1, to_state, &journal);
+    if (journal_result != JQ_OK) {
+        return journal_result;
+    }
+    jq_result_t move_result =
+        jq_move_job_files(&pdf_locked, &metadata_locked, &report_locked, &pdf_dest, &metadata_dest, &report_dest);
+    jq_journal_end(root, &journal);
+    if (move_result != JQ_OK) {
+        return move_result;
+    }
+
+    jq_job_sizes_t sizes;
+    jq_job_sizes(&pdf_dest, &metadata_dest, &report_dest, &sizes);
+    jq_job_sizes_t claimed = sizes;
+    int level = 0;
+    int tenant = 0;
+    (void)jq_lease_claimed(root_path, uuid, &claimed, &level, &tenant);
+    jq_stats_change_t changes[2] = {{.state = from_state}, {.state = to_state}};
+    jq_stats_add_job(&changes[0], -1, 1, claimed.pdf, claimed.metadata, 0, 0);
+    jq_stats_add_job(&changes[1], 1, 0, sizes.pdf, sizes.metadata, sizes.has_report, sizes.report);
+    jq_stats_apply(root_path, changes, 2, sizes.mtime);
+    jq_status_index_set(root_path, uuid, to_state, 0);
+
+    jq_lease_remove(root_path, uuid);
+    jq_tenant_settle(root_path, tenant);
+    jq_attempts_remove(root_path, uuid);
+    (void)jq_event_append(root, JQ_EVENT_FINALIZE, uuid, from_state, to_state, sizes.pdf + sizes.metadata);
+    return JQ_OK;
+}
+
+jq_result_t jq_finalize(const char *root_path,
+                        const char *uuid,
+                        jq_state_t from_state,
+                        jq_state_t to_state) {
+    if (!root_path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    return jq_finalize_at(&root, uuid, from_state, to_state);
+}
+
+/*
+ * Cancellation: a waiting job is locked the way a claim would lock it and
+ * then deleted, so no claimer can take it halfway. A job backing off under
+ * the retry owner has no worker either and goes the same way once its lease
+ * is pulled out of the delay wheel's reach. A job a worker holds only gets
+ * the cancelled flag in its lease: the worker sees it through
+ * jq_cancel_watch, stops, and hands the job back with jq_release or
+ * jq_retry, which delete it. A worker that finishes first still finalizes
+ * its result, and an abandoned cancelled lease is deleted by the reaper.
+ */
+static jq_result_t jq_lease_cancel(const jq_root_t *root, const char *uuid, jq_state_t state) {
+    char path[PATH_MAX];
+    char reaping_path[PATH_MAX];
+    if (!jq_lease_path(root->path, uuid, ".lease", path, sizeof(path)) ||
+        !jq_lease_path(root->path, uuid, ".reaping", reaping_path, sizeof(reaping_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    jq_lease_record_t record;
+    if (pread(fd, &record, sizeof(record), 0) != (ssize_t)sizeof(record) || !jq_lease_record_valid(&record)) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+    if (record.state != (int32_t)state) {
+        close(fd);
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    if (strncmp(record.owner, JQ_RETRY_OWNER, sizeof(record.owner)) == 0) {
+        close(fd);
+        if (rename(path, reaping_path) != 0) {
+            return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+        }
+        jq_result_t result = jq_discard_at(root, uuid, state, 1);
+        unlink(reaping_path);
+        return result;
+    }
+
+    uint32_t cancelled = 1;
+    jq_result_t result = JQ_OK;
+    if (pwrite(fd, &cancelled, sizeof(cancelled), offsetof(jq_lease_record_t, cancelled)) !=
+        (ssize_t)sizeof(cancelled)) {
+        result = JQ_ERR_IO;
+    }
+    close(fd);
+    return result;
+}
+
+jq_result_t jq_cancel(const char *root_path, const char *uuid) {
+    if (!root_path || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    /* Each pass looks again after losing a race with a claim, release or reap of the same job. */
+    for (int attempt = 0; attempt < JQ_CANCEL_ATTEMPTS; ++attempt) {
+        jq_state_t state = JQ_STATE_JOBS;
+        int locked = 0;
+        jq_result_t result = jq_status_at(&root, uuid, 0, &state, &locked);
+        if (result != JQ_OK) {
+            return result;
+        }
+        if (state != JQ_STATE_JOBS && state != JQ_STATE_PRIORITY) {
+            return JQ_ERR_NOT_FOUND;
+        }
+
+        if (!locked) {
+            result = jq_claim_pair(&root, uuid, state);
+            if (result == JQ_OK) {
+                return jq_discard_at(&root, uuid, state, 0);
+            }
+        } else {
+            result = jq_lease_cancel(&root, uuid, state);
+            if (result == JQ_ERR_NOT_FOUND) {
+                /* Locked but not leased yet: the claim is still writing its lease. */
+                struct timespec pause = {0, 1000000L};
+                nanosleep(&pause, NULL);
+            }
+        }
+        if (result != JQ_ERR_NOT_FOUND) {
+            return result;
+        }
+    }
+    return JQ_ERR_IO;
+}
+
+/* Maps a job's lease shared, read-only unless writable is set. */
+static jq_result_t jq_lease_map(const char *root_path, const char *uuid, int writable, jq_lease_record_t **out) {
+    char path[PATH_MAX];
+    if (!jq_lease_path(root_path, uuid, ".lease", path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(jq_lease_record_t)) {
+        base = mmap(NULL, sizeof(jq_lease_record_t), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                    fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+    if (!jq_lease_record_valid(base)) {
+        munmap(base, sizeof(jq_lease_record_t));
+        return JQ_ERR_IO;
+    }
+    *out = base;
+    return JQ_OK;
+}
+
+struct jq_cancel_watch {
+    const jq_lease_record_t *record;
+};
+
+jq_cancel_watch_t *jq_cancel_watch(const char *root_path, const char *uuid) {
+    jq_lease_record_t *record = NULL;
+    if (!root_path || !uuid || jq_lease_map(root_path, uuid, 0, &record) != JQ_OK) {
+        return NULL;
+    }
+    jq_cancel_watch_t *watch = malloc(sizeof(*watch));
+    if (!watch) {
+        munmap(record, sizeof(jq_lease_record_t));
+        return NULL;
+    }
+    watch->record = record;
+    return watch;
+}
+
+/* One load from the mapped lease, cheap enough to call for every chunk a scanner reads. */
+int jq_cancel_requested(const jq_cancel_watch_t *watch) {
+    return watch && atomic_load_explicit(&watch->record->cancelled, memory_order_relaxed) != 0;
+}
+
+void jq_cancel_unwatch(jq_cancel_watch_t *watch) {
+    if (!watch) {
+        return;
+    }
+    munmap((void *)watch->record, sizeof(jq_lease_record_t));
+    free(watch);
+}
+
+static int64_t jq_wall_clock_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+struct jq_progress_slot {
+    jq_lease_record_t *record;
+};
+
+jq_progress_slot_t *jq_progress_begin(const char *root_path,
+                                      const char *uuid,
+                                      const char *phase,
+                                      unsigned long long bytes_total) {
+    jq_lease_record_t *record = NULL;
+    if (!root_path || !uuid || !phase || phase[0] == '\0' || jq_lease_map(root_path, uuid, 1, &record) != JQ_OK) {
+        return NULL;
+    }
+    jq_progress_slot_t *slot = malloc(sizeof(*slot));
+    if (!slot) {
+        munmap(record, sizeof(jq_lease_record_t));
+        return NULL;
+    }
+    slot->record = record;
+
+    uint32_t seq = atomic_load_explicit(&record->progress_seq, memory_order_relaxed);
+    atomic_store_explicit(&record->progress_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(record->phase, 0, sizeof(record->phase));
+    snprintf(record->phase, sizeof(record->phase), "%s", phase);
+    record->bytes_total = (uint64_t)bytes_total;
+    atomic_store_explicit(&record->bytes_done, 0, memory_order_relaxed);
+    record->progress_started_ms = jq_wall_clock_ms();
+    atomic_store_explicit(&record->progress_seq, seq + 2, memory_order_release);
+    return slot;
+}
+
+/* One store into the mapped lease, cheap enough to call for every chunk a scanner reads. */
+void jq_progress_update(jq_progress_slot_t *slot, unsigned long long bytes_done) {
+    if (slot) {
+        atomic_store_explicit(&slot->record->bytes_done, (uint64_t)bytes_done, memory_order_relaxed);
+    }
+}
+
+void jq_progress_end(jq_progress_slot_t *slot) {
+    if (!slot) {
+        return;
+    }
+    munmap(slot->record, sizeof(jq_lease_record_t));
+    free(slot);
+}
+
+/*
+ * Throughput is the average since the phase began, and the ETA assumes it
+ * holds for the rest of the phase; eta_seconds is -1 until there is a rate
+ * to go on.
+ */
+jq_result_t jq_status_progress(const char *root_path, const char *uuid, jq_progress_t *progress_out) {
+    if (!root_path || !uuid || !progress_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_lease_record_t *record = NULL;
+    jq_result_t result = jq_lease_map(root_path, uuid, 0, &record);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    /* Retry while the worker is between phases so phase, total and start always belong together. */
+    char phase[JQ_PHASE_MAX];
+    uint64_t bytes_total = 0;
+    int64_t started_ms = 0;
+    uint32_t seq = 0;
+    do {
+        seq = atomic_load_explicit(&record->progress_seq, memory_order_acquire);
+        if (seq & 1u) {
+            sched_yield();
+            continue;
+        }
+        memcpy(phase, record->phase, sizeof(phase));
+        bytes_total = record->bytes_total;
+        started_ms = record->progress_started_ms;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1u) || atomic_load_explicit(&record->progress_seq, memory_order_relaxed) != seq);
+    uint64_t bytes_done = atomic_load_explicit(&record->bytes_done, memory_order_relaxed);
+    munmap(record, sizeof(jq_lease_record_t));
+    if (started_ms <= 0) {
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    memset(progress_out, 0, sizeof(*progress_out));
+    memcpy(progress_out->phase, phase, sizeof(progress_out->phase));
+    progress_out->phase[sizeof(progress_out->phase) - 1] = '\0';
+    progress_out->bytes_done = bytes_done;
+    progress_out->bytes_total = bytes_total;
+    progress_out->started_at = (time_t)(started_ms / 1000);
+    progress_out->eta_seconds = -1;
+
+    int64_t elapsed_ms = jq_wall_clock_ms() - started_ms;
+    if (elapsed_ms > 0) {
+        progress_out->bytes_per_second =
+            (unsigned long long)((double)progress_out->bytes_done * 1000.0 / (double)elapsed_ms);
+    }
+    if (progress_out->bytes_per_second > 0 && progress_out->bytes_total >= progress_out->bytes_done) {
+        unsigned long long remaining = progress_out->bytes_total - progress_out->bytes_done;
+        progress_out->eta_seconds =
+            (long long)((remaining + progress_out->bytes_per_second - 1) / progress_out->bytes_per_second);
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_reap_lease(const char *root_path, const char *uuid, time_t now, size_t *requeued) {
+    char path[PATH_MAX];
+    char reaping_path[PATH_MAX];
+    if (!jq_lease_path(root_path, uuid, ".lease", path, sizeof(path)) ||
+        !jq_lease_path(root_path, uuid, ".reaping", reaping_path, sizeof(reaping_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_lease_record_t record;
+    jq_result_t read_result = jq_lease_read(path, &record);
+    if (read_result == JQ_ERR_NOT_FOUND) {
+        return JQ_OK;
+    }
+    if (read_result != JQ_OK) {
+        /* Unreadable lease: drop it and let the unleased pass pick the job up once its lock ages. */
+        unlink(path);
+        return JQ_OK;
+    }
+    if ((time_t)record.expires_at > now) {
+        return JQ_OK;
+    }
+
+    /* Take the lease out of play first so a racing finalize or release cannot be undone. */
+    if (rename(path, reaping_path) != 0) {
+        return errno == ENOENT ? JQ_OK : JQ_ERR_IO;
+    }
+    if (jq_lease_read(reaping_path, &record) == JQ_OK && (time_t)record.expires_at > now) {
+        /* A heartbeat landed between the read and the rename. */
+        return jq_rename_path(reaping_path, path);
+    }
+
+    /*
+     * A lease that ran out under a worker, not a backoff, is a failed attempt; too many dead-letter the job.
+     * A cancelled job is dropped by the release instead.
+     */
+    int cancelled = atomic_load(&record.cancelled) != 0;
+    int dead_letter = 0;
+    if (!cancelled && strncmp(record.owner, JQ_RETRY_OWNER, sizeof(record.owner)) != 0) {
+        unsigned int recorded = 0;
+        unsigned int attempts = jq_attempts_read(root_path, uuid, &recorded) + 1;
+        unsigned int max_attempts = jq_retry_limit(0, record.max_attempts, recorded);
+        dead_letter = attempts >= max_attempts;
+        if (!dead_letter) {
+            (void)jq_attempts_write(root_path, uuid, attempts, max_attempts);
+        }
+    }
+
+    jq_result_t release_result = dead_letter
+                                     ? jq_finalize(root_path, uuid, (jq_state_t)record.state, JQ_STATE_ERROR)
+                                     : jq_release(root_path, uuid, (jq_state_t)record.state);
+    if (release_result != JQ_OK && release_result != JQ_ERR_NOT_FOUND) {
+        (void)jq_rename_path(reaping_path, path);
+        return release_result;
+    }
+    unlink(reaping_path);
+    if (release_result == JQ_OK && !dead_letter && !cancelled) {
+        (*requeued)++;
+    }
+    return JQ_OK;
+}
+
+/*
+ * Delay wheel: a job backing off after a failure stays locked under a lease
+ * owned by JQ_RETRY_OWNER that expires at its not_before time, so no claim
+ * can see it early. The wheel files it under .jq/delay/<not_before>.delay,
+ * and .jq/delay/next holds the earliest pending second. Claims compare that
+ * against the clock and, once a second has passed, reap the leases filed
+ * under it, which puts the jobs back on their ready logs. jq_reap_expired
+ * releases the same leases if the wheel is ever lost.
+ */
+static int jq_delay_path(const char *root_path, const char *name, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_DELAY_DIR, name);
+    return written >= 0 && (size_t)written < out_len;
+}
+
+static time_t jq_delay_read_cursor(int fd) {
+    int64_t next = 0;
+    if (pread(fd, &next, sizeof(next), 0) != (ssize_t)sizeof(next)) {
+        return 0;
+    }
+    return (time_t)next;
+}
+
+static time_t jq_delay_next(const char *root_path) {
+    char path[PATH_MAX];
+    if (!jq_delay_path(root_path, JQ_DELAY_CURSOR_FILE, path, sizeof(path))) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    time_t next = jq_delay_read_cursor(fd);
+    close(fd);
+    return next;
+}
+
+static jq_result_t jq_delay_schedule(const char *root_path, const char *uuid, time_t due) {
+    char name[64];
+    snprintf(name, sizeof(name), "%lld.delay", (long long)due);
+    char bucket_path[PATH_MAX];
+    char cursor_path[PATH_MAX];
+    if (!jq_delay_path(root_path, name, bucket_path, sizeof(bucket_path)) ||
+        !jq_delay_path(root_path, JQ_DELAY_CURSOR_FILE, cursor_path, sizeof(cursor_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    jq_ready_record_t record;
+    if (!jq_ready_fill_record(&record, uuid, strlen(uuid))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    record.enqueued_at = (int64_t)due;
+
+    int fd = open(bucket_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        char dir_path[PATH_MAX];
+        if (jq_ensure_index_dir(root_path) != JQ_OK ||
+            !jq_build_index_path(root_path, JQ_DELAY_DIR, dir_path, sizeof(dir_path)) ||
+            jq_ensure_dir(dir_path) != JQ_OK) {
+            return JQ_ERR_IO;
+        }
+        fd = open(bucket_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    }
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = jq_write_all(fd, &record, sizeof(record));
+    close(fd);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    /* The record is in place before the cursor points at it, so a promotion never skips it. */
+    int cursor_fd = open(cursor_path, O_RDWR | O_CREAT, 0644);
+    if (cursor_fd < 0) {
+        return JQ_ERR_IO;
+    }
+    if (flock(cursor_fd, LOCK_EX) != 0) {
+        close(cursor_fd);
+        return JQ_ERR_IO;
+    }
+    time_t next = jq_delay_read_cursor(cursor_fd);
+    if (next == 0 || due < next) {
+        int64_t value = (int64_t)due;
+        if (pwrite(cursor_fd, &value, sizeof(value), 0) != (ssize_t)sizeof(value)) {
+            result = JQ_ERR_IO;
+        }
+    }
+    close(cursor_fd);
+    return result;
+}
+
+static void jq_delay_promote_bucket(const char *root_path, int dir_fd, const char *name, time_t now) {
+    int fd = openat(dir_fd, name, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    jq_ready_record_t record;
+    size_t promoted = 0;
+    while (read(fd, &record, sizeof(record)) == (ssize_t)sizeof(record)) {
+        if (!jq_ready_record_valid(&record)) {
+            continue;
+        }
+        record.uuid[record.uuid_len] = '\0';
+        /* Reaping checks the lease first, so a stale record cannot release a job claimed since. */
+        (void)jq_reap_lease(root_path, record.uuid, now, &promoted);
+    }
+    close(fd);
+    unlinkat(dir_fd, name, 0);
+}
+
+static void jq_delay_promote(const char *root_path, time_t now) {
+    time_t next = jq_delay_next(root_path);
+    if (next == 0 || next > now) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    if (!jq_delay_path(root_path, JQ_DELAY_CURSOR_FILE, path, sizeof(path))) {
+        return;
+    }
+    int cursor_fd = open(path, O_RDWR);
+    if (cursor_fd < 0) {
+        return;
+    }
+    /* One promoter at a time; the others skip rather than queue up behind it. */
+    if (flock(cursor_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(cursor_fd);
+        return;
+    }
+    next = jq_delay_read_cursor(cursor_fd);
+    char *slash = strrchr(path, '/');
+    *slash = '\0';
+    DIR *dir = next != 0 && next <= now ? opendir(path) : NULL;
+    if (dir) {
+        time_t earliest = 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!jq_has_suffix(entry->d_name, ".delay")) {
+                continue;
+            }
+            char *end = NULL;
+            long long due = strtoll(entry->d_name, &end, 10);
+            if (!end || strcmp(end, ".delay") != 0) {
+                continue;
+            }
+            if ((time_t)due <= now) {
+                jq_delay_promote_bucket(root_path, dirfd(dir), entry->d_name, now);
+            } else if (earliest == 0 || (time_t)due < earliest) {
+                earliest = (time_t)due;
+            }
+        }
+        closedir(dir);
+        int64_t value = (int64_t)earliest;
+        (void)pwrite(cursor_fd, &value, sizeof(value), 0);
+    }
+    close(cursor_fd);
+}
+
+void jq_retry_options_init(jq_retry_options_t *options) {
+    if (!options) {
+        return;
+    }
+    memset(options, 0, sizeof(*options));
+    options->max_attempts = JQ_RETRY_DEFAULT_ATTEMPTS;
+    options->base_delay_seconds = JQ_RETRY_DEFAULT_BASE_SECONDS;
+    options->max_delay_seconds = JQ_RETRY_DEFAULT_MAX_SECONDS;
+}
+
+/* base * 2^(attempts - 1), capped, plus up to a quarter more from the uuid so failed batches spread out. */
+static unsigned int jq_retry_delay(const jq_retry_options_t *options, const char *uuid, unsigned int attempts) {
+    unsigned int delay = options->base_delay_seconds > 0 ? options->base_delay_seconds : 1;
+    unsigned int cap = options->max_delay_seconds > delay ? options->max_delay_seconds : delay;
+    for (unsigned int i = 1; i < attempts && delay < cap; ++i) {
+        delay = delay > cap / 2 ? cap : delay * 2;
+    }
+    return delay + jq_shard_hash(uuid) % (delay / 4 + 1);
+}
+
+jq_result_t jq_retry(const char *root_path,
+                     const char *uuid,
+                     jq_state_t state,
+                     const jq_retry_options_t *options,
+                     unsigned int *attempts_out,
+                     time_t *not_before_out) {
+    if (!root_path || !uuid || (state != JQ_STATE_JOBS && state != JQ_STATE_PRIORITY)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_retry_options_t defaults;
+    jq_retry_options_init(&defaults);
+    if (options) {
+        defaults.owner = options->owner;
+        defaults.base_delay_seconds = options->base_delay_seconds;
+        defaults.max_delay_seconds = options->max_delay_seconds;
+        defaults.max_attempts = options->max_attempts;
+    }
+    options = &defaults;
+
+    /* Only the worker holding the claim may give it back, and only once. */
+    char lease_path[PATH_MAX];
+    char expected[JQ_LEASE_OWNER_MAX];
+    jq_lease_record_t lease;
+    if (!jq_lease_path(root_path, uuid, ".lease", lease_path, sizeof(lease_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_lease_expected_owner(options->owner, expected, sizeof(expected));
+    jq_result_t lease_result = jq_lease_read(lease_path, &lease);
+    if (lease_result != JQ_OK) {
+        return lease_result;
+    }
+    if (lease.state != (int32_t)state || strncmp(lease.owner, expected, sizeof(lease.owner)) != 0) {
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    jq_file_t pdf_locked;
+    jq_file_t metadata_locked;
+    jq_result_t path_result = jq_pair_paths(&root, uuid, state, 1, &pdf_locked, &metadata_locked);
+    if (path_result != JQ_OK) {
+        return path_result;
+    }
+    if (faccessat(pdf_locked.dirfd, pdf_locked.name, F_OK, 0) != 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    unsigned int recorded = 0;
+    unsigned int attempts = jq_attempts_read(root_path, uuid, &recorded) + 1;
+    unsigned int max_attempts = jq_retry_limit(options->max_attempts, lease.max_attempts, recorded);
+    if (attempts_out) {
+        *attempts_out = attempts;
+    }
+    if (not_before_out) {
+        *not_before_out = 0;
+    }
+    if (jq_lease_cancelled(root_path, uuid)) {
+        return jq_discard_at(&root, uuid, state, 1);
+    }
+    if (attempts >= max_attempts) {
+        return jq_finalize_at(&root, uuid, state, JQ_STATE_ERROR);
+    }
+
+    /* The new lease keeps the claim-time sizes, level and tenant so the release later balances them. */
+    jq_job_sizes_t sizes;
+    memset(&sizes, 0, sizeof(sizes));
+    int level = jq_state_default_level(state);
+    int tenant = 0;
+    (void)jq_lease_claimed(root_path, uuid, &sizes, &level, &tenant);
+    unsigned int delay = jq_retry_delay(options, uuid, attempts);
+    jq_result_t result = jq_attempts_write(root_path, uuid, attempts, max_attempts);
+    if (result == JQ_OK) {
+        result =
+            jq_lease_write(root_path, uuid, state, level, tenant, JQ_RETRY_OWNER, delay, max_attempts, &sizes);
+    }
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    time_t not_before = time(NULL) + (time_t)delay;
+    (void)jq_delay_schedule(root_path, uuid, not_before);
+    (void)jq_event_append(&root, JQ_EVENT_RETRY, uuid, state, state, sizes.pdf + sizes.metadata);
+    if (not_before_out) {
+        *not_before_out = not_before;
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_reap_unleased(const char *root_path, jq_state_t state, time_t now, size_t *requeued) {
+    jq_dir_iter_t iter;
+    jq_result_t open_result = jq_dir_iter_open(&iter, root_path, state);
+    if (open_result != JQ_OK) {
+        return open_result == JQ_ERR_NOT_FOUND ? JQ_OK : open_result;
+    }
+
+    const char *suffix = ".pdf.job.lock";
+    const size_t suffix_len = strlen(suffix);
+    jq_result_t result = JQ_OK;
+    const char *name;
+    while ((name = jq_dir_iter_next(&iter)) != NULL) {
+        if (!jq_has_suffix(name, suffix)) {
+            continue;
+        }
+        char uuid[NAME_MAX + 1];
+        size_t uuid_len = strlen(name) - suffix_len;
+        if (uuid_len == 0) {
+            continue;
+        }
+        memcpy(uuid, name, uuid_len);
+        uuid[uuid_len] = '\0';
+
+        char lease_path[PATH_MAX];
+        char reaping_path[PATH_MAX];
+        if (!jq_lease_path(root_path, uuid, ".lease", lease_path, sizeof(lease_path)) ||
+            !jq_lease_path(root_path, uuid, ".reaping", reaping_path, sizeof(reaping_path)) ||
+            access(lease_path, F_OK) == 0 || access(reaping_path, F_OK) == 0) {
+            continue;
+        }
+
+        /* Rename updates ctime, so it marks when the job was claimed. */
+        struct stat st;
+        if (jq_dir_iter_stat_job(&iter, &st) != 0 ||
+            st.st_ctime + (time_t)JQ_LEASE_DEFAULT_SECONDS > now) {
+            continue;
+        }
+
+        jq_result_t release_result = jq_release(root_path, uuid, state);
+        if (release_result == JQ_OK) {
+            (*requeued)++;
+        } else if (release_result != JQ_ERR_NOT_FOUND && result == JQ_OK) {
+            result = release_result;
+        }
+    }
+
+    jq_dir_iter_close(&iter);
+    return result;
+}
+
+jq_result_t jq_reap_expired(const char *root_path,
+                            time_t now,
+                            size_t *requeued_out) {
+    if (!root_path) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (now == 0) {
+        now = time(NULL);
+    }
+
+    char dir_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_LEASE_DIR, dir_path, sizeof(dir_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    size_t requeued = 0;
+    jq_result_t result = JQ_OK;
+    DIR *dir = opendir(dir_path);
+    if (!dir && errno != ENOENT) {
+        return JQ_ERR_IO;
+    }
+    if (dir) {
+        const char *suffix = ".lease";
+        const size_t suffix_len = strlen(suffix);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!jq_has_suffix(entry->d_name, suffix)) {
+                continue;
+            }
+            char uuid[NAME_MAX + 1];
+            size_t uuid_len = strlen(entry->d_name) - suffix_len;
+            if (uuid_len == 0) {
+                continue;
+            }
+            memcpy(uuid, entry->d_name, uuid_len);
+            uuid[uuid_len] = '\0';
+
+            jq_result_t lease_result = jq_reap_lease(root_path, uuid, now, &requeued);
+            if (lease_result != JQ_OK && result == JQ_OK) {
+                result = lease_result;
+            }
+        }
+        closedir(dir);
+    }
+
+    /* Locks with no lease at all (a crash between claim and lease write) age out after the default lease. */
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        jq_result_t unleased_result = jq_reap_unleased(root_path, states[i], now, &requeued);
+        if (unleased_result != JQ_OK && result == JQ_OK) {
+            result = unleased_result;
+        }
+    }
+    jq_ready_reindex(root_path);
+    jq_retention_tick(root_path, now);
+
+    if (requeued_out) {
+        *requeued_out = requeued;
+    }
+    return result;
+}
+
+static int jq_stats_path(const char *root_path, char *out, size_t out_len) {
+    return jq_build_index_path(root_path, "stats", out, out_len);
+}
+
+static jq_result_t jq_stats_map(const char *root_path, jq_stats_file_t **stats_out) {
+    char path[PATH_MAX];
+    if (!jq_stats_path(root_path, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+    if ((size_t)st.st_size < sizeof(jq_stats_file_t)) {
+        close(fd);
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    jq_stats_file_t *stats = mmap(NULL, sizeof(jq_stats_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+    if (stats->magic != JQ_STATS_MAGIC || stats->version != JQ_STATS_VERSION) {
+        munmap(stats, sizeof(jq_stats_file_t));
+        return JQ_ERR_NOT_FOUND;
+    }
+
+    *stats_out = stats;
+    return JQ_OK;
+}
+
+static void jq_stats_apply(const char *root_path, const jq_stats_change_t *changes, size_t count, time_t mtime) {
+    jq_stats_file_t *stats = NULL;
+    if (jq_stats_map(root_path, &stats) != JQ_OK) {
+        /* No stats file yet: the next read builds one from a full scan. */
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t counter = 0; counter < JQ_STAT_COUNT; ++counter) {
+            if (changes[i].counters[counter] != 0) {
+                atomic_fetch_add(&stats->counters[changes[i].state][counter], changes[i].counters[counter]);
+            }
+        }
+    }
+
+    if (mtime > 0) {
+        int64_t value = (int64_t)mtime;
+        int64_t newest = atomic_load(&stats->newest_mtime);
+        while (value > newest && !atomic_compare_exchange_weak(&stats->newest_mtime, &newest, value)) {
+        }
+        int64_t oldest = atomic_load(&stats->oldest_mtime);
+        while ((oldest == 0 || value < oldest) &&
+               !atomic_compare_exchange_weak(&stats->oldest_mtime, &oldest, value)) {
+        }
+    }
+
+    munmap(stats, sizeof(jq_stats_file_t));
+}
+
+static void jq_stats_count_dropped_event(const char *root_path) {
+    jq_stats_file_t *stats = NULL;
+    if (jq_stats_map(root_path, &stats) == JQ_OK) {
+        atomic_fetch_add(&stats->events_dropped, 1);
+        munmap(stats, sizeof(jq_stats_file_t));
+    }
+}
+
+static void jq_stats_fill_counters(_Atomic int64_t *counters, const jq_state_stats_t *state_stats) {
+    atomic_store(&counters[JQ_STAT_PDF], (int64_t)state_stats->pdf_jobs);
+    atomic_store(&counters[JQ_STAT_METADATA], (int64_t)state_stats->metadata_jobs);
+    atomic_store(&counters[JQ_STAT_REPORT], (int64_t)state_stats->report_jobs);
+    atomic_store(&counters[JQ_STAT_PDF_LOCKED], (int64_t)state_stats->pdf_locked);
+    atomic_store(&counters[JQ_STAT_METADATA_LOCKED], (int64_t)state_stats->metadata_locked);
+    atomic_store(&counters[JQ_STAT_REPORT_LOCKED], (int64_t)state_stats->report_locked);
+    atomic_store(&counters[JQ_STAT_PDF_BYTES], (int64_t)state_stats->pdf_bytes);
+    atomic_store(&counters[JQ_STAT_METADATA_BYTES], (int64_t)state_stats->metadata_bytes);
+    atomic_store(&counters[JQ_STAT_REPORT_BYTES], (int64_t)state_stats->report_bytes);
+    atomic_store(&counters[JQ_STAT_ORPHAN_PDF], (int64_t)state_stats->orphan_pdf);
+    atomic_store(&counters[JQ_STAT_ORPHAN_METADATA], (int64_t)state_stats->orphan_metadata);
+    atomic_store(&counters[JQ_STAT_ORPHAN_REPORT], (int64_t)state_stats->orphan_report);
+}
+
+/*
+ * Overwrite the counters with a full scan. Operations that land while the
+ * scan runs may be counted twice or not at all; the next reconcile fixes that.
+ */
+static jq_result_t jq_stats_store(const char *root_path, const jq_stats_t *scan, time_t now) {
+    jq_stats_file_t *stats = NULL;
+    jq_result_t map_result = jq_stats_map(root_path, &stats);
+    if (map_result == JQ_OK) {
+        for (size_t state = 0; state <= JQ_STATE_ERROR; ++state) {
+            jq_stats_fill_counters(stats->counters[state], &scan->states[state]);
+        }
+        atomic_store(&stats->oldest_mtime, (int64_t)scan->oldest_mtime);
+        atomic_store(&stats->newest_mtime, (int64_t)scan->newest_mtime);
+        stats->oldest_waiting_mtime = (int64_t)scan->oldest_waiting_mtime;
+        stats->reconciled_at = (int64_t)now;
+        munmap(stats, sizeof(jq_stats_file_t));
+        return JQ_OK;
+    }
+    if (map_result != JQ_ERR_NOT_FOUND) {
+        return map_result;
+    }
+
+    jq_stats_file_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.magic = JQ_STATS_MAGIC;
+    snapshot.version = JQ_STATS_VERSION;
+    snapshot.reconciled_at = (int64_t)now;
+    snapshot.oldest_waiting_mtime = (int64_t)scan->oldest_waiting_mtime;
+    atomic_store(&snapshot.oldest_mtime, (int64_t)scan->oldest_mtime);
+    atomic_store(&snapshot.newest_mtime, (int64_t)scan->newest_mtime);
+    for (size_t state = 0; state <= JQ_STATE_ERROR; ++state) {
+        jq_stats_fill_counters(snapshot.counters[state], &scan->states[state]);
+    }
+
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_stats_path(root_path, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, "stats.tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_result_t ensure_result = jq_ensure_index_dir(root_path);
+    if (ensure_result != JQ_OK) {
+        return ensure_result;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = jq_write_all(fd, &snapshot, sizeof(snapshot));
+    if (close(fd) != 0 && result == JQ_OK) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+    }
+    return result;
+}
+
+/* Claimed jobs per tenant, counted from the leases (a lease being reaped still counts). */
+static int jq_tenant_count_leases(const char *root_path, int64_t *leased) {
+    char dir_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_LEASE_DIR, dir_path, sizeof(dir_path))) {
+        return 0;
+    }
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return errno == ENOENT;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!jq_has_suffix(entry->d_name, ".lease") && !jq_has_suffix(entry->d_name, ".reaping")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        jq_lease_record_t record;
+        int written = snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (written >= 0 && (size_t)written < sizeof(path) && jq_lease_read(path, &record) == JQ_OK &&
+            record.tenant < JQ_TENANT_MAX) {
+            leased[record.tenant]++;
+        }
+    }
+    closedir(dir);
+    return 1;
+}
+
+/*
+ * Per-tenant numbers: depth is what is left in the tenant's lanes (a stale
+ * record counts until a claim skips it) and in-flight is the table's count,
+ * which a reconcile rewrites from the leases. Outside a reconcile the lane
+ * heads also feed the oldest waiting job, as the untagged lanes do.
+ */
+static void jq_tenant_stats_fill(const char *root_path, jq_stats_t *stats, int reconcile) {
+    jq_tenant_file_t *file = NULL;
+    if (jq_tenants_map(root_path, 0, NULL, &file) != JQ_OK) {
+        return;
+    }
+    int64_t leased[JQ_TENANT_MAX] = {0};
+    int counted = reconcile && jq_tenant_count_leases(root_path, leased);
+
+    uint32_t count = jq_tenants_count(file);
+    for (uint32_t index = 1; index < count; ++index) {
+        jq_tenant_slot_t *slot = &file->slots[index];
+        jq_tenant_stats_t *tenant = &stats->tenants[stats->tenant_count++];
+        memcpy(tenant->name, slot->name, sizeof(tenant->name));
+        tenant->name[sizeof(tenant->name) - 1] = '\0';
+        tenant->max_in_flight = atomic_load(&slot->max_in_flight);
+        tenant->weight = atomic_load(&slot->weight);
+        if (counted) {
+            atomic_store(&slot->in_flight, leased[index]);
+        }
+        int64_t in_flight = atomic_load(&slot->in_flight);
+        tenant->in_flight = in_flight > 0 ? (size_t)in_flight : 0;
+
+        for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+            jq_ready_map_t map;
+            if (jq_ready_map(root_path, (int)index, level, &map) != JQ_OK) {
+                continue;
+            }
+            uint64_t head = atomic_load(&map.header->head);
+            if (head < map.count) {
+                tenant->depth += (size_t)(map.count - head);
+                time_t enqueued_at = (time_t)map.records[head].enqueued_at;
+                if (!reconcile && jq_ready_record_valid(&map.records[head]) && enqueued_at > 0 &&
+                    (stats->oldest_waiting_mtime == 0 || enqueued_at < stats->oldest_waiting_mtime)) {
+                    stats->oldest_waiting_mtime = enqueued_at;
+                }
+            }
+            jq_ready_unmap(&map);
+        }
+    }
+    jq_tenants_unmap(file);
+}
+
+static void jq_stats_finish(jq_stats_t *stats, time_t now) {
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        const jq_state_stats_t *state_stats = &stats->states[states[i]];
+        stats->total_jobs += state_stats->pdf_jobs + state_stats->metadata_jobs + state_stats->report_jobs;
+        stats->total_locked += state_stats->pdf_locked + state_stats->metadata_locked + state_stats->report_locked;
+        stats->total_orphans += state_stats->orphan_pdf + state_stats->orphan_metadata + state_stats->orphan_report;
+        stats->total_bytes += state_stats->pdf_bytes + state_stats->metadata_bytes + state_stats->report_bytes;
+    }
+
+    if (stats->oldest_waiting_mtime > 0 && now > stats->oldest_waiting_mtime) {
+        stats->oldest_waiting_age_seconds = (unsigned long long)(now - stats->oldest_waiting_mtime);
+    }
+}
+
+static uint32_t jq_journal_checksum(const jq_journal_record_t *record) {
+    jq_journal_record_t copy = *record;
+    copy.checksum = 0;
+    uint32_t hash = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *)&copy;
+    for (size_t i = 0; i < sizeof(copy); ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int jq_journal_record_valid(const jq_journal_record_t *record) {
+    return record->magic == JQ_JOURNAL_RECORD_MAGIC && record->uuid_len > 0 &&
+           record->uuid_len < JQ_JOURNAL_UUID_MAX && record->uuid[record->uuid_len] == '\0' &&
+           jq_state_dir((jq_state_t)record->from_state) && jq_state_dir((jq_state_t)record->to_state) &&
+           record->checksum == jq_journal_checksum(record);
+}
+
+static void jq_journal_close(jq_journal_t *journal) {
+    if (journal->cached) {
+        (void)flock(journal->fd, LOCK_UN);
+        return;
+    }
+    if (journal->header) {
+        munmap(journal->header, sizeof(jq_journal_header_t));
+        journal->header = NULL;
+    }
+    if (journal->sync_fd >= 0) {
+        close(journal->sync_fd);
+        journal->sync_fd = -1;
+    }
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+}
+
+static jq_result_t jq_journal_create(const char *root_path, const char *journal_path) {
+    char tmp_path[PATH_MAX];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", journal_path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_journal_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JQ_JOURNAL_MAGIC;
+    header.version = JQ_JOURNAL_VERSION;
+    header.record_size = (uint32_t)sizeof(jq_journal_record_t);
+    atomic_init(&header.synced, sizeof(header));
+    jq_result_t result = jq_write_all(fd, &header, sizeof(header));
+    if (result == JQ_OK && fsync(fd) != 0) {
+        result = JQ_ERR_IO;
+    }
+    close(fd);
+    /* link() so two processes creating the journal at once end up sharing one. */
+    if (result == JQ_OK && link(tmp_path, journal_path) != 0 && errno != EEXIST) {
+        result = JQ_ERR_IO;
+    }
+    unlink(tmp_path);
+    if (result == JQ_OK) {
+        jq_sync_parent_dir(journal_path);
+    }
+    return result;
+}
+
+static jq_result_t jq_journal_open(const char *root_path, int create, jq_journal_t *journal) {
+    journal->fd = -1;
+    journal->sync_fd = -1;
+    journal->header = NULL;
+    journal->pid = getpid();
+    journal->cached = 0;
+
+    char journal_path[PATH_MAX];
+    char sync_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_JOURNAL_FILE, journal_path, sizeof(journal_path)) ||
+        !jq_build_index_path(root_path, JQ_JOURNAL_FILE ".sync", sync_path, sizeof(sync_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    journal->fd = open(journal_path, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (journal->fd < 0 && errno == ENOENT && create && jq_journal_create(root_path, journal_path) == JQ_OK) {
+        journal->fd = open(journal_path, O_RDWR | O_APPEND | O_CLOEXEC);
+    }
+    if (journal->fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0 || (size_t)st.st_size < sizeof(jq_journal_header_t)) {
+        jq_journal_close(journal);
+        return JQ_ERR_IO;
+    }
+    journal->sync_fd = open(sync_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    void *base = mmap(NULL, sizeof(jq_journal_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (journal->sync_fd < 0 || base == MAP_FAILED) {
+        jq_journal_close(journal);
+        return JQ_ERR_IO;
+    }
+    journal->header = base;
+    if (journal->header->magic != JQ_JOURNAL_MAGIC || journal->header->version != JQ_JOURNAL_VERSION ||
+        journal->header->record_size != sizeof(jq_journal_record_t)) {
+        jq_journal_close(journal);
+        return JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+/* Group commit: returns once every byte up to end is on disk, flushing it ourselves only if nobody else has. */
+static jq_result_t jq_journal_commit(jq_journal_t *journal, uint64_t end) {
+    if (atomic_load(&journal->header->synced) >= end) {
+        return JQ_OK;
+    }
+    if (flock(journal->sync_fd, LOCK_EX) != 0) {
+        return JQ_ERR_IO;
+    }
+
+    jq_result_t result = JQ_OK;
+    if (atomic_load(&journal->header->synced) < end) {
+        struct stat st;
+        if (fstat(journal->fd, &st) != 0 || fdatasync(journal->fd) != 0) {
+            result = JQ_ERR_IO;
+        } else {
+            uint64_t synced = atomic_load(&journal->header->synced);
+            while (synced < (uint64_t)st.st_size &&
+                   !atomic_compare_exchange_weak(&journal->header->synced, &synced, (uint64_t)st.st_size)) {
+            }
+        }
+    }
+    flock(journal->sync_fd, LOCK_UN);
+    return result;
+}
+
+/*
+ * Lends a transition the handle's journal, opening it on first use. A
+ * descriptor inherited across fork shares its flock with the parent, so a
+ * child drops the inherited one and opens its own.
+ */
+static jq_result_t jq_journal_borrow(const jq_root_t *root, jq_journal_t *journal) {
+    jq_journal_t *held = root->journal;
+    if (held->fd >= 0 && held->pid != getpid()) {
+        held->cached = 0;
+        jq_journal_close(held);
+    }
+    if (held->fd < 0) {
+        jq_result_t result = jq_journal_open(root->path, 1, held);
+        if (result != JQ_OK) {
+            return result;
+        }
+    }
+    *journal = *held;
+    journal->cached = 1;
+    return JQ_OK;
+}
+
+/* The handle's journal, if one was opened; jq_close calls this. */
+static void jq_journal_release(jq_journal_t *journal) {
+    journal->cached = 0;
+    jq_journal_close(journal);
+}
+
+/*
+ * Opens (or borrows) the journal and takes its lock shared. Transitions
+ * hold it across their renames, and so do claims, which are not journaled:
+ * a replay takes the lock exclusive, so it only ever sees pairs that no
+ * running claim or transition is halfway through.
+ */
+static jq_result_t jq_journal_hold(const jq_root_t *root, jq_journal_t *journal) {
+    jq_result_t result = root->journal ? jq_journal_borrow(root, journal) : jq_journal_open(root->path, 1, journal);
+    if (result != JQ_OK) {
+        return result;
+    }
+    if (flock(journal->fd, LOCK_SH) != 0) {
+        jq_journal_close(journal);
+        return JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_journal_begin(const jq_root_t *root,
+                                    const char *uuid,
+                                    jq_state_t from_state,
+                                    int from_locked,
+                                    jq_state_t to_state,
+                                    jq_journal_t *journal) {
+    jq_journal_record_t record;
+    size_t uuid_len = strlen(uuid);
+    if (uuid_len == 0 || uuid_len >= JQ_JOURNAL_UUID_MAX) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    memset(&record, 0, sizeof(record));
+    record.magic = JQ_JOURNAL_RECORD_MAGIC;
+    record.uuid_len = (uint32_t)uuid_len;
+    record.from_state = (int32_t)from_state;
+    record.to_state = (int32_t)to_state;
+    record.from_locked = from_locked ? 1u : 0u;
+    memcpy(record.uuid, uuid, uuid_len);
+    record.checksum = jq_journal_checksum(&record);
+
+    jq_result_t result = jq_journal_hold(root, journal);
+    if (result != JQ_OK) {
+        return result;
+    }
+
+    /* With O_APPEND the offset after the write is the end of our own record. */
+    off_t end = -1;
+    result = jq_write_all(journal->fd, &record, sizeof(record));
+    if (result == JQ_OK && (end = lseek(journal->fd, 0, SEEK_CUR)) < 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK) {
+        result = jq_journal_commit(journal, (uint64_t)end);
+    }
+    if (result != JQ_OK) {
+        jq_journal_close(journal);
+    }
+    return result;
+}
+
+static int jq_journal_present(const jq_file_t *file) {
+    return faccessat(file->dirfd, file->name, F_OK, 0) == 0;
+}
+
+/* Brings one interrupted transition to an end: forward when both halves of the pair survive, else back. */
+static int jq_journal_repair(const jq_root_t *root, const jq_journal_record_t *record) {
+    const char *root_path = root->path;
+    jq_state_t from_state = (jq_state_t)record->from_state;
+    jq_state_t to_state = (jq_state_t)record->to_state;
+    jq_file_t src[3];
+    jq_file_t dst[3];
+    if (jq_pair_paths(root, record->uuid, from_state, (int)record->from_locked, &src[0], &src[1]) != JQ_OK ||
+        jq_report_path(root, record->uuid, from_state, (int)record->from_locked, &src[2]) != JQ_OK ||
+        jq_pair_paths(root, record->uuid, to_state, 0, &dst[0], &dst[1]) != JQ_OK ||
+        jq_report_path(root, record->uuid, to_state, 0, &dst[2]) != JQ_OK) {
+        return 0;
+    }
+
+    if (strcmp(src[0].name, dst[0].name) == 0) {
+        return 0;
+    }
+
+    int at_src[3];
+    int at_dst[3];
+    for (size_t i = 0; i < 3; ++i) {
+        at_src[i] = jq_journal_present(&src[i]);
+        at_dst[i] = jq_journal_present(&dst[i]);
+    }
+    if (!at_src[0] && !at_src[1] && !at_src[2]) {
+        return 0;
+    }
+    if (!at_dst[0] && !at_dst[1]) {
+        /* Never started, or already rolled back. */
+        return 0;
+    }
+
+    int forward = (at_src[0] || at_dst[0]) && (at_src[1] || at_dst[1]);
+    int tenant = 0;
+    if (forward && record->from_locked) {
+        jq_job_sizes_t claimed;
+        int level = 0;
+        (void)jq_lease_claimed(root_path, record->uuid, &claimed, &level, &tenant);
+    } else if (forward) {
+        tenant = jq_ready_pending_tenant(root_path, from_state, record->uuid);
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        if (forward && at_src[i]) {
+            (void)jq_rename(&src[i], &dst[i]);
+        } else if (!forward && at_dst[i] && !at_src[i]) {
+            (void)jq_rename(&dst[i], &src[i]);
+        }
+    }
+    if (forward) {
+        if (record->from_locked) {
+            jq_lease_remove(root_path, record->uuid);
+        }
+        jq_job_sizes_t sizes;
+        jq_job_sizes(&dst[0], &dst[1], NULL, &sizes);
+        (void)jq_ready_append(root_path, tenant, jq_state_default_level(to_state), record->uuid, sizes.pdf);
+        jq_status_index_set(root_path, record->uuid, to_state, 0);
+    } else {
+        jq_status_index_set(root_path, record->uuid, from_state, (int)record->from_locked);
+    }
+    return 1;
+}
+
+static int jq_journal_record_compare(const void *left, const void *right) {
+    const jq_journal_record_t *a = left;
+    const jq_journal_record_t *b = right;
+    int order = strcmp(a->uuid, b->uuid);
+    if (order != 0) {
+        return order;
+    }
+    /* Equal uuids keep journal order: once validated, checksum holds the record's position. */
+    return (a->checksum > b->checksum) - (a->checksum < b->checksum);
+}
+
+/* Replays the journal and truncates it. The caller holds the journal lock exclusively. */
+static jq_result_t jq_journal_settle(const char *root_path, jq_journal_t *journal, size_t *repaired_out) {
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0) {
+        return JQ_ERR_IO;
+    }
+    size_t count = ((size_t)st.st_size - sizeof(jq_journal_header_t)) / sizeof(jq_journal_record_t);
+    jq_journal_record_t *records = NULL;
+    if (count > 0) {
+        records = malloc(count * sizeof(*records));
+        if (!records) {
+            return JQ_ERR_IO;
+        }
+        ssize_t bytes = pread(journal->fd, records, count * sizeof(*records), sizeof(jq_journal_header_t));
+        if (bytes < 0) {
+            free(records);
+            return JQ_ERR_IO;
+        }
+        count = (size_t)bytes / sizeof(*records);
+    }
+
+    /* Torn records are dropped; only the last intent of each job matters. */
+    size_t valid = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (jq_journal_record_valid(&records[i])) {
+            records[valid] = records[i];
+            records[valid].checksum = (uint32_t)valid;
+            valid++;
+        }
+    }
+    qsort(records, valid, sizeof(*records), jq_journal_record_compare);
+
+    size_t repaired = 0;
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    for (size_t i = 0; i < valid; ++i) {
+        if (i + 1 < valid && strcmp(records[i].uuid, records[i + 1].uuid) == 0) {
+            continue;
+        }
+        repaired += (size_t)jq_journal_repair(&root, &records[i]);
+    }
+    free(records);
+
+    if (repaired > 0) {
+        jq_stats_t stats;
+        (void)jq_collect_stats(root_path, &stats);
+    }
+
+    /* The renames behind the dropped intents must be durable before the intents go. */
+#if defined(__linux__)
+    if (syncfs(journal->fd) != 0) {
+        return JQ_ERR_IO;
+    }
+#else
+    sync();
+#endif
+    if (ftruncate(journal->fd, sizeof(jq_journal_header_t)) != 0) {
+        return JQ_ERR_IO;
+    }
+    atomic_store(&journal->header->synced, sizeof(jq_journal_header_t));
+    if (fsync(journal->fd) != 0) {
+        return JQ_ERR_IO;
+    }
+    if (repaired_out) {
+        *repaired_out = repaired;
+    }
+    return JQ_OK;
+}
+
+static void jq_journal_end(const jq_root_t *root, jq_journal_t *journal) {
+    /* Checkpoint once the journal is large and no other transition is running. */
+    struct stat st;
+    if (fstat(journal->fd, &st) == 0 && (size_t)st.st_size >= JQ_JOURNAL_CHECKPOINT_BYTES &&
+        flock(journal->fd, LOCK_EX | LOCK_NB) == 0) {
+        (void)jq_journal_settle(root->path, journal, NULL);
+    }
+    jq_journal_close(journal);
+}
+
+jq_result_t jq_replay_journal(const char *root_path, size_t *repaired_out) {
+    if (!root_path) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (repaired_out) {
+        *repaired_out = 0;
+    }
+
+    jq_journal_t journal;
+    jq_result_t result = jq_journal_open(root_path, 0, &journal);
+    if (result != JQ_OK) {
+        return result == JQ_ERR_NOT_FOUND ? JQ_OK : result;
+    }
+    /* Waits out running transitions; what is left in the journal afterwards was interrupted. */
+    if (flock(journal.fd, LOCK_EX) != 0) {
+        jq_journal_close(&journal);
+        return JQ_ERR_IO;
+    }
+    result = jq_journal_settle(root_path, &journal, repaired_out);
+    jq_journal_close(&journal);
+    if (result == JQ_OK) {
+        /* The ring may hold slots a crashed process reserved but never filled or freed. */
+        result = jq_ring_rebuild(root_path);
+    }
+    return result;
+}
+
+/*
+ * Archive: finished jobs packed out of complete/ and error/ so those
+ * directories stop growing with every job ever run. A compaction round
+ * appends each selected job's metadata and report, and with pack_pdf its
+ * PDF, to the current segment (.jq/archive/<n>.seg, rolled at 256 MiB),
+ * syncs the segment, records the offsets in the archive index, syncs that,
+ * and only then removes the loose files. A crash in between leaves a job
+ * both loose and packed: the loose copy wins everywhere and the next round
+ * packs it again. Unpacked PDFs are renamed into .jq/archive/pdf/ instead.
+ *
+ * The index is an open-addressing table like the status index, but with a
+ * single writer (rounds hold the flock on .jq/archive/lock), and unlike it
+ * the index is the only record of a packed job. Readers map it read-only and
+ * take a slot only if its tag is unchanged after copying it. It grows at the
+ * start of a batch, before any loose file of that batch is removed, so a
+ * reader that misses a loose file always opens a table holding its entry.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t segment;
+    uint64_t capacity;
+    uint64_t used;
+    unsigned char padding[32];
+} jq_archive_header_t;
+
+typedef struct {
+    _Atomic uint32_t tag;
+    uint32_t hash;
+    char uuid[JQ_UUID_MAX];
+    uint32_t segment;
+    uint32_t flags;
+    int64_t archived_at;
+    uint64_t offsets[3];
+    uint64_t lengths[3];
+} jq_archive_slot_t;
+
+typedef struct {
+    jq_state_t state;
+    uint32_t segment;
+    uint32_t flags;
+    uint64_t offsets[3];
+    uint64_t lengths[3];
+} jq_archive_entry_t;
+
+typedef struct {
+    void *base;
+    size_t length;
+    jq_archive_header_t *header;
+    jq_archive_slot_t *slots;
+} jq_archive_map_t;
+
+typedef struct {
+    const char *root_path;
+    int lock_fd;
+    int segment_fd;
+    uint64_t segment_end;
+    jq_archive_map_t map;
+} jq_archive_t;
+
+typedef struct {
+    char uuid[JQ_UUID_MAX];
+    time_t finished_at;
+} jq_archive_candidate_t;
+
+typedef struct {
+    const char *uuid;
+    jq_archive_entry_t entry;
+    jq_job_sizes_t sizes;
+} jq_archive_job_t;
+
+/*
+ * The policy in .jq/retention, plus when the reaper should next run a round.
+ * Version 1 files end at next_due and keep every event segment.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_age_seconds;
+    uint32_t pack_pdf;
+    uint64_t max_loose;
+    int64_t next_due;
+    uint64_t max_event_segments;
+} jq_retention_file_t;
+
+static int jq_archive_path(const char *root_path, const char *name, char *out, size_t out_len) {
+    char relative[NAME_MAX + 16];
+    int written = snprintf(relative, sizeof(relative), "%s/%s", JQ_ARCHIVE_DIR, name);
+    if (written < 0 || (size_t)written >= sizeof(relative)) {
+        return 0;
+    }
+    return jq_build_index_path(root_path, relative, out, out_len);
+}
+
+static int jq_archive_segment_path(const char *root_path, uint32_t segment, char *out, size_t out_len) {
+    char name[32];
+    snprintf(name, sizeof(name), "%08u.seg", (unsigned int)segment);
+    return jq_archive_path(root_path, name, out, out_len);
+}
+
+static int jq_archive_pdf_path(const char *root_path, const char *uuid, char *out, size_t out_len) {
+    char shard[8];
+    char name[NAME_MAX + 16];
+    jq_shard_prefix(uuid, shard);
+    int written = snprintf(name, sizeof(name), "pdf/%s%s.pdf.job", shard, uuid);
+    if (written < 0 || (size_t)written >= sizeof(name)) {
+        return 0;
+    }
+    return jq_archive_path(root_path, name, out, out_len);
+}
+
+static void jq_archive_unmap(jq_archive_map_t *map) {
+    if (map->base) {
+        munmap(map->base, map->length);
+        map->base = NULL;
+    }
+}
+
+static jq_result_t jq_archive_map_fd(int fd, int writable, jq_archive_map_t *map_out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(jq_archive_header_t)) {
+        return JQ_ERR_IO;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return JQ_ERR_IO;
+    }
+
+    jq_archive_header_t *header = base;
+    uint64_t capacity = header->capacity;
+    if (header->magic != JQ_ARCHIVE_INDEX_MAGIC || header->version != JQ_ARCHIVE_INDEX_VERSION ||
+        header->slot_size != sizeof(jq_archive_slot_t) || capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        (size_t)st.st_size < sizeof(jq_archive_header_t) + capacity * sizeof(jq_archive_slot_t)) {
+        munmap(base, (size_t)st.st_size);
+        return JQ_ERR_IO;
+    }
+    map_out->base = base;
+    map_out->length = (size_t)st.st_size;
+    map_out->header = header;
+    map_out->slots = (jq_archive_slot_t *)((unsigned char *)base + sizeof(jq_archive_header_t));
+    return JQ_OK;
+}
+
+static jq_result_t jq_archive_map(const char *root_path, int writable, jq_archive_map_t *map_out) {
+    char path[PATH_MAX];
+    if (!jq_archive_path(root_path, "index", path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    jq_result_t result = jq_archive_map_fd(fd, writable, map_out);
+    close(fd);
+    return result;
+}
+
+/* The slot holding uuid, or with insert set the free slot it would take; NULL when neither. */
+static jq_archive_slot_t *jq_archive_slot(const jq_archive_map_t *map, const char *uuid, uint32_t hash, int insert) {
+    uint64_t mask = map->header->capacity - 1;
+    for (uint64_t probe = 0; probe <= mask; ++probe) {
+        jq_archive_slot_t *slot = &map->slots[(hash + probe) & mask];
+        if (atomic_load(&slot->tag) == 0) {
+            return insert ? slot : NULL;
+        }
+        if (slot->hash == hash && strcmp(slot->uuid, uuid) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static int jq_archive_find(const char *root_path, const char *uuid, jq_archive_entry_t *entry_out) {
+    jq_archive_map_t map = {0};
+    if (strlen(uuid) >= JQ_UUID_MAX || jq_archive_map(root_path, 0, &map) != JQ_OK) {
+        return 0;
+    }
+    int found = 0;
+    const jq_archive_slot_t *slot = jq_archive_slot(&map, uuid, jq_shard_hash(uuid), 0);
+    uint32_t tag = slot ? atomic_load(&slot->tag) : 0;
+    if (tag >= JQ_ARCHIVE_TAG_FIRST && tag - JQ_ARCHIVE_TAG_FIRST <= JQ_STATE_ERROR) {
+        entry_out->state = (jq_state_t)(tag - JQ_ARCHIVE_TAG_FIRST);
+        entry_out->segment = slot->segment;
+        entry_out->flags = slot->flags;
+        memcpy(entry_out->offsets, slot->offsets, sizeof(entry_out->offsets));
+        memcpy(entry_out->lengths, slot->lengths, sizeof(entry_out->lengths));
+        atomic_thread_fence(memory_order_acquire);
+        /* A slot rewritten while it was copied reads as a miss; the job is still loose then. */
+        found = atomic_load(&slot->tag) == tag;
+    }
+    jq_archive_unmap(&map);
+    return found;
+}
+
+/* jq_status_at's last resort: a job found nowhere loose, or only half there, may be packed. */
+static jq_result_t jq_status_archived(const char *root_path,
+                                      const char *uuid,
+                                      jq_result_t miss,
+                                      jq_state_t *state_out,
+                                      int *locked_out) {
+    jq_archive_entry_t entry;
+    if (!jq_archive_find(root_path, uuid, &entry)) {
+        return miss;
+    }
+    *state_out = entry.state;
+    *locked_out = 0;
+    return JQ_OK;
+}
+
+static jq_result_t jq_archive_index_create(const char *root_path, const jq_archive_map_t *old_map, uint64_t capacity) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_archive_path(root_path, "index", path, sizeof(path)) ||
+        !jq_archive_path(root_path, "index.tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_archive_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JQ_ARCHIVE_INDEX_MAGIC;
+    header.version = JQ_ARCHIVE_INDEX_VERSION;
+    header.slot_size = (uint32_t)sizeof(jq_archive_slot_t);
+    header.segment = old_map ? old_map->header->segment : 0;
+    header.capacity = capacity;
+
+    jq_archive_map_t map = {0};
+    jq_result_t result = jq_write_all(fd, &header, sizeof(header));
+    if (result == JQ_OK && ftruncate(fd, (off_t)(sizeof(header) + capacity * sizeof(jq_archive_slot_t))) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK) {
+        result = jq_archive_map_fd(fd, 1, &map);
+    }
+    if (result == JQ_OK && old_map) {
+        for (uint64_t i = 0; i < old_map->header->capacity; ++i) {
+            const jq_archive_slot_t *old_slot = &old_map->slots[i];
+            uint32_t tag = atomic_load(&old_slot->tag);
+            if (tag < JQ_ARCHIVE_TAG_FIRST) {
+                continue;
+            }
+            jq_archive_slot_t *slot = jq_archive_slot(&map, old_slot->uuid, old_slot->hash, 1);
+            if (!slot) {
+                result = JQ_ERR_IO;
+                break;
+            }
+            memcpy(slot, old_slot, sizeof(*slot));
+            map.header->used++;
+        }
+    }
+    if (result == JQ_OK && (msync(map.base, map.length, MS_SYNC) != 0 || fsync(fd) != 0)) {
+        result = JQ_ERR_IO;
+    }
+    jq_archive_unmap(&map);
+    close(fd);
+
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+        return result;
+    }
+    jq_sync_parent_dir(path);
+    return JQ_OK;
+}
+
+static void jq_archive_close(jq_archive_t *archive) {
+    jq_archive_unmap(&archive->map);
+    if (archive->segment_fd >= 0) {
+        close(archive->segment_fd);
+        archive->segment_fd = -1;
+    }
+    if (archive->lock_fd >= 0) {
+        close(archive->lock_fd);
+        archive->lock_fd = -1;
+    }
+}
+
+/* Takes the compaction lock, waiting for it only when wait is set, and maps the index for writing. */
+static jq_result_t jq_archive_open(const char *root_path, int wait, jq_archive_t *archive) {
+    memset(archive, 0, sizeof(*archive));
+    archive->root_path = root_path;
+    archive->lock_fd = -1;
+    archive->segment_fd = -1;
+
+    char dir_path[PATH_MAX];
+    char lock_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_ARCHIVE_DIR, dir_path, sizeof(dir_path)) ||
+        !jq_archive_path(root_path, "lock", lock_path, sizeof(lock_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK || jq_ensure_dir(dir_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+    archive->lock_fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+    if (archive->lock_fd < 0 || flock(archive->lock_fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+        jq_archive_close(archive);
+        return JQ_ERR_IO;
+    }
+
+    jq_result_t result = jq_archive_map(root_path, 1, &archive->map);
+    if (result == JQ_ERR_NOT_FOUND) {
+        result = jq_archive_index_create(root_path, NULL, JQ_ARCHIVE_INITIAL_SLOTS);
+        if (result == JQ_OK) {
+            result = jq_archive_map(root_path, 1, &archive->map);
+        }
+    }
+    if (result != JQ_OK) {
+        jq_archive_close(archive);
+    }
+    return result;
+}
+
+/* Opens the segment to append to, moving on to a fresh one once the current one is full. */
+static jq_result_t jq_archive_segment_open(jq_archive_t *archive) {
+    while (archive->segment_fd < 0 || archive->segment_end >= JQ_ARCHIVE_SEGMENT_BYTES) {
+        if (archive->segment_fd >= 0) {
+            close(archive->segment_fd);
+            archive->segment_fd = -1;
+            archive->map.header->segment++;
+        }
+        char path[PATH_MAX];
+        if (!jq_archive_segment_path(archive->root_path, archive->map.header->segment, path, sizeof(path))) {
+            return JQ_ERR_INVALID_ARGUMENT;
+        }
+        archive->segment_fd = open(path, O_RDWR | O_CREAT, 0644);
+        struct stat st;
+        if (archive->segment_fd < 0 || fstat(archive->segment_fd, &st) != 0) {
+            return JQ_ERR_IO;
+        }
+        if (st.st_size == 0) {
+            jq_sync_parent_dir(path);
+        }
+        /* Bytes past the last indexed job are what a crashed round left behind; they stay dead. */
+        archive->segment_end = (uint64_t)st.st_size;
+    }
+    return JQ_OK;
+}
+
+static jq_result_t jq_archive_append(jq_archive_t *archive, int src_fd, uint64_t *offset_out, uint64_t *length_out) {
+    if (lseek(archive->segment_fd, (off_t)archive->segment_end, SEEK_SET) == (off_t)-1) {
+        return JQ_ERR_IO;
+    }
+    off_t copied = 0;
+    jq_copy_status_t status = jq_copy_range(src_fd, archive->segment_fd, &copied);
+    if (status == JQ_COPY_UNSUPPORTED) {
+        status = jq_copy_sendfile(src_fd, archive->segment_fd, &copied);
+    }
+    if (status == JQ_COPY_UNSUPPORTED) {
+        status = jq_copy_buffered(src_fd, archive->segment_fd, &copied);
+    }
+    if (status != JQ_COPY_DONE) {
+        return JQ_ERR_IO;
+    }
+    *offset_out = archive->segment_end;
+    *length_out = (uint64_t)copied;
+    archive->segment_end += (uint64_t)copied;
+    return JQ_OK;
+}
+
+/* Appends one job's files to the segment; 0 when the job is not there whole. */
+static int jq_archive_pack_job(jq_archive_t *archive,
+                               const jq_root_t *root,
+                               jq_state_t state,
+                               int pack_pdf,
+                               jq_archive_job_t *job) {
+    jq_file_t files[3];
+    if (jq_pair_paths(root, job->uuid, state, 0, &files[JQ_FILE_PDF], &files[JQ_FILE_METADATA]) != JQ_OK ||
+        jq_report_path(root, job->uuid, state, 0, &files[JQ_FILE_REPORT]) != JQ_OK) {
+        return 0;
+    }
+    memset(&job->entry, 0, sizeof(job->entry));
+    job->entry.state = state;
+    job->entry.segment = archive->map.header->segment;
+    jq_job_sizes(&files[JQ_FILE_PDF], &files[JQ_FILE_METADATA], &files[JQ_FILE_REPORT], &job->sizes);
+
+    int packed = 1;
+    for (int kind = JQ_FILE_PDF; kind <= JQ_FILE_REPORT && packed; ++kind) {
+        int fd = openat(files[kind].dirfd, files[kind].name, O_RDONLY);
+        if (fd < 0) {
+            packed = kind == JQ_FILE_REPORT && errno == ENOENT;
+            break;
+        }
+        if (kind == JQ_FILE_PDF && !pack_pdf) {
+            job->entry.flags |= JQ_ARCHIVE_PDF_LOOSE;
+            job->entry.lengths[kind] = (uint64_t)job->sizes.pdf;
+        } else {
+            packed = jq_archive_append(archive, fd, &job->entry.offsets[kind], &job->entry.lengths[kind]) == JQ_OK;
+        }
+        if (kind == JQ_FILE_REPORT) {
+            job->entry.flags |= JQ_ARCHIVE_HAS_REPORT;
+        }
+        close(fd);
+    }
+    return packed;
+}
+
+static void jq_archive_store(jq_archive_t *archive, const char *uuid, const jq_archive_entry_t *entry, time_t now) {
+    uint32_t hash = jq_shard_hash(uuid);
+    jq_archive_slot_t *slot = jq_archive_slot(&archive->map, uuid, hash, 1);
+    if (!slot) {
+        return;
+    }
+    if (atomic_load(&slot->tag) == 0) {
+        slot->hash = hash;
+        snprintf(slot->uuid, sizeof(slot->uuid), "%s", uuid);
+        archive->map.header->used++;
+    } else {
+        atomic_store(&slot->tag, JQ_ARCHIVE_TAG_BUSY);
+    }
+    slot->segment = entry->segment;
+    slot->flags = entry->flags;
+    slot->archived_at = (int64_t)now;
+    memcpy(slot->offsets, entry->offsets, sizeof(slot->offsets));
+    memcpy(slot->lengths, entry->lengths, sizeof(slot->lengths));
+    atomic_store(&slot->tag, JQ_ARCHIVE_TAG_FIRST + (uint32_t)entry->state);
+}
+
+/* Doubles the index until adding more entries keeps it at most three quarters full. */
+static jq_result_t jq_archive_reserve(jq_archive_t *archive, size_t adding) {
+    while ((archive->map.header->used + adding) * 4 > archive->map.header->capacity * 3) {
+        jq_result_t result =
+            jq_archive_index_create(archive->root_path, &archive->map, archive->map.header->capacity * 2);
+        if (result != JQ_OK) {
+            return result;
+        }
+        jq_archive_unmap(&archive->map);
+        result = jq_archive_map(archive->root_path, 1, &archive->map);
+        if (result != JQ_OK) {
+            return result;
+        }
+    }
+    return JQ_OK;
+}
+
+/*
+ * Removes the loose copy of a packed job, PDF first so a metadata file is
+ * always left for the next round to find. An unpacked PDF moves to the
+ * archive's pdf/ tree; one already moved there is fine.
+ */
+static int jq_archive_drop_loose(const jq_root_t *root,
+                                 jq_state_t state,
+                                 const char *uuid,
+                                 const jq_archive_entry_t *entry) {
+    jq_file_t pdf;
+    jq_file_t metadata;
+    jq_file_t report;
+    if (jq_pair_paths(root, uuid, state, 0, &pdf, &metadata) != JQ_OK ||
+        jq_report_path(root, uuid, state, 0, &report) != JQ_OK) {
+        return 0;
+    }
+    if (entry->flags & JQ_ARCHIVE_PDF_LOOSE) {
+        char path[PATH_MAX];
+        if (!jq_archive_pdf_path(root->path, uuid, path, sizeof(path))) {
+            return 0;
+        }
+        char *slash = strrchr(path, '/');
+        *slash = '\0';
+        jq_result_t dir_result = jq_mkdirs_at(AT_FDCWD, path, 3);
+        *slash = '/';
+        if (dir_result != JQ_OK || (renameat(pdf.dirfd, pdf.name, AT_FDCWD, path) != 0 && errno != ENOENT)) {
+            return 0;
+        }
+    } else if (unlinkat(pdf.dirfd, pdf.name, 0) != 0 && errno != ENOENT) {
+        return 0;
+    }
+    if ((unlinkat(metadata.dirfd, metadata.name, 0) != 0 && errno != ENOENT) ||
+        (unlinkat(report.dirfd, report.name, 0) != 0 && errno != ENOENT)) {
+        return 0;
+    }
+    jq_remove_job_dir(&metadata);
+    return 1;
+}
+
+static jq_result_t jq_archive_pack_batch(jq_archive_t *archive,
+                                         const jq_root_t *root,
+                                         jq_state_t state,
+                                         const jq_archive_candidate_t *candidates,
+                                         size_t count,
+                                         const jq_retention_options_t *options,
+                                         time_t now,
+                                         size_t *packed_out) {
+    jq_archive_job_t *jobs = malloc(count * sizeof(*jobs));
+    if (!jobs) {
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = jq_archive_segment_open(archive);
+    size_t appended = 0;
+    for (size_t i = 0; i < count && result == JQ_OK; ++i) {
+        jq_archive_job_t *job = &jobs[appended];
+        job->uuid = candidates[i].uuid;
+        if (jq_archive_pack_job(archive, root, state, options->pack_pdf, job)) {
+            appended++;
+            continue;
+        }
+        /* Only metadata left behind: a round removing this job's loose files was cut short. */
+        jq_archive_entry_t entry;
+        if (!jq_archive_find(root->path, job->uuid, &entry) || entry.state != state) {
+            continue;
+        }
+        jq_file_t pdf;
+        jq_file_t metadata;
+        if (jq_pair_paths(root, job->uuid, state, 0, &pdf, &metadata) == JQ_OK &&
+            faccessat(pdf.dirfd, pdf.name, F_OK, 0) != 0 && errno == ENOENT) {
+            (void)jq_archive_drop_loose(root, state, job->uuid, &entry);
+        }
+    }
+    if (result == JQ_OK && appended > 0 && fdatasync(archive->segment_fd) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result == JQ_OK && appended > 0) {
+        result = jq_archive_reserve(archive, appended);
+    }
+    if (result == JQ_OK && appended > 0) {
+        for (size_t i = 0; i < appended; ++i) {
+            jq_archive_store(archive, jobs[i].uuid, &jobs[i].entry, now);
+        }
+        if (msync(archive->map.base, archive->map.length, MS_SYNC) != 0) {
+            result = JQ_ERR_IO;
+        }
+    }
+    if (result == JQ_OK && appended > 0) {
+        jq_stats_change_t change = {.state = state};
+        for (size_t i = 0; i < appended; ++i) {
+            const jq_job_sizes_t *sizes = &jobs[i].sizes;
+            if (jq_archive_drop_loose(root, state, jobs[i].uuid, &jobs[i].entry)) {
+                jq_stats_add_job(&change, -1, 0, sizes->pdf, sizes->metadata, sizes->has_report, sizes->report);
+                (*packed_out)++;
+            }
+        }
+        jq_stats_apply(root->path, &change, 1, 0);
+    }
+    free(jobs);
+    return result;
+}
+
+/* Newest first, so the jobs to keep are a prefix and the ones to pack the rest. */
+static int jq_archive_candidate_compare(const void *left, const void *right) {
+    const jq_archive_candidate_t *a = left;
+    const jq_archive_candidate_t *b = right;
+    if (a->finished_at != b->finished_at) {
+        return a->finished_at > b->finished_at ? -1 : 1;
+    }
+    return strcmp(a->uuid, b->uuid);
+}
+
+/* Unclaimed jobs of a finished state, dated by when they were last renamed: the finalize that put them there. */
+static jq_result_t jq_archive_collect(const char *root_path,
+                                      jq_state_t state,
+                                      jq_archive_candidate_t **candidates_out,
+                                      size_t *count_out) {
+    *candidates_out = NULL;
+    *count_out = 0;
+    jq_dir_iter_t iter;
+    jq_result_t result = jq_dir_iter_open(&iter, root_path, state);
+    if (result != JQ_OK) {
+        return result == JQ_ERR_NOT_FOUND ? JQ_OK : result;
+    }
+
+    static const char suffix[] = ".metadata.job";
+    jq_archive_candidate_t *candidates = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    const char *name;
+    while ((name = jq_dir_iter_next(&iter)) != NULL) {
+        size_t uuid_len = strlen(name) - (sizeof(suffix) - 1);
+        struct stat st;
+        if (!jq_has_suffix(name, suffix) || uuid_len == 0 || uuid_len >= JQ_UUID_MAX ||
+            jq_dir_iter_stat_job(&iter, &st) != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            size_t next_capacity = capacity ? capacity * 2 : 256;
+            jq_archive_candidate_t *grown = realloc(candidates, next_capacity * sizeof(*candidates));
+            if (!grown) {
+                result = JQ_ERR_IO;
+                break;
+            }
+            candidates = grown;
+            capacity = next_capacity;
+        }
+        memcpy(candidates[count].uuid, name, uuid_len);
+        candidates[count].uuid[uuid_len] = '\0';
+        candidates[count].finished_at = st.st_ctime;
+        count++;
+    }
+    jq_dir_iter_close(&iter);
+    if (result != JQ_OK) {
+        free(candidates);
+        return result;
+    }
+    *candidates_out = candidates;
+    *count_out = count;
+    return JQ_OK;
+}
+
+/*
+ * One compaction round over complete/ and error/, oldest jobs first. limit
+ * caps how many jobs it packs (0 for no cap); more_out says whether jobs
+ * past the policy were left for another round.
+ */
+static jq_result_t jq_archive_run(jq_archive_t *archive,
+                                  const jq_retention_options_t *options,
+                                  time_t now,
+                                  size_t limit,
+                                  size_t *packed_out,
+                                  int *more_out) {
+    jq_root_t root;
+    jq_root_from_path(&root, archive->root_path);
+    *packed_out = 0;
+    *more_out = 0;
+    const jq_state_t states[] = {JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    for (size_t s = 0; s < sizeof(states) / sizeof(states[0]); ++s) {
+        jq_archive_candidate_t *candidates = NULL;
+        size_t count = 0;
+        jq_result_t result = jq_archive_collect(archive->root_path, states[s], &candidates, &count);
+        if (result != JQ_OK) {
+            return result;
+        }
+        qsort(candidates, count, sizeof(*candidates), jq_archive_candidate_compare);
+
+        size_t keep = options->max_loose > 0 && options->max_loose < count ? options->max_loose : count;
+        if (options->max_age_seconds > 0) {
+            for (size_t i = 0; i < keep; ++i) {
+                if (candidates[i].finished_at + (time_t)options->max_age_seconds <= now) {
+                    keep = i;
+                    break;
+                }
+            }
+        }
+        if (limit > 0 && count - keep > limit - *packed_out) {
+            keep = count - (limit - *packed_out);
+            *more_out = 1;
+        }
+        for (size_t end = count; end > keep && result == JQ_OK;) {
+            size_t begin = end - keep > JQ_ARCHIVE_BATCH ? end - JQ_ARCHIVE_BATCH : keep;
+            result = jq_archive_pack_batch(archive, &root, states[s], candidates + begin, end - begin, options, now,
+                                           packed_out);
+            end = begin;
+        }
+        free(candidates);
+        if (result != JQ_OK) {
+            return result;
+        }
+    }
+    return JQ_OK;
+}
+
+void jq_retention_options_init(jq_retention_options_t *options) {
+    if (!options) {
+        return;
+    }
+    memset(options, 0, sizeof(*options));
+}
+
+static int jq_retention_valid(const jq_retention_options_t *options) {
+    return options->max_age_seconds > 0 || options->max_loose > 0 || options->max_event_segments > 0;
+}
+
+/* Opens .jq/retention and reads the policy; the descriptor is left open in *fd_out when fd_out is set. */
+static jq_result_t jq_retention_read(const char *root_path, int flags, int *fd_out, jq_retention_file_t *file_out) {
+    char path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_RETENTION_FILE, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, flags);
+    if (fd < 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    memset(file_out, 0, sizeof(*file_out));
+    ssize_t bytes_read = pread(fd, file_out, sizeof(*file_out), 0);
+    size_t expected = file_out->version == 1u ? offsetof(jq_retention_file_t, max_event_segments) : sizeof(*file_out);
+    if (bytes_read != (ssize_t)expected || file_out->magic != JQ_RETENTION_MAGIC || file_out->version == 0 ||
+        file_out->version > JQ_RETENTION_VERSION) {
+        close(fd);
+        return JQ_ERR_IO;
+    }
+    if (fd_out) {
+        *fd_out = fd;
+    } else {
+        close(fd);
+    }
+    return JQ_OK;
+}
+
+static void jq_retention_options_of(const jq_retention_file_t *file, jq_retention_options_t *options_out) {
+    jq_retention_options_init(options_out);
+    options_out->max_age_seconds = file->max_age_seconds;
+    options_out->max_loose = (size_t)file->max_loose;
+    options_out->pack_pdf = file->pack_pdf != 0;
+    options_out->max_event_segments = (size_t)file->max_event_segments;
+}
+
+jq_result_t jq_retention_configure(const char *root_path, const jq_retention_options_t *options) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!root_path || !options || !jq_retention_valid(options) ||
+        !jq_build_index_path(root_path, JQ_RETENTION_FILE, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, JQ_RETENTION_FILE ".tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (jq_ensure_index_dir(root_path) != JQ_OK) {
+        return JQ_ERR_IO;
+    }
+
+    jq_retention_file_t file;
+    memset(&file, 0, sizeof(file));
+    file.magic = JQ_RETENTION_MAGIC;
+    file.version = JQ_RETENTION_VERSION;
+    file.max_age_seconds = options->max_age_seconds;
+    file.pack_pdf = options->pack_pdf ? 1u : 0u;
+    file.max_loose = (uint64_t)options->max_loose;
+    file.max_event_segments = (uint64_t)options->max_event_segments;
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
+    }
+    jq_result_t result = jq_write_all(fd, &file, sizeof(file));
+    if (result == JQ_OK && fchmod(fd, 0644) != 0) {
+        result = JQ_ERR_IO;
+    }
+    close(fd);
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
+    }
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+    }
+    return result;
+}
+
+jq_result_t jq_retention_disable(const char *root_path) {
+    char path[PATH_MAX];
+    if (!root_path || !jq_build_index_path(root_path, JQ_RETENTION_FILE, path, sizeof(path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (unlink(path) != 0) {
+        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    }
+    return JQ_OK;
+}
+
+jq_result_t jq_read_retention(const char *root_path, jq_retention_options_t *options_out) {
+    if (!root_path || !options_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_retention_file_t file;
+    jq_result_t result = jq_retention_read(root_path, O_RDONLY, NULL, &file);
+    if (result == JQ_OK) {
+        jq_retention_options_of(&file, options_out);
+    }
+    return result;
+}
+
+/*
+ * Removes the event segments older than the newest keep, counting the one
+ * being written; keep 0 removes nothing. Readers step over the gap.
+ */
+static void jq_event_prune(const char *root_path, size_t keep) {
+    uint64_t last = jq_counter_peek(root_path, JQ_EVENTS_COUNTER);
+    uint64_t current = last > 0 ? (last - 1) / JQ_EVENT_SEGMENT_RECORDS : 0;
+    if (keep == 0 || current < keep) {
+        return;
+    }
+    uint64_t first_kept = current + 1 - keep;
+
+    char dir_path[PATH_MAX];
+    int written = snprintf(dir_path, sizeof(dir_path), "%s/%s/%s", root_path, JQ_INDEX_DIR, JQ_EVENTS_DIR);
+    DIR *dir = written >= 0 && (size_t)written < sizeof(dir_path) ? opendir(dir_path) : NULL;
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end = NULL;
+        unsigned long long segment = strtoull(entry->d_name, &end, 16);
+        if (end == entry->d_name + 16 && strcmp(end, ".events") == 0 && segment < first_kept) {
+            (void)unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+/*
+ * Run by the reaper. At most once a minute, and only if no round is running
+ * already, packs up to JQ_RETENTION_ROUND_JOBS jobs and prunes the event log;
+ * a bigger backlog waits for the next round or for jq_compact. next_due is only
+ * read and written under the compaction lock.
+ */
+static void jq_retention_tick(const char *root_path, time_t now) {
+    jq_retention_file_t file;
+    if (jq_retention_read(root_path, O_RDONLY, NULL, &file) != JQ_OK || file.next_due > (int64_t)now) {
+        return;
+    }
+    jq_archive_t archive;
+    if (jq_archive_open(root_path, 0, &archive) != JQ_OK) {
+        return;
+    }
+    int fd = -1;
+    if (jq_retention_read(root_path, O_RDWR, &fd, &file) == JQ_OK) {
+        if (file.next_due <= (int64_t)now) {
+            int64_t next_due = (int64_t)now + JQ_RETENTION_INTERVAL_SECONDS;
+            (void)pwrite(fd, &next_due, sizeof(next_due), offsetof(jq_retention_file_t, next_due));
+
+            jq_retention_options_t options;
+            jq_retention_options_of(&file, &options);
+            size_t packed = 0;
+            int more = 0;
+            (void)jq_archive_run(&archive, &options, now, JQ_RETENTION_ROUND_JOBS, &packed, &more);
+            jq_event_prune(root_path, options.max_event_segments);
+        }
+        close(fd);
+    }
+    jq_archive_close(&archive);
+}
+
+jq_result_t jq_compact(const char *root_path,
+                       const jq_retention_options_t *options,
+                       time_t now,
+                       size_t *packed_out) {
+    if (!root_path || !packed_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_retention_options_t settings;
+    if (options) {
+        settings = *options;
+    } else {
+        jq_result_t read_result = jq_read_retention(root_path, &settings);
+        if (read_result != JQ_OK) {
+            return read_result;
+        }
+    }
+    if (!jq_retention_valid(&settings)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    if (now == 0) {
+        now = time(NULL);
+    }
+
+    jq_archive_t archive;
+    jq_result_t result = jq_archive_open(root_path, 1, &archive);
+    if (result != JQ_OK) {
+        return result;
+    }
+    int more = 0;
+    *packed_out = 0;
+    result = jq_archive_run(&archive, &settings, now, 0, packed_out, &more);
+    if (result == JQ_OK) {
+        jq_event_prune(root_path, settings.max_event_segments);
+    }
+    jq_archive_close(&archive);
+    return result;
+}
+
+jq_result_t jq_archive_locate(const char *root_path,
+                              const char *uuid,
+                              jq_file_kind_t kind,
+                              jq_state_t *state_out,
+                              char *path_out,
+                              size_t path_out_len,
+                              unsigned long long *offset_out,
+                              unsigned long long *length_out) {
+    if (!root_path || !uuid || !state_out || !path_out || !offset_out || !length_out || kind < JQ_FILE_PDF ||
+        kind > JQ_FILE_REPORT) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_archive_entry_t entry;
+    if (!jq_archive_find(root_path, uuid, &entry) ||
+        (kind == JQ_FILE_REPORT && !(entry.flags & JQ_ARCHIVE_HAS_REPORT))) {
+        return JQ_ERR_NOT_FOUND;
+    }
+    int loose = kind == JQ_FILE_PDF && (entry.flags & JQ_ARCHIVE_PDF_LOOSE);
+    if (loose ? !jq_archive_pdf_path(root_path, uuid, path_out, path_out_len)
+              : !jq_archive_segment_path(root_path, entry.segment, path_out, path_out_len)) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    *state_out = entry.state;
+    *offset_out = loose ? 0 : entry.offsets[kind];
+    *length_out = entry.lengths[kind];
+    return JQ_OK;
+}
+
+/*
+ * fsck. The scan notes every job location that is incomplete or claimed.
+ * Sorted by uuid, the notes for one job sit side by side, so a pdf that
+ * moved without its metadata is paired up however far apart the halves
+ * ended. Repairs reuse the journal's repair for split jobs and the reaper
+ * for dead claims, and leave alone anything changed within
+ * JQ_FSCK_GRACE_SECONDS, which is what a transition still running looks like.
+ */
+void jq_fsck_options_init(jq_fsck_options_t *options) {
+    if (!options) {
+        return;
+    }
+    memset(options, 0, sizeof(*options));
+}
+
+static int jq_fsck_finding_compare(const void *left, const void *right) {
+    const jq_fsck_finding_t *a = left;
+    const jq_fsck_finding_t *b = right;
+    int order = strcmp(a->uuid, b->uuid);
+    if (order != 0) {
+        return order;
+    }
+    if (a->state != b->state) {
+        return a->state < b->state ? -1 : 1;
+    }
+    return (int)a->locked - (int)b->locked;
+}
+
+static int jq_fsck_has(const jq_fsck_finding_t *finding, jq_scan_kind_t kind) {
+    return (finding->present >> kind) & 1u;
+}
+
+static int jq_fsck_fresh(time_t ctime, const jq_fsck_options_t *options) {
+    return ctime + (time_t)JQ_FSCK_GRACE_SECONDS > options->now;
+}
+
+/* Finishes or undoes an interrupted transition from one location of the job to another. */
+static int jq_fsck_settle(const jq_root_t *root, const char *uuid, const jq_fsck_finding_t *from, jq_state_t to_state) {
+    jq_journal_record_t record;
+    size_t uuid_len = strlen(uuid);
+    if (uuid_len >= JQ_JOURNAL_UUID_MAX) {
+        return 0;
+    }
+    memset(&record, 0, sizeof(record));
+    record.uuid_len = (uint32_t)uuid_len;
+    record.from_state = (int32_t)from->state;
+    record.to_state = (int32_t)to_state;
+    record.from_locked = from->locked;
+    memcpy(record.uuid, uuid, uuid_len);
+
+    /* Exclusive, like a replay, so no claim or transition is halfway through this pair. */
+    jq_journal_t journal;
+    if (jq_journal_open(root->path, 1, &journal) != JQ_OK) {
+        return 0;
+    }
+    int repaired = flock(journal.fd, LOCK_EX) == 0 && jq_journal_repair(root, &record);
+    jq_journal_close(&journal);
+    return repaired;
+}
+
+/* A claim is dead once its lease has run out, or, with no lease, once the claim is older than a lease. */
+static void jq_fsck_claim(const char *root_path,
+                          const jq_fsck_finding_t *finding,
+                          const jq_fsck_options_t *options,
+                          jq_fsck_report_t *report) {
+    char lease_path[PATH_MAX];
+    char reaping_path[PATH_MAX];
+    if (!jq_lease_path(root_path, finding->uuid, ".lease", lease_path, sizeof(lease_path)) ||
+        !jq_lease_path(root_path, finding->uuid, ".reaping", reaping_path, sizeof(reaping_path))) {
+        return;
+    }
+    jq_lease_record_t record;
+    jq_result_t lease_result = jq_lease_read(lease_path, &record);
+    int leased = lease_result == JQ_OK;
+    if (leased ? (time_t)record.expires_at > options->now
+               : access(reaping_path, F_OK) == 0 ||
+                     finding->ctime + (time_t)JQ_LEASE_DEFAULT_SECONDS > options->now) {
+        return;
+    }
+
+    report->stale_locks++;
+    if (!options->repair) {
+        return;
+    }
+    size_t requeued = 0;
+    if (leased) {
+        report->repaired += jq_reap_lease(root_path, finding->uuid, options->now, &requeued) == JQ_OK;
+        return;
+    }
+    if (lease_result != JQ_ERR_NOT_FOUND) {
+        unlink(lease_path);
+    }
+    report->repaired += jq_release(root_path, finding->uuid, finding->state) == JQ_OK;
+}
+
+/* Transitions rename the pdf first and always to an unlocked name, so the unlocked half is where the job was going. */
+static void jq_fsck_split(const jq_root_t *root,
+                          const jq_fsck_finding_t *pdf,
+                          const jq_fsck_finding_t *metadata,
+                          const jq_fsck_options_t *options,
+                          jq_fsck_report_t *report) {
+    report->split_pairs++;
+    if (jq_fsck_fresh(pdf->ctime > metadata->ctime ? pdf->ctime : metadata->ctime, options)) {
+        report->busy++;
+        return;
+    }
+    /* A locked pdf next to unlocked metadata is a claim that died halfway; it is rolled back. */
+    const jq_fsck_finding_t *from = pdf->locked ? pdf : metadata;
+    const jq_fsck_finding_t *to = pdf->locked ? metadata : pdf;
+    if (options->repair && !to->locked) {
+        report->repaired += (size_t)jq_fsck_settle(root, pdf->uuid, from, to->state);
+    }
+}
+
+/* Whether a job lives only in the archive, its loose files already removed. */
+static int jq_fsck_packed(const jq_root_t *root, const char *uuid, jq_state_t state) {
+    jq_archive_entry_t entry;
+    jq_file_t pdf;
+    jq_file_t metadata;
+    int present = 0;
+    return jq_archive_find(root->path, uuid, &entry) && entry.state == state &&
+           jq_pair_paths(root, uuid, state, 0, &pdf, &metadata) == JQ_OK &&
+           jq_check_pair_exists(&pdf, &metadata, &present) == JQ_OK && !present;
+}
+
+/* A report away from its job follows the job; one whose job is gone, or packed into the archive, is removed. */
+static void jq_fsck_stray(const jq_root_t *root,
+                          const jq_fsck_finding_t *finding,
+                          const jq_fsck_options_t *options,
+                          jq_fsck_report_t *report) {
+    report->stray_reports++;
+    if (jq_fsck_fresh(finding->ctime, options)) {
+        report->busy++;
+        return;
+    }
+    if (!options->repair) {
+        return;
+    }
+    jq_state_t state;
+    int locked = 0;
+    jq_result_t status = jq_status_at(root, finding->uuid, 0, &state, &locked);
+    if (status == JQ_OK && jq_fsck_packed(root, finding->uuid, state)) {
+        status = JQ_ERR_NOT_FOUND;
+    }
+    if (status == JQ_OK && !locked) {
+        report->repaired += (size_t)jq_fsck_settle(root, finding->uuid, finding, state);
+    } else if (status == JQ_ERR_NOT_FOUND) {
+        jq_file_t file;
+        if (jq_report_path(root, finding->uuid, finding->state, finding->locked, &file) == JQ_OK &&
+            unlinkat(file.dirfd, file.name, 0) == 0) {
+            jq_remove_job_dir(&file);
+            report->repaired++;
+        }
+    }
+}
+
+static void jq_fsck_job(const jq_root_t *root,
+                        const jq_fsck_finding_t *findings,
+                        size_t count,
+                        const jq_fsck_options_t *options,
+                        jq_fsck_report_t *report) {
+    const jq_fsck_finding_t *pdf = NULL;
+    const jq_fsck_finding_t *metadata = NULL;
+    size_t halves = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const jq_fsck_finding_t *finding = &findings[i];
+        int has_pdf = jq_fsck_has(finding, JQ_SCAN_PDF);
+        int has_metadata = jq_fsck_has(finding, JQ_SCAN_METADATA);
+        if (has_pdf && has_metadata) {
+            jq_fsck_claim(root->path, finding, options, report);
+        } else if (has_pdf || has_metadata) {
+            halves++;
+            if (has_pdf && !pdf) {
+                pdf = finding;
+            } else if (has_metadata && !metadata) {
+                metadata = finding;
+            }
+        }
+    }
+    /* Halves with no counterpart anywhere are only counted: there is nothing to put them back together with. */
+    if (pdf && metadata) {
+        jq_fsck_split(root, pdf, metadata, options, report);
+        halves -= 2;
+    }
+    report->orphans += halves;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!jq_fsck_has(&findings[i], JQ_SCAN_PDF) && !jq_fsck_has(&findings[i], JQ_SCAN_METADATA)) {
+            jq_fsck_stray(root, &findings[i], options, report);
+        }
+    }
+}
+
+jq_result_t jq_fsck(const char *root_path,
+                    const jq_fsck_options_t *options,
+                    jq_fsck_report_t *report_out) {
+    if (!root_path || !report_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
+    }
+    jq_fsck_options_t settings;
+    if (options) {
+        settings = *options;
+    } else {
+        jq_fsck_options_init(&settings);
+    }
+    if (settings.now == 0) {
+        settings.now = time(NULL);
+    }
+
+    jq_fsck_report_t report;
+    memset(&report, 0, sizeof(report));
+    /* The journal knows exactly which transitions were cut short; those are settled before the scan. */
+    if (settings.repair) {
+        size_t replayed = 0;
+        jq_result_t replay_result = jq_replay_journal(root_path, &replayed);
+        if (replay_result != JQ_OK) {
+            return replay_result;
+        }
+        report.repaired += replayed;
+    }
+
+    jq_scan_state_t *scans = NULL;
+    size_t count = 0;
+    jq_result_t result = jq_scan_run(root_path, settings.threads, &settings, &scans, &count);
+    if (result != JQ_OK) {
+        return result;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += scans[i].finding_count;
+        report.entries += scans[i].report.entries;
+        report.temp_files += scans[i].report.temp_files;
+        report.busy += scans[i].report.busy;
+        report.repaired += scans[i].report.repaired;
+    }
+    jq_fsck_finding_t *findings = malloc((total > 0 ? total : 1) * sizeof(*findings));
+    if (!findings) {
+        jq_scan_free(scans, count);
+        return JQ_ERR_IO;
+    }
+    size_t filled = 0;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(findings + filled, scans[i].findings, scans[i].finding_count * sizeof(*findings));
+        filled += scans[i].finding_count;
     }
-    if (*newest == 0 || mtime > *newest) {
-        *newest = mtime;
+    jq_scan_free(scans, count);
+    qsort(findings, total, sizeof(*findings), jq_fsck_finding_compare);
+
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    for (size_t first = 0; first < total;) {
+        size_t end = first + 1;
+        while (end < total && strcmp(findings[first].uuid, findings[end].uuid) == 0) {
+            end++;
+        }
+        jq_fsck_job(&root, findings + first, end - first, &settings, &report);
+        first = end;
     }
-}
+    free(findings);
 
-static int jq_build_dir_path(const char *root_path, const char *dir_name, char *out, size_t out_len) {
-    int written = snprintf(out, out_len, "%s/%s", root_path, dir_name);
-    if (written < 0 || (size_t)written >= out_len) {
-        return 0;
+    if (report.repaired > 0) {
+        jq_stats_t stats;
+        (void)jq_collect_stats(root_path, &stats);
     }
-    return 1;
+    if (settings.repair) {
+        jq_status_index_reset(root_path);
+        jq_ready_reindex(root_path);
+    }
+    *report_out = report;
+    return JQ_OK;
 }
 
-static int jq_build_entry_path(const char *dir_path, const char *name, char *out, size_t out_len) {
-    int written = snprintf(out, out_len, "%s/%s", dir_path, name);
-    if (written < 0 || (size_t)written >= out_len) {
-        return 0;
+jq_result_t jq_read_layout(const char *root_path, jq_layout_t *layout_out) {
+    if (!root_path || !layout_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
-    return 1;
+    *layout_out = jq_layout_of(root_path);
+    return JQ_OK;
 }
 
-static int jq_check_counterpart(const char *dir_path,
-                                const char *name,
-                                const char *suffix,
-                                const char *counter_suffix) {
-    size_t name_len = strlen(name);
-    size_t suffix_len = strlen(suffix);
-    if (suffix_len > name_len) {
-        return 0;
+static jq_result_t jq_write_layout(const char *root_path, const char *value) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!jq_build_index_path(root_path, JQ_LAYOUT_FILE, path, sizeof(path)) ||
+        !jq_build_index_path(root_path, "layout.tmp.XXXXXX", tmp_path, sizeof(tmp_path))) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
-    size_t base_len = name_len - suffix_len;
-    char counterpart[PATH_MAX];
-    if (base_len + strlen(counter_suffix) + 1 > sizeof(counterpart)) {
-        return 0;
+    jq_result_t ensure_result = jq_ensure_index_dir(root_path);
+    if (ensure_result != JQ_OK) {
+        return ensure_result;
     }
-    memcpy(counterpart, name, base_len);
-    memcpy(counterpart + base_len, counter_suffix, strlen(counter_suffix) + 1);
 
-    char path[PATH_MAX];
-    if (!jq_build_entry_path(dir_path, counterpart, path, sizeof(path))) {
-        return 0;
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return JQ_ERR_IO;
     }
-    if (access(path, F_OK) == 0) {
-        return 1;
+    jq_result_t result = jq_write_all(fd, value, strlen(value));
+    if (result == JQ_OK && fsync(fd) != 0) {
+        result = JQ_ERR_IO;
     }
-    if (errno == ENOENT) {
-        return 0;
+    if (close(fd) != 0 && result == JQ_OK) {
+        result = JQ_ERR_IO;
     }
-    return 1;
-}
-
-static jq_result_t jq_collect_state_stats(const char *root_path,
-                                          jq_state_t state,
-                                          jq_state_stats_t *stats,
-                                          time_t *oldest_mtime,
-                                          time_t *newest_mtime) {
-    if (!root_path || !stats) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (result == JQ_OK && rename(tmp_path, path) != 0) {
+        result = JQ_ERR_IO;
     }
-
-    const char *dir_name = jq_state_dir(state);
-    if (!dir_name) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (result != JQ_OK) {
+        unlink(tmp_path);
+        return result;
     }
+    jq_sync_parent_dir(path);
+    return JQ_OK;
+}
 
+/* Moves the unlocked flat files of one state into their shards; claimed files are left for their worker. */
+static jq_result_t jq_migrate_state(const char *root_path, jq_state_t state, size_t *moved, size_t *remaining) {
+    const char *dir_name = jq_state_dir(state);
     char dir_path[PATH_MAX];
     if (!jq_build_dir_path(root_path, dir_name, dir_path, sizeof(dir_path))) {
         return JQ_ERR_INVALID_ARGUMENT;
@@ -613,384 +9506,484 @@ static jq_result_t jq_collect_state_stats(const char *root_path,
 
     DIR *dir = opendir(dir_path);
     if (!dir) {
-        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+        return errno == ENOENT ? JQ_OK : JQ_ERR_IO;
     }
 
+    jq_root_t sharded;
+    jq_root_from_path(&sharded, root_path);
+    sharded.layout = JQ_LAYOUT_SHARDED;
+
+    const char *suffixes[] = {".pdf.job", ".metadata.job", ".report.html"};
+    jq_result_t result = JQ_OK;
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
         const char *name = entry->d_name;
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-            continue;
-        }
-
         const char *suffix = NULL;
-        enum {
-            JQ_FILE_UNKNOWN = 0,
-            JQ_FILE_PDF = 1,
-            JQ_FILE_METADATA = 2,
-            JQ_FILE_REPORT = 3
-        } file_type = JQ_FILE_UNKNOWN;
         int locked = 0;
-
-        if (jq_has_suffix(name, ".pdf.job.lock")) {
-            suffix = ".pdf.job.lock";
-            file_type = JQ_FILE_PDF;
-            locked = 1;
-        } else if (jq_has_suffix(name, ".pdf.job")) {
-            suffix = ".pdf.job";
-            file_type = JQ_FILE_PDF;
-        } else if (jq_has_suffix(name, ".metadata.job.lock")) {
-            suffix = ".metadata.job.lock";
-            file_type = JQ_FILE_METADATA;
-            locked = 1;
-        } else if (jq_has_suffix(name, ".metadata.job")) {
-            suffix = ".metadata.job";
-            file_type = JQ_FILE_METADATA;
-        } else if (jq_has_suffix(name, ".report.html.lock")) {
-            suffix = ".report.html.lock";
-            file_type = JQ_FILE_REPORT;
-            locked = 1;
-        } else if (jq_has_suffix(name, ".report.html")) {
-            suffix = ".report.html";
-            file_type = JQ_FILE_REPORT;
-        } else {
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]) && !suffix; ++i) {
+            char locked_suffix[32];
+            snprintf(locked_suffix, sizeof(locked_suffix), "%s.lock", suffixes[i]);
+            if (jq_has_suffix(name, suffixes[i])) {
+                suffix = suffixes[i];
+            } else if (jq_has_suffix(name, locked_suffix)) {
+                suffix = suffixes[i];
+                locked = 1;
+            }
+        }
+        if (!suffix) {
             continue;
         }
-
-        char path[PATH_MAX];
-        if (!jq_build_entry_path(dir_path, name, path, sizeof(path))) {
-            closedir(dir);
-            return JQ_ERR_INVALID_ARGUMENT;
+        if (locked) {
+            (*remaining)++;
+            continue;
         }
 
-        struct stat st;
-        if (stat(path, &st) != 0) {
-            closedir(dir);
-            return JQ_ERR_IO;
-        }
-        jq_update_mtime(st.st_mtime, oldest_mtime, newest_mtime);
+        char uuid[NAME_MAX + 1];
+        size_t uuid_len = strlen(name) - strlen(suffix);
+        memcpy(uuid, name, uuid_len);
+        uuid[uuid_len] = '\0';
 
-        if (file_type == JQ_FILE_PDF) {
-            if (locked) {
-                stats->pdf_locked++;
-            } else {
-                stats->pdf_jobs++;
-            }
-            stats->pdf_bytes += (unsigned long long)st.st_size;
-            const char *counter_suffix = locked ? ".metadata.job.lock" : ".metadata.job";
-            if (!jq_check_counterpart(dir_path, name, suffix, counter_suffix)) {
-                stats->orphan_pdf++;
-            }
-        } else if (file_type == JQ_FILE_METADATA) {
-            if (locked) {
-                stats->metadata_locked++;
-            } else {
-                stats->metadata_jobs++;
-            }
-            stats->metadata_bytes += (unsigned long long)st.st_size;
-            const char *counter_suffix = locked ? ".pdf.job.lock" : ".pdf.job";
-            if (!jq_check_counterpart(dir_path, name, suffix, counter_suffix)) {
-                stats->orphan_metadata++;
-            }
-        } else if (file_type == JQ_FILE_REPORT) {
-            if (locked) {
-                stats->report_locked++;
-            } else {
-                stats->report_jobs++;
-            }
-            stats->report_bytes += (unsigned long long)st.st_size;
-            const char *counter_suffix = locked ? ".pdf.job.lock" : ".pdf.job";
-            if (!jq_check_counterpart(dir_path, name, suffix, counter_suffix)) {
-                stats->orphan_report++;
-            }
+        jq_file_t src = {.dirfd = AT_FDCWD};
+        jq_file_t dst;
+        if (!jq_build_entry_path(dir_path, name, src.name, sizeof(src.name)) ||
+            !jq_job_file(&sharded, state, uuid, suffix, &dst)) {
+            result = JQ_ERR_INVALID_ARGUMENT;
+            break;
+        }
+        if (faccessat(dst.dirfd, dst.name, F_OK, 0) == 0) {
+            /* Both copies exist; leave the flat one for fsck rather than overwrite. */
+            (*remaining)++;
+            continue;
+        }
+        jq_result_t rename_result = jq_rename(&src, &dst);
+        if (rename_result == JQ_OK) {
+            (*moved)++;
+        } else if (rename_result == JQ_ERR_IO && errno == EEXIST) {
+            /* The same, created since the check. */
+            (*remaining)++;
+        } else if (rename_result != JQ_ERR_NOT_FOUND) {
+            /* A NOT_FOUND means a worker claimed or moved it first. */
+            result = rename_result;
+            break;
         }
     }
 
     closedir(dir);
-    return JQ_OK;
+    return result;
 }
 
-static jq_result_t jq_claim_in_dir(const char *root_path,
-                                   const char *dir_name,
-                                   jq_state_t state,
-                                   char *uuid_out,
-                                   size_t uuid_out_len) {
-    if (!root_path || !dir_name || !uuid_out || uuid_out_len == 0) {
+jq_result_t jq_migrate_layout(const char *root_path, size_t *moved_out, size_t *remaining_out) {
+    if (!root_path) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
+    if (jq_is_job_dir_layout(jq_layout_of(root_path))) {
+        /* Job directories already live in the shards. */
+        return jq_migrate_job_dirs(root_path, moved_out, remaining_out);
+    }
 
-    char dir_path[PATH_MAX];
-    int written = snprintf(dir_path, sizeof(dir_path), "%s/%s", root_path, dir_name);
-    if (written < 0 || (size_t)written >= sizeof(dir_path)) {
-        return JQ_ERR_INVALID_ARGUMENT;
+    if (jq_layout_of(root_path) != JQ_LAYOUT_SHARDED) {
+        jq_result_t result = jq_write_layout(root_path, "migrating\n");
+        if (result != JQ_OK) {
+            return result;
+        }
     }
 
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        return errno == ENOENT ? JQ_ERR_NOT_FOUND : JQ_ERR_IO;
+    size_t moved = 0;
+    size_t remaining = 0;
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        jq_result_t result = jq_migrate_state(root_path, states[i], &moved, &remaining);
+        if (result != JQ_OK) {
+            return result;
+        }
     }
 
-    struct dirent *entry;
-    jq_result_t result = JQ_ERR_NOT_FOUND;
-    while ((entry = readdir(dir)) != NULL) {
-        const char *name = entry->d_name;
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+    if (moved_out) {
+        *moved_out = moved;
+    }
+    if (remaining_out) {
+        *remaining_out = remaining;
+    }
+    if (remaining > 0) {
+        return JQ_OK;
+    }
+    return jq_layout_of(root_path) == JQ_LAYOUT_SHARDED ? JQ_OK : jq_write_layout(root_path, "sharded\n");
+}
+
+/* Moves the unclaimed loose files of one state into job directories; claimed jobs move when released. */
+static jq_result_t jq_migrate_state_dirs(const jq_root_t *root, jq_state_t state, size_t *moved, size_t *remaining) {
+    jq_dir_iter_t iter;
+    jq_result_t open_result = jq_dir_iter_open(&iter, root->path, state);
+    if (open_result != JQ_OK) {
+        return open_result == JQ_ERR_NOT_FOUND ? JQ_OK : open_result;
+    }
+
+    const char *suffixes[] = {".pdf.job", ".metadata.job", ".report.html"};
+    jq_result_t result = JQ_OK;
+    const char *name;
+    while ((name = jq_dir_iter_next(&iter)) != NULL) {
+        if (jq_dir_iter_in_job(&iter)) {
             continue;
         }
-        if (!jq_has_suffix(name, ".pdf.job")) {
-            continue;
+        const char *suffix = NULL;
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]) && !suffix; ++i) {
+            if (jq_has_suffix(name, suffixes[i])) {
+                suffix = suffixes[i];
+            }
         }
-        if (jq_has_suffix(name, ".pdf.job.lock")) {
+        if (!suffix) {
+            if (jq_has_suffix(name, ".lock")) {
+                (*remaining)++;
+            }
             continue;
         }
 
-        size_t base_len = strlen(name) - strlen(".pdf.job");
-        if (base_len + 1 > uuid_out_len) {
+        char uuid[NAME_MAX + 1];
+        size_t uuid_len = strlen(name) - strlen(suffix);
+        memcpy(uuid, name, uuid_len);
+        uuid[uuid_len] = '\0';
+
+        char shard[8];
+        jq_shard_prefix(uuid, shard);
+        jq_file_t src = {.dirfd = AT_FDCWD};
+        jq_file_t dst;
+        if (!jq_build_entry_path(jq_dir_iter_path(&iter), name, src.name, sizeof(src.name)) ||
+            !jq_format_dir_file(root, state, shard, uuid, suffix, &dst)) {
             result = JQ_ERR_INVALID_ARGUMENT;
             break;
         }
-
-        memcpy(uuid_out, name, base_len);
-        uuid_out[base_len] = '\0';
-
-        char pdf_src[PATH_MAX];
-        char metadata_src[PATH_MAX];
-        char pdf_locked[PATH_MAX];
-        char metadata_locked[PATH_MAX];
-
-        jq_result_t src_paths =
-            jq_job_paths(root_path, uuid_out, state, pdf_src, sizeof(pdf_src), metadata_src, sizeof(metadata_src));
-        if (src_paths != JQ_OK) {
-            result = src_paths;
-            break;
-        }
-
-        jq_result_t locked_paths = jq_job_paths_locked(root_path, uuid_out, state,
-                                                       pdf_locked, sizeof(pdf_locked),
-                                                       metadata_locked, sizeof(metadata_locked));
-        if (locked_paths != JQ_OK) {
-            result = locked_paths;
-            break;
-        }
-
-        if (access(metadata_src, F_OK) != 0) {
+        if (faccessat(dst.dirfd, dst.name, F_OK, 0) == 0) {
+            /* Both copies exist; leave the loose one for fsck rather than overwrite. */
+            (*remaining)++;
             continue;
         }
-
-        jq_result_t pdf_lock = jq_rename(pdf_src, pdf_locked);
-        if (pdf_lock != JQ_OK) {
-            result = pdf_lock;
-            break;
-        }
-
-        jq_result_t metadata_lock = jq_rename(metadata_src, metadata_locked);
-        if (metadata_lock != JQ_OK) {
-            jq_rename(pdf_locked, pdf_src);
-            result = metadata_lock;
+        jq_result_t rename_result = jq_rename(&src, &dst);
+        if (rename_result == JQ_OK) {
+            (*moved)++;
+        } else if (rename_result == JQ_ERR_IO && errno == EEXIST) {
+            (*remaining)++;
+        } else if (rename_result != JQ_ERR_NOT_FOUND) {
+            /* A NOT_FOUND means a worker claimed or moved it first. */
+            result = rename_result;
             break;
         }
-
-        result = JQ_OK;
-        break;
     }
 
-    closedir(dir);
+    jq_dir_iter_close(&iter);
     return result;
 }
 
-jq_result_t jq_claim_next(const char *root_path,
-                          int prefer_priority,
-                          char *uuid_out,
-                          size_t uuid_out_len,
-                          jq_state_t *state_out) {
-    if (!root_path || !uuid_out || uuid_out_len == 0 || !state_out) {
+/*
+ * Converts a flat or sharded root to the directory layout while workers keep
+ * running. The root reads as directories-migrating until no loose file is
+ * left; rerun it once claimed jobs have been released or finalized.
+ */
+jq_result_t jq_migrate_job_dirs(const char *root_path, size_t *moved_out, size_t *remaining_out) {
+    if (!root_path) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    const char *first_dir = prefer_priority ? "priority_jobs" : "jobs";
-    const char *second_dir = prefer_priority ? "jobs" : "priority_jobs";
-    jq_state_t first_state = prefer_priority ? JQ_STATE_PRIORITY : JQ_STATE_JOBS;
-    jq_state_t second_state = prefer_priority ? JQ_STATE_JOBS : JQ_STATE_PRIORITY;
-
-    jq_result_t first_result = jq_claim_in_dir(root_path, first_dir, first_state, uuid_out, uuid_out_len);
-    if (first_result == JQ_OK) {
-        *state_out = first_state;
-        return JQ_OK;
+    if (jq_layout_of(root_path) != JQ_LAYOUT_DIRECTORY) {
+        jq_result_t result = jq_write_layout(root_path, "directories-migrating\n");
+        if (result != JQ_OK) {
+            return result;
+        }
     }
 
-    if (first_result != JQ_ERR_NOT_FOUND) {
-        return first_result;
+    jq_root_t root;
+    jq_root_from_path(&root, root_path);
+    size_t moved = 0;
+    size_t remaining = 0;
+    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
+        jq_result_t result = jq_migrate_state_dirs(&root, states[i], &moved, &remaining);
+        if (result != JQ_OK) {
+            return result;
+        }
     }
 
-    jq_result_t second_result = jq_claim_in_dir(root_path, second_dir, second_state, uuid_out, uuid_out_len);
-    if (second_result == JQ_OK) {
-        *state_out = second_state;
+    if (moved_out) {
+        *moved_out = moved;
+    }
+    if (remaining_out) {
+        *remaining_out = remaining;
+    }
+    if (remaining > 0 || root.layout == JQ_LAYOUT_DIRECTORY) {
         return JQ_OK;
     }
-
-    return second_result;
+    return jq_write_layout(root_path, "directories\n");
 }
 
-jq_result_t jq_release(const char *root_path,
-                       const char *uuid,
-                       jq_state_t state) {
-    if (!root_path || !uuid) {
+jq_result_t jq_collect_stats(const char *root_path,
+                             jq_stats_t *stats_out) {
+    if (!root_path || !stats_out) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    jq_result_t ensure_result = jq_ensure_state_dir(root_path, state);
-    if (ensure_result != JQ_OK) {
-        return ensure_result;
-    }
-
-    char pdf_locked[PATH_MAX];
-    char metadata_locked[PATH_MAX];
-    char pdf_dest[PATH_MAX];
-    char metadata_dest[PATH_MAX];
-    char report_locked[PATH_MAX];
-    char report_dest[PATH_MAX];
+    memset(stats_out, 0, sizeof(*stats_out));
 
-    jq_result_t locked_result = jq_job_paths_locked(root_path, uuid, state,
-                                                    pdf_locked, sizeof(pdf_locked),
-                                                    metadata_locked, sizeof(metadata_locked));
-    if (locked_result != JQ_OK) {
-        return locked_result;
+    jq_result_t result = jq_scan_states(root_path, JQ_SCAN_THREADS, stats_out);
+    if (result != JQ_OK) {
+        return result;
     }
 
-    jq_result_t dest_result = jq_job_paths(root_path, uuid, state,
-                                           pdf_dest, sizeof(pdf_dest),
-                                           metadata_dest, sizeof(metadata_dest));
-    if (dest_result != JQ_OK) {
-        return dest_result;
+    time_t now = time(NULL);
+    jq_stats_finish(stats_out, now);
+    stats_out->reconciled_at = now;
+    /* The scan is the repair path for the incremental counters. */
+    (void)jq_stats_store(root_path, stats_out, now);
+    jq_stats_file_t *stats = NULL;
+    if (jq_stats_map(root_path, &stats) == JQ_OK) {
+        stats_out->events_dropped = (unsigned long long)atomic_load(&stats->events_dropped);
+        munmap(stats, sizeof(jq_stats_file_t));
     }
+    jq_tenant_stats_fill(root_path, stats_out, 1);
+    return JQ_OK;
+}
 
-    jq_result_t report_locked_result =
-        jq_job_report_paths_locked(root_path, uuid, state, report_locked, sizeof(report_locked));
-    if (report_locked_result != JQ_OK) {
-        return report_locked_result;
-    }
+static size_t jq_stats_counter(const _Atomic int64_t *counters, size_t counter) {
+    int64_t value = atomic_load(&counters[counter]);
+    return value > 0 ? (size_t)value : 0;
+}
 
-    jq_result_t report_dest_result =
-        jq_job_report_paths(root_path, uuid, state, report_dest, sizeof(report_dest));
-    if (report_dest_result != JQ_OK) {
-        return report_dest_result;
+jq_result_t jq_read_stats(const char *root_path,
+                          jq_stats_t *stats_out) {
+    if (!root_path || !stats_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    jq_result_t pdf_release = jq_rename(pdf_locked, pdf_dest);
-    if (pdf_release != JQ_OK) {
-        return pdf_release;
+    jq_stats_file_t *stats = NULL;
+    if (jq_stats_map(root_path, &stats) != JQ_OK) {
+        return jq_collect_stats(root_path, stats_out);
     }
 
-    jq_result_t metadata_release = jq_rename(metadata_locked, metadata_dest);
-    if (metadata_release != JQ_OK) {
-        jq_rename(pdf_dest, pdf_locked);
-        return metadata_release;
+    memset(stats_out, 0, sizeof(*stats_out));
+    for (size_t state = 0; state <= JQ_STATE_ERROR; ++state) {
+        const _Atomic int64_t *counters = stats->counters[state];
+        jq_state_stats_t *state_stats = &stats_out->states[state];
+        state_stats->pdf_jobs = jq_stats_counter(counters, JQ_STAT_PDF);
+        state_stats->metadata_jobs = jq_stats_counter(counters, JQ_STAT_METADATA);
+        state_stats->report_jobs = jq_stats_counter(counters, JQ_STAT_REPORT);
+        state_stats->pdf_locked = jq_stats_counter(counters, JQ_STAT_PDF_LOCKED);
+        state_stats->metadata_locked = jq_stats_counter(counters, JQ_STAT_METADATA_LOCKED);
+        state_stats->report_locked = jq_stats_counter(counters, JQ_STAT_REPORT_LOCKED);
+        state_stats->pdf_bytes = jq_stats_counter(counters, JQ_STAT_PDF_BYTES);
+        state_stats->metadata_bytes = jq_stats_counter(counters, JQ_STAT_METADATA_BYTES);
+        state_stats->report_bytes = jq_stats_counter(counters, JQ_STAT_REPORT_BYTES);
+        state_stats->orphan_pdf = jq_stats_counter(counters, JQ_STAT_ORPHAN_PDF);
+        state_stats->orphan_metadata = jq_stats_counter(counters, JQ_STAT_ORPHAN_METADATA);
+        state_stats->orphan_report = jq_stats_counter(counters, JQ_STAT_ORPHAN_REPORT);
     }
-
-    jq_result_t report_release = jq_move_report_if_present(report_locked, report_dest);
-    if (report_release != JQ_OK) {
-        jq_rename(metadata_dest, metadata_locked);
-        jq_rename(pdf_dest, pdf_locked);
-        return report_release;
+    stats_out->oldest_mtime = (time_t)atomic_load(&stats->oldest_mtime);
+    stats_out->newest_mtime = (time_t)atomic_load(&stats->newest_mtime);
+    stats_out->reconciled_at = (time_t)stats->reconciled_at;
+    stats_out->events_dropped = (unsigned long long)atomic_load(&stats->events_dropped);
+    time_t waiting_snapshot = (time_t)stats->oldest_waiting_mtime;
+    munmap(stats, sizeof(jq_stats_file_t));
+
+    /*
+     * The oldest waiting job sits at the head of one of its state's lanes. A
+     * missing lane is rebuilt once here, as a claim would; the last scan is
+     * the fallback.
+     */
+    const jq_state_t queues[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY};
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); ++i) {
+        if (stats_out->states[queues[i]].pdf_jobs == 0) {
+            continue;
+        }
+        int first = jq_state_first_level(queues[i]);
+        time_t candidate = 0;
+        int unusable = 0;
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            candidate = 0;
+            unusable = 0;
+            for (int level = first; level < first + JQ_LEVELS_PER_STATE; ++level) {
+                uint64_t seq = 0;
+                uint64_t records = 0;
+                int64_t enqueued_at = 0;
+                jq_ready_status_t status = jq_ready_peek(root_path, 0, level, &seq, &enqueued_at, &records);
+                if (status == JQ_READY_UNUSABLE) {
+                    unusable = 1;
+                } else if (status == JQ_READY_PENDING && (candidate == 0 || (time_t)enqueued_at < candidate)) {
+                    candidate = (time_t)enqueued_at;
+                }
+            }
+            size_t indexed = 0;
+            int unindexed = 0;
+            if (!unusable || attempt == 1 ||
+                jq_ready_refresh(root_path, queues[i], 1, &indexed, &unindexed) != JQ_OK) {
+                break;
+            }
+        }
+        if (unusable || candidate == 0) {
+            candidate = waiting_snapshot;
+        }
+        if (candidate > 0 && (stats_out->oldest_waiting_mtime == 0 || candidate < stats_out->oldest_waiting_mtime)) {
+            stats_out->oldest_waiting_mtime = candidate;
+        }
     }
 
+    jq_tenant_stats_fill(root_path, stats_out, 0);
+    jq_stats_finish(stats_out, time(NULL));
     return JQ_OK;
 }
 
-jq_result_t jq_finalize(const char *root_path,
-                        const char *uuid,
-                        jq_state_t from_state,
-                        jq_state_t to_state) {
-    if (!root_path || !uuid) {
-        return JQ_ERR_INVALID_ARGUMENT;
+/*
+ * Handles: jq_open keeps a descriptor on every state directory and on .jq
+ * for the life of the handle, so transitions resolve job files with the
+ * *at() calls relative to them rather than walking the root path on every
+ * rename and stat. The layout is re-read through the .jq descriptor on each
+ * call so a migration started by another process is still honoured. The
+ * ready ring stays mapped too, and is swapped for its successor once a
+ * rebuild retires it.
+ */
+struct jq_handle {
+    char path[PATH_MAX];
+    jq_root_t root;
+    jq_journal_t journal;
+    jq_event_writer_t events;
+};
+
+jq_handle_t *jq_open(const char *root_path) {
+    if (!root_path || strlen(root_path) >= PATH_MAX || jq_init(root_path) != JQ_OK) {
+        return NULL;
     }
 
-    jq_result_t ensure_result = jq_ensure_state_dir(root_path, to_state);
-    if (ensure_result != JQ_OK) {
-        return ensure_result;
+    jq_handle_t *handle = calloc(1, sizeof(*handle));
+    if (!handle) {
+        return NULL;
     }
+    memcpy(handle->path, root_path, strlen(root_path) + 1);
+    jq_root_from_path(&handle->root, handle->path);
+    handle->journal.fd = -1;
+    handle->journal.sync_fd = -1;
+    handle->root.journal = &handle->journal;
+    handle->events.fd = -1;
+    handle->root.events = &handle->events;
 
-    char pdf_locked[PATH_MAX];
-    char metadata_locked[PATH_MAX];
-    char pdf_dest[PATH_MAX];
-    char metadata_dest[PATH_MAX];
-    char report_locked[PATH_MAX];
-    char report_dest[PATH_MAX];
-
-    jq_result_t locked_result = jq_job_paths_locked(root_path, uuid, from_state,
-                                                    pdf_locked, sizeof(pdf_locked),
-                                                    metadata_locked, sizeof(metadata_locked));
-    if (locked_result != JQ_OK) {
-        return locked_result;
+    char path[PATH_MAX];
+    for (int state = JQ_STATE_JOBS; state <= JQ_STATE_ERROR; ++state) {
+        if (!jq_build_dir_path(root_path, jq_state_dir((jq_state_t)state), path, sizeof(path)) ||
+            (handle->root.state_fds[state] = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            jq_close(handle);
+            return NULL;
+        }
     }
-
-    jq_result_t dest_result = jq_job_paths(root_path, uuid, to_state,
-                                           pdf_dest, sizeof(pdf_dest),
-                                           metadata_dest, sizeof(metadata_dest));
-    if (dest_result != JQ_OK) {
-        return dest_result;
+    if (!jq_build_dir_path(root_path, JQ_INDEX_DIR, path, sizeof(path)) ||
+        (handle->root.index_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        jq_close(handle);
+        return NULL;
     }
+    return handle;
+}
 
-    jq_result_t report_locked_result =
-        jq_job_report_paths_locked(root_path, uuid, from_state, report_locked, sizeof(report_locked));
-    if (report_locked_result != JQ_OK) {
-        return report_locked_result;
+void jq_close(jq_handle_t *handle) {
+    if (!handle) {
+        return;
+    }
+    for (int state = JQ_STATE_JOBS; state <= JQ_STATE_ERROR; ++state) {
+        if (handle->root.state_fds[state] >= 0) {
+            close(handle->root.state_fds[state]);
+        }
     }
+    if (handle->root.index_fd >= 0) {
+        close(handle->root.index_fd);
+    }
+    jq_journal_release(&handle->journal);
+    jq_event_writer_close(&handle->events);
+    jq_ring_unmap(handle->root.ring);
+    free(handle);
+}
 
-    jq_result_t report_dest_result =
-        jq_job_report_paths(root_path, uuid, to_state, report_dest, sizeof(report_dest));
-    if (report_dest_result != JQ_OK) {
-        return report_dest_result;
+static void jq_handle_root(jq_handle_t *handle, jq_root_t *root) {
+    if (handle->root.ring && atomic_load_explicit(&handle->root.ring->retired, memory_order_relaxed)) {
+        jq_ring_unmap(handle->root.ring);
+        handle->root.ring = NULL;
     }
+    if (!handle->root.ring) {
+        handle->root.ring = jq_ring_map_at(handle->root.index_fd, JQ_RING_FILE);
+    }
+    *root = handle->root;
+    root->layout = jq_layout_lookup(handle->root.path, handle->root.index_fd, JQ_LAYOUT_FILE);
+}
 
-    jq_result_t pdf_move = jq_rename(pdf_locked, pdf_dest);
-    if (pdf_move != JQ_OK) {
-        return pdf_move;
+jq_result_t jq_handle_move(jq_handle_t *handle,
+                           const char *uuid,
+                           jq_state_t from_state,
+                           jq_state_t to_state) {
+    if (!handle || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    jq_result_t metadata_move = jq_rename(metadata_locked, metadata_dest);
-    if (metadata_move != JQ_OK) {
-        jq_rename(pdf_dest, pdf_locked);
-        return metadata_move;
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    return jq_move_at(&root, uuid, from_state, to_state);
+}
+
+jq_result_t jq_handle_claim(jq_handle_t *handle,
+                            const jq_claim_options_t *options,
+                            char *uuid_out,
+                            size_t uuid_out_len,
+                            jq_state_t *state_out) {
+    if (!handle || !uuid_out || uuid_out_len == 0 || !state_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    jq_result_t report_move = jq_move_report_if_present(report_locked, report_dest);
-    if (report_move != JQ_OK) {
-        jq_rename(metadata_dest, metadata_locked);
-        jq_rename(pdf_dest, pdf_locked);
-        return report_move;
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    size_t count = 0;
+    return jq_claim_many(&root, options, 1, uuid_out, uuid_out_len, state_out, &count);
+}
+
+jq_result_t jq_handle_claim_batch(jq_handle_t *handle,
+                                  const jq_claim_options_t *options,
+                                  size_t max_jobs,
+                                  char uuids_out[][JQ_UUID_MAX],
+                                  jq_state_t *states_out,
+                                  size_t *count_out) {
+    if (!handle || max_jobs == 0 || !uuids_out || !states_out || !count_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    return JQ_OK;
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    return jq_claim_many(&root, options, max_jobs, uuids_out[0], JQ_UUID_MAX, states_out, count_out);
 }
 
-jq_result_t jq_collect_stats(const char *root_path,
-                             jq_stats_t *stats_out) {
-    if (!root_path || !stats_out) {
+jq_result_t jq_handle_release(jq_handle_t *handle,
+                              const char *uuid,
+                              jq_state_t state) {
+    if (!handle || !uuid) {
         return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    memset(stats_out, 0, sizeof(*stats_out));
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    return jq_release_at(&root, uuid, state);
+}
 
-    const jq_state_t states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_COMPLETE, JQ_STATE_ERROR};
-    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
-        jq_result_t result = jq_collect_state_stats(root_path,
-                                                    states[i],
-                                                    &stats_out->states[states[i]],
-                                                    &stats_out->oldest_mtime,
-                                                    &stats_out->newest_mtime);
-        if (result != JQ_OK) {
-            return result;
-        }
+jq_result_t jq_handle_finalize(jq_handle_t *handle,
+                               const char *uuid,
+                               jq_state_t from_state,
+                               jq_state_t to_state) {
+    if (!handle || !uuid) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); ++i) {
-        const jq_state_stats_t *state_stats = &stats_out->states[states[i]];
-        stats_out->total_jobs += state_stats->pdf_jobs + state_stats->metadata_jobs + state_stats->report_jobs;
-        stats_out->total_locked += state_stats->pdf_locked + state_stats->metadata_locked + state_stats->report_locked;
-        stats_out->total_orphans += state_stats->orphan_pdf + state_stats->orphan_metadata + state_stats->orphan_report;
-        stats_out->total_bytes += state_stats->pdf_bytes + state_stats->metadata_bytes + state_stats->report_bytes;
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    return jq_finalize_at(&root, uuid, from_state, to_state);
+}
+
+jq_result_t jq_handle_status(jq_handle_t *handle,
+                             const char *uuid,
+                             jq_state_t *state_out,
+                             int *locked_out) {
+    if (!handle || !uuid || !state_out || !locked_out) {
+        return JQ_ERR_INVALID_ARGUMENT;
     }
 
-    return JQ_OK;
+    jq_root_t root;
+    jq_handle_root(handle, &root);
+    return jq_status_at(&root, uuid, 1, state_out, locked_out);
 }
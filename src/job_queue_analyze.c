@@ -1,4 +1,5 @@
 #include "pap/job_queue.h"
+#include "pap/job_queue_worker.h"
 #include "pap/pdf_accessibility.h"
 
 #include <errno.h>
@@ -6,43 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#define FAILURE_ERROR "analysis_failed"
 #define REPORT_JSON_INITIAL 2048
 #define REPORT_HTML_INITIAL 4096
 
 static void print_usage(void) {
     printf("Usage:\n");
-    printf("  job_queue_analyze <root> [--prefer-priority] [--no-html]\n");
-}
-
-static int write_buffer_to_file(const char *path, const char *buffer, size_t length) {
-    FILE *fp = fopen(path, "wb");
-    if (!fp) {
-        return 0;
-    }
-    if (length > 0 && fwrite(buffer, 1, length, fp) != length) {
-        fclose(fp);
-        return 0;
-    }
-    if (fclose(fp) != 0) {
-        return 0;
-    }
-    return 1;
-}
-
-static int write_error_metadata(const char *path, const char *detail) {
-    if (!path || !detail) {
-        return 0;
-    }
-    char buffer[256];
-    int written = snprintf(buffer, sizeof(buffer),
-                           "{\"error\":\"analysis_failed\",\"detail\":\"%s\"}",
-                           detail);
-    if (written < 0 || (size_t)written >= sizeof(buffer)) {
-        return 0;
-    }
-    return write_buffer_to_file(path, buffer, (size_t)written);
+    printf("  job_queue_analyze <root> [--prefer-priority] [--no-html] [--wait <ms>]\n");
 }
 
 static int write_report_json(const pdfa_report_t *report, const char *path) {
@@ -58,7 +32,7 @@ static int write_report_json(const pdfa_report_t *report, const char *path) {
         size_t written = 0;
         pdfa_result_t result = pdfa_report_to_json(report, buffer, buffer_len, &written);
         if (result == PDFA_OK) {
-            int ok = write_buffer_to_file(path, buffer, written);
+            int ok = jq_worker_write_file(path, buffer, written);
             free(buffer);
             return ok;
         }
@@ -85,7 +59,7 @@ static int write_report_html(const pdfa_report_t *report, const char *source_lin
         size_t written = 0;
         pdfa_result_t result = pdfa_report_to_html_analysis(report, source_link, buffer, buffer_len, &written);
         if (result == PDFA_OK) {
-            int ok = write_buffer_to_file(path, buffer, written);
+            int ok = jq_worker_write_file(path, buffer, written);
             free(buffer);
             return ok;
         }
@@ -108,11 +82,20 @@ int main(int argc, char **argv) {
     const char *root = argv[1];
     int prefer_priority = 0;
     int write_html = 1;
+    int wait_ms = 0;
     for (int i = 2; i < argc; ++i) {
         if (strcmp(argv[i], "--prefer-priority") == 0) {
             prefer_priority = 1;
         } else if (strcmp(argv[i], "--no-html") == 0) {
             write_html = 0;
+        } else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            long value = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || value < -1 || value > INT_MAX) {
+                print_usage();
+                return 1;
+            }
+            wait_ms = (int)value;
         } else {
             print_usage();
             return 1;
@@ -121,7 +104,9 @@ int main(int argc, char **argv) {
 
     char uuid[128];
     jq_state_t state = JQ_STATE_JOBS;
-    jq_result_t claim_result = jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
+    jq_result_t claim_result = wait_ms != 0
+                                   ? jq_claim_wait(root, prefer_priority, wait_ms, uuid, sizeof(uuid), &state)
+                                   : jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
     if (claim_result == JQ_ERR_NOT_FOUND) {
         return 2;
     }
@@ -139,42 +124,39 @@ int main(int argc, char **argv) {
     }
 
     pdfa_report_t report;
-    pdfa_result_t analyze_result = pdfa_analyze_file(pdf_locked, &report);
+    jq_worker_monitor_t monitor;
+    jq_worker_monitor_begin(&monitor, root, uuid, "analyze", pdf_locked);
+    pdfa_result_t analyze_result =
+        pdfa_analyze_file_with_progress(pdf_locked, &report, jq_worker_progress, &monitor);
+    jq_worker_monitor_end(&monitor);
+    if (analyze_result == PDFA_ERR_CANCELLED) {
+        return jq_worker_cancel(root, uuid, state);
+    }
     if (analyze_result != PDFA_OK) {
-        const char *detail = pdfa_result_str(analyze_result);
-        write_error_metadata(metadata_locked, detail);
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR,
+                              pdfa_result_str(analyze_result), analyze_result == PDFA_ERR_IO);
     }
 
     if (!write_report_json(&report, metadata_locked)) {
-        write_error_metadata(metadata_locked, "report_write_failed");
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_write_failed", 1);
     }
 
     char report_locked[PATH_MAX];
     if (write_html) {
         if (jq_job_report_paths_locked(root, uuid, state, report_locked, sizeof(report_locked)) != JQ_OK) {
-            write_error_metadata(metadata_locked, "report_path_failed");
-            (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-            return 1;
+            return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_path_failed", 0);
         }
 
         char pdf_complete[PATH_MAX];
         char metadata_complete[PATH_MAX];
         if (jq_job_paths(root, uuid, JQ_STATE_COMPLETE, pdf_complete, sizeof(pdf_complete),
                          metadata_complete, sizeof(metadata_complete)) != JQ_OK) {
-            write_error_metadata(metadata_locked, "report_path_failed");
-            (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-            return 1;
+            return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_path_failed", 0);
         }
 
         if (!write_report_html(&report, pdf_complete, report_locked)) {
             unlink(report_locked);
-            write_error_metadata(metadata_locked, "report_write_failed");
-            (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-            return 1;
+            return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_write_failed", 1);
         }
     }
 
@@ -1,18 +1,36 @@
 #include "pap/job_queue.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static void print_usage(void) {
     printf("Usage:\n");
     printf("  job_queue_cli init <root>\n");
-    printf("  job_queue_cli submit <root> <uuid> <pdf> <metadata> [--priority]\n");
-    printf("  job_queue_cli claim <root> [--prefer-priority]\n");
+    printf("  job_queue_cli submit <root> <uuid> <pdf> <metadata> [--priority] [--level <0-7>] [--link | --blob] [--tenant <name>]\n");
+    printf("  job_queue_cli submit-batch <root> <manifest> [--priority] [--level <0-7>] [--link | --blob] [--tenant <name>] [--threads <n>]\n");
+    printf("  job_queue_cli claim <root> [--prefer-priority] [--fifo] [--weighted] [--weights <w0,...,w7>] [--smallest-first | --size-round-robin] [--max-bytes <n>] [--batch <n>] [--owner <id>] [--lease <seconds>] [--wait <ms>]\n");
+    printf("  job_queue_cli heartbeat <root> <uuid> <state> [--owner <id>]\n");
+    printf("  job_queue_cli reap <root>\n");
+    printf("  job_queue_cli recover <root>\n");
+    printf("  job_queue_cli fsck <root> [--repair] [--threads <n>]\n");
     printf("  job_queue_cli release <root> <uuid> <state>\n");
+    printf("  job_queue_cli retry <root> <uuid> <state> [--owner <id>]\n");
+    printf("  job_queue_cli cancel <root> <uuid>\n");
     printf("  job_queue_cli finalize <root> <uuid> <from_state> <to_state>\n");
     printf("  job_queue_cli move <root> <uuid> <from_state> <to_state>\n");
-    printf("  job_queue_cli stats <root>\n");
+    printf("  job_queue_cli tenant <root> <name> [--max-in-flight <n>] [--weight <n>]\n");
+    printf("  job_queue_cli ring <root> [--capacity <n> | --disable]\n");
+    printf("  job_queue_cli retention <root> [--max-age <seconds>] [--keep <n>] [--pack-pdf] "
+           "[--keep-event-segments <n>] | --disable\n");
+    printf("  job_queue_cli compact <root> [--max-age <seconds>] [--keep <n>] [--pack-pdf] "
+           "[--keep-event-segments <n>]\n");
+    printf("  job_queue_cli tail <root> [--from <cursor>] [--follow]\n");
+    printf("  job_queue_cli stats <root> [--reconcile]\n");
+    printf("  job_queue_cli migrate <root> [--job-dirs]\n");
+    printf("  job_queue_cli gc-blobs <root>\n");
 }
 
 static const char *state_to_string(jq_state_t state) {
@@ -53,6 +71,41 @@ static int parse_state(const char *value, jq_state_t *state_out) {
     return 0;
 }
 
+static int parse_weights(const char *value, unsigned int *weights_out) {
+    const char *cursor = value;
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        char *end = NULL;
+        unsigned long weight = strtoul(cursor, &end, 10);
+        if (!end || end == cursor || weight > JQ_LEVEL_WEIGHT_MAX) {
+            return 0;
+        }
+        weights_out[level] = (unsigned int)weight;
+        if (level + 1 < JQ_LEVEL_COUNT) {
+            if (*end != ',') {
+                return 0;
+            }
+            cursor = end + 1;
+        } else if (*end != '\0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const char *result_to_string(jq_result_t result) {
+    switch (result) {
+        case JQ_OK:
+            return "ok";
+        case JQ_ERR_NOT_FOUND:
+            return "not_found";
+        case JQ_ERR_INVALID_ARGUMENT:
+            return "invalid";
+        case JQ_ERR_IO:
+        default:
+            return "io_error";
+    }
+}
+
 static int exit_for_result(jq_result_t result) {
     switch (result) {
         case JQ_OK:
@@ -80,9 +133,9 @@ static void print_state_stats(const char *label, const jq_state_stats_t *stats)
            stats->pdf_bytes, stats->metadata_bytes, stats->report_bytes);
 }
 
-static int handle_stats(const char *root) {
+static int handle_stats(const char *root, int reconcile) {
     jq_stats_t stats;
-    jq_result_t result = jq_collect_stats(root, &stats);
+    jq_result_t result = reconcile ? jq_collect_stats(root, &stats) : jq_read_stats(root, &stats);
     if (result != JQ_OK) {
         return exit_for_result(result);
     }
@@ -94,9 +147,330 @@ static int handle_stats(const char *root) {
     printf("totals: files=%zu locked=%zu orphans=%zu bytes=%llu oldest_mtime=%lld newest_mtime=%lld\n",
            stats.total_jobs, stats.total_locked, stats.total_orphans, stats.total_bytes,
            (long long)stats.oldest_mtime, (long long)stats.newest_mtime);
+    printf("waiting: oldest_mtime=%lld oldest_age_seconds=%llu\n",
+           (long long)stats.oldest_waiting_mtime, stats.oldest_waiting_age_seconds);
+    printf("counters: reconciled_at=%lld events_dropped=%llu\n", (long long)stats.reconciled_at,
+           stats.events_dropped);
+    for (size_t i = 0; i < stats.tenant_count; ++i) {
+        const jq_tenant_stats_t *tenant = &stats.tenants[i];
+        printf("tenant %s: depth=%zu in_flight=%zu max_in_flight=%u weight=%u\n", tenant->name, tenant->depth,
+               tenant->in_flight, tenant->max_in_flight, tenant->weight);
+    }
     return 0;
 }
 
+/* Options left out keep their current value (no cap, weight 1 for a new tenant). */
+static int handle_tenant(const char *root, const char *name, int argc, char **argv) {
+    unsigned int max_in_flight = 0;
+    unsigned int weight = 1;
+    jq_stats_t stats;
+    if (jq_read_stats(root, &stats) == JQ_OK) {
+        for (size_t i = 0; i < stats.tenant_count; ++i) {
+            if (strcmp(stats.tenants[i].name, name) == 0) {
+                max_in_flight = stats.tenants[i].max_in_flight;
+                weight = stats.tenants[i].weight;
+            }
+        }
+    }
+
+    for (int i = 0; i < argc; ++i) {
+        char *end = NULL;
+        unsigned long value = 0;
+        if ((strcmp(argv[i], "--max-in-flight") == 0 || strcmp(argv[i], "--weight") == 0) && i + 1 < argc) {
+            value = strtoul(argv[i + 1], &end, 10);
+        }
+        if (!end || *end != '\0' || value > UINT_MAX) {
+            print_usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--weight") == 0) {
+            weight = (unsigned int)value;
+        } else {
+            max_in_flight = (unsigned int)value;
+        }
+        i++;
+    }
+
+    jq_result_t result = jq_tenant_configure(root, name, max_in_flight, weight);
+    if (result == JQ_OK) {
+        printf("tenant=%s max_in_flight=%u weight=%u\n", name, max_in_flight, weight);
+    }
+    return exit_for_result(result);
+}
+
+static int handle_ring(const char *root, int argc, char **argv) {
+    if (argc == 1 && strcmp(argv[0], "--disable") == 0) {
+        jq_result_t result = jq_ring_disable(root);
+        if (result == JQ_OK) {
+            printf("ring=disabled\n");
+        }
+        return exit_for_result(result);
+    }
+
+    unsigned long capacity = 0;
+    if (argc == 2 && strcmp(argv[0], "--capacity") == 0) {
+        char *end = NULL;
+        capacity = strtoul(argv[1], &end, 10);
+        if (!end || *end != '\0' || capacity == 0 || capacity > UINT_MAX) {
+            print_usage();
+            return 1;
+        }
+    } else if (argc != 0) {
+        print_usage();
+        return 1;
+    }
+
+    jq_result_t result = jq_ring_enable(root, (unsigned int)capacity);
+    if (result == JQ_OK) {
+        printf("ring=enabled\n");
+    }
+    return exit_for_result(result);
+}
+
+/* Applies retention flags over options; returns 0 on a malformed flag and counts what was given. */
+static int parse_retention(int argc, char **argv, jq_retention_options_t *options, int *given_out) {
+    *given_out = 0;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--pack-pdf") == 0) {
+            options->pack_pdf = 1;
+            (*given_out)++;
+            continue;
+        }
+        char *end = NULL;
+        unsigned long value = 0;
+        if ((strcmp(argv[i], "--max-age") == 0 || strcmp(argv[i], "--keep") == 0 ||
+             strcmp(argv[i], "--keep-event-segments") == 0) &&
+            i + 1 < argc) {
+            value = strtoul(argv[i + 1], &end, 10);
+        }
+        if (!end || *end != '\0' || value > UINT_MAX) {
+            return 0;
+        }
+        if (strcmp(argv[i], "--max-age") == 0) {
+            options->max_age_seconds = (unsigned int)value;
+        } else if (strcmp(argv[i], "--keep-event-segments") == 0) {
+            options->max_event_segments = (size_t)value;
+        } else {
+            options->max_loose = (size_t)value;
+        }
+        (*given_out)++;
+        i++;
+    }
+    return 1;
+}
+
+/* Options left out keep their current value; with none at all the current policy is printed. */
+static int handle_retention(const char *root, int argc, char **argv) {
+    if (argc == 1 && strcmp(argv[0], "--disable") == 0) {
+        jq_result_t result = jq_retention_disable(root);
+        if (result == JQ_OK) {
+            printf("retention=disabled\n");
+        }
+        return exit_for_result(result);
+    }
+
+    jq_retention_options_t options;
+    jq_result_t result = jq_read_retention(root, &options);
+    if (result == JQ_ERR_NOT_FOUND) {
+        jq_retention_options_init(&options);
+    } else if (result != JQ_OK) {
+        return exit_for_result(result);
+    }
+    int given = 0;
+    if (!parse_retention(argc, argv, &options, &given)) {
+        print_usage();
+        return 1;
+    }
+    if (given == 0 && result == JQ_ERR_NOT_FOUND) {
+        printf("retention=disabled\n");
+        return 0;
+    }
+    if (given > 0) {
+        result = jq_retention_configure(root, &options);
+    }
+    if (result == JQ_OK) {
+        printf("retention max_age=%u keep=%zu pack_pdf=%d event_segments=%zu\n", options.max_age_seconds,
+               options.max_loose, options.pack_pdf, options.max_event_segments);
+    }
+    return exit_for_result(result);
+}
+
+static const char *event_kind_to_string(jq_event_kind_t kind) {
+    switch (kind) {
+        case JQ_EVENT_SUBMIT:
+            return "submit";
+        case JQ_EVENT_CLAIM:
+            return "claim";
+        case JQ_EVENT_RELEASE:
+            return "release";
+        case JQ_EVENT_RETRY:
+            return "retry";
+        case JQ_EVENT_FINALIZE:
+            return "finalize";
+        case JQ_EVENT_MOVE:
+            return "move";
+        case JQ_EVENT_CANCEL:
+            return "cancel";
+        default:
+            return "unknown";
+    }
+}
+
+static const char *event_state_to_string(int state) {
+    return state < 0 ? "none" : state_to_string((jq_state_t)state);
+}
+
+/* One line per event: <cursor> <at_ms> <kind> <uuid> <from> <to> <bytes>; --follow polls every 100ms. */
+static int handle_tail(const char *root, int argc, char **argv) {
+    unsigned long long cursor = 0;
+    int follow = 0;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            cursor = strtoull(argv[++i], &end, 10);
+            if (!end || *end != '\0') {
+                print_usage();
+                return 1;
+            }
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    jq_event_t events[256];
+    for (;;) {
+        size_t count = 0;
+        jq_result_t result =
+            jq_events_read(root, cursor, events, sizeof(events) / sizeof(events[0]), &count, &cursor);
+        if (result != JQ_OK) {
+            return exit_for_result(result);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            printf("%llu %lld %s %s %s %s %lld\n", events[i].cursor, events[i].at_ms,
+                   event_kind_to_string(events[i].kind), events[i].uuid, event_state_to_string(events[i].from_state),
+                   event_state_to_string(events[i].to_state), events[i].bytes);
+        }
+        if (count == sizeof(events) / sizeof(events[0])) {
+            continue;
+        }
+        if (!follow) {
+            return 0;
+        }
+        fflush(stdout);
+        struct timespec pause = {0, 100000000L};
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void free_manifest(jq_submit_item_t *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free((char *)items[i].uuid);
+        free((char *)items[i].pdf_path);
+        free((char *)items[i].metadata_path);
+    }
+    free(items);
+}
+
+/* One job per line: <uuid> <pdf> <metadata> [level]; blank lines and # comments are skipped. */
+static int read_manifest(const char *path, jq_submit_item_t **items_out, size_t *count_out) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        perror("manifest");
+        return 0;
+    }
+
+    jq_submit_item_t *items = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char line[3 * 4096 + 64];
+    size_t line_number = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *fields[5] = {NULL};
+        size_t field_count = 0;
+        for (char *token = strtok(line, " \t\r\n"); token && field_count < 5; token = strtok(NULL, " \t\r\n")) {
+            fields[field_count++] = token;
+        }
+        if (field_count == 0 || fields[0][0] == '#') {
+            continue;
+        }
+
+        int level = JQ_LEVEL_AUTO;
+        if (field_count == 4) {
+            char *end = NULL;
+            long value = strtol(fields[3], &end, 10);
+            if (!end || *end != '\0' || value < 0 || value >= JQ_LEVEL_COUNT) {
+                field_count = 0;
+            }
+            level = (int)value;
+        }
+        if (field_count != 3 && field_count != 4) {
+            fprintf(stderr, "manifest line %zu: expected <uuid> <pdf> <metadata> [level]\n", line_number);
+            ok = 0;
+            break;
+        }
+
+        if (count == capacity) {
+            size_t next = capacity ? capacity * 2 : 64;
+            jq_submit_item_t *grown = realloc(items, next * sizeof(*items));
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            items = grown;
+            capacity = next;
+        }
+        jq_submit_item_t *item = &items[count++];
+        item->uuid = strdup(fields[0]);
+        item->pdf_path = strdup(fields[1]);
+        item->metadata_path = strdup(fields[2]);
+        item->level = level;
+        item->result = JQ_ERR_IO;
+        if (!item->uuid || !item->pdf_path || !item->metadata_path) {
+            ok = 0;
+        }
+    }
+
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!ok) {
+        free_manifest(items, count);
+        return 0;
+    }
+    *items_out = items;
+    *count_out = count;
+    return 1;
+}
+
+static int handle_submit_batch(const char *root, const char *manifest, const jq_submit_options_t *options) {
+    jq_submit_item_t *items = NULL;
+    size_t count = 0;
+    if (!read_manifest(manifest, &items, &count)) {
+        return 1;
+    }
+
+    size_t submitted = 0;
+    jq_result_t result = jq_submit_batch(root, items, count, options, &submitted);
+    if (result == JQ_OK) {
+        for (size_t i = 0; i < count; ++i) {
+            if (items[i].result != JQ_OK) {
+                printf("%s %s\n", items[i].uuid, result_to_string(items[i].result));
+            }
+        }
+        printf("submitted=%zu failed=%zu\n", submitted, count - submitted);
+    }
+    free_manifest(items, count);
+    if (result != JQ_OK) {
+        return exit_for_result(result);
+    }
+    return submitted == count ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         print_usage();
@@ -114,39 +488,229 @@ int main(int argc, char **argv) {
     }
 
     if (strcmp(command, "submit") == 0) {
-        if (argc < 6 || argc > 7) {
+        if (argc < 6) {
+            print_usage();
+            return 1;
+        }
+        jq_submit_options_t options;
+        jq_submit_options_init(&options);
+        for (int i = 6; i < argc; ++i) {
+            if (strcmp(argv[i], "--priority") == 0) {
+                options.priority = 1;
+            } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                long value = strtol(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value < 0 || value >= JQ_LEVEL_COUNT) {
+                    print_usage();
+                    return 1;
+                }
+                options.level = (int)value;
+            } else if (strcmp(argv[i], "--link") == 0) {
+                options.mode = JQ_SUBMIT_LINK;
+            } else if (strcmp(argv[i], "--blob") == 0) {
+                options.mode = JQ_SUBMIT_BLOB;
+            } else if (strcmp(argv[i], "--tenant") == 0 && i + 1 < argc) {
+                options.tenant = argv[++i];
+            } else {
+                print_usage();
+                return 1;
+            }
+        }
+        return exit_for_result(jq_submit_with_options(argv[2], argv[3], argv[4], argv[5], &options));
+    }
+
+    if (strcmp(command, "submit-batch") == 0) {
+        if (argc < 4) {
             print_usage();
             return 1;
         }
-        int priority = 0;
-        if (argc == 7) {
-            if (strcmp(argv[6], "--priority") != 0) {
+        jq_submit_options_t options;
+        jq_submit_options_init(&options);
+        for (int i = 4; i < argc; ++i) {
+            if (strcmp(argv[i], "--priority") == 0) {
+                options.priority = 1;
+            } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                long value = strtol(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value < 0 || value >= JQ_LEVEL_COUNT) {
+                    print_usage();
+                    return 1;
+                }
+                options.level = (int)value;
+            } else if (strcmp(argv[i], "--link") == 0) {
+                options.mode = JQ_SUBMIT_LINK;
+            } else if (strcmp(argv[i], "--blob") == 0) {
+                options.mode = JQ_SUBMIT_BLOB;
+            } else if (strcmp(argv[i], "--tenant") == 0 && i + 1 < argc) {
+                options.tenant = argv[++i];
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                long value = strtol(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value <= 0) {
+                    print_usage();
+                    return 1;
+                }
+                options.threads = (unsigned int)value;
+            } else {
                 print_usage();
                 return 1;
             }
-            priority = 1;
         }
-        return exit_for_result(jq_submit(argv[2], argv[3], argv[4], argv[5], priority));
+        return handle_submit_batch(argv[2], argv[3], &options);
     }
 
     if (strcmp(command, "claim") == 0) {
-        if (argc < 3 || argc > 4) {
+        if (argc < 3) {
             print_usage();
             return 1;
         }
-        int prefer_priority = 0;
-        if (argc == 4) {
-            if (strcmp(argv[3], "--prefer-priority") != 0) {
+        jq_claim_options_t options;
+        jq_claim_options_init(&options);
+        size_t batch = 1;
+        int wait_ms = 0;
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "--prefer-priority") == 0) {
+                options.prefer_priority = 1;
+            } else if (strcmp(argv[i], "--fifo") == 0) {
+                options.order = JQ_CLAIM_ORDER_FIFO;
+            } else if (strcmp(argv[i], "--weighted") == 0) {
+                options.order = JQ_CLAIM_ORDER_WEIGHTED;
+            } else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc) {
+                if (!parse_weights(argv[++i], options.weights)) {
+                    print_usage();
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--smallest-first") == 0) {
+                options.size = JQ_CLAIM_SIZE_SMALLEST_FIRST;
+            } else if (strcmp(argv[i], "--size-round-robin") == 0) {
+                options.size = JQ_CLAIM_SIZE_ROUND_ROBIN;
+            } else if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                unsigned long long value = strtoull(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value == 0) {
+                    print_usage();
+                    return 1;
+                }
+                options.max_bytes = value;
+            } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                unsigned long value = strtoul(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value == 0 || value > 1024) {
+                    print_usage();
+                    return 1;
+                }
+                batch = (size_t)value;
+            } else if (strcmp(argv[i], "--owner") == 0 && i + 1 < argc) {
+                options.owner = argv[++i];
+            } else if (strcmp(argv[i], "--lease") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                unsigned long value = strtoul(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value == 0 || value > 86400) {
+                    print_usage();
+                    return 1;
+                }
+                options.lease_seconds = (unsigned int)value;
+            } else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                long value = strtol(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value < -1 || value > INT_MAX) {
+                    print_usage();
+                    return 1;
+                }
+                wait_ms = (int)value;
+            } else {
                 print_usage();
                 return 1;
             }
-            prefer_priority = 1;
         }
-        char uuid[128];
-        jq_state_t state = JQ_STATE_JOBS;
-        jq_result_t result = jq_claim_next(argv[2], prefer_priority, uuid, sizeof(uuid), &state);
+        char (*uuids)[JQ_UUID_MAX] = calloc(batch, sizeof(*uuids));
+        jq_state_t *states = calloc(batch, sizeof(*states));
+        if (!uuids || !states) {
+            free(uuids);
+            free(states);
+            return exit_for_result(JQ_ERR_IO);
+        }
+        size_t count = 0;
+        jq_result_t result = wait_ms != 0
+                                 ? jq_claim_batch_wait(argv[2], &options, wait_ms, batch, uuids, states, &count)
+                                 : jq_claim_batch(argv[2], &options, batch, uuids, states, &count);
+        for (size_t i = 0; result == JQ_OK && i < count; ++i) {
+            printf("%s %s\n", uuids[i], state_to_string(states[i]));
+        }
+        free(uuids);
+        free(states);
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "heartbeat") == 0) {
+        if (argc != 5 && !(argc == 7 && strcmp(argv[5], "--owner") == 0)) {
+            print_usage();
+            return 1;
+        }
+        jq_state_t state;
+        if (!parse_state(argv[4], &state)) {
+            print_usage();
+            return 1;
+        }
+        return exit_for_result(jq_heartbeat(argv[2], argv[3], state, argc == 7 ? argv[6] : NULL));
+    }
+
+    if (strcmp(command, "reap") == 0) {
+        if (argc != 3) {
+            print_usage();
+            return 1;
+        }
+        size_t requeued = 0;
+        jq_result_t result = jq_reap_expired(argv[2], 0, &requeued);
+        if (result == JQ_OK) {
+            printf("requeued=%zu\n", requeued);
+        }
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "recover") == 0) {
+        if (argc != 3) {
+            print_usage();
+            return 1;
+        }
+        size_t repaired = 0;
+        jq_result_t result = jq_replay_journal(argv[2], &repaired);
         if (result == JQ_OK) {
-            printf("%s %s\n", uuid, state_to_string(state));
+            printf("repaired=%zu\n", repaired);
+        }
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "fsck") == 0) {
+        if (argc < 3) {
+            print_usage();
+            return 1;
+        }
+        jq_fsck_options_t options;
+        jq_fsck_options_init(&options);
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "--repair") == 0) {
+                options.repair = 1;
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                char *end = NULL;
+                long value = strtol(argv[++i], &end, 10);
+                if (!end || *end != '\0' || value <= 0) {
+                    print_usage();
+                    return 1;
+                }
+                options.threads = (unsigned int)value;
+            } else {
+                print_usage();
+                return 1;
+            }
+        }
+        jq_fsck_report_t report;
+        jq_result_t result = jq_fsck(argv[2], &options, &report);
+        if (result == JQ_OK) {
+            printf("entries=%zu temp_files=%zu stale_locks=%zu split_pairs=%zu stray_reports=%zu orphans=%zu busy=%zu "
+                   "repaired=%zu\n",
+                   report.entries, report.temp_files, report.stale_locks, report.split_pairs, report.stray_reports,
+                   report.orphans, report.busy, report.repaired);
         }
         return exit_for_result(result);
     }
@@ -164,6 +728,44 @@ int main(int argc, char **argv) {
         return exit_for_result(jq_release(argv[2], argv[3], state));
     }
 
+    if (strcmp(command, "retry") == 0) {
+        if (argc != 5 && !(argc == 7 && strcmp(argv[5], "--owner") == 0)) {
+            print_usage();
+            return 1;
+        }
+        jq_state_t state;
+        if (!parse_state(argv[4], &state)) {
+            print_usage();
+            return 1;
+        }
+        jq_retry_options_t options;
+        jq_retry_options_init(&options);
+        options.owner = argc == 7 ? argv[6] : NULL;
+        unsigned int attempts = 0;
+        time_t not_before = 0;
+        jq_result_t result = jq_retry(argv[2], argv[3], state, &options, &attempts, &not_before);
+        if (result == JQ_OK) {
+            printf("attempts=%u not_before=%lld%s\n", attempts, (long long)not_before,
+                   not_before == 0 ? " dead_letter=1" : "");
+        }
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "cancel") == 0) {
+        if (argc != 4) {
+            print_usage();
+            return 1;
+        }
+        jq_result_t result = jq_cancel(argv[2], argv[3]);
+        if (result == JQ_OK) {
+            /* A lease left behind means a worker still holds the job and has yet to notice. */
+            jq_lease_t lease;
+            int running = jq_lease_info(argv[2], argv[3], &lease) == JQ_OK && lease.cancelled;
+            printf("%s %s\n", running ? "cancelling" : "cancelled", argv[3]);
+        }
+        return exit_for_result(result);
+    }
+
     if (strcmp(command, "finalize") == 0) {
         if (argc != 6) {
             print_usage();
@@ -192,12 +794,98 @@ int main(int argc, char **argv) {
         return exit_for_result(jq_move(argv[2], argv[3], from_state, to_state));
     }
 
+    if (strcmp(command, "tenant") == 0) {
+        if (argc < 4) {
+            print_usage();
+            return 1;
+        }
+        return handle_tenant(argv[2], argv[3], argc - 4, argv + 4);
+    }
+
+    if (strcmp(command, "ring") == 0) {
+        if (argc < 3) {
+            print_usage();
+            return 1;
+        }
+        return handle_ring(argv[2], argc - 3, argv + 3);
+    }
+
+    if (strcmp(command, "retention") == 0) {
+        if (argc < 3) {
+            print_usage();
+            return 1;
+        }
+        return handle_retention(argv[2], argc - 3, argv + 3);
+    }
+
+    if (strcmp(command, "compact") == 0) {
+        if (argc < 3) {
+            print_usage();
+            return 1;
+        }
+        /* Flags describe a one-off policy; without any the stored one applies. */
+        jq_retention_options_t options;
+        jq_retention_options_init(&options);
+        int given = 0;
+        if (!parse_retention(argc - 3, argv + 3, &options, &given)) {
+            print_usage();
+            return 1;
+        }
+        size_t packed = 0;
+        jq_result_t result = jq_compact(argv[2], given > 0 ? &options : NULL, 0, &packed);
+        if (result == JQ_OK) {
+            printf("packed=%zu\n", packed);
+        }
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "tail") == 0) {
+        if (argc < 3) {
+            print_usage();
+            return 1;
+        }
+        return handle_tail(argv[2], argc - 3, argv + 3);
+    }
+
     if (strcmp(command, "stats") == 0) {
+        if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "--reconcile") != 0)) {
+            print_usage();
+            return 1;
+        }
+        return handle_stats(argv[2], argc == 4);
+    }
+
+    if (strcmp(command, "migrate") == 0) {
+        if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "--job-dirs") != 0)) {
+            print_usage();
+            return 1;
+        }
+        size_t moved = 0;
+        size_t remaining = 0;
+        jq_result_t result = argc == 4 ? jq_migrate_job_dirs(argv[2], &moved, &remaining)
+                                       : jq_migrate_layout(argv[2], &moved, &remaining);
+        jq_layout_t layout = JQ_LAYOUT_FLAT;
+        if (result == JQ_OK) {
+            result = jq_read_layout(argv[2], &layout);
+        }
+        if (result == JQ_OK) {
+            const char *names[] = {"flat", "sharded", "migrating", "directories", "directories-migrating"};
+            printf("moved=%zu remaining=%zu layout=%s\n", moved, remaining, names[layout]);
+        }
+        return exit_for_result(result);
+    }
+
+    if (strcmp(command, "gc-blobs") == 0) {
         if (argc != 3) {
             print_usage();
             return 1;
         }
-        return handle_stats(argv[2]);
+        size_t removed = 0;
+        jq_result_t result = jq_gc_blobs(argv[2], 0, &removed);
+        if (result == JQ_OK) {
+            printf("removed=%zu\n", removed);
+        }
+        return exit_for_result(result);
     }
 
     print_usage();
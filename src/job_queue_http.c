@@ -52,6 +52,8 @@ static struct timespec server_start_time;
 static int server_start_set = 0;
 static char server_exe_dir[PATH_MAX];
 static int server_exe_dir_set = 0;
+/* Opened once in main; forked connection handlers inherit its directory descriptors. */
+static jq_handle_t *server_queue = NULL;
 
 static void record_server_start(void) {
     if (!server_start_set) {
@@ -265,7 +267,12 @@ typedef enum {
     SEND_IO_ERROR = 2
 } send_result_t;
 
-static send_result_t send_file(int client_fd, const char *content_type, const char *path) {
+/* Sends length bytes of path starting at start, or the whole file when length is negative. */
+static send_result_t send_file_range(int client_fd,
+                                     const char *content_type,
+                                     const char *path,
+                                     off_t start,
+                                     off_t length) {
     int file_fd = open(path, O_RDONLY);
     if (file_fd < 0) {
         if (errno == ENOENT) {
@@ -279,6 +286,13 @@ static send_result_t send_file(int client_fd, const char *content_type, const ch
         close(file_fd);
         return SEND_IO_ERROR;
     }
+    if (length < 0) {
+        length = st.st_size;
+    } else if (start + length > st.st_size) {
+        close(file_fd);
+        return SEND_IO_ERROR;
+    }
+    off_t end = start + length;
 
     char header[HTTP_BUFFER_SIZE];
     int written = snprintf(header, sizeof(header),
@@ -286,7 +300,7 @@ static send_result_t send_file(int client_fd, const char *content_type, const ch
                            "Content-Type: %s\r\n"
                            "Content-Length: %lld\r\n"
                            "Connection: close\r\n\r\n",
-                           content_type, (long long)st.st_size);
+                           content_type, (long long)length);
     if (written < 0 || (size_t)written >= sizeof(header)) {
         close(file_fd);
         return SEND_IO_ERROR;
@@ -297,9 +311,9 @@ static send_result_t send_file(int client_fd, const char *content_type, const ch
         return SEND_IO_ERROR;
     }
 
-    off_t offset = 0;
-    while (offset < st.st_size) {
-        ssize_t sent = sendfile(client_fd, file_fd, &offset, (size_t)(st.st_size - offset));
+    off_t offset = start;
+    while (offset < end) {
+        ssize_t sent = sendfile(client_fd, file_fd, &offset, (size_t)(end - offset));
         if (sent < 0) {
             if (errno == EINTR) {
                 continue;
@@ -311,18 +325,24 @@ static send_result_t send_file(int client_fd, const char *content_type, const ch
         }
     }
 
-    if (offset < st.st_size) {
+    if (offset < end) {
         if (lseek(file_fd, offset, SEEK_SET) == (off_t)-1) {
             close(file_fd);
             return SEND_IO_ERROR;
         }
         char buffer[HTTP_BUFFER_SIZE];
-        ssize_t bytes_read;
-        while ((bytes_read = read(file_fd, buffer, sizeof(buffer))) > 0) {
+        ssize_t bytes_read = 0;
+        while (offset < end) {
+            size_t want = end - offset < (off_t)sizeof(buffer) ? (size_t)(end - offset) : sizeof(buffer);
+            bytes_read = read(file_fd, buffer, want);
+            if (bytes_read <= 0) {
+                break;
+            }
             if (!write_all(client_fd, buffer, (size_t)bytes_read)) {
                 close(file_fd);
                 return SEND_IO_ERROR;
             }
+            offset += bytes_read;
         }
         if (bytes_read < 0) {
             close(file_fd);
@@ -334,6 +354,31 @@ static send_result_t send_file(int client_fd, const char *content_type, const ch
     return SEND_OK;
 }
 
+static send_result_t send_file(int client_fd, const char *content_type, const char *path) {
+    return send_file_range(client_fd, content_type, path, 0, -1);
+}
+
+/* A finished job packed by retention: served out of its archive segment. */
+static send_result_t send_archived(const char *root,
+                                   const char *uuid,
+                                   jq_state_t state,
+                                   jq_file_kind_t kind,
+                                   const char *content_type,
+                                   int client_fd) {
+    jq_state_t archived_state;
+    char path[HTTP_PATH_SIZE];
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+    jq_result_t result = jq_archive_locate(root, uuid, kind, &archived_state, path, sizeof(path), &offset, &length);
+    if (result == JQ_ERR_NOT_FOUND || (result == JQ_OK && archived_state != state)) {
+        return SEND_NOT_FOUND;
+    }
+    if (result != JQ_OK) {
+        return SEND_IO_ERROR;
+    }
+    return send_file_range(client_fd, content_type, path, (off_t)offset, (off_t)length);
+}
+
 static int constant_time_equals(const char *a, const char *b) {
     if (!a || !b) {
         return 0;
@@ -1668,6 +1713,27 @@ static int get_query_param(const char *query, const char *key, char *out, size_t
     return 0;
 }
 
+static int parse_weights(const char *value, unsigned int *weights_out) {
+    const char *cursor = value;
+    for (int level = 0; level < JQ_LEVEL_COUNT; ++level) {
+        char *end = NULL;
+        unsigned long weight = strtoul(cursor, &end, 10);
+        if (!end || end == cursor || weight > JQ_LEVEL_WEIGHT_MAX) {
+            return 0;
+        }
+        weights_out[level] = (unsigned int)weight;
+        if (level + 1 < JQ_LEVEL_COUNT) {
+            if (*end != ',') {
+                return 0;
+            }
+            cursor = end + 1;
+        } else if (*end != '\0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static int handle_claim(const char *root, const char *query, int client_fd) {
     char prefer_value[8];
     int prefer_priority = 0;
@@ -1675,9 +1741,43 @@ static int handle_claim(const char *root, const char *query, int client_fd) {
         prefer_priority = strcmp(prefer_value, "1") == 0;
     }
 
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.prefer_priority = prefer_priority;
+    char order_value[16];
+    if (get_query_param(query, "order", order_value, sizeof(order_value))) {
+        if (strcmp(order_value, "fifo") == 0) {
+            options.order = JQ_CLAIM_ORDER_FIFO;
+        } else if (strcmp(order_value, "weighted") == 0) {
+            options.order = JQ_CLAIM_ORDER_WEIGHTED;
+        } else if (strcmp(order_value, "priority") != 0) {
+            return send_response(client_fd, 400, "Bad Request", "invalid order\n");
+        }
+    }
+    char weights_value[96];
+    if (get_query_param(query, "weights", weights_value, sizeof(weights_value)) &&
+        !parse_weights(weights_value, options.weights)) {
+        return send_response(client_fd, 400, "Bad Request", "invalid weights\n");
+    }
+
+    char owner[JQ_LEASE_OWNER_MAX];
+    if (get_query_param(query, "owner", owner, sizeof(owner))) {
+        options.owner = owner;
+    }
+    char lease_value[16];
+    if (get_query_param(query, "lease", lease_value, sizeof(lease_value))) {
+        char *end = NULL;
+        unsigned long lease_seconds = strtoul(lease_value, &end, 10);
+        if (!end || *end != '\0' || lease_seconds == 0 || lease_seconds > 86400) {
+            return send_response(client_fd, 400, "Bad Request", "invalid lease\n");
+        }
+        options.lease_seconds = (unsigned int)lease_seconds;
+    }
+
     char uuid[HTTP_UUID_SIZE];
     jq_state_t state = JQ_STATE_JOBS;
-    jq_result_t result = jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
+    jq_result_t result = server_queue ? jq_handle_claim(server_queue, &options, uuid, sizeof(uuid), &state)
+                                     : jq_claim(root, &options, uuid, sizeof(uuid), &state);
 
     if (result == JQ_OK) {
         char body[HTTP_BUFFER_SIZE];
@@ -1715,7 +1815,7 @@ static int handle_release(const char *root, const char *query, int client_fd) {
         return send_response(client_fd, 400, "Bad Request", "invalid state\n");
     }
 
-    jq_result_t result = jq_release(root, uuid, state);
+    jq_result_t result = server_queue ? jq_handle_release(server_queue, uuid, state) : jq_release(root, uuid, state);
     if (result == JQ_OK) {
         return send_response(client_fd, 200, "OK", "released\n");
     }
@@ -1731,6 +1831,81 @@ static int handle_release(const char *root, const char *query, int client_fd) {
     return send_response(client_fd, 500, "Internal Server Error", "io error\n");
 }
 
+static int handle_heartbeat(const char *root, const char *query, int client_fd) {
+    char uuid[HTTP_UUID_SIZE];
+    char state_value[32];
+    if (!get_query_param(query, "uuid", uuid, sizeof(uuid)) ||
+        !get_query_param(query, "state", state_value, sizeof(state_value))) {
+        return send_response(client_fd, 400, "Bad Request", "missing parameters\n");
+    }
+    if (!is_valid_uuid(uuid)) {
+        return send_response(client_fd, 400, "Bad Request", "invalid uuid\n");
+    }
+
+    jq_state_t state;
+    if (!parse_state(state_value, &state)) {
+        return send_response(client_fd, 400, "Bad Request", "invalid state\n");
+    }
+
+    char owner[JQ_LEASE_OWNER_MAX];
+    jq_result_t result = jq_heartbeat(root, uuid, state,
+                                      get_query_param(query, "owner", owner, sizeof(owner)) ? owner : NULL);
+    if (result == JQ_OK) {
+        return send_response(client_fd, 200, "OK", "extended\n");
+    }
+
+    if (result == JQ_ERR_NOT_FOUND) {
+        return send_response(client_fd, 404, "Not Found", "lease not found\n");
+    }
+
+    if (result == JQ_ERR_INVALID_ARGUMENT) {
+        return send_response(client_fd, 400, "Bad Request", "invalid arguments\n");
+    }
+
+    return send_response(client_fd, 500, "Internal Server Error", "io error\n");
+}
+
+static int handle_cancel(const char *root, const char *query, int client_fd) {
+    char uuid[HTTP_UUID_SIZE];
+    if (!get_query_param(query, "uuid", uuid, sizeof(uuid))) {
+        return send_response(client_fd, 400, "Bad Request", "missing parameters\n");
+    }
+    if (!is_valid_uuid(uuid)) {
+        return send_response(client_fd, 400, "Bad Request", "invalid uuid\n");
+    }
+
+    jq_result_t result = jq_cancel(root, uuid);
+    if (result == JQ_OK) {
+        jq_lease_t lease;
+        if (jq_lease_info(root, uuid, &lease) == JQ_OK && lease.cancelled) {
+            return send_response(client_fd, 202, "Accepted", "cancelling\n");
+        }
+        return send_response(client_fd, 200, "OK", "cancelled\n");
+    }
+
+    if (result == JQ_ERR_NOT_FOUND) {
+        return send_response(client_fd, 404, "Not Found", "job not found\n");
+    }
+
+    if (result == JQ_ERR_INVALID_ARGUMENT) {
+        return send_response(client_fd, 400, "Bad Request", "invalid arguments\n");
+    }
+
+    return send_response(client_fd, 500, "Internal Server Error", "io error\n");
+}
+
+static int handle_reap(const char *root, int client_fd) {
+    size_t requeued = 0;
+    jq_result_t result = jq_reap_expired(root, 0, &requeued);
+    if (result != JQ_OK) {
+        return send_response(client_fd, 500, "Internal Server Error", "io error\n");
+    }
+
+    char body[64];
+    snprintf(body, sizeof(body), "requeued=%zu\n", requeued);
+    return send_response(client_fd, 200, "OK", body);
+}
+
 static int handle_finalize(const char *root, const char *query, int client_fd) {
     char uuid[HTTP_UUID_SIZE];
     char from_value[32];
@@ -1750,7 +1925,8 @@ static int handle_finalize(const char *root, const char *query, int client_fd) {
         return send_response(client_fd, 400, "Bad Request", "invalid state\n");
     }
 
-    jq_result_t result = jq_finalize(root, uuid, from_state, to_state);
+    jq_result_t result = server_queue ? jq_handle_finalize(server_queue, uuid, from_state, to_state)
+                                     : jq_finalize(root, uuid, from_state, to_state);
     if (result == JQ_OK) {
         return send_response(client_fd, 200, "OK", "finalized\n");
     }
@@ -1805,12 +1981,35 @@ static int handle_submit(const char *root, const char *query, int client_fd) {
         return send_response(client_fd, 500, "Internal Server Error", "io error\n");
     }
 
-    int priority = 0;
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
     if (get_query_param(query, "priority", priority_value, sizeof(priority_value))) {
-        priority = strcmp(priority_value, "1") == 0;
+        options.priority = strcmp(priority_value, "1") == 0;
+    }
+    char level_value[8];
+    if (get_query_param(query, "level", level_value, sizeof(level_value))) {
+        char *end = NULL;
+        long level = strtol(level_value, &end, 10);
+        if (!end || end == level_value || *end != '\0' || level < 0 || level >= JQ_LEVEL_COUNT) {
+            return send_response(client_fd, 400, "Bad Request", "invalid level\n");
+        }
+        options.level = (int)level;
+    }
+    char mode_value[16];
+    if (get_query_param(query, "mode", mode_value, sizeof(mode_value))) {
+        if (strcmp(mode_value, "link") == 0) {
+            options.mode = JQ_SUBMIT_LINK;
+        } else if (strcmp(mode_value, "copy") != 0) {
+            return send_response(client_fd, 400, "Bad Request", "invalid mode\n");
+        }
+    }
+
+    char tenant_value[JQ_TENANT_NAME_MAX];
+    if (get_query_param(query, "tenant", tenant_value, sizeof(tenant_value))) {
+        options.tenant = tenant_value;
     }
 
-    jq_result_t result = jq_submit(root, uuid, pdf_resolved, metadata_resolved, priority);
+    jq_result_t result = jq_submit_with_options(root, uuid, pdf_resolved, metadata_resolved, &options);
     if (result == JQ_OK) {
         return send_response(client_fd, 200, "OK", "submitted\n");
     }
@@ -1858,12 +2057,14 @@ static int handle_upload(const char *root,
     char redact_flag[16] = "";
     char priority_flag[16] = "";
     char label[64] = "";
+    char tenant[JQ_TENANT_NAME_MAX] = "";
 
     (void)read_multipart_text(body, body_len, boundary, "output_dir", output_dir, sizeof(output_dir));
     (void)read_multipart_text(body, body_len, boundary, "redactions", redactions, sizeof(redactions));
     (void)read_multipart_text(body, body_len, boundary, "redact", redact_flag, sizeof(redact_flag));
     (void)read_multipart_text(body, body_len, boundary, "priority", priority_flag, sizeof(priority_flag));
     (void)read_multipart_text(body, body_len, boundary, "label", label, sizeof(label));
+    (void)read_multipart_text(body, body_len, boundary, "tenant", tenant, sizeof(tenant));
 
     if (!is_safe_relpath(output_dir)) {
         return send_response(client_fd, 400, "Bad Request", "invalid output directory\n");
@@ -1911,9 +2112,28 @@ static int handle_upload(const char *root,
         return send_response(client_fd, 500, "Internal Server Error", "failed to write metadata\n");
     }
 
-    int priority = priority_flag[0] != '\0' && strcmp(priority_flag, "0") != 0 &&
-                   strcasecmp(priority_flag, "false") != 0;
-    jq_result_t submit_result = jq_submit(root, ocr_uuid, pdf_path, ocr_metadata_path, priority);
+    /*
+     * The uploaded PDF is hashed before it is copied into the blob store, so
+     * a repeat upload costs one read, and both jobs link to that blob instead
+     * of copying it. Without a blob the jobs link the upload itself.
+     */
+    jq_submit_options_t submit_options;
+    jq_submit_options_init(&submit_options);
+    submit_options.mode = JQ_SUBMIT_LINK;
+    char blob_hash[JQ_BLOB_HASH_MAX];
+    if (jq_blob_put(root, pdf_path, JQ_SUBMIT_LINK, blob_hash, sizeof(blob_hash)) == JQ_OK) {
+        submit_options.blob = blob_hash;
+    }
+    submit_options.priority = priority_flag[0] != '\0' && strcmp(priority_flag, "0") != 0 &&
+                              strcasecmp(priority_flag, "false") != 0;
+    if (tenant[0] != '\0') {
+        submit_options.tenant = tenant;
+    }
+    jq_result_t submit_result =
+        jq_submit_with_options(root, ocr_uuid, pdf_path, ocr_metadata_path, &submit_options);
+    if (submit_result == JQ_ERR_INVALID_ARGUMENT && submit_options.tenant) {
+        return send_response(client_fd, 400, "Bad Request", "invalid tenant\n");
+    }
     if (submit_result != JQ_OK) {
         return send_response(client_fd, 500, "Internal Server Error", "failed to submit ocr job\n");
     }
@@ -1938,7 +2158,8 @@ static int handle_upload(const char *root,
         if (!redact_written) {
             return send_response(client_fd, 500, "Internal Server Error", "failed to write redact metadata\n");
         }
-        jq_result_t redact_submit = jq_submit(root, redact_uuid, pdf_path, redact_metadata_path, priority);
+        jq_result_t redact_submit = jq_submit_with_options(root, redact_uuid, pdf_path, redact_metadata_path,
+                                                            &submit_options);
         if (redact_submit != JQ_OK) {
             return send_response(client_fd, 500, "Internal Server Error", "failed to submit redact job\n");
         }
@@ -2004,7 +2225,8 @@ static int handle_move(const char *root, const char *query, int client_fd) {
         return send_response(client_fd, 400, "Bad Request", "invalid state\n");
     }
 
-    jq_result_t result = jq_move(root, uuid, from_state, to_state);
+    jq_result_t result = server_queue ? jq_handle_move(server_queue, uuid, from_state, to_state)
+                                     : jq_move(root, uuid, from_state, to_state);
     if (result == JQ_OK) {
         return send_response(client_fd, 200, "OK", "moved\n");
     }
@@ -2031,10 +2253,28 @@ static int handle_status(const char *root, const char *query, int client_fd) {
 
     jq_state_t state = JQ_STATE_JOBS;
     int locked = 0;
-    jq_result_t result = jq_status(root, uuid, &state, &locked);
+    jq_result_t result = server_queue ? jq_handle_status(server_queue, uuid, &state, &locked)
+                                     : jq_status(root, uuid, &state, &locked);
     if (result == JQ_OK) {
         char body[HTTP_BUFFER_SIZE];
-        int written = snprintf(body, sizeof(body), "state=%s locked=%d\n", state_to_string(state), locked);
+        int written = snprintf(body, sizeof(body), "state=%s locked=%d", state_to_string(state), locked);
+        jq_lease_t lease;
+        if (written >= 0 && (size_t)written < sizeof(body) && locked &&
+            jq_lease_info(root, uuid, &lease) == JQ_OK) {
+            written += snprintf(body + written, sizeof(body) - (size_t)written, " owner=%s expires_at=%lld%s",
+                                lease.owner, (long long)lease.expires_at, lease.cancelled ? " cancelled=1" : "");
+        }
+        jq_progress_t progress;
+        if (written >= 0 && (size_t)written < sizeof(body) && locked &&
+            jq_status_progress(root, uuid, &progress) == JQ_OK) {
+            written += snprintf(body + written, sizeof(body) - (size_t)written,
+                                " phase=%s bytes_done=%llu bytes_total=%llu bytes_per_second=%llu eta_seconds=%lld",
+                                progress.phase, progress.bytes_done, progress.bytes_total,
+                                progress.bytes_per_second, progress.eta_seconds);
+        }
+        if (written >= 0 && (size_t)written < sizeof(body)) {
+            written += snprintf(body + written, sizeof(body) - (size_t)written, "\n");
+        }
         if (written < 0 || (size_t)written >= sizeof(body)) {
             return send_response(client_fd, 500, "Internal Server Error", "response too large");
         }
@@ -2095,21 +2335,23 @@ static int handle_retrieve(const char *root, const char *query, int client_fd) {
     }
 
     const char *path = send_pdf ? pdf_path : (send_metadata ? metadata_path : report_path);
+    const char *content_type = send_pdf ? "application/pdf" :
+                               (send_metadata ? "application/json" : "text/html");
+    jq_file_kind_t kind = send_pdf ? JQ_FILE_PDF : (send_metadata ? JQ_FILE_METADATA : JQ_FILE_REPORT);
     char resolved[PATH_MAX];
     int status = 0;
-    if (!resolve_existing_under_root(root, path, resolved, sizeof(resolved), &status)) {
-        if (status == 403) {
-            return send_response(client_fd, 403, "Forbidden", "path outside root\n");
-        }
-        if (status == 404) {
-            return send_response(client_fd, 404, "Not Found", "job not found\n");
-        }
+    send_result_t send_result = SEND_NOT_FOUND;
+    if (resolve_existing_under_root(root, path, resolved, sizeof(resolved), &status)) {
+        send_result = send_file(client_fd, content_type, resolved);
+    } else if (status == 403) {
+        return send_response(client_fd, 403, "Forbidden", "path outside root\n");
+    } else if (status != 404) {
         return send_response(client_fd, 500, "Internal Server Error", "io error\n");
     }
-
-    const char *content_type = send_pdf ? "application/pdf" :
-                               (send_metadata ? "application/json" : "text/html");
-    send_result_t send_result = send_file(client_fd, content_type, resolved);
+    /* Not loose (any more): retention may have packed it into the archive. */
+    if (send_result == SEND_NOT_FOUND) {
+        send_result = send_archived(root, uuid, state, kind, content_type, client_fd);
+    }
     if (send_result == SEND_NOT_FOUND) {
         return send_response(client_fd, 404, "Not Found", "job not found\n");
     }
@@ -2120,9 +2362,12 @@ static int handle_retrieve(const char *root, const char *query, int client_fd) {
     return 200;
 }
 
-static int handle_metrics(const char *root, int client_fd) {
+static int handle_metrics(const char *root, const char *query, int client_fd) {
+    char reconcile_value[8];
+    int reconcile = get_query_param(query, "reconcile", reconcile_value, sizeof(reconcile_value)) &&
+                    strcmp(reconcile_value, "1") == 0;
     jq_stats_t stats;
-    jq_result_t result = jq_collect_stats(root, &stats);
+    jq_result_t result = reconcile ? jq_collect_stats(root, &stats) : jq_read_stats(root, &stats);
     if (result == JQ_ERR_NOT_FOUND) {
         return send_response(client_fd, 404, "Not Found", "job root not found\n");
     }
@@ -2161,7 +2406,11 @@ static int handle_metrics(const char *root, int client_fd) {
                      "\"orphans\":%zu,"
                      "\"bytes\":%llu,"
                      "\"oldest_mtime\":%lld,"
-                     "\"newest_mtime\":%lld"
+                     "\"newest_mtime\":%lld,"
+                     "\"oldest_waiting_mtime\":%lld,"
+                     "\"oldest_waiting_age_seconds\":%llu,"
+                     "\"reconciled_at\":%lld,"
+                     "\"events_dropped\":%llu"
                      "},"
                      "\"states\":{",
                      (long long)now,
@@ -2179,7 +2428,11 @@ static int handle_metrics(const char *root, int client_fd) {
                      stats.total_orphans,
                      stats.total_bytes,
                      (long long)stats.oldest_mtime,
-                     (long long)stats.newest_mtime)) {
+                     (long long)stats.newest_mtime,
+                     (long long)stats.oldest_waiting_mtime,
+                     stats.oldest_waiting_age_seconds,
+                     (long long)stats.reconciled_at,
+                     stats.events_dropped)) {
         return send_response(client_fd, 500, "Internal Server Error", "metrics too large\n");
     }
 
@@ -2190,7 +2443,20 @@ static int handle_metrics(const char *root, int client_fd) {
         !append_state_metrics(body, sizeof(body), &offset, "complete", &stats.states[JQ_STATE_COMPLETE]) ||
         !json_append(body, sizeof(body), &offset, ",") ||
         !append_state_metrics(body, sizeof(body), &offset, "error", &stats.states[JQ_STATE_ERROR]) ||
-        !json_append(body, sizeof(body), &offset, "}}")) {
+        !json_append(body, sizeof(body), &offset, "},\"tenants\":{")) {
+        return send_response(client_fd, 500, "Internal Server Error", "metrics too large\n");
+    }
+    /* Tenant names are limited to [A-Za-z0-9._-], so they need no escaping. */
+    for (size_t i = 0; i < stats.tenant_count; ++i) {
+        const jq_tenant_stats_t *tenant = &stats.tenants[i];
+        if (!json_append(body, sizeof(body), &offset,
+                         "%s\"%s\":{\"depth\":%zu,\"in_flight\":%zu,\"max_in_flight\":%u,\"weight\":%u}",
+                         i > 0 ? "," : "", tenant->name, tenant->depth, tenant->in_flight,
+                         tenant->max_in_flight, tenant->weight)) {
+            return send_response(client_fd, 500, "Internal Server Error", "metrics too large\n");
+        }
+    }
+    if (!json_append(body, sizeof(body), &offset, "}}")) {
         return send_response(client_fd, 500, "Internal Server Error", "metrics too large\n");
     }
 
@@ -2599,7 +2865,7 @@ static int route_request(const char *root,
     }
 
     if (strcmp(decoded_path, "/metrics") == 0) {
-        return handle_metrics(root, client_fd);
+        return handle_metrics(root, query, client_fd);
     }
 
     if (strcmp(decoded_path, "/") == 0 || strcmp(decoded_path, "/panel") == 0) {
@@ -2634,6 +2900,27 @@ static int route_request(const char *root,
         return handle_release(root, query, client_fd);
     }
 
+    if (strcmp(decoded_path, "/heartbeat") == 0) {
+        if (!is_get) {
+            return send_response(client_fd, 405, "Method Not Allowed", "only GET supported\n");
+        }
+        return handle_heartbeat(root, query, client_fd);
+    }
+
+    if (strcmp(decoded_path, "/cancel") == 0) {
+        if (!is_get) {
+            return send_response(client_fd, 405, "Method Not Allowed", "only GET supported\n");
+        }
+        return handle_cancel(root, query, client_fd);
+    }
+
+    if (strcmp(decoded_path, "/reap") == 0) {
+        if (!is_get) {
+            return send_response(client_fd, 405, "Method Not Allowed", "only GET supported\n");
+        }
+        return handle_reap(root, client_fd);
+    }
+
     if (strcmp(decoded_path, "/finalize") == 0) {
         if (!is_get) {
             return send_response(client_fd, 405, "Method Not Allowed", "only GET supported\n");
@@ -2685,6 +2972,19 @@ int main(int argc, char **argv) {
         perror("realpath");
         return 1;
     }
+    size_t repaired = 0;
+    if (jq_replay_journal(root_real, &repaired) != JQ_OK) {
+        fprintf(stderr, "journal replay failed\n");
+        return 1;
+    }
+    if (repaired > 0) {
+        fprintf(stderr, "journal replay repaired %zu interrupted transitions\n", repaired);
+    }
+    server_queue = jq_open(root_real);
+    if (!server_queue) {
+        fprintf(stderr, "failed to open queue root\n");
+        return 1;
+    }
     int port = atoi(argv[2]);
     if (port <= 0 || port > 65535) {
         fprintf(stderr, "invalid port\n");
@@ -2989,6 +3289,21 @@ static int test_parse_state_and_uuid(void) {
     return 1;
 }
 
+static int test_parse_weights(void) {
+    unsigned int weights[JQ_LEVEL_COUNT];
+    if (!assert_true(parse_weights("1,2,4,8,16,32,64,128", weights) && weights[0] == 1 && weights[7] == 128,
+                     "parse weights")) {
+        return 0;
+    }
+    if (!assert_true(!parse_weights("1,2,3", weights), "reject short weights")) {
+        return 0;
+    }
+    if (!assert_true(!parse_weights("1,2,4,8,16,32,64,128,256", weights), "reject long weights")) {
+        return 0;
+    }
+    return assert_true(!parse_weights("1,2,4,8,16,32,64,99999", weights), "reject oversized weight");
+}
+
 static int test_query_param_and_root_paths(void) {
     char output[HTTP_PATH_SIZE];
     if (!assert_true(get_query_param("uuid=test&pdf=file+name.pdf", "pdf", output, sizeof(output)),
@@ -3296,6 +3611,7 @@ int main(void) {
     passed &= test_extract_bearer();
     passed &= test_get_header_value();
     passed &= test_parse_state_and_uuid();
+    passed &= test_parse_weights();
     passed &= test_query_param_and_root_paths();
     passed &= test_resolve_existing_under_root();
     passed &= test_build_log_path();
@@ -1,4 +1,5 @@
 #include "pap/job_queue.h"
+#include "pap/job_queue_worker.h"
 #include "pap/pdf_ocr.h"
 
 #include <errno.h>
@@ -6,42 +7,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#define FAILURE_ERROR "ocr_failed"
 #define REPORT_JSON_INITIAL 1024
 
 static void print_usage(void) {
     printf("Usage:\n");
-    printf("  job_queue_ocr <root> [--prefer-priority]\n");
-}
-
-static int write_buffer_to_file(const char *path, const char *buffer, size_t length) {
-    FILE *fp = fopen(path, "wb");
-    if (!fp) {
-        return 0;
-    }
-    if (length > 0 && fwrite(buffer, 1, length, fp) != length) {
-        fclose(fp);
-        return 0;
-    }
-    if (fclose(fp) != 0) {
-        return 0;
-    }
-    return 1;
-}
-
-static int write_error_metadata(const char *path, const char *detail) {
-    if (!path || !detail) {
-        return 0;
-    }
-    char buffer[256];
-    int written = snprintf(buffer, sizeof(buffer),
-                           "{\"error\":\"ocr_failed\",\"detail\":\"%s\"}",
-                           detail);
-    if (written < 0 || (size_t)written >= sizeof(buffer)) {
-        return 0;
-    }
-    return write_buffer_to_file(path, buffer, (size_t)written);
+    printf("  job_queue_ocr <root> [--prefer-priority] [--wait <ms>]\n");
 }
 
 static int write_report_json(const pocr_report_t *report, const char *path) {
@@ -57,7 +31,7 @@ static int write_report_json(const pocr_report_t *report, const char *path) {
         size_t written = 0;
         pocr_result_t result = pocr_report_to_json(report, buffer, buffer_len, &written);
         if (result == POCR_OK) {
-            int ok = write_buffer_to_file(path, buffer, written);
+            int ok = jq_worker_write_file(path, buffer, written);
             free(buffer);
             return ok;
         }
@@ -79,9 +53,18 @@ int main(int argc, char **argv) {
 
     const char *root = argv[1];
     int prefer_priority = 0;
+    int wait_ms = 0;
     for (int i = 2; i < argc; ++i) {
         if (strcmp(argv[i], "--prefer-priority") == 0) {
             prefer_priority = 1;
+        } else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            long value = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || value < -1 || value > INT_MAX) {
+                print_usage();
+                return 1;
+            }
+            wait_ms = (int)value;
         } else {
             print_usage();
             return 1;
@@ -90,7 +73,9 @@ int main(int argc, char **argv) {
 
     char uuid[128];
     jq_state_t state = JQ_STATE_JOBS;
-    jq_result_t claim_result = jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
+    jq_result_t claim_result = wait_ms != 0
+                                   ? jq_claim_wait(root, prefer_priority, wait_ms, uuid, sizeof(uuid), &state)
+                                   : jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
     if (claim_result == JQ_ERR_NOT_FOUND) {
         return 2;
     }
@@ -113,18 +98,21 @@ int main(int argc, char **argv) {
     }
 
     pocr_report_t report;
-    pocr_result_t scan_result = pocr_scan_file_with_provider(provider_name, pdf_locked, &report);
+    jq_worker_monitor_t monitor;
+    jq_worker_monitor_begin(&monitor, root, uuid, "ocr", pdf_locked);
+    pocr_result_t scan_result =
+        pocr_scan_file_with_progress(provider_name, pdf_locked, &report, jq_worker_progress, &monitor);
+    jq_worker_monitor_end(&monitor);
+    if (scan_result == POCR_ERR_CANCELLED) {
+        return jq_worker_cancel(root, uuid, state);
+    }
     if (scan_result != POCR_OK) {
-        const char *detail = pocr_result_str(scan_result);
-        write_error_metadata(metadata_locked, detail);
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR,
+                              pocr_result_str(scan_result), scan_result == POCR_ERR_IO);
     }
 
     if (!write_report_json(&report, metadata_locked)) {
-        write_error_metadata(metadata_locked, "report_write_failed");
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_write_failed", 1);
     }
 
     if (jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) != JQ_OK) {
@@ -1,4 +1,5 @@
 #include "pap/job_queue.h"
+#include "pap/job_queue_worker.h"
 #include "pap/pdf_redaction.h"
 
 #include <errno.h>
@@ -6,43 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#define FAILURE_ERROR "redaction_failed"
 #define REPORT_JSON_INITIAL 1024
 #define METADATA_MAX_SIZE 65536
 
 static void print_usage(void) {
     printf("Usage:\n");
-    printf("  job_queue_redact <root> [--prefer-priority]\n");
-}
-
-static int write_buffer_to_file(const char *path, const char *buffer, size_t length) {
-    FILE *fp = fopen(path, "wb");
-    if (!fp) {
-        return 0;
-    }
-    if (length > 0 && fwrite(buffer, 1, length, fp) != length) {
-        fclose(fp);
-        return 0;
-    }
-    if (fclose(fp) != 0) {
-        return 0;
-    }
-    return 1;
-}
-
-static int write_error_metadata(const char *path, const char *detail) {
-    if (!path || !detail) {
-        return 0;
-    }
-    char buffer[256];
-    int written = snprintf(buffer, sizeof(buffer),
-                           "{\"error\":\"redaction_failed\",\"detail\":\"%s\"}",
-                           detail);
-    if (written < 0 || (size_t)written >= sizeof(buffer)) {
-        return 0;
-    }
-    return write_buffer_to_file(path, buffer, (size_t)written);
+    printf("  job_queue_redact <root> [--prefer-priority] [--wait <ms>]\n");
 }
 
 static int write_report_json(const pdrx_report_t *report, const pdrx_plan_t *plan, const char *path) {
@@ -58,7 +32,7 @@ static int write_report_json(const pdrx_report_t *report, const pdrx_plan_t *pla
         size_t written = 0;
         pdrx_result_t result = pdrx_report_to_json(report, plan, buffer, buffer_len, &written);
         if (result == PDRX_OK) {
-            int ok = write_buffer_to_file(path, buffer, written);
+            int ok = jq_worker_write_file(path, buffer, written);
             free(buffer);
             return ok;
         }
@@ -112,7 +86,10 @@ static int read_metadata_plan(const char *path, pdrx_plan_t *plan) {
     return parse_result == PDRX_OK;
 }
 
-static pdrx_result_t replace_pdf_with_redacted(const char *pdf_locked, const pdrx_plan_t *plan, pdrx_report_t *report) {
+static pdrx_result_t replace_pdf_with_redacted(const char *pdf_locked,
+                                               const pdrx_plan_t *plan,
+                                               pdrx_report_t *report,
+                                               jq_worker_monitor_t *monitor) {
     char temp_path[PATH_MAX];
     int written = snprintf(temp_path, sizeof(temp_path), "%s.redact.tmp.XXXXXX", pdf_locked);
     if (written < 0 || (size_t)written >= sizeof(temp_path)) {
@@ -124,7 +101,8 @@ static pdrx_result_t replace_pdf_with_redacted(const char *pdf_locked, const pdr
     }
     close(temp_fd);
 
-    pdrx_result_t redact_result = pdrx_apply_file(pdf_locked, temp_path, plan, report);
+    pdrx_result_t redact_result =
+        pdrx_apply_file_with_progress(pdf_locked, temp_path, plan, report, jq_worker_progress, monitor);
     if (redact_result != PDRX_OK) {
         unlink(temp_path);
         return redact_result;
@@ -146,9 +124,18 @@ int main(int argc, char **argv) {
 
     const char *root = argv[1];
     int prefer_priority = 0;
+    int wait_ms = 0;
     for (int i = 2; i < argc; ++i) {
         if (strcmp(argv[i], "--prefer-priority") == 0) {
             prefer_priority = 1;
+        } else if (strcmp(argv[i], "--wait") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            long value = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || value < -1 || value > INT_MAX) {
+                print_usage();
+                return 1;
+            }
+            wait_ms = (int)value;
         } else {
             print_usage();
             return 1;
@@ -157,7 +144,9 @@ int main(int argc, char **argv) {
 
     char uuid[128];
     jq_state_t state = JQ_STATE_JOBS;
-    jq_result_t claim_result = jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
+    jq_result_t claim_result = wait_ms != 0
+                                   ? jq_claim_wait(root, prefer_priority, wait_ms, uuid, sizeof(uuid), &state)
+                                   : jq_claim_next(root, prefer_priority, uuid, sizeof(uuid), &state);
     if (claim_result == JQ_ERR_NOT_FOUND) {
         return 2;
     }
@@ -176,23 +165,24 @@ int main(int argc, char **argv) {
 
     pdrx_plan_t plan;
     if (!read_metadata_plan(metadata_locked, &plan)) {
-        write_error_metadata(metadata_locked, "plan_parse_failed");
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "plan_parse_failed", 0);
     }
 
     pdrx_report_t report;
-    pdrx_result_t redact_result = replace_pdf_with_redacted(pdf_locked, &plan, &report);
+    jq_worker_monitor_t monitor;
+    jq_worker_monitor_begin(&monitor, root, uuid, "redact", pdf_locked);
+    pdrx_result_t redact_result = replace_pdf_with_redacted(pdf_locked, &plan, &report, &monitor);
+    jq_worker_monitor_end(&monitor);
+    if (redact_result == PDRX_ERR_CANCELLED) {
+        return jq_worker_cancel(root, uuid, state);
+    }
     if (redact_result != PDRX_OK) {
-        write_error_metadata(metadata_locked, pdrx_result_str(redact_result));
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR,
+                              pdrx_result_str(redact_result), redact_result == PDRX_ERR_IO);
     }
 
     if (!write_report_json(&report, &plan, metadata_locked)) {
-        write_error_metadata(metadata_locked, "report_write_failed");
-        (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
-        return 1;
+        return jq_worker_fail(root, uuid, state, metadata_locked, FAILURE_ERROR, "report_write_failed", 1);
     }
 
     if (jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) != JQ_OK) {
@@ -0,0 +1,103 @@
+#include "pap/job_queue_worker.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+int jq_worker_write_file(const char *path, const char *buffer, size_t length) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return 0;
+    }
+    if (length > 0 && fwrite(buffer, 1, length, fp) != length) {
+        fclose(fp);
+        return 0;
+    }
+    if (fclose(fp) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+static int write_error_metadata(const char *path, const char *error, const char *detail) {
+    if (!path || !error || !detail) {
+        return 0;
+    }
+    char buffer[256];
+    int written = snprintf(buffer, sizeof(buffer), "{\"error\":\"%s\",\"detail\":\"%s\"}", error, detail);
+    if (written < 0 || (size_t)written >= sizeof(buffer)) {
+        return 0;
+    }
+    return jq_worker_write_file(path, buffer, (size_t)written);
+}
+
+void jq_worker_monitor_begin(jq_worker_monitor_t *monitor,
+                             const char *root,
+                             const char *uuid,
+                             const char *phase,
+                             const char *pdf_path) {
+    struct stat st;
+    unsigned long long total = stat(pdf_path, &st) == 0 ? (unsigned long long)st.st_size : 0;
+    monitor->watch = jq_cancel_watch(root, uuid);
+    monitor->progress = jq_progress_begin(root, uuid, phase, total);
+}
+
+void jq_worker_monitor_end(jq_worker_monitor_t *monitor) {
+    jq_progress_end(monitor->progress);
+    jq_cancel_unwatch(monitor->watch);
+}
+
+int jq_worker_progress(size_t bytes_done, size_t bytes_total, void *monitor_data) {
+    (void)bytes_total;
+    jq_worker_monitor_t *monitor = monitor_data;
+    jq_progress_update(monitor->progress, bytes_done);
+    return jq_cancel_requested(monitor->watch);
+}
+
+/*
+ * I/O failures may be transient, so they go back on the queue with backoff
+ * until jq_retry decides the job is out of attempts. Anything else, and the
+ * last attempt, lands in error/ with the detail in its metadata.
+ */
+int jq_worker_fail(const char *root,
+                   const char *uuid,
+                   jq_state_t state,
+                   const char *metadata_locked,
+                   const char *error,
+                   const char *detail,
+                   int retryable) {
+    if (retryable) {
+        jq_retry_options_t retry;
+        jq_retry_options_init(&retry);
+        unsigned int attempts = 0;
+        time_t not_before = 0;
+        if (jq_retry(root, uuid, state, &retry, &attempts, &not_before) == JQ_OK) {
+            if (not_before != 0) {
+                fprintf(stderr, "Job %s failed (%s) on attempt %u; retrying at %lld.\n", uuid, detail, attempts,
+                        (long long)not_before);
+                return 1;
+            }
+            /* Out of attempts: jq_retry already moved it to error/, so the detail goes on that copy. */
+            jq_state_t final_state;
+            int locked = 0;
+            char pdf_path[PATH_MAX];
+            char metadata_path[PATH_MAX];
+            if (jq_status(root, uuid, &final_state, &locked) == JQ_OK && final_state == JQ_STATE_ERROR &&
+                jq_job_paths(root, uuid, JQ_STATE_ERROR, pdf_path, sizeof(pdf_path), metadata_path,
+                             sizeof(metadata_path)) == JQ_OK) {
+                write_error_metadata(metadata_path, error, detail);
+            }
+            return 1;
+        }
+    }
+    write_error_metadata(metadata_locked, error, detail);
+    (void)jq_finalize(root, uuid, state, JQ_STATE_ERROR);
+    return 1;
+}
+
+/* A cancelled job is handed back, which deletes it instead of requeueing it. */
+int jq_worker_cancel(const char *root, const char *uuid, jq_state_t state) {
+    fprintf(stderr, "Job %s cancelled.\n", uuid);
+    (void)jq_release(root, uuid, state);
+    return 1;
+}
@@ -303,7 +303,16 @@ static void pdfa_note_pending_key(const char *token, size_t token_len, pdfa_pend
     }
 }
 
-static void pdfa_scan_tokens(FILE *fp, pdfa_report_t *report) {
+/* The callbacks a caller passed in; either may be NULL. */
+typedef struct {
+    pdfa_cancel_fn cancel;
+    void *cancel_data;
+    pdfa_progress_fn progress;
+    void *progress_data;
+} pdfa_scan_hooks_t;
+
+/* cancel is polled before each chunk and progress hears about it after; returns 0 when either asked to stop. */
+static int pdfa_scan_tokens(FILE *fp, pdfa_report_t *report, const pdfa_scan_hooks_t *hooks) {
     char buffer[PDFA_SCAN_CHUNK_SIZE + 1];
     char token[128];
     size_t token_len = 0;
@@ -311,6 +320,9 @@ static void pdfa_scan_tokens(FILE *fp, pdfa_report_t *report) {
     pdfa_pending_key_t pending = PDFA_PENDING_NONE;
 
     while (!feof(fp)) {
+        if (hooks->cancel && hooks->cancel(hooks->cancel_data)) {
+            return 0;
+        }
         size_t bytes = fread(buffer, 1, PDFA_SCAN_CHUNK_SIZE, fp);
         if (bytes == 0) {
             break;
@@ -382,6 +394,9 @@ static void pdfa_scan_tokens(FILE *fp, pdfa_report_t *report) {
             token_len = 0;
             token_is_name = 0;
         }
+        if (hooks->progress && hooks->progress(report->bytes_scanned, report->byte_count, hooks->progress_data)) {
+            return 0;
+        }
     }
     if (token_len > 0) {
         token[token_len] = '\0';
@@ -392,6 +407,7 @@ static void pdfa_scan_tokens(FILE *fp, pdfa_report_t *report) {
             pdfa_mark_keyword(token, token_len, report, &pending);
         }
     }
+    return 1;
 }
 
 static void pdfa_finalize_report(pdfa_report_t *report) {
@@ -414,7 +430,7 @@ static void pdfa_finalize_report(pdfa_report_t *report) {
     pdfa_track_mcid(report);
 }
 
-pdfa_result_t pdfa_analyze_file(const char *path, pdfa_report_t *report) {
+static pdfa_result_t pdfa_analyze(const char *path, pdfa_report_t *report, const pdfa_scan_hooks_t *hooks) {
     if (!path || !report) {
         return PDFA_ERR_INVALID_ARGUMENT;
     }
@@ -444,13 +460,37 @@ pdfa_result_t pdfa_analyze_file(const char *path, pdfa_report_t *report) {
     }
 
     rewind(fp);
-    pdfa_scan_tokens(fp, report);
+    int scanned = pdfa_scan_tokens(fp, report, hooks);
     fclose(fp);
+    if (!scanned) {
+        return PDFA_ERR_CANCELLED;
+    }
 
     pdfa_finalize_report(report);
     return PDFA_OK;
 }
 
+pdfa_result_t pdfa_analyze_file(const char *path, pdfa_report_t *report) {
+    const pdfa_scan_hooks_t hooks = {NULL, NULL, NULL, NULL};
+    return pdfa_analyze(path, report, &hooks);
+}
+
+pdfa_result_t pdfa_analyze_file_with_cancel(const char *path,
+                                            pdfa_report_t *report,
+                                            pdfa_cancel_fn cancel,
+                                            void *cancel_data) {
+    const pdfa_scan_hooks_t hooks = {cancel, cancel_data, NULL, NULL};
+    return pdfa_analyze(path, report, &hooks);
+}
+
+pdfa_result_t pdfa_analyze_file_with_progress(const char *path,
+                                              pdfa_report_t *report,
+                                              pdfa_progress_fn progress,
+                                              void *progress_data) {
+    const pdfa_scan_hooks_t hooks = {NULL, NULL, progress, progress_data};
+    return pdfa_analyze(path, report, &hooks);
+}
+
 pdfa_result_t pdfa_report_to_json(const pdfa_report_t *report,
                                   char *buffer,
                                   size_t buffer_len,
@@ -860,6 +900,8 @@ const char *pdfa_result_str(pdfa_result_t result) {
             return "parse_error";
         case PDFA_ERR_BUFFER_TOO_SMALL:
             return "buffer_too_small";
+        case PDFA_ERR_CANCELLED:
+            return "cancelled";
         default:
             return "unknown";
     }
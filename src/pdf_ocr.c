@@ -46,6 +46,11 @@ static int pocr_registry_initialized = 0;
 
 static pocr_log_fn pocr_logger = NULL;
 static void *pocr_logger_data = NULL;
+static pocr_cancel_fn pocr_cancel = NULL;
+static void *pocr_cancel_data = NULL;
+/* The progress callback of the scan running on this thread, set only for the length of that call. */
+static _Thread_local pocr_progress_fn pocr_progress = NULL;
+static _Thread_local void *pocr_progress_data = NULL;
 static int pocr_log_level_initialized = 0;
 static pocr_log_level_t pocr_env_log_level = POCR_LOG_WARN;
 
@@ -146,7 +151,11 @@ static size_t pocr_count_marker_hits_window(const char *buffer,
     return hits;
 }
 
-static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
+/*
+ * The cancel callback is polled before each chunk and the scan's progress
+ * callback hears about it after; returns 0 when either asked to stop.
+ */
+static int pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
     static const pocr_marker_t markers[] = {
         { "/Subtype/Ink", 45 },
         { "InkList", 30 },
@@ -162,7 +171,7 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
     };
 
     if (!fp || !report) {
-        return;
+        return 1;
     }
 
     size_t max_marker_len = 0;
@@ -176,13 +185,13 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
     if (max_marker_len == 0) {
         report->handwriting_marker_hits = 0;
         report->handwriting_confidence = 0;
-        return;
+        return 1;
     }
 
     if (fseek(fp, 0, SEEK_SET) != 0) {
         report->handwriting_marker_hits = 0;
         report->handwriting_confidence = 0;
-        return;
+        return 1;
     }
 
     char chunk[POCR_MARKER_SCAN_CHUNK];
@@ -198,13 +207,19 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
         free(carry);
         report->handwriting_marker_hits = 0;
         report->handwriting_confidence = 0;
-        return;
+        return 1;
     }
     size_t marker_hits[sizeof(markers) / sizeof(markers[0])];
     memset(marker_hits, 0, sizeof(marker_hits));
 
     size_t read_bytes = 0;
+    size_t scanned = 0;
     while ((read_bytes = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        if (pocr_cancel_requested()) {
+            free(window);
+            free(carry);
+            return 0;
+        }
         size_t window_len = 0;
         if (carry_len > 0) {
             memcpy(window, carry, carry_len);
@@ -228,6 +243,13 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
             carry_len = window_len;
             memcpy(carry, window, carry_len);
         }
+
+        scanned += read_bytes;
+        if (pocr_report_progress(scanned, report->bytes_scanned)) {
+            free(window);
+            free(carry);
+            return 0;
+        }
     }
     free(window);
     free(carry);
@@ -273,7 +295,7 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
     if (total_hits == 0) {
         report->handwriting_marker_hits = 0;
         report->handwriting_confidence = 0;
-        return;
+        return 1;
     }
 
     if (has_ink && has_signature) {
@@ -295,6 +317,7 @@ static void pocr_scan_handwriting_markers(FILE *fp, pocr_report_t *report) {
 
     report->handwriting_marker_hits = total_hits;
     report->handwriting_confidence = score;
+    return 1;
 }
 
 static pocr_result_t pocr_register_provider_internal(const pocr_provider_t *provider, int log_errors) {
@@ -346,9 +369,9 @@ static pocr_result_t pocr_builtin_scan(const char *path, pocr_report_t *report,
     }
 
     pocr_result_t version_result = pocr_scan_version(fp, report);
-    pocr_scan_handwriting_markers(fp, report);
+    int scanned = pocr_scan_handwriting_markers(fp, report);
     fclose(fp);
-    return version_result;
+    return scanned ? version_result : POCR_ERR_CANCELLED;
 }
 
 static void pocr_init_registry(void) {
@@ -384,6 +407,14 @@ pocr_result_t pocr_scan_file(const char *path, pocr_report_t *report) {
 pocr_result_t pocr_scan_file_with_provider(const char *provider_name,
                                            const char *path,
                                            pocr_report_t *report) {
+    return pocr_scan_file_with_progress(provider_name, path, report, NULL, NULL);
+}
+
+pocr_result_t pocr_scan_file_with_progress(const char *provider_name,
+                                           const char *path,
+                                           pocr_report_t *report,
+                                           pocr_progress_fn progress,
+                                           void *progress_data) {
     if (!path || !report) {
         return POCR_ERR_INVALID_ARGUMENT;
     }
@@ -413,7 +444,13 @@ pocr_result_t pocr_scan_file_with_provider(const char *provider_name,
 
     report->provider_name = provider->name;
     pocr_log_message(POCR_LOG_INFO, "Starting OCR scan with provider '%s'.", provider->name);
+    pocr_progress_fn outer_progress = pocr_progress;
+    void *outer_progress_data = pocr_progress_data;
+    pocr_progress = progress;
+    pocr_progress_data = progress_data;
     pocr_result_t result = provider->scan_file(path, report, provider->user_data);
+    pocr_progress = outer_progress;
+    pocr_progress_data = outer_progress_data;
     if (result != POCR_OK) {
         pocr_log_message(POCR_LOG_ERROR, "OCR scan failed with provider '%s': %s",
                          provider->name, pocr_result_str(result));
@@ -479,6 +516,8 @@ const char *pocr_result_str(pocr_result_t result) {
             return "provider_exists";
         case POCR_ERR_PROVIDER_LIMIT:
             return "provider_limit";
+        case POCR_ERR_CANCELLED:
+            return "cancelled";
         default:
             return "unknown_error";
     }
@@ -489,6 +528,19 @@ void pocr_set_logger(pocr_log_fn logger, void *user_data) {
     pocr_logger_data = user_data;
 }
 
+void pocr_set_cancel(pocr_cancel_fn cancel, void *user_data) {
+    pocr_cancel = cancel;
+    pocr_cancel_data = user_data;
+}
+
+int pocr_cancel_requested(void) {
+    return pocr_cancel && pocr_cancel(pocr_cancel_data);
+}
+
+int pocr_report_progress(size_t bytes_done, size_t bytes_total) {
+    return pocr_progress && pocr_progress(bytes_done, bytes_total, pocr_progress_data);
+}
+
 const char *pocr_log_level_str(pocr_log_level_t level) {
     return pocr_log_level_str_internal(level);
 }
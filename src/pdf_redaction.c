@@ -611,10 +611,24 @@ static void pdrx_redact_buffer(char *buffer,
     }
 }
 
-pdrx_result_t pdrx_apply_file(const char *input_path,
-                              const char *output_path,
-                              const pdrx_plan_t *plan,
-                              pdrx_report_t *report) {
+/* The callbacks a caller passed in; either may be NULL. */
+typedef struct {
+    pdrx_cancel_fn cancel;
+    void *cancel_data;
+    pdrx_progress_fn progress;
+    void *progress_data;
+} pdrx_apply_hooks_t;
+
+/*
+ * cancel is polled before each chunk and progress hears about it after;
+ * either may stop the run, which leaves a partial output for the caller to
+ * remove.
+ */
+static pdrx_result_t pdrx_apply(const char *input_path,
+                                const char *output_path,
+                                const pdrx_plan_t *plan,
+                                pdrx_report_t *report,
+                                const pdrx_apply_hooks_t *hooks) {
     if (!input_path || !output_path || !plan || !report) {
         return PDRX_ERR_INVALID_ARGUMENT;
     }
@@ -671,6 +685,12 @@ pdrx_result_t pdrx_apply_file(const char *input_path,
     size_t carry = 0;
     ssize_t bytes_read = 0;
     while ((bytes_read = read(input_fd, buffer + carry, chunk_size)) > 0) {
+        if (hooks->cancel && hooks->cancel(hooks->cancel_data)) {
+            free(buffer);
+            close(input_fd);
+            close(output_fd);
+            return PDRX_ERR_CANCELLED;
+        }
         size_t total = carry + (size_t)bytes_read;
         size_t process_len = total > overlap ? total - overlap : 0;
 
@@ -697,6 +717,12 @@ pdrx_result_t pdrx_apply_file(const char *input_path,
             memmove(buffer, buffer + process_len, carry);
         }
         report->bytes_scanned += (size_t)bytes_read;
+        if (hooks->progress && hooks->progress(report->bytes_scanned, (size_t)st.st_size, hooks->progress_data)) {
+            free(buffer);
+            close(input_fd);
+            close(output_fd);
+            return PDRX_ERR_CANCELLED;
+        }
     }
 
     if (bytes_read < 0) {
@@ -734,6 +760,34 @@ pdrx_result_t pdrx_apply_file(const char *input_path,
     return PDRX_OK;
 }
 
+pdrx_result_t pdrx_apply_file(const char *input_path,
+                              const char *output_path,
+                              const pdrx_plan_t *plan,
+                              pdrx_report_t *report) {
+    const pdrx_apply_hooks_t hooks = {NULL, NULL, NULL, NULL};
+    return pdrx_apply(input_path, output_path, plan, report, &hooks);
+}
+
+pdrx_result_t pdrx_apply_file_with_cancel(const char *input_path,
+                                          const char *output_path,
+                                          const pdrx_plan_t *plan,
+                                          pdrx_report_t *report,
+                                          pdrx_cancel_fn cancel,
+                                          void *cancel_data) {
+    const pdrx_apply_hooks_t hooks = {cancel, cancel_data, NULL, NULL};
+    return pdrx_apply(input_path, output_path, plan, report, &hooks);
+}
+
+pdrx_result_t pdrx_apply_file_with_progress(const char *input_path,
+                                            const char *output_path,
+                                            const pdrx_plan_t *plan,
+                                            pdrx_report_t *report,
+                                            pdrx_progress_fn progress,
+                                            void *progress_data) {
+    const pdrx_apply_hooks_t hooks = {NULL, NULL, progress, progress_data};
+    return pdrx_apply(input_path, output_path, plan, report, &hooks);
+}
+
 pdrx_result_t pdrx_report_to_json(const pdrx_report_t *report,
                                   const pdrx_plan_t *plan,
                                   char *buffer,
@@ -781,6 +835,8 @@ const char *pdrx_result_str(pdrx_result_t result) {
             return "buffer_too_small";
         case PDRX_ERR_NOT_FOUND:
             return "not_found";
+        case PDRX_ERR_CANCELLED:
+            return "cancelled";
         default:
             return "unknown_error";
     }
@@ -7,7 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 static int assert_true(int condition, const char *message) {
@@ -184,6 +186,47 @@ static int create_job_files(const char *root, const char *uuid, int priority) {
     return jq_submit(root, uuid, pdf_src, metadata_src, priority) == JQ_OK;
 }
 
+static int create_level_job(const char *root, const char *uuid, int level) {
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/%s.pdf", root, uuid);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/%s.metadata", root, uuid);
+
+    if (!write_file(pdf_src, "pdf data") || !write_file(metadata_src, "metadata")) {
+        return 0;
+    }
+
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.level = level;
+    return jq_submit_with_options(root, uuid, pdf_src, metadata_src, &options) == JQ_OK;
+}
+
+static int create_tenant_job(const char *root, const char *uuid, const char *tenant) {
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/%s.pdf", root, uuid);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/%s.metadata", root, uuid);
+
+    if (!write_file(pdf_src, "pdf data") || !write_file(metadata_src, "metadata")) {
+        return 0;
+    }
+
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.tenant = tenant;
+    return jq_submit_with_options(root, uuid, pdf_src, metadata_src, &options) == JQ_OK;
+}
+
+static const jq_tenant_stats_t *find_tenant(const jq_stats_t *stats, const char *name) {
+    for (size_t i = 0; i < stats->tenant_count; ++i) {
+        if (strcmp(stats->tenants[i].name, name) == 0) {
+            return &stats->tenants[i];
+        }
+    }
+    return NULL;
+}
+
 static int build_locked_paths(const char *root,
                               const char *uuid,
                               const char *dir_name,
@@ -367,6 +410,175 @@ static int test_collect_stats(void) {
     return 1;
 }
 
+static int stats_match(const jq_stats_t *counters, const jq_stats_t *scan) {
+    for (size_t state = 0; state <= JQ_STATE_ERROR; ++state) {
+        const jq_state_stats_t *left = &counters->states[state];
+        const jq_state_stats_t *right = &scan->states[state];
+        if (left->pdf_jobs != right->pdf_jobs || left->metadata_jobs != right->metadata_jobs ||
+            left->report_jobs != right->report_jobs || left->pdf_locked != right->pdf_locked ||
+            left->metadata_locked != right->metadata_locked || left->pdf_bytes != right->pdf_bytes ||
+            left->metadata_bytes != right->metadata_bytes || left->report_bytes != right->report_bytes) {
+            fprintf(stderr, "stats differ in state %zu\n", state);
+            return 0;
+        }
+    }
+    return counters->total_jobs == scan->total_jobs && counters->total_bytes == scan->total_bytes;
+}
+
+static int test_collect_stats_large_dir(void) {
+    char template[] = "/tmp/pap_test_scan_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for large scan")) {
+        return 0;
+    }
+
+    /* Enough names to take several directory reads; every tenth pdf has no metadata. */
+    char path[PATH_MAX];
+    for (int i = 0; i < 4000; ++i) {
+        snprintf(path, sizeof(path), "%s/jobs/bulk-%05d.pdf.job", root, i);
+        if (!write_file(path, "pdf")) {
+            return 0;
+        }
+        if (i % 10 == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/jobs/bulk-%05d.metadata.job", root, i);
+        if (!write_file(path, "{}")) {
+            return 0;
+        }
+    }
+    /* A locked job directory missing its metadata, next to a loose unlocked metadata of the same uuid. */
+    const char *dirs[] = {"error/ab", "error/ab/cd", "error/ab/cd/held.lock"};
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        if (!assert_true(mkdir(path, 0755) == 0, "create sharded job dir")) {
+            return 0;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/error/ab/cd/held.lock/held.pdf.job", root);
+    if (!write_file(path, "pdf")) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/error/ab/cd/held.metadata.job", root);
+    if (!write_file(path, "{}")) {
+        return 0;
+    }
+
+    jq_stats_t stats;
+    return assert_true(jq_collect_stats(root, &stats) == JQ_OK, "collect stats over large dir") &&
+           assert_true(stats.states[JQ_STATE_JOBS].pdf_jobs == 4000 &&
+                           stats.states[JQ_STATE_JOBS].metadata_jobs == 3600 &&
+                           stats.states[JQ_STATE_JOBS].orphan_pdf == 400 &&
+                           stats.states[JQ_STATE_JOBS].orphan_metadata == 0,
+                       "large dir pairs and orphans") &&
+           assert_true(stats.states[JQ_STATE_ERROR].pdf_locked == 1 &&
+                           stats.states[JQ_STATE_ERROR].orphan_pdf == 1 &&
+                           stats.states[JQ_STATE_ERROR].orphan_metadata == 1,
+                       "locked dir does not pair with loose files");
+}
+
+static int test_incremental_stats(void) {
+    char template[] = "/tmp/pap_test_stats_counters_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for counters")) {
+        return 0;
+    }
+
+    jq_stats_t counters;
+    jq_stats_t scan;
+    if (!assert_true(jq_read_stats(root, &counters) == JQ_OK && counters.total_jobs == 0 &&
+                         counters.reconciled_at > 0,
+                     "first read builds counters")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "count-1", 0), "create counter job 1") ||
+        !assert_true(create_job_files(root, "count-2", 0), "create counter job 2") ||
+        !assert_true(create_job_files(root, "count-3", 1), "create counter job 3") ||
+        !assert_true(create_job_files(root, "count-4", 0), "create counter job 4")) {
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(jq_claim_next(root, 1, uuid, sizeof(uuid), &state) == JQ_OK, "claim counter job")) {
+        return 0;
+    }
+    if (!assert_true(jq_read_stats(root, &counters) == JQ_OK && counters.states[JQ_STATE_PRIORITY].pdf_locked == 1 &&
+                         counters.states[JQ_STATE_JOBS].pdf_jobs == 3,
+                     "claim moves counters to locked")) {
+        return 0;
+    }
+    if (!assert_true(counters.oldest_waiting_mtime > 0, "counters report oldest waiting job")) {
+        return 0;
+    }
+
+    /* Workers rewrite metadata and add a report while the job is locked. */
+    char pdf_locked[PATH_MAX];
+    char metadata_locked[PATH_MAX];
+    char report_locked[PATH_MAX];
+    if (jq_job_paths_locked(root, uuid, state, pdf_locked, sizeof(pdf_locked), metadata_locked,
+                            sizeof(metadata_locked)) != JQ_OK ||
+        jq_job_report_paths_locked(root, uuid, state, report_locked, sizeof(report_locked)) != JQ_OK) {
+        return assert_true(0, "locked counter paths");
+    }
+    if (!assert_true(write_file(metadata_locked, "{\"rewritten\":\"by a worker\"}") &&
+                         write_file(report_locked, "<html>report</html>"),
+                     "worker output")) {
+        return 0;
+    }
+    if (!assert_true(jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) == JQ_OK, "finalize counter job")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim second counter job")) {
+        return 0;
+    }
+    if (!assert_true(jq_release(root, uuid, state) == JQ_OK, "release counter job")) {
+        return 0;
+    }
+    if (!assert_true(jq_move(root, "count-4", JQ_STATE_JOBS, JQ_STATE_ERROR) == JQ_OK, "move counter job")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_read_stats(root, &counters) == JQ_OK, "read counters")) {
+        return 0;
+    }
+    if (!assert_true(jq_collect_stats(root, &scan) == JQ_OK, "scan stats")) {
+        return 0;
+    }
+    if (!assert_true(stats_match(&counters, &scan), "counters match full scan")) {
+        return 0;
+    }
+
+    /* Files changed behind the queue's back drift until a reconcile. */
+    char stray[PATH_MAX];
+    snprintf(stray, sizeof(stray), "%s/error/stray.pdf.job", root);
+    if (!assert_true(write_file(stray, "stray"), "write stray job")) {
+        return 0;
+    }
+    if (!assert_true(jq_read_stats(root, &counters) == JQ_OK && counters.states[JQ_STATE_ERROR].pdf_jobs == 1,
+                     "outside write not counted")) {
+        return 0;
+    }
+    if (!assert_true(jq_collect_stats(root, &scan) == JQ_OK && jq_read_stats(root, &counters) == JQ_OK,
+                     "reconcile counters")) {
+        return 0;
+    }
+    return assert_true(counters.states[JQ_STATE_ERROR].pdf_jobs == 2 &&
+                           counters.states[JQ_STATE_ERROR].orphan_pdf == 1 && stats_match(&counters, &scan),
+                       "reconcile repairs counters");
+}
+
 static int test_submit_and_move(void) {
     char template[] = "/tmp/pap_test_XXXXXX";
     char *root = mkdtemp(template);
@@ -513,6 +725,26 @@ static int test_submit_metadata_cleanup(void) {
         return 0;
     }
 
+    /* A job kept in its own directory takes the directory with it. */
+    size_t moved = 0;
+    size_t remaining = 0;
+    if (!assert_true(jq_migrate_job_dirs(root, &moved, &remaining) == JQ_OK && remaining == 0,
+                     "migrate to job dirs for cleanup") ||
+        !assert_true(jq_submit(root, "job-dir-cleanup", pdf_src, metadata_src, 0) == JQ_ERR_NOT_FOUND,
+                     "missing metadata in job dir returns not found") ||
+        !assert_true(jq_job_paths(root, "job-dir-cleanup", JQ_STATE_JOBS, pdf_dest, sizeof(pdf_dest),
+                                  metadata_dest, sizeof(metadata_dest)) == JQ_OK,
+                     "paths for job dir cleanup")) {
+        return 0;
+    }
+    char *slash = strrchr(pdf_dest, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+    if (!assert_true(!file_exists(pdf_dest), "job dir removed after metadata failure")) {
+        return 0;
+    }
+
     return 1;
 }
 
@@ -647,6 +879,304 @@ static int test_submit_large_files(void) {
     return 1;
 }
 
+static int test_submit_link_mode(void) {
+    char template[] = "/tmp/pap_test_link_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for link submit")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/link.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/link.metadata", root);
+    if (!assert_true(write_pattern_file(pdf_src, 1024 * 256, 5, 0600), "write link pdf")) {
+        return 0;
+    }
+    if (!assert_true(write_pattern_file(metadata_src, 1024 * 8, 9, 0644), "write link metadata")) {
+        return 0;
+    }
+
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.mode = JQ_SUBMIT_LINK;
+    options.priority = 1;
+    if (!assert_true(jq_submit_with_options(root, "job-link", pdf_src, metadata_src, &options) == JQ_OK,
+                     "link submit")) {
+        return 0;
+    }
+
+    char pdf_dest[PATH_MAX];
+    char metadata_dest[PATH_MAX];
+    if (!assert_true(jq_job_paths(root, "job-link", JQ_STATE_PRIORITY, pdf_dest, sizeof(pdf_dest),
+                                  metadata_dest, sizeof(metadata_dest)) == JQ_OK,
+                     "job paths for link submit")) {
+        return 0;
+    }
+
+    struct stat src_stat;
+    struct stat dest_stat;
+    if (!assert_true(stat(pdf_src, &src_stat) == 0 && stat(pdf_dest, &dest_stat) == 0, "stat linked pdf")) {
+        return 0;
+    }
+    if (!assert_true(src_stat.st_ino == dest_stat.st_ino && dest_stat.st_nlink == 2, "pdf hard-linked")) {
+        return 0;
+    }
+    if (!assert_true(stat(metadata_src, &src_stat) == 0 && stat(metadata_dest, &dest_stat) == 0,
+                     "stat metadata")) {
+        return 0;
+    }
+    if (!assert_true(src_stat.st_ino != dest_stat.st_ino && compare_files(metadata_src, metadata_dest),
+                     "metadata copied, not linked")) {
+        return 0;
+    }
+
+    char priority_dir[PATH_MAX];
+    snprintf(priority_dir, sizeof(priority_dir), "%s/priority_jobs", root);
+    if (!assert_true(!directory_has_tmp_files(priority_dir), "no temp files after link submit")) {
+        return 0;
+    }
+
+    options.mode = JQ_SUBMIT_COPY;
+    if (!assert_true(jq_submit_with_options(root, "job-copy", pdf_src, metadata_src, &options) == JQ_OK,
+                     "copy submit")) {
+        return 0;
+    }
+    if (jq_job_paths(root, "job-copy", JQ_STATE_PRIORITY, pdf_dest, sizeof(pdf_dest), metadata_dest,
+                     sizeof(metadata_dest)) != JQ_OK) {
+        return assert_true(0, "job paths for copy submit");
+    }
+    if (!assert_true(stat(pdf_src, &src_stat) == 0 && stat(pdf_dest, &dest_stat) == 0, "stat copied pdf")) {
+        return 0;
+    }
+    if (!assert_true(src_stat.st_ino != dest_stat.st_ino && compare_files(pdf_src, pdf_dest),
+                     "copy mode copies pdf")) {
+        return 0;
+    }
+
+    options.mode = (jq_submit_mode_t)7;
+    return assert_true(jq_submit_with_options(root, "job-bad", pdf_src, metadata_src, &options) ==
+                           JQ_ERR_INVALID_ARGUMENT,
+                       "unknown submit mode rejected");
+}
+
+static int test_blob_store(void) {
+    char template[] = "/tmp/pap_test_blob_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for blob store")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char pdf_dup[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/blob.pdf", root);
+    snprintf(pdf_dup, sizeof(pdf_dup), "%s/blob-dup.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/blob.metadata", root);
+    if (!assert_true(write_file(pdf_src, "abc") && write_file(pdf_dup, "abc") &&
+                         write_file(metadata_src, "{}"),
+                     "write blob sources")) {
+        return 0;
+    }
+
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.mode = JQ_SUBMIT_BLOB;
+    if (!assert_true(jq_submit_with_options(root, "job-blob-a", pdf_src, metadata_src, &options) == JQ_OK,
+                     "blob submit")) {
+        return 0;
+    }
+
+    char hash[JQ_BLOB_HASH_MAX];
+    if (!assert_true(jq_blob_put(root, pdf_src, JQ_SUBMIT_COPY, hash, sizeof(hash)) == JQ_OK, "blob put")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(hash, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0,
+                     "blob keyed by sha-256")) {
+        return 0;
+    }
+    size_t refs = 0;
+    if (!assert_true(jq_blob_refs(root, hash, &refs) == JQ_OK && refs == 1, "first job references blob")) {
+        return 0;
+    }
+
+    jq_submit_options_init(&options);
+    options.blob = hash;
+    if (!assert_true(jq_submit_with_options(root, "job-blob-b", NULL, metadata_src, &options) == JQ_OK,
+                     "submit from stored blob")) {
+        return 0;
+    }
+    char blob_path[PATH_MAX];
+    snprintf(blob_path, sizeof(blob_path), "%s/.jq/blobs/ba/%s", root, hash);
+    char pdf_a[PATH_MAX];
+    char pdf_b[PATH_MAX];
+    char metadata_dest[PATH_MAX];
+    if (!assert_true(jq_job_paths(root, "job-blob-a", JQ_STATE_JOBS, pdf_a, sizeof(pdf_a), metadata_dest,
+                                  sizeof(metadata_dest)) == JQ_OK &&
+                         jq_job_paths(root, "job-blob-b", JQ_STATE_JOBS, pdf_b, sizeof(pdf_b), metadata_dest,
+                                      sizeof(metadata_dest)) == JQ_OK,
+                     "job paths for blob jobs")) {
+        return 0;
+    }
+    struct stat blob_stat;
+    struct stat a_stat;
+    struct stat b_stat;
+    if (!assert_true(stat(blob_path, &blob_stat) == 0 && stat(pdf_a, &a_stat) == 0 && stat(pdf_b, &b_stat) == 0,
+                     "stat blob and job pdfs")) {
+        return 0;
+    }
+    if (!assert_true(a_stat.st_ino == blob_stat.st_ino && b_stat.st_ino == blob_stat.st_ino &&
+                         compare_files(pdf_src, pdf_a),
+                     "jobs share one blob")) {
+        return 0;
+    }
+
+    /* A linked duplicate finds the stored blob and leaves the caller's file alone. */
+    char dup_hash[JQ_BLOB_HASH_MAX];
+    struct stat dup_before;
+    struct stat dup_stat;
+    if (!assert_true(stat(pdf_dup, &dup_before) == 0 &&
+                         jq_blob_put(root, pdf_dup, JQ_SUBMIT_LINK, dup_hash, sizeof(dup_hash)) == JQ_OK &&
+                         strcmp(dup_hash, hash) == 0 && stat(pdf_dup, &dup_stat) == 0 &&
+                         dup_stat.st_ino == dup_before.st_ino && dup_stat.st_ino != blob_stat.st_ino,
+                     "linked duplicate keeps its own file")) {
+        return 0;
+    }
+    if (!assert_true(jq_blob_refs(root, hash, &refs) == JQ_OK && refs == 2, "blob counts two references")) {
+        return 0;
+    }
+
+    /* New content stored in link mode is a copy, never the caller's inode. */
+    char pdf_new[PATH_MAX];
+    char new_hash[JQ_BLOB_HASH_MAX];
+    char new_blob[PATH_MAX];
+    struct stat new_stat;
+    struct stat new_blob_stat;
+    snprintf(pdf_new, sizeof(pdf_new), "%s/blob-new.pdf", root);
+    if (!assert_true(write_file(pdf_new, "fresh contents") &&
+                         jq_blob_put(root, pdf_new, JQ_SUBMIT_LINK, new_hash, sizeof(new_hash)) == JQ_OK,
+                     "linked store of new content")) {
+        return 0;
+    }
+    snprintf(new_blob, sizeof(new_blob), "%s/.jq/blobs/%.2s/%s", root, new_hash, new_hash);
+    if (!assert_true(stat(pdf_new, &new_stat) == 0 && stat(new_blob, &new_blob_stat) == 0 &&
+                         new_stat.st_ino != new_blob_stat.st_ino && new_stat.st_nlink == 1 &&
+                         compare_files(pdf_new, new_blob),
+                     "linked store copies new content")) {
+        return 0;
+    }
+    unlink(pdf_new);
+
+    options.blob = "not-a-hash";
+    if (!assert_true(jq_submit_with_options(root, "job-blob-bad", NULL, metadata_src, &options) ==
+                         JQ_ERR_INVALID_ARGUMENT,
+                     "invalid blob hash rejected")) {
+        return 0;
+    }
+
+    size_t removed = 0;
+    if (!assert_true(jq_gc_blobs(root, 0, &removed) == JQ_OK && removed == 0, "referenced blob kept")) {
+        return 0;
+    }
+    unlink(pdf_a);
+    unlink(pdf_b);
+    unlink(pdf_dup);
+    if (!assert_true(jq_gc_blobs(root, 0, &removed) == JQ_OK && removed == 0, "fresh blob kept for grace")) {
+        return 0;
+    }
+    if (!assert_true(jq_gc_blobs(root, time(NULL) + 7200, &removed) == JQ_OK && removed == 2,
+                     "unreferenced blobs collected")) {
+        return 0;
+    }
+    return assert_true(jq_blob_refs(root, hash, &refs) == JQ_ERR_NOT_FOUND, "collected blob gone");
+}
+
+static int test_submit_batch(void) {
+    char template[] = "/tmp/pap_test_submit_batch_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for batch")) {
+        return 0;
+    }
+
+    enum { BATCH_JOBS = 24 };
+    char uuids[BATCH_JOBS][32];
+    char pdf_paths[BATCH_JOBS][PATH_MAX];
+    char metadata_paths[BATCH_JOBS][PATH_MAX];
+    jq_submit_item_t items[BATCH_JOBS + 2];
+    for (size_t i = 0; i < BATCH_JOBS; ++i) {
+        snprintf(uuids[i], sizeof(uuids[i]), "batch-%02zu", i);
+        snprintf(pdf_paths[i], sizeof(pdf_paths[i]), "%s/%s.pdf", root, uuids[i]);
+        snprintf(metadata_paths[i], sizeof(metadata_paths[i]), "%s/%s.metadata", root, uuids[i]);
+        if (!assert_true(write_file(pdf_paths[i], "pdf data") && write_file(metadata_paths[i], "metadata"),
+                         "write batch sources")) {
+            return 0;
+        }
+        items[i].uuid = uuids[i];
+        items[i].pdf_path = pdf_paths[i];
+        items[i].metadata_path = metadata_paths[i];
+        items[i].level = i % 4 == 0 ? 7 : JQ_LEVEL_AUTO;
+    }
+    items[BATCH_JOBS] = items[0];
+    items[BATCH_JOBS].uuid = "batch-missing";
+    items[BATCH_JOBS].pdf_path = "/nonexistent/batch.pdf";
+    items[BATCH_JOBS + 1] = items[1];
+    items[BATCH_JOBS + 1].uuid = "batch-bad-level";
+    items[BATCH_JOBS + 1].level = JQ_LEVEL_COUNT;
+
+    jq_submit_options_t options;
+    jq_submit_options_init(&options);
+    options.threads = 3;
+    size_t submitted = 0;
+    if (!assert_true(jq_submit_batch(NULL, items, 1, &options, &submitted) == JQ_ERR_INVALID_ARGUMENT,
+                     "batch rejects NULL root") ||
+        !assert_true(jq_submit_batch(root, items, BATCH_JOBS + 2, &options, &submitted) == JQ_OK,
+                     "submit batch") ||
+        !assert_true(submitted == BATCH_JOBS, "batch submitted count") ||
+        !assert_true(items[BATCH_JOBS].result == JQ_ERR_NOT_FOUND, "batch reports missing source") ||
+        !assert_true(items[BATCH_JOBS + 1].result == JQ_ERR_INVALID_ARGUMENT, "batch reports bad level")) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < BATCH_JOBS; ++i) {
+        jq_state_t state;
+        int locked = 1;
+        jq_state_t expected = i % 4 == 0 ? JQ_STATE_PRIORITY : JQ_STATE_JOBS;
+        if (!assert_true(items[i].result == JQ_OK, "batch item ok") ||
+            !assert_true(jq_status(root, uuids[i], &state, &locked) == JQ_OK && state == expected && !locked,
+                         "batch job queued at its level")) {
+            return 0;
+        }
+    }
+
+    /* Published in item order once durable, so claims see them in manifest order. */
+    char uuid[64];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 1, uuid, sizeof(uuid), &state) == JQ_OK &&
+                     strcmp(uuid, "batch-00") == 0, "batch claim order")) {
+        return 0;
+    }
+
+    jq_stats_t counters;
+    return assert_true(jq_read_stats(root, &counters) == JQ_OK &&
+                       counters.states[JQ_STATE_JOBS].pdf_jobs == 18 &&
+                       counters.states[JQ_STATE_PRIORITY].pdf_jobs == 5 &&
+                       counters.states[JQ_STATE_PRIORITY].pdf_locked == 1, "batch counted in stats");
+}
+
 static int test_submit_atomic_cleanup(void) {
     char template[] = "/tmp/pap_test_atomic_XXXXXX";
     char *root = mkdtemp(template);
@@ -850,38 +1380,1640 @@ static int test_claim_priority(void) {
     return 1;
 }
 
-static int test_claim_no_jobs(void) {
-    char template[] = "/tmp/pap_test_claim_none_XXXXXX";
+static int test_claim_index_order(void) {
+    char template[] = "/tmp/pap_test_claim_index_XXXXXX";
     char *root = mkdtemp(template);
     if (!root) {
         perror("mkdtemp failed");
         return 0;
     }
 
-    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for claim none")) {
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for claim index")) {
         return 0;
     }
 
-    char uuid[32];
+    char uuid[64];
     jq_state_t state = JQ_STATE_JOBS;
-    jq_result_t claim_result = jq_claim_next(root, 1, uuid, sizeof(uuid), &state);
-    return assert_true(claim_result == JQ_ERR_NOT_FOUND, "jq_claim_next returns not found");
-}
-
-static int test_release_and_finalize(void) {
-    char template[] = "/tmp/pap_test_release_XXXXXX";
-    char *root = mkdtemp(template);
-    if (!root) {
-        perror("mkdtemp failed");
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "empty claim builds index")) {
         return 0;
     }
 
-    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for release")) {
+    char log_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%s/.jq/jobs.2.ready", root);
+    if (!assert_true(file_exists(log_path), "ready log created")) {
         return 0;
     }
 
-    if (!assert_true(create_job_files(root, "job-release", 0), "create release job")) {
-        return 0;
+    const char *uuids[] = {"index-a", "index-b", "index-c"};
+    for (size_t i = 0; i < sizeof(uuids) / sizeof(uuids[0]); ++i) {
+        if (!assert_true(create_job_files(root, uuids[i], 0), "create indexed job")) {
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(uuids) / sizeof(uuids[0]); ++i) {
+        if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim indexed job")) {
+            return 0;
+        }
+        if (!assert_true(strcmp(uuid, uuids[i]) == 0, "indexed jobs claimed in submission order")) {
+            return 0;
+        }
+    }
+
+    if (!assert_true(jq_release(root, "index-b", JQ_STATE_JOBS) == JQ_OK, "release indexed job")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim released job")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(uuid, "index-b") == 0, "released job requeued")) {
+        return 0;
+    }
+
+    return assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                       "index drained");
+}
+
+static int test_claim_index_rebuild(void) {
+    char template[] = "/tmp/pap_test_claim_rebuild_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for claim rebuild")) {
+        return 0;
+    }
+    if (!assert_true(create_job_files(root, "rebuild-a", 0), "create rebuild job a")) {
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim rebuild job a")) {
+        return 0;
+    }
+
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    snprintf(pdf_path, sizeof(pdf_path), "%s/jobs/external.pdf.job", root);
+    snprintf(metadata_path, sizeof(metadata_path), "%s/jobs/external.metadata.job", root);
+    if (!assert_true(write_file(pdf_path, "pdf data") && write_file(metadata_path, "metadata"),
+                     "write external job")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "drained index is not rescanned unmarked")) {
+        return 0;
+    }
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init marks queues for a rescan")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim external job")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(uuid, "external") == 0, "marked index rescans directory")) {
+        return 0;
+    }
+
+    /* A PDF without its metadata is never indexed. */
+    snprintf(pdf_path, sizeof(pdf_path), "%s/jobs/orphan.pdf.job", root);
+    if (!assert_true(write_file(pdf_path, "pdf data"), "write orphan pdf")) {
+        return 0;
+    }
+    struct stat before;
+    struct stat after;
+    char ready_path[PATH_MAX];
+    snprintf(ready_path, sizeof(ready_path), "%s/.jq/jobs.2.ready", root);
+    if (!assert_true(stat(ready_path, &before) == 0 && jq_init(root) == JQ_OK &&
+                         jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND &&
+                         stat(ready_path, &after) == 0 && after.st_size == before.st_size,
+                     "orphan pdf skipped by rescan")) {
+        return 0;
+    }
+    if (!assert_true(unlink(pdf_path) == 0, "remove orphan pdf")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "rebuild-b", 0), "create rebuild job b")) {
+        return 0;
+    }
+    char log_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%s/.jq/jobs.2.ready", root);
+    if (!assert_true(write_file(log_path, "garbage"), "corrupt ready log")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim after corruption")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(uuid, "rebuild-b") == 0, "corrupt index rebuilt")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "rebuild-c", 0), "create rebuild job c")) {
+        return 0;
+    }
+    if (!assert_true(unlink(log_path) == 0, "remove ready log")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim after removal")) {
+        return 0;
+    }
+    return assert_true(strcmp(uuid, "rebuild-c") == 0, "missing index rebuilt");
+}
+
+/* Mirrors the 256-byte ready-log record, to stand in for a claimer that died or a long-lived lane. */
+typedef struct {
+    unsigned int magic;
+    unsigned int uuid_len;
+    unsigned long long seq;
+    long long enqueued_at;
+    long long bytes;
+    char uuid[224];
+} ready_record_t;
+
+static int test_claim_index_recovery(void) {
+    char template[] = "/tmp/pap_test_claim_recovery_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state = JQ_STATE_JOBS;
+    char log_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%s/.jq/jobs.2.ready", root);
+    if (!assert_true(jq_init(root) == JQ_OK && create_job_files(root, "lost", 0), "create job to lose") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         jq_release(root, uuid, state) == JQ_OK,
+                     "claim and release build every lane")) {
+        return 0;
+    }
+
+    /* A claimer took the record with its CAS and died before the rename. */
+    struct stat st;
+    unsigned long long head = 0;
+    int fd = open(log_path, O_RDWR);
+    if (!assert_true(fd >= 0 && fstat(fd, &st) == 0, "open ready log")) {
+        return 0;
+    }
+    head = (unsigned long long)(st.st_size - 256) / sizeof(ready_record_t);
+    if (!assert_true(pwrite(fd, &head, sizeof(head), 16) == (ssize_t)sizeof(head), "consume every record")) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND, "lost job not claimed") ||
+        !assert_true(jq_reap_expired(root, 0, NULL) == JQ_OK, "reaper runs") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, "lost") == 0,
+                     "reaper put the lost job back on its lane") ||
+        !assert_true(jq_release(root, uuid, state) == JQ_OK, "release recovered job")) {
+        return 0;
+    }
+
+    /* A lane past the compaction threshold is rewritten by a claim that still finds work. */
+    ready_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = 0x4a515252u;
+    record.uuid_len = 5;
+    memcpy(record.uuid, "stale", 5);
+    fd = open(log_path, O_WRONLY | O_APPEND);
+    if (!assert_true(fd >= 0, "open ready log to grow")) {
+        return 0;
+    }
+    for (int i = 0; i < 65536; ++i) {
+        record.seq = (unsigned long long)i + 1000;
+        if (write(fd, &record, sizeof(record)) != (ssize_t)sizeof(record)) {
+            close(fd);
+            return assert_true(0, "grow ready log");
+        }
+    }
+    close(fd);
+    if (!assert_true(create_job_files(root, "after-stale", 0), "create job behind stale records") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, "lost") == 0,
+                     "claim from a large lane") ||
+        !assert_true(stat(log_path, &st) == 0 && st.st_size < 256 * 16, "large lane compacted under load")) {
+        return 0;
+    }
+    return assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                           strcmp(uuid, "after-stale") == 0,
+                       "compacted lane keeps pending jobs");
+}
+
+static int test_claim_fifo_order(void) {
+    char template[] = "/tmp/pap_test_claim_fifo_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for fifo")) {
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "empty fifo root")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "fifo-1", 0), "create fifo job 1") ||
+        !assert_true(create_job_files(root, "fifo-2", 1), "create fifo job 2") ||
+        !assert_true(create_job_files(root, "fifo-3", 0), "create fifo job 3") ||
+        !assert_true(create_job_files(root, "fifo-4", 1), "create fifo job 4")) {
+        return 0;
+    }
+
+    jq_stats_t stats;
+    if (!assert_true(jq_collect_stats(root, &stats) == JQ_OK, "collect fifo stats")) {
+        return 0;
+    }
+    if (!assert_true(stats.oldest_waiting_mtime > 0, "oldest waiting job reported")) {
+        return 0;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.order = JQ_CLAIM_ORDER_FIFO;
+    const char *expected[] = {"fifo-1", "fifo-2", "fifo-3", "fifo-4"};
+    const jq_state_t expected_states[] = {JQ_STATE_JOBS, JQ_STATE_PRIORITY, JQ_STATE_JOBS, JQ_STATE_PRIORITY};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK, "fifo claim")) {
+            return 0;
+        }
+        if (!assert_true(strcmp(uuid, expected[i]) == 0, "fifo claims follow submission order")) {
+            return 0;
+        }
+        if (!assert_true(state == expected_states[i], "fifo claim reports queue")) {
+            return 0;
+        }
+    }
+
+    if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "fifo drained")) {
+        return 0;
+    }
+    if (!assert_true(jq_collect_stats(root, &stats) == JQ_OK, "collect drained fifo stats")) {
+        return 0;
+    }
+    return assert_true(stats.oldest_waiting_mtime == 0 && stats.oldest_waiting_age_seconds == 0,
+                       "no waiting jobs after drain");
+}
+
+static int test_claim_batch(void) {
+    char template[] = "/tmp/pap_test_claim_batch_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for batch")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "batch-1", 0), "create batch job 1") ||
+        !assert_true(create_job_files(root, "batch-2", 1), "create batch job 2") ||
+        !assert_true(create_job_files(root, "batch-3", 0), "create batch job 3") ||
+        !assert_true(create_job_files(root, "batch-4", 1), "create batch job 4") ||
+        !assert_true(create_job_files(root, "batch-5", 0), "create batch job 5")) {
+        return 0;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/jobs/batch-3.metadata.job", root);
+    if (!assert_true(unlink(path) == 0, "remove batch job 3 metadata")) {
+        return 0;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.prefer_priority = 1;
+    char uuids[4][JQ_UUID_MAX];
+    jq_state_t states[4];
+    size_t count = 0;
+    if (!assert_true(jq_claim_batch(root, &options, 3, uuids, states, &count) == JQ_OK, "batch claim")) {
+        return 0;
+    }
+    if (!assert_true(count == 3, "batch claim fills across queues")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(uuids[0], "batch-2") == 0 && states[0] == JQ_STATE_PRIORITY &&
+                         strcmp(uuids[1], "batch-4") == 0 && states[1] == JQ_STATE_PRIORITY &&
+                         strcmp(uuids[2], "batch-1") == 0 && states[2] == JQ_STATE_JOBS,
+                     "batch claim order")) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/priority_jobs/batch-4.pdf.job.lock", root);
+    if (!assert_true(file_exists(path), "batch claim locks pdf")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK, "batch claim rest")) {
+        return 0;
+    }
+    if (!assert_true(count == 1 && strcmp(uuids[0], "batch-5") == 0, "batch claim skips incomplete job")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_ERR_NOT_FOUND && count == 0,
+                     "batch claim drained")) {
+        return 0;
+    }
+    return assert_true(jq_claim_batch(root, &options, 0, uuids, states, &count) == JQ_ERR_INVALID_ARGUMENT,
+                       "batch claim rejects zero");
+}
+
+static int test_claim_wait(void) {
+    char template[] = "/tmp/pap_test_claim_wait_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for claim wait")) {
+        return 0;
+    }
+
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_wait(root, 0, 50, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "claim wait times out on empty queue")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/wait.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/wait.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf") && write_file(metadata_src, "{}"), "write wait sources")) {
+        return 0;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = 200L * 1000 * 1000};
+        nanosleep(&pause, NULL);
+        _exit(jq_submit(root, "job-wait", pdf_src, metadata_src, 1) == JQ_OK ? 0 : 1);
+    }
+    if (!assert_true(child > 0, "fork submitter")) {
+        return 0;
+    }
+    time_t started = time(NULL);
+    jq_result_t result = jq_claim_wait(root, 0, 10000, uuid, sizeof(uuid), &state);
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0, "delayed submit")) {
+        return 0;
+    }
+    if (!assert_true(result == JQ_OK && strcmp(uuid, "job-wait") == 0 && state == JQ_STATE_PRIORITY,
+                     "claim wait picks up new job")) {
+        return 0;
+    }
+    return assert_true(time(NULL) - started < 5, "claim wait wakes before timeout");
+}
+
+static int test_priority_levels(void) {
+    char template[] = "/tmp/pap_test_levels_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for levels")) {
+        return 0;
+    }
+    if (!assert_true(jq_level_state(3) == JQ_STATE_JOBS && jq_level_state(4) == JQ_STATE_PRIORITY,
+                     "levels split across queue directories")) {
+        return 0;
+    }
+
+    if (!assert_true(create_level_job(root, "bulk-0", 0), "create level 0 job") ||
+        !assert_true(create_level_job(root, "sla-3", 3), "create level 3 job") ||
+        !assert_true(create_job_files(root, "legacy", 0), "create legacy job") ||
+        !assert_true(create_level_job(root, "urgent-7", 7), "create level 7 job") ||
+        !assert_true(create_level_job(root, "high-5", 5), "create level 5 job")) {
+        return 0;
+    }
+    if (!assert_true(!create_level_job(root, "bad-level", JQ_LEVEL_COUNT), "reject out of range level")) {
+        return 0;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/priority_jobs/high-5.pdf.job", root);
+    if (!assert_true(file_exists(path), "high level lands in priority directory")) {
+        return 0;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.prefer_priority = 1;
+    char uuids[5][JQ_UUID_MAX];
+    jq_state_t states[5];
+    size_t count = 0;
+    if (!assert_true(jq_claim_batch(root, &options, 5, uuids, states, &count) == JQ_OK && count == 5,
+                     "claim every level")) {
+        return 0;
+    }
+    const char *expected[] = {"urgent-7", "high-5", "sla-3", "legacy", "bulk-0"};
+    for (size_t i = 0; i < count; ++i) {
+        if (!assert_true(strcmp(uuids[i], expected[i]) == 0, "claims follow level order")) {
+            return 0;
+        }
+    }
+
+    jq_lease_t lease;
+    if (!assert_true(jq_lease_info(root, "high-5", &lease) == JQ_OK && lease.level == 5, "lease records level")) {
+        return 0;
+    }
+    if (!assert_true(jq_release(root, "high-5", JQ_STATE_PRIORITY) == JQ_OK &&
+                         jq_release(root, "urgent-7", JQ_STATE_PRIORITY) == JQ_OK,
+                     "release leveled jobs")) {
+        return 0;
+    }
+
+    /* A torn lane is rebuilt without moving the jobs still pending in its siblings. */
+    snprintf(path, sizeof(path), "%s/.jq/priority_jobs.%d.ready", root, JQ_LEVEL_HIGH);
+    if (!assert_true(write_file(path, "garbage"), "corrupt default priority lane")) {
+        return 0;
+    }
+    if (!assert_true(create_job_files(root, "legacy-high", 1), "create legacy priority job")) {
+        return 0;
+    }
+    const char *requeued[] = {"urgent-7", "legacy-high", "high-5"};
+    for (size_t i = 0; i < sizeof(requeued) / sizeof(requeued[0]); ++i) {
+        char uuid[JQ_UUID_MAX];
+        jq_state_t state = JQ_STATE_JOBS;
+        if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK, "claim requeued job")) {
+            return 0;
+        }
+        if (!assert_true(strcmp(uuid, requeued[i]) == 0, "rebuild keeps levels")) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int test_claim_weighted(void) {
+    char template[] = "/tmp/pap_test_weighted_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for weighted")) {
+        return 0;
+    }
+    for (int i = 0; i < 4; ++i) {
+        char uuid[32];
+        snprintf(uuid, sizeof(uuid), "urgent-%d", i);
+        if (!assert_true(create_level_job(root, uuid, 7), "create urgent job")) {
+            return 0;
+        }
+        snprintf(uuid, sizeof(uuid), "bulk-%d", i);
+        if (!assert_true(create_level_job(root, uuid, 0), "create bulk job")) {
+            return 0;
+        }
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.order = JQ_CLAIM_ORDER_WEIGHTED;
+    char uuids[8][JQ_UUID_MAX];
+    jq_state_t states[8];
+    size_t count = 0;
+    memset(options.weights, 0, sizeof(options.weights));
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_ERR_INVALID_ARGUMENT,
+                     "weighted claim rejects empty weights")) {
+        return 0;
+    }
+    options.weights[7] = JQ_LEVEL_WEIGHT_MAX + 1;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_ERR_INVALID_ARGUMENT,
+                     "weighted claim rejects oversized weight")) {
+        return 0;
+    }
+
+    /* One cycle of 1:3 weights serves the bulk level once despite urgent work waiting. */
+    options.weights[0] = 1;
+    options.weights[7] = 3;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 4,
+                     "weighted claim cycle")) {
+        return 0;
+    }
+    size_t bulk = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bulk += states[i] == JQ_STATE_JOBS;
+    }
+    if (!assert_true(bulk == 1, "weighted claim does not starve bulk level")) {
+        return 0;
+    }
+
+    /* Empty levels fall through to whatever is still waiting. */
+    if (!assert_true(jq_claim_batch(root, &options, 8, uuids, states, &count) == JQ_OK && count == 4,
+                     "weighted claim drains remaining jobs")) {
+        return 0;
+    }
+    return assert_true(jq_claim_batch(root, &options, 1, uuids, states, &count) == JQ_ERR_NOT_FOUND,
+                       "weighted claim drained");
+}
+
+static int create_sized_job(const char *root, const char *uuid, off_t pdf_bytes) {
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/%s.pdf", root, uuid);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/%s.metadata", root, uuid);
+    if (!write_file(pdf_src, "pdf data") || truncate(pdf_src, pdf_bytes) != 0 || !write_file(metadata_src, "metadata")) {
+        return 0;
+    }
+    return jq_submit(root, uuid, pdf_src, metadata_src, 0) == JQ_OK;
+}
+
+static int test_claim_by_size(void) {
+    char template[] = "/tmp/pap_test_claim_size_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for size claims")) {
+        return 0;
+    }
+    /* A burst of large files ahead of small ones: 2 MiB and 20 MiB land in the second and third classes. */
+    const char *large[] = {"size-large-1", "size-large-2", "size-large-3"};
+    const char *small[] = {"size-small-1", "size-small-2", "size-small-3"};
+    for (size_t i = 0; i < 3; ++i) {
+        if (!assert_true(create_sized_job(root, large[i], (off_t)2 << 20), "create large job")) {
+            return 0;
+        }
+    }
+    if (!assert_true(create_sized_job(root, "size-huge", (off_t)20 << 20), "create huge job")) {
+        return 0;
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        if (!assert_true(create_sized_job(root, small[i], 64), "create small job")) {
+            return 0;
+        }
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.size = JQ_CLAIM_SIZE_SMALLEST_FIRST;
+    options.order = JQ_CLAIM_ORDER_FIFO;
+    char uuids[4][JQ_UUID_MAX];
+    jq_state_t states[4];
+    size_t count = 0;
+    if (!assert_true(jq_claim_batch(root, &options, 1, uuids, states, &count) == JQ_ERR_INVALID_ARGUMENT,
+                     "size order needs priority order")) {
+        return 0;
+    }
+
+    /* Round-robin: four consecutive tickets start at each class once; the empty top class passes its turn on. */
+    options.order = JQ_CLAIM_ORDER_PRIORITY;
+    options.size = JQ_CLAIM_SIZE_ROUND_ROBIN;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 4,
+                     "round-robin claims four")) {
+        return 0;
+    }
+    size_t small_claimed = 0;
+    size_t huge_claimed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        small_claimed += strncmp(uuids[i], "size-small-", 11) == 0;
+        huge_claimed += strcmp(uuids[i], "size-huge") == 0;
+    }
+    if (!assert_true(small_claimed == 2 && huge_claimed == 1, "every class gets a turn")) {
+        return 0;
+    }
+
+    /* A 1 MiB cap takes the last small job and leaves the large ones alone. */
+    options.size = JQ_CLAIM_SIZE_ANY;
+    options.max_bytes = 1 << 20;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 1 &&
+                         strncmp(uuids[0], "size-small-", 11) == 0,
+                     "cap takes small job") ||
+        !assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_ERR_NOT_FOUND,
+                     "cap skips large jobs")) {
+        return 0;
+    }
+    options.size = JQ_CLAIM_SIZE_SMALLEST_FIRST;
+    options.max_bytes = 4 << 20;
+    if (!assert_true(jq_claim_batch(root, &options, 1, uuids, states, &count) == JQ_OK && count == 1,
+                     "cap takes fitting job") ||
+        !assert_true(strncmp(uuids[0], "size-large-", 11) == 0, "capped claim is a large job")) {
+        return 0;
+    }
+
+    /* Plain claims skip what the size lanes handed out. */
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strncmp(uuid, "size-large-", 11) == 0,
+                     "plain claim finds the last large job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND, "queue drained")) {
+        return 0;
+    }
+
+    /* Lanes lost with an older root are rebuilt from the directory on the next size-aware claim. */
+    if (!assert_true(create_sized_job(root, "size-late", 64), "create late job")) {
+        return 0;
+    }
+    char lane[PATH_MAX];
+    snprintf(lane, sizeof(lane), "%s/.jq/jobs.%d.s0.ready", root, JQ_LEVEL_NORMAL);
+    if (!assert_true(unlink(lane) == 0, "remove small lane")) {
+        return 0;
+    }
+    options.max_bytes = 0;
+    return assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 1 &&
+                           strcmp(uuids[0], "size-late") == 0,
+                       "size lanes rebuilt");
+}
+
+static int test_claim_by_size_tenants(void) {
+    char template[] = "/tmp/pap_test_claim_size_tenants_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for sized tenant claims")) {
+        return 0;
+    }
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/big.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/big.metadata", root);
+    jq_submit_options_t submit;
+    jq_submit_options_init(&submit);
+    submit.tenant = "acme";
+    if (!assert_true(create_tenant_job(root, "tenant-small", "acme"), "create small tenant job") ||
+        !assert_true(write_file(pdf_src, "pdf data") && truncate(pdf_src, 2 << 20) == 0 &&
+                         write_file(metadata_src, "metadata") &&
+                         jq_submit_with_options(root, "tenant-big", pdf_src, metadata_src, &submit) == JQ_OK,
+                     "create large tenant job") ||
+        !assert_true(create_sized_job(root, "plain-small", 64), "create small untagged job")) {
+        return 0;
+    }
+
+    /* Capped workers take tenant jobs too, once the untagged classes are empty, but never one over the cap. */
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.max_bytes = 1024;
+    char uuids[4][JQ_UUID_MAX];
+    jq_state_t states[4];
+    size_t count = 0;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 2 &&
+                         strcmp(uuids[0], "plain-small") == 0 && strcmp(uuids[1], "tenant-small") == 0,
+                     "byte cap reaches tenant lanes")) {
+        return 0;
+    }
+    options.max_bytes = 0;
+    options.size = JQ_CLAIM_SIZE_SMALLEST_FIRST;
+    if (!assert_true(jq_claim_batch(root, &options, 4, uuids, states, &count) == JQ_OK && count == 1 &&
+                         strcmp(uuids[0], "tenant-big") == 0,
+                     "uncapped sized claim takes the large tenant job")) {
+        return 0;
+    }
+
+    /* A job whose name is too long for a record is still found by sized claims. */
+    char long_uuid[231];
+    memset(long_uuid, 'u', sizeof(long_uuid) - 1);
+    long_uuid[sizeof(long_uuid) - 1] = '\0';
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    snprintf(pdf_path, sizeof(pdf_path), "%s/jobs/%s.pdf.job", root, long_uuid);
+    snprintf(metadata_path, sizeof(metadata_path), "%s/jobs/%s.metadata.job", root, long_uuid);
+    if (!assert_true(write_file(pdf_path, "pdf data") && write_file(metadata_path, "metadata") &&
+                         jq_init(root) == JQ_OK,
+                     "place unindexed job")) {
+        return 0;
+    }
+    char uuid[256];
+    jq_state_t state = JQ_STATE_ERROR;
+    return assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK &&
+                           strcmp(uuid, long_uuid) == 0 && state == JQ_STATE_JOBS,
+                       "sized claim falls back to unindexed jobs");
+}
+
+static int test_tenant_fair_share(void) {
+    char template[] = "/tmp/pap_test_tenants_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for tenants")) {
+        return 0;
+    }
+    if (!assert_true(!create_tenant_job(root, "bad-tenant", "../x"), "submit rejects invalid tenant")) {
+        return 0;
+    }
+    /* The bulk tenant queues everything first; the small one must not wait behind it. */
+    for (int i = 0; i < 6; ++i) {
+        char uuid[32];
+        snprintf(uuid, sizeof(uuid), "bulk-%d", i);
+        if (!assert_true(create_tenant_job(root, uuid, "bulk"), "create bulk tenant job")) {
+            return 0;
+        }
+    }
+    if (!assert_true(create_tenant_job(root, "small-0", "small") && create_tenant_job(root, "small-1", "small"),
+                     "create small tenant jobs")) {
+        return 0;
+    }
+
+    jq_stats_t stats;
+    const jq_tenant_stats_t *bulk = NULL;
+    const jq_tenant_stats_t *small = NULL;
+    if (!assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.tenant_count == 2 &&
+                         (bulk = find_tenant(&stats, "bulk")) != NULL && bulk->depth == 6 && bulk->in_flight == 0 &&
+                         (small = find_tenant(&stats, "small")) != NULL && small->depth == 2,
+                     "tenant depth in stats")) {
+        return 0;
+    }
+
+    char uuids[4][JQ_UUID_MAX];
+    jq_state_t state;
+    size_t small_claims = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (!assert_true(jq_claim_next(root, 0, uuids[i], sizeof(uuids[i]), &state) == JQ_OK,
+                         "claim tenant job")) {
+            return 0;
+        }
+        small_claims += strncmp(uuids[i], "small-", 6) == 0;
+    }
+    if (!assert_true(small_claims == 2, "round-robin serves the small tenant early")) {
+        return 0;
+    }
+
+    /* bulk has two jobs in flight: a cap of two holds the rest back until one finishes. */
+    if (!assert_true(jq_tenant_configure(root, "bulk", 2, 1) == JQ_OK &&
+                         jq_tenant_configure(root, "bulk", 2, 0) == JQ_ERR_INVALID_ARGUMENT,
+                     "configure tenant cap")) {
+        return 0;
+    }
+    char uuid[JQ_UUID_MAX];
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "capped tenant is not claimed")) {
+        return 0;
+    }
+    const char *finished = strncmp(uuids[0], "bulk-", 5) == 0 ? uuids[0] : uuids[1];
+    if (!assert_true(jq_finalize(root, finished, JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK &&
+                         jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strncmp(uuid, "bulk-", 5) == 0,
+                     "finishing a job frees a slot under the cap")) {
+        return 0;
+    }
+    if (!assert_true(jq_release(root, uuid, state) == JQ_OK && jq_read_stats(root, &stats) == JQ_OK &&
+                         (bulk = find_tenant(&stats, "bulk")) != NULL && bulk->depth == 4 &&
+                         bulk->in_flight == 1 && bulk->max_in_flight == 2,
+                     "released job returns to its tenant lane")) {
+        return 0;
+    }
+
+    /* A queued job moved to the other queue stays in its tenant's lanes there. */
+    char candidate[32];
+    const char *moved = NULL;
+    for (int i = 0; i < 6 && !moved; ++i) {
+        int locked = 1;
+        snprintf(candidate, sizeof(candidate), "bulk-%d", i);
+        if (jq_status(root, candidate, &state, &locked) == JQ_OK && state == JQ_STATE_JOBS && !locked) {
+            moved = candidate;
+        }
+    }
+    char tenant_lane[PATH_MAX];
+    snprintf(tenant_lane, sizeof(tenant_lane), "%s/.jq/priority_jobs.%d.t1.ready", root, JQ_LEVEL_HIGH);
+    if (!assert_true(moved && jq_move(root, moved, JQ_STATE_JOBS, JQ_STATE_PRIORITY) == JQ_OK &&
+                         file_exists(tenant_lane),
+                     "moved job keeps its tenant lane")) {
+        return 0;
+    }
+
+    /* FIFO claims still reach tenant jobs once the untagged lanes are empty. */
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.order = JQ_CLAIM_ORDER_FIFO;
+    if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strncmp(uuid, "bulk-", 5) == 0,
+                     "fifo claim reaches tenant lanes")) {
+        return 0;
+    }
+
+    /* A reconcile recounts in-flight jobs from the leases. */
+    if (!assert_true(jq_collect_stats(root, &stats) == JQ_OK && (bulk = find_tenant(&stats, "bulk")) != NULL &&
+                         bulk->in_flight == 2 && (small = find_tenant(&stats, "small")) != NULL &&
+                         small->in_flight == 2 && small->depth == 0,
+                     "reconcile tenant in-flight counts")) {
+        return 0;
+    }
+
+    /* Untagged jobs are one more lane in the rotation, so a FIFO or sized claim cannot starve a tenant. */
+    for (int i = 0; i < 4; ++i) {
+        char untagged[32];
+        snprintf(untagged, sizeof(untagged), "untagged-%d", i);
+        if (!assert_true(create_job_files(root, untagged, 0), "create untagged job")) {
+            return 0;
+        }
+    }
+    if (!assert_true(create_tenant_job(root, "small-2", "small") && create_tenant_job(root, "small-3", "small"),
+                     "create late tenant jobs")) {
+        return 0;
+    }
+    int small_seen = 0;
+    for (int i = 0; i < 2; ++i) {
+        small_seen |= jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, "small-2") == 0;
+    }
+    if (!assert_true(small_seen, "fifo claim rotates past untagged jobs")) {
+        return 0;
+    }
+    jq_claim_options_init(&options);
+    options.size = JQ_CLAIM_SIZE_SMALLEST_FIRST;
+    small_seen = 0;
+    for (int i = 0; i < 2; ++i) {
+        small_seen |= jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, "small-3") == 0;
+    }
+    return assert_true(small_seen, "sized claim rotates past untagged jobs");
+}
+
+static int test_job_dir_layout(void) {
+    char template[] = "/tmp/pap_test_job_dirs_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char uuid[64];
+    jq_state_t state;
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for job dirs") ||
+        !assert_true(create_job_files(root, "loose-claimed", 0), "create claimed loose job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim loose job") ||
+        !assert_true(create_job_files(root, "loose-queued", 0), "create queued loose job")) {
+        return 0;
+    }
+
+    /* Claimed jobs stay loose until they are finalized. */
+    size_t moved = 0;
+    size_t remaining = 0;
+    jq_layout_t layout = JQ_LAYOUT_FLAT;
+    if (!assert_true(jq_migrate_job_dirs(root, &moved, &remaining) == JQ_OK, "migrate to job dirs") ||
+        !assert_true(moved == 2 && remaining == 2, "queued job moved, claimed job left") ||
+        !assert_true(jq_read_layout(root, &layout) == JQ_OK && layout == JQ_LAYOUT_DIRECTORY_MIGRATING,
+                     "layout reads directories-migrating")) {
+        return 0;
+    }
+
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    int locked = 0;
+    if (!assert_true(jq_job_paths(root, "loose-queued", JQ_STATE_JOBS, pdf_path, sizeof(pdf_path), metadata_path,
+                                  sizeof(metadata_path)) == JQ_OK &&
+                         strstr(pdf_path, "/loose-queued/loose-queued.pdf.job") && file_exists(pdf_path) &&
+                         file_exists(metadata_path),
+                     "queued job has a directory") ||
+        !assert_true(jq_status(root, "loose-claimed", &state, &locked) == JQ_OK && locked,
+                     "loose claimed job still found") ||
+        !assert_true(jq_finalize(root, "loose-claimed", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finalize loose job during migration") ||
+        !assert_true(jq_job_paths(root, "loose-claimed", JQ_STATE_COMPLETE, pdf_path, sizeof(pdf_path),
+                                  metadata_path, sizeof(metadata_path)) == JQ_OK &&
+                         strstr(pdf_path, "/loose-claimed/") && file_exists(pdf_path) && file_exists(metadata_path),
+                     "finalize moves loose job into a directory") ||
+        !assert_true(jq_migrate_job_dirs(root, &moved, &remaining) == JQ_OK && remaining == 0,
+                     "second migration pass finishes") ||
+        !assert_true(jq_read_layout(root, &layout) == JQ_OK && layout == JQ_LAYOUT_DIRECTORY,
+                     "layout reads directories")) {
+        return 0;
+    }
+
+    /* Claim and finalize rename the whole directory, report included. */
+    char report_path[PATH_MAX];
+    if (!assert_true(create_job_files(root, "fresh", 1), "submit into job dir layout") ||
+        !assert_true(jq_claim_next(root, 1, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, "fresh") == 0,
+                     "claim job dir") ||
+        !assert_true(jq_job_paths_locked(root, "fresh", JQ_STATE_PRIORITY, pdf_path, sizeof(pdf_path),
+                                         metadata_path, sizeof(metadata_path)) == JQ_OK &&
+                         strstr(pdf_path, "/fresh.lock/fresh.pdf.job") && file_exists(pdf_path),
+                     "claimed job dir carries the lock") ||
+        !assert_true(jq_job_report_paths_locked(root, "fresh", JQ_STATE_PRIORITY, report_path,
+                                                sizeof(report_path)) == JQ_OK &&
+                         write_report_file(report_path),
+                     "worker writes report in claimed dir") ||
+        !assert_true(jq_finalize(root, "fresh", JQ_STATE_PRIORITY, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finalize job dir") ||
+        !assert_true(!file_exists(pdf_path), "claimed dir renamed away") ||
+        !assert_true(jq_job_report_paths(root, "fresh", JQ_STATE_COMPLETE, report_path, sizeof(report_path)) ==
+                             JQ_OK &&
+                         file_exists(report_path),
+                     "report moved with its directory") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "loose-queued") == 0,
+                     "claim migrated job")) {
+        return 0;
+    }
+
+    jq_stats_t stats;
+    return assert_true(jq_collect_stats(root, &stats) == JQ_OK, "collect stats over job dirs") &&
+           assert_true(stats.states[JQ_STATE_COMPLETE].pdf_jobs == 2 &&
+                           stats.states[JQ_STATE_COMPLETE].report_jobs == 1 &&
+                           stats.states[JQ_STATE_JOBS].pdf_locked == 1 &&
+                           stats.states[JQ_STATE_JOBS].metadata_locked == 1 && stats.total_orphans == 0,
+                       "stats count files inside job dirs");
+}
+
+static int test_sharded_layout_migration(void) {
+    char template[] = "/tmp/pap_test_shards_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    jq_layout_t layout = JQ_LAYOUT_SHARDED;
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for shards") ||
+        !assert_true(jq_read_layout(root, &layout) == JQ_OK && layout == JQ_LAYOUT_FLAT, "new root is flat")) {
+        return 0;
+    }
+    const char *uuids[] = {"shard-a", "shard-b", "shard-c"};
+    for (size_t i = 0; i < 3; ++i) {
+        if (!assert_true(create_job_files(root, uuids[i], 0), "create flat job")) {
+            return 0;
+        }
+    }
+
+    char claimed[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, claimed, sizeof(claimed), &state) == JQ_OK, "claim flat job")) {
+        return 0;
+    }
+
+    /* The claimed pair stays flat until its worker finishes with it. */
+    size_t moved = 0;
+    size_t remaining = 0;
+    if (!assert_true(jq_migrate_layout(root, &moved, &remaining) == JQ_OK && moved == 4 && remaining == 2,
+                     "migration moves unclaimed jobs") ||
+        !assert_true(jq_read_layout(root, &layout) == JQ_OK && layout == JQ_LAYOUT_MIGRATING,
+                     "claimed job keeps root migrating")) {
+        return 0;
+    }
+
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    char flat_path[PATH_MAX];
+    const char *waiting = strcmp(claimed, uuids[0]) == 0 ? uuids[1] : uuids[0];
+    snprintf(flat_path, sizeof(flat_path), "%s/jobs/%s.pdf.job", root, waiting);
+    if (!assert_true(jq_job_paths(root, waiting, JQ_STATE_JOBS, pdf_path, sizeof(pdf_path),
+                                  metadata_path, sizeof(metadata_path)) == JQ_OK, "sharded job paths") ||
+        !assert_true(strcmp(pdf_path, flat_path) != 0 && file_exists(pdf_path) && file_exists(metadata_path),
+                     "job moved into its shard") ||
+        !assert_true(!file_exists(flat_path), "flat copy removed")) {
+        return 0;
+    }
+
+    int locked = 0;
+    if (!assert_true(jq_status(root, claimed, &state, &locked) == JQ_OK && state == JQ_STATE_JOBS && locked,
+                     "status finds flat claimed job") ||
+        !assert_true(jq_status(root, waiting, &state, &locked) == JQ_OK && !locked, "status finds sharded job")) {
+        return 0;
+    }
+
+    char second[JQ_UUID_MAX];
+    if (!assert_true(jq_claim_next(root, 0, second, sizeof(second), &state) == JQ_OK, "claim sharded job") ||
+        !assert_true(jq_finalize(root, claimed, JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finalize flat claimed job") ||
+        !assert_true(jq_finalize(root, second, JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finalize sharded job")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_migrate_layout(root, &moved, &remaining) == JQ_OK && moved == 0 && remaining == 0,
+                     "second pass finds nothing flat") ||
+        !assert_true(jq_read_layout(root, &layout) == JQ_OK && layout == JQ_LAYOUT_SHARDED, "root sharded")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "shard-d", 1), "submit into sharded root") ||
+        !assert_true(jq_job_paths(root, "shard-d", JQ_STATE_PRIORITY, pdf_path, sizeof(pdf_path),
+                                  metadata_path, sizeof(metadata_path)) == JQ_OK &&
+                     file_exists(pdf_path) && file_exists(metadata_path), "new job lands in its shard")) {
+        return 0;
+    }
+
+    jq_stats_t stats;
+    return assert_true(jq_collect_stats(root, &stats) == JQ_OK, "stats on sharded root") &&
+           assert_true(stats.states[JQ_STATE_JOBS].pdf_jobs == 1 &&
+                       stats.states[JQ_STATE_PRIORITY].pdf_jobs == 1 &&
+                       stats.states[JQ_STATE_COMPLETE].pdf_jobs == 2 &&
+                       stats.total_orphans == 0, "stats scan shard directories");
+}
+
+static int test_retry_checks(void) {
+    char template[] = "/tmp/pap_test_retry_checks_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for retry checks")) {
+        return 0;
+    }
+    if (!assert_true(create_job_files(root, "checked-job", 0), "create checked job")) {
+        return 0;
+    }
+
+    jq_retry_options_t retry;
+    jq_retry_options_init(&retry);
+    if (!assert_true(jq_retry(root, "checked-job", JQ_STATE_JOBS, &retry, NULL, NULL) == JQ_ERR_NOT_FOUND,
+                     "retry without a claim refused")) {
+        return 0;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.owner = "worker-a";
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK, "claim checked job")) {
+        return 0;
+    }
+    if (!assert_true(jq_retry(root, uuid, state, &retry, NULL, NULL) == JQ_ERR_NOT_FOUND,
+                     "retry by another owner refused")) {
+        return 0;
+    }
+    retry.owner = "worker-a";
+    if (!assert_true(jq_retry(root, uuid, JQ_STATE_PRIORITY, &retry, NULL, NULL) == JQ_ERR_NOT_FOUND,
+                     "retry in the wrong state refused")) {
+        return 0;
+    }
+
+    /* No attempt limit means the default one, not dead-lettering on the first failure. */
+    retry.max_attempts = 0;
+    unsigned int attempts = 0;
+    time_t not_before = 0;
+    if (!assert_true(jq_retry(root, uuid, state, &retry, &attempts, &not_before) == JQ_OK && attempts == 1 &&
+                         not_before != 0,
+                     "zero max_attempts backs off")) {
+        return 0;
+    }
+    return assert_true(jq_retry(root, uuid, state, &retry, NULL, NULL) == JQ_ERR_NOT_FOUND,
+                       "backing-off job cannot be retried again");
+}
+
+static int test_retry_backoff(void) {
+    char template[] = "/tmp/pap_test_retry_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for retry")) {
+        return 0;
+    }
+    if (!assert_true(create_job_files(root, "retry-job", 0), "create retry job")) {
+        return 0;
+    }
+
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim retry job")) {
+        return 0;
+    }
+
+    jq_retry_options_t retry;
+    jq_retry_options_init(&retry);
+    retry.max_attempts = 3;
+    retry.base_delay_seconds = 1;
+    unsigned int attempts = 0;
+    time_t not_before = 0;
+    time_t now = time(NULL);
+    if (!assert_true(jq_retry(root, "retry-job", state, &retry, &attempts, &not_before) == JQ_OK &&
+                         attempts == 1 && not_before >= now + 1 && not_before <= now + 3,
+                     "first failure backs off")) {
+        return 0;
+    }
+    jq_lease_t lease;
+    if (!assert_true(jq_lease_info(root, "retry-job", &lease) == JQ_OK && strcmp(lease.owner, "jq-retry") == 0,
+                     "backing-off job parked under retry lease")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "job invisible before not_before")) {
+        return 0;
+    }
+    if (!assert_true(jq_claim_wait(root, 0, 5000, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "retry-job") == 0 && time(NULL) >= not_before,
+                     "job claimable once due")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_retry(root, "retry-job", state, &retry, &attempts, &not_before) == JQ_OK &&
+                         attempts == 2 && not_before != 0,
+                     "second failure backs off")) {
+        return 0;
+    }
+    if (!assert_true(jq_reap_expired(root, not_before + 1, NULL) == JQ_OK &&
+                         jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK,
+                     "reaper releases due job without the wheel")) {
+        return 0;
+    }
+    if (!assert_true(jq_attempts(root, "retry-job", &attempts) == JQ_OK && attempts == 2,
+                     "retry lease expiry is not an attempt")) {
+        return 0;
+    }
+    if (!assert_true(jq_retry(root, "retry-job", state, &retry, &attempts, &not_before) == JQ_OK &&
+                         attempts == 3 && not_before == 0,
+                     "last attempt dead-letters")) {
+        return 0;
+    }
+    int locked = 0;
+    if (!assert_true(jq_status(root, "retry-job", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR && !locked,
+                     "dead-lettered job in error")) {
+        return 0;
+    }
+    if (!assert_true(jq_attempts(root, "retry-job", &attempts) == JQ_OK && attempts == 0,
+                     "attempts cleared when finalized")) {
+        return 0;
+    }
+
+    /* A worker that dies holding a job also costs an attempt. */
+    if (!assert_true(create_job_files(root, "crash-job", 0), "create crash job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim crash job")) {
+        return 0;
+    }
+    size_t requeued = 0;
+    if (!assert_true(jq_reap_expired(root, time(NULL) + JQ_LEASE_DEFAULT_SECONDS + 1, &requeued) == JQ_OK &&
+                         requeued == 1,
+                     "expired worker lease requeued")) {
+        return 0;
+    }
+    if (!assert_true(jq_attempts(root, "crash-job", &attempts) == JQ_OK && attempts == 1,
+                     "expired worker lease counts an attempt")) {
+        return 0;
+    }
+
+    /* The reaper judges a crash by the claimer's limit, and keeps it for later claims that name none. */
+    jq_claim_options_t claim_options;
+    jq_claim_options_init(&claim_options);
+    claim_options.max_attempts = 3;
+    if (!assert_true(jq_claim(root, &claim_options, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "crash-job") == 0,
+                     "claim crash job with a limit") ||
+        !assert_true(jq_reap_expired(root, time(NULL) + JQ_LEASE_DEFAULT_SECONDS + 1, &requeued) == JQ_OK &&
+                         requeued == 1 && jq_attempts(root, "crash-job", &attempts) == JQ_OK && attempts == 2,
+                     "second crash under a limit of three requeues") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim crash job again") ||
+        !assert_true(jq_reap_expired(root, time(NULL) + JQ_LEASE_DEFAULT_SECONDS + 1, &requeued) == JQ_OK &&
+                         requeued == 0,
+                     "recorded limit dead-letters the crash")) {
+        return 0;
+    }
+    return assert_true(jq_status(root, "crash-job", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR,
+                       "crash job dead-lettered");
+}
+
+static int test_cancel(void) {
+    char template[] = "/tmp/pap_test_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for cancel")) {
+        return 0;
+    }
+    if (!assert_true(jq_cancel(root, NULL) == JQ_ERR_INVALID_ARGUMENT, "cancel rejects null uuid") ||
+        !assert_true(jq_cancel(root, "missing-job") == JQ_ERR_NOT_FOUND, "cancel unknown job")) {
+        return 0;
+    }
+
+    /* A waiting job is gone at once, and its stale ready record is skipped. */
+    if (!assert_true(create_job_files(root, "cancel-queued", 0), "create queued job")) {
+        return 0;
+    }
+    jq_state_t state = JQ_STATE_JOBS;
+    int locked = 0;
+    char uuid[JQ_UUID_MAX];
+    jq_stats_t stats;
+    if (!assert_true(jq_cancel(root, "cancel-queued") == JQ_OK, "cancel queued job") ||
+        !assert_true(jq_status(root, "cancel-queued", &state, &locked) == JQ_ERR_NOT_FOUND, "queued job removed") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "cancelled job not claimable") ||
+        !assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.total_jobs == 0 && stats.total_locked == 0,
+                     "stats drop cancelled job")) {
+        return 0;
+    }
+
+    /* A running job only gets the flag; the worker's release then deletes it. */
+    if (!assert_true(create_job_files(root, "cancel-running", 0), "create running job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim running job")) {
+        return 0;
+    }
+    jq_cancel_watch_t *watch = jq_cancel_watch(root, "cancel-running");
+    if (!assert_true(watch != NULL && !jq_cancel_requested(watch), "watch starts clear")) {
+        return 0;
+    }
+    jq_lease_t lease;
+    int flagged = jq_cancel(root, "cancel-running") == JQ_OK && jq_cancel_requested(watch) &&
+                  jq_lease_info(root, "cancel-running", &lease) == JQ_OK && lease.cancelled;
+    jq_cancel_unwatch(watch);
+    if (!assert_true(flagged, "cancel flags running job") ||
+        !assert_true(jq_status(root, "cancel-running", &state, &locked) == JQ_OK && locked,
+                     "running job kept until worker stops") ||
+        !assert_true(jq_release(root, "cancel-running", state) == JQ_OK, "worker hands back cancelled job") ||
+        !assert_true(jq_status(root, "cancel-running", &state, &locked) == JQ_ERR_NOT_FOUND,
+                     "released cancelled job removed") ||
+        !assert_true(jq_lease_info(root, "cancel-running", &lease) == JQ_ERR_NOT_FOUND, "lease removed") ||
+        !assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.total_jobs == 0 && stats.total_locked == 0,
+                     "stats drop released cancelled job")) {
+        return 0;
+    }
+
+    /* A job backing off has no worker, so it goes at once too. */
+    if (!assert_true(create_job_files(root, "cancel-backoff", 0), "create backoff job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim backoff job") ||
+        !assert_true(jq_retry(root, "cancel-backoff", state, NULL, NULL, NULL) == JQ_OK, "park backoff job") ||
+        !assert_true(jq_cancel(root, "cancel-backoff") == JQ_OK, "cancel backoff job") ||
+        !assert_true(jq_status(root, "cancel-backoff", &state, &locked) == JQ_ERR_NOT_FOUND,
+                     "backoff job removed") ||
+        !assert_true(jq_reap_expired(root, time(NULL) + 7200, NULL) == JQ_OK &&
+                         jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "delay wheel skips removed backoff job")) {
+        return 0;
+    }
+    unsigned int attempts = 1;
+    if (!assert_true(jq_attempts(root, "cancel-backoff", &attempts) == JQ_OK && attempts == 0,
+                     "attempts cleared for removed job")) {
+        return 0;
+    }
+
+    /* Finished jobs cannot be cancelled. */
+    if (!assert_true(create_job_files(root, "cancel-done", 0), "create finished job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim finished job") ||
+        !assert_true(jq_finalize(root, "cancel-done", state, JQ_STATE_COMPLETE) == JQ_OK, "finish job")) {
+        return 0;
+    }
+    return assert_true(jq_cancel(root, "cancel-done") == JQ_ERR_NOT_FOUND, "cancel finished job");
+}
+
+static int test_progress(void) {
+    char template[] = "/tmp/pap_test_progress_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for progress")) {
+        return 0;
+    }
+    jq_progress_t progress;
+    if (!assert_true(jq_status_progress(root, NULL, &progress) == JQ_ERR_INVALID_ARGUMENT,
+                     "progress rejects null uuid") ||
+        !assert_true(jq_progress_begin(root, "missing-job", "analyze", 100) == NULL, "no slot without a lease") ||
+        !assert_true(jq_status_progress(root, "missing-job", &progress) == JQ_ERR_NOT_FOUND,
+                     "no progress without a lease")) {
+        return 0;
+    }
+
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(create_job_files(root, "progress-job", 0), "create progress job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim progress job") ||
+        !assert_true(jq_status_progress(root, uuid, &progress) == JQ_ERR_NOT_FOUND, "no progress before a phase")) {
+        return 0;
+    }
+
+    jq_progress_slot_t *slot = jq_progress_begin(root, uuid, "analyze", 1000);
+    if (!assert_true(slot != NULL, "progress slot opens")) {
+        return 0;
+    }
+    jq_progress_update(slot, 250);
+    int read_back = jq_status_progress(root, uuid, &progress) == JQ_OK;
+    jq_progress_end(slot);
+    if (!assert_true(read_back && strcmp(progress.phase, "analyze") == 0, "progress phase reported") ||
+        !assert_true(progress.bytes_done == 250 && progress.bytes_total == 1000, "progress bytes reported") ||
+        !assert_true(progress.started_at > 0 && progress.started_at <= time(NULL), "progress start reported") ||
+        !assert_true(progress.bytes_per_second == 0 ? progress.eta_seconds == -1 : progress.eta_seconds >= 0,
+                     "eta follows throughput")) {
+        return 0;
+    }
+
+    /* Heartbeats rewrite the lease in place and leave the slot alone. */
+    jq_lease_t lease;
+    if (!assert_true(jq_heartbeat(root, uuid, state, NULL) == JQ_OK, "heartbeat progress job") ||
+        !assert_true(jq_lease_info(root, uuid, &lease) == JQ_OK, "lease still readable") ||
+        !assert_true(jq_status_progress(root, uuid, &progress) == JQ_OK && progress.bytes_done == 250,
+                     "progress survives heartbeat")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) == JQ_OK, "finish progress job")) {
+        return 0;
+    }
+    return assert_true(jq_status_progress(root, uuid, &progress) == JQ_ERR_NOT_FOUND, "progress gone with lease");
+}
+
+static int test_events(void) {
+    char template[] = "/tmp/pap_test_events_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for events")) {
+        return 0;
+    }
+    jq_event_t events[8];
+    size_t count = 1;
+    unsigned long long next = 99;
+    if (!assert_true(jq_events_read(root, 0, NULL, 8, &count, &next) == JQ_ERR_INVALID_ARGUMENT,
+                     "events reject null output") ||
+        !assert_true(jq_events_read(root, 0, events, 8, &count, &next) == JQ_OK && count == 0 && next == 0,
+                     "empty log reads nothing")) {
+        return 0;
+    }
+
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(create_job_files(root, "event-done", 0), "create finished event job") ||
+        !assert_true(create_job_files(root, "event-gone", 0), "create cancelled event job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "event-done") == 0,
+                     "claim event job") ||
+        !assert_true(jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) == JQ_OK, "finish event job") ||
+        !assert_true(jq_cancel(root, "event-gone") == JQ_OK, "cancel event job")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_events_read(root, 0, events, 8, &count, &next) == JQ_OK && count == 5 && next == 5,
+                     "every transition logged")) {
+        return 0;
+    }
+    const jq_event_kind_t kinds[] = {JQ_EVENT_SUBMIT, JQ_EVENT_SUBMIT, JQ_EVENT_CLAIM, JQ_EVENT_FINALIZE,
+                                     JQ_EVENT_CANCEL};
+    const char *uuids[] = {"event-done", "event-gone", "event-done", "event-done", "event-gone"};
+    for (size_t i = 0; i < count; ++i) {
+        if (!assert_true(events[i].cursor == i && events[i].kind == kinds[i] && strcmp(events[i].uuid, uuids[i]) == 0,
+                         "events in transition order") ||
+            !assert_true(events[i].bytes == 16 && events[i].at_ms > 0, "event carries bytes and time")) {
+            return 0;
+        }
+    }
+    if (!assert_true(events[0].from_state == -1 && events[0].to_state == JQ_STATE_JOBS, "submit has no source") ||
+        !assert_true(events[3].from_state == JQ_STATE_JOBS && events[3].to_state == JQ_STATE_COMPLETE,
+                     "finalize records both states") ||
+        !assert_true(events[4].to_state == -1, "cancel has no destination")) {
+        return 0;
+    }
+
+    /* A reader resumes from any cursor and sees nothing new at the head. */
+    if (!assert_true(jq_events_read(root, 3, events, 1, &count, &next) == JQ_OK && count == 1 && next == 4 &&
+                         events[0].kind == JQ_EVENT_FINALIZE,
+                     "read resumes mid-log") ||
+        !assert_true(jq_events_read(root, 5, events, 8, &count, &next) == JQ_OK && count == 0 && next == 5,
+                     "head reads nothing")) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Segments hold 16384 records; the test moves the counter rather than writing that many. */
+static int test_event_retention(void) {
+    char template[] = "/tmp/pap_test_event_retention_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    const unsigned long long segment_records = 16384;
+    char counter_path[PATH_MAX];
+    char first_segment[PATH_MAX];
+    char kept_segment[PATH_MAX];
+    snprintf(counter_path, sizeof(counter_path), "%s/.jq/events.next", root);
+    snprintf(first_segment, sizeof(first_segment), "%s/.jq/events/0000000000000000.events", root);
+    snprintf(kept_segment, sizeof(kept_segment), "%s/.jq/events/0000000000000002.events", root);
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for event retention") ||
+        !assert_true(create_job_files(root, "segment-a", 0), "create job in the first segment") ||
+        !assert_true(file_exists(first_segment), "first segment written")) {
+        return 0;
+    }
+    unsigned long long last = 2 * segment_records;
+    int fd = open(counter_path, O_WRONLY);
+    if (!assert_true(fd >= 0 && pwrite(fd, &last, sizeof(last), 0) == (ssize_t)sizeof(last), "skip to segment 2")) {
+        return 0;
+    }
+    close(fd);
+
+    /* A handle keeps writing to the segment it opened. */
+    jq_handle_t *handle = jq_open(root);
+    if (!assert_true(handle != NULL, "open handle for events") ||
+        !assert_true(jq_handle_move(handle, "segment-a", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK &&
+                         create_job_files(root, "segment-b", 0) &&
+                         jq_handle_move(handle, "segment-b", JQ_STATE_JOBS, JQ_STATE_ERROR) == JQ_OK,
+                     "transitions through handle and path")) {
+        jq_close(handle);
+        return 0;
+    }
+    jq_close(handle);
+
+    jq_retention_options_t options;
+    jq_retention_options_init(&options);
+    options.max_event_segments = 1;
+    size_t packed = 1;
+    if (!assert_true(jq_compact(root, &options, 0, &packed) == JQ_OK && packed == 0, "compact prunes events only") ||
+        !assert_true(!file_exists(first_segment) && file_exists(kept_segment), "older segment pruned")) {
+        return 0;
+    }
+
+    /* A reader in a pruned segment carries on at the oldest one kept. */
+    jq_event_t events[8];
+    size_t count = 0;
+    unsigned long long next = 0;
+    if (!assert_true(jq_events_read(root, 0, events, 8, &count, &next) == JQ_OK && count == 3 && next == last + 3,
+                     "reader skips pruned segments") ||
+        !assert_true(events[0].cursor == last && events[0].kind == JQ_EVENT_MOVE &&
+                         strcmp(events[0].uuid, "segment-a") == 0 && events[1].kind == JQ_EVENT_SUBMIT &&
+                         events[2].kind == JQ_EVENT_MOVE && strcmp(events[2].uuid, "segment-b") == 0,
+                     "events after the gap in order")) {
+        return 0;
+    }
+
+    /* An event that cannot be written is counted, and the transition still happens. */
+    char events_dir[PATH_MAX];
+    char saved_dir[PATH_MAX];
+    snprintf(events_dir, sizeof(events_dir), "%s/.jq/events", root);
+    snprintf(saved_dir, sizeof(saved_dir), "%s/.jq/events.saved", root);
+    jq_stats_t stats;
+    jq_state_t state;
+    int locked = 1;
+    if (!assert_true(jq_collect_stats(root, &stats) == JQ_OK && stats.events_dropped == 0, "nothing dropped yet") ||
+        !assert_true(rename(events_dir, saved_dir) == 0 && write_file(events_dir, "not a directory"),
+                     "break the event log") ||
+        !assert_true(jq_move(root, "segment-a", JQ_STATE_COMPLETE, JQ_STATE_ERROR) == JQ_OK &&
+                         jq_status(root, "segment-a", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR,
+                     "move without an event log") ||
+        !assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.events_dropped == 1, "dropped event counted")) {
+        return 0;
+    }
+    return assert_true(jq_collect_stats(root, &stats) == JQ_OK && stats.events_dropped == 1,
+                       "reconcile keeps the dropped count");
+}
+
+static int test_claim_leases(void) {
+    char template[] = "/tmp/pap_test_claim_lease_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for leases")) {
+        return 0;
+    }
+    if (!assert_true(create_job_files(root, "lease-1", 0), "create lease job 1") ||
+        !assert_true(create_job_files(root, "lease-2", 0), "create lease job 2")) {
+        return 0;
+    }
+
+    jq_claim_options_t options;
+    jq_claim_options_init(&options);
+    options.owner = "worker-a";
+    options.lease_seconds = 30;
+    char uuid[64];
+    jq_state_t state = JQ_STATE_JOBS;
+    if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK, "claim with lease")) {
+        return 0;
+    }
+
+    jq_lease_t lease;
+    if (!assert_true(jq_lease_info(root, uuid, &lease) == JQ_OK, "lease recorded")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(lease.owner, "worker-a") == 0 && lease.state == JQ_STATE_JOBS &&
+                         lease.lease_seconds == 30 && lease.expires_at == lease.claimed_at + 30,
+                     "lease fields")) {
+        return 0;
+    }
+    if (!assert_true(jq_heartbeat(root, uuid, JQ_STATE_JOBS, "worker-a") == JQ_OK, "heartbeat extends lease")) {
+        return 0;
+    }
+    if (!assert_true(jq_heartbeat(root, uuid, JQ_STATE_PRIORITY, "worker-a") == JQ_ERR_NOT_FOUND,
+                     "heartbeat rejects wrong state")) {
+        return 0;
+    }
+    if (!assert_true(jq_heartbeat(root, uuid, JQ_STATE_JOBS, "worker-b") == JQ_ERR_NOT_FOUND &&
+                         jq_heartbeat(root, uuid, JQ_STATE_JOBS, NULL) == JQ_ERR_NOT_FOUND,
+                     "heartbeat rejects another owner")) {
+        return 0;
+    }
+    if (!assert_true(jq_heartbeat(root, "lease-2", JQ_STATE_JOBS, "worker-a") == JQ_ERR_NOT_FOUND,
+                     "heartbeat without claim")) {
+        return 0;
+    }
+
+    size_t requeued = 0;
+    if (!assert_true(jq_reap_expired(root, 0, &requeued) == JQ_OK && requeued == 0, "live lease not reaped")) {
+        return 0;
+    }
+    if (!assert_true(jq_reap_expired(root, time(NULL) + 31, &requeued) == JQ_OK && requeued == 1,
+                     "expired lease reaped")) {
+        return 0;
+    }
+    jq_state_t status_state = JQ_STATE_ERROR;
+    int locked = 1;
+    if (!assert_true(jq_status(root, uuid, &status_state, &locked) == JQ_OK && locked == 0 &&
+                         status_state == JQ_STATE_JOBS,
+                     "reaped job requeued")) {
+        return 0;
+    }
+    if (!assert_true(jq_lease_info(root, uuid, &lease) == JQ_ERR_NOT_FOUND &&
+                         jq_heartbeat(root, uuid, JQ_STATE_JOBS, "worker-a") == JQ_ERR_NOT_FOUND,
+                     "reaped lease removed")) {
+        return 0;
+    }
+
+    if (!assert_true(jq_claim(root, &options, uuid, sizeof(uuid), &state) == JQ_OK, "claim again")) {
+        return 0;
+    }
+    if (!assert_true(jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) == JQ_OK, "finalize leased job")) {
+        return 0;
+    }
+    if (!assert_true(jq_lease_info(root, uuid, &lease) == JQ_ERR_NOT_FOUND, "finalize removes lease")) {
+        return 0;
+    }
+
+    /* A lock left without any lease ages out after the default lease. */
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    char pdf_locked[PATH_MAX];
+    char metadata_locked[PATH_MAX];
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim for unleased")) {
+        return 0;
+    }
+    if (!assert_true(jq_release(root, uuid, state) == JQ_OK, "release for unleased")) {
+        return 0;
+    }
+    if (jq_job_paths(root, uuid, state, pdf_path, sizeof(pdf_path), metadata_path, sizeof(metadata_path)) != JQ_OK ||
+        jq_job_paths_locked(root, uuid, state, pdf_locked, sizeof(pdf_locked), metadata_locked,
+                            sizeof(metadata_locked)) != JQ_OK) {
+        return assert_true(0, "unleased paths");
+    }
+    if (!assert_true(rename(pdf_path, pdf_locked) == 0 && rename(metadata_path, metadata_locked) == 0,
+                     "lock without lease")) {
+        return 0;
+    }
+    if (!assert_true(jq_reap_expired(root, 0, &requeued) == JQ_OK && requeued == 0, "fresh unleased lock kept")) {
+        return 0;
+    }
+    if (!assert_true(jq_reap_expired(root, time(NULL) + JQ_LEASE_DEFAULT_SECONDS + 1, &requeued) == JQ_OK &&
+                         requeued == 1,
+                     "stale unleased lock reaped")) {
+        return 0;
+    }
+    return assert_true(file_exists(pdf_path) && file_exists(metadata_path), "unleased job requeued");
+}
+
+static int test_claim_no_jobs(void) {
+    char template[] = "/tmp/pap_test_claim_none_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for claim none")) {
+        return 0;
+    }
+
+    char uuid[32];
+    jq_state_t state = JQ_STATE_JOBS;
+    jq_result_t claim_result = jq_claim_next(root, 1, uuid, sizeof(uuid), &state);
+    return assert_true(claim_result == JQ_ERR_NOT_FOUND, "jq_claim_next returns not found");
+}
+
+static int test_release_and_finalize(void) {
+    char template[] = "/tmp/pap_test_release_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for release")) {
+        return 0;
+    }
+
+    if (!assert_true(create_job_files(root, "job-release", 0), "create release job")) {
+        return 0;
     }
 
     char uuid[64];
@@ -939,6 +3071,334 @@ static int test_release_and_finalize(void) {
     return 1;
 }
 
+static int test_journal_replay(void) {
+    char template[] = "/tmp/pap_test_journal_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    size_t repaired = 1;
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for journal") ||
+        !assert_true(jq_replay_journal(root, &repaired) == JQ_OK && repaired == 0, "empty journal replay") ||
+        !assert_true(create_job_files(root, "journal-split", 0), "create finalize job") ||
+        !assert_true(create_job_files(root, "journal-move", 0), "create move job") ||
+        !assert_true(create_job_files(root, "journal-last", 0), "create twice moved job")) {
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                     strcmp(uuid, "journal-split") == 0, "claim journal job") ||
+        !assert_true(jq_finalize(root, uuid, state, JQ_STATE_COMPLETE) == JQ_OK, "finalize journal job") ||
+        !assert_true(jq_move(root, "journal-move", JQ_STATE_JOBS, JQ_STATE_ERROR) == JQ_OK, "move journal job") ||
+        !assert_true(jq_move(root, "journal-last", JQ_STATE_JOBS, JQ_STATE_ERROR) == JQ_OK &&
+                     jq_move(root, "journal-last", JQ_STATE_ERROR, JQ_STATE_JOBS) == JQ_OK, "move job and back")) {
+        return 0;
+    }
+
+    /* Put each pair back where a crash after its pdf rename would have left it. */
+    const char *splits[][2] = {
+        {"complete/journal-split.metadata.job", "jobs/journal-split.metadata.job.lock"},
+        {"error/journal-move.metadata.job", "jobs/journal-move.metadata.job"},
+        {"jobs/journal-last.metadata.job", "error/journal-last.metadata.job"},
+    };
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+        snprintf(from, sizeof(from), "%s/%s", root, splits[i][0]);
+        snprintf(to, sizeof(to), "%s/%s", root, splits[i][1]);
+        if (!assert_true(rename(from, to) == 0, "split pair")) {
+            return 0;
+        }
+    }
+
+    if (!assert_true(jq_replay_journal(root, &repaired) == JQ_OK && repaired == 3, "replay repairs split pairs")) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", root, splits[i][0]);
+        if (!assert_true(file_exists(path), "replay finishes transition")) {
+            return 0;
+        }
+    }
+
+    jq_stats_t stats;
+    if (!assert_true(jq_collect_stats(root, &stats) == JQ_OK && stats.total_orphans == 0 &&
+                         stats.total_locked == 0,
+                     "no orphans after replay") ||
+        !assert_true(jq_replay_journal(root, &repaired) == JQ_OK && repaired == 0, "journal truncated") ||
+        !assert_true(jq_init(root) == JQ_OK, "jq_init replays cleanly")) {
+        return 0;
+    }
+
+    /* A claim waits for a replay holding the journal, so it never renames half a pair under it. */
+    char journal_path[PATH_MAX];
+    snprintf(journal_path, sizeof(journal_path), "%s/.jq/journal", root);
+    int journal_fd = open(journal_path, O_RDWR);
+    if (!assert_true(journal_fd >= 0 && flock(journal_fd, LOCK_EX) == 0, "hold journal like a replay")) {
+        return 0;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(journal_fd);
+        char claimed[64];
+        jq_state_t claimed_state;
+        _exit(jq_claim_next(root, 0, claimed, sizeof(claimed), &claimed_state) == JQ_OK ? 0 : 1);
+    }
+    int status = 0;
+    struct timespec pause = {0, 200 * 1000 * 1000};
+    nanosleep(&pause, NULL);
+    int waiting = child > 0 && waitpid(child, &status, WNOHANG) == 0;
+    close(journal_fd);
+    return assert_true(waiting, "claim waits for the replay") &&
+           assert_true(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+                           WEXITSTATUS(status) == 0,
+                       "claim runs once the replay is done");
+}
+
+static int test_fsck(void) {
+    char template[] = "/tmp/pap_test_fsck_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state;
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for fsck") ||
+        !assert_true(create_job_files(root, "fsck-stale", 0), "create stale claim job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "fsck-stale") == 0,
+                     "claim job its worker never finishes") ||
+        !assert_true(create_job_files(root, "fsck-split", 0), "create split job") ||
+        !assert_true(create_job_files(root, "fsck-half-claim", 0), "create half claimed job") ||
+        !assert_true(create_job_files(root, "fsck-done", 0), "create finished job") ||
+        !assert_true(jq_move(root, "fsck-done", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK, "finish job") ||
+        !assert_true(create_job_files(root, "fsck-healthy", 1), "create healthy job")) {
+        return 0;
+    }
+
+    /* What a crash leaves behind, none of it recorded in the journal. */
+    const char *renames[][2] = {
+        {"jobs/fsck-split.pdf.job", "complete/fsck-split.pdf.job"},
+        {"jobs/fsck-half-claim.pdf.job", "jobs/fsck-half-claim.pdf.job.lock"},
+    };
+    for (size_t i = 0; i < sizeof(renames) / sizeof(renames[0]); ++i) {
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+        snprintf(from, sizeof(from), "%s/%s", root, renames[i][0]);
+        snprintf(to, sizeof(to), "%s/%s", root, renames[i][1]);
+        if (!assert_true(rename(from, to) == 0, "leave split pair")) {
+            return 0;
+        }
+    }
+    const char *leftovers[] = {"jobs/fsck-copy.pdf.job.tmp.Ab12Cd", "complete/fsck-ghost.report.html",
+                               "error/fsck-done.report.html", "jobs/fsck-lonely.pdf.job"};
+    for (size_t i = 0; i < sizeof(leftovers) / sizeof(leftovers[0]); ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", root, leftovers[i]);
+        if (!write_file(path, "leftover")) {
+            return 0;
+        }
+    }
+
+    /* Straight after the crash everything is too fresh to touch. */
+    jq_fsck_options_t options;
+    jq_fsck_options_init(&options);
+    options.repair = 1;
+    jq_fsck_report_t report;
+    if (!assert_true(jq_fsck(root, &options, &report) == JQ_OK && report.temp_files == 1 && report.split_pairs == 2 &&
+                         report.stray_reports == 2 && report.orphans == 1 && report.stale_locks == 0 &&
+                         report.busy == 5 && report.repaired == 0,
+                     "fsck leaves fresh leftovers alone")) {
+        return 0;
+    }
+
+    options.repair = 0;
+    options.threads = 3;
+    options.now = time(NULL) + JQ_LEASE_DEFAULT_SECONDS + 120;
+    if (!assert_true(jq_fsck(root, &options, &report) == JQ_OK && report.entries == 14 && report.temp_files == 1 &&
+                         report.stale_locks == 1 && report.split_pairs == 2 && report.stray_reports == 2 &&
+                         report.orphans == 1 && report.busy == 0 && report.repaired == 0,
+                     "fsck classifies leftovers")) {
+        return 0;
+    }
+
+    options.repair = 1;
+    int locked = 1;
+    char path[PATH_MAX];
+    if (!assert_true(jq_fsck(root, &options, &report) == JQ_OK && report.repaired == 6, "fsck repairs leftovers") ||
+        !assert_true(jq_status(root, "fsck-split", &state, &locked) == JQ_OK && state == JQ_STATE_COMPLETE &&
+                         !locked,
+                     "split job finished where its pdf went") ||
+        !assert_true(jq_status(root, "fsck-half-claim", &state, &locked) == JQ_OK && state == JQ_STATE_JOBS &&
+                         !locked,
+                     "half claim rolled back") ||
+        !assert_true(jq_status(root, "fsck-stale", &state, &locked) == JQ_OK && !locked, "dead claim requeued") ||
+        !assert_true(jq_job_report_paths(root, "fsck-done", JQ_STATE_COMPLETE, path, sizeof(path)) == JQ_OK &&
+                         file_exists(path),
+                     "report follows its job")) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(leftovers) / sizeof(leftovers[0]); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, leftovers[i]);
+        if (!assert_true(file_exists(path) == (i == 3), "leftovers removed, lone pdf kept")) {
+            return 0;
+        }
+    }
+
+    jq_stats_t stats;
+    return assert_true(jq_fsck(root, &options, &report) == JQ_OK && report.temp_files == 0 &&
+                           report.stale_locks == 0 && report.split_pairs == 0 && report.stray_reports == 0 &&
+                           report.orphans == 1 && report.repaired == 0,
+                       "second fsck finds only the lone pdf") &&
+           assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.total_locked == 0 && stats.total_orphans == 1,
+                       "counters reconciled after repair");
+}
+
+/* Reads a packed file back through the archive index. */
+static int read_archived(const char *root, const char *uuid, jq_file_kind_t kind, char *buffer, size_t buffer_len) {
+    jq_state_t state;
+    char path[PATH_MAX];
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+    if (jq_archive_locate(root, uuid, kind, &state, path, sizeof(path), &offset, &length) != JQ_OK ||
+        length >= buffer_len) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t bytes_read = pread(fd, buffer, (size_t)length, (off_t)offset);
+    close(fd);
+    if (bytes_read != (ssize_t)length) {
+        return 0;
+    }
+    buffer[length] = '\0';
+    return 1;
+}
+
+static int test_compact(void) {
+    char template[] = "/tmp/pap_test_compact_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    const char *finished[] = {"pack-a", "pack-b", "pack-c", "pack-d", "pack-e"};
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for compact")) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(finished) / sizeof(finished[0]); ++i) {
+        if (!assert_true(create_job_files(root, finished[i], 0), "create job to pack") ||
+            !assert_true(jq_move(root, finished[i], JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK, "finish job to pack")) {
+            return 0;
+        }
+    }
+    char report_path[PATH_MAX];
+    if (!assert_true(create_job_files(root, "pack-failed", 0), "create failed job") ||
+        !assert_true(jq_move(root, "pack-failed", JQ_STATE_JOBS, JQ_STATE_ERROR) == JQ_OK, "fail job") ||
+        !assert_true(jq_job_report_paths(root, "pack-a", JQ_STATE_COMPLETE, report_path, sizeof(report_path)) ==
+                         JQ_OK && write_file(report_path, "<html>a</html>"),
+                     "write report to pack")) {
+        return 0;
+    }
+
+    /* Keeping two per state packs the three oldest completed jobs, PDFs included. */
+    jq_retention_options_t options;
+    jq_retention_options_init(&options);
+    options.max_loose = 2;
+    options.pack_pdf = 1;
+    size_t packed = 0;
+    jq_stats_t stats;
+    if (!assert_true(jq_compact(root, &options, 0, &packed) == JQ_OK && packed == 3, "compact by count") ||
+        !assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.states[JQ_STATE_COMPLETE].pdf_jobs == 2 &&
+                         stats.states[JQ_STATE_ERROR].pdf_jobs == 1,
+                     "stats drop packed jobs")) {
+        return 0;
+    }
+
+    /* Then everything older than a second, leaving PDFs as files under the archive. */
+    options.max_loose = 0;
+    options.max_age_seconds = 1;
+    options.pack_pdf = 0;
+    if (!assert_true(jq_compact(root, &options, time(NULL) + 10, &packed) == JQ_OK && packed == 3,
+                     "compact by age") ||
+        !assert_true(jq_collect_stats(root, &stats) == JQ_OK && stats.total_jobs == 0, "nothing left loose")) {
+        return 0;
+    }
+
+    char buffer[64];
+    for (size_t i = 0; i < sizeof(finished) / sizeof(finished[0]); ++i) {
+        jq_state_t state;
+        int locked = 1;
+        char pdf_path[PATH_MAX];
+        char metadata_path[PATH_MAX];
+        if (!assert_true(jq_status(root, finished[i], &state, &locked) == JQ_OK && state == JQ_STATE_COMPLETE &&
+                             !locked,
+                         "status sees packed job") ||
+            !assert_true(jq_job_paths(root, finished[i], JQ_STATE_COMPLETE, pdf_path, sizeof(pdf_path), metadata_path,
+                                      sizeof(metadata_path)) == JQ_OK &&
+                             !file_exists(pdf_path) && !file_exists(metadata_path),
+                         "packed job leaves no loose files") ||
+            !assert_true(read_archived(root, finished[i], JQ_FILE_PDF, buffer, sizeof(buffer)) &&
+                             strcmp(buffer, "pdf data") == 0,
+                         "packed pdf reads back") ||
+            !assert_true(read_archived(root, finished[i], JQ_FILE_METADATA, buffer, sizeof(buffer)) &&
+                             strcmp(buffer, "metadata") == 0,
+                         "packed metadata reads back")) {
+            return 0;
+        }
+    }
+    jq_state_t state;
+    int locked = 1;
+    if (!assert_true(read_archived(root, "pack-a", JQ_FILE_REPORT, buffer, sizeof(buffer)) &&
+                         strcmp(buffer, "<html>a</html>") == 0 && !file_exists(report_path),
+                     "packed report reads back") ||
+        !assert_true(!read_archived(root, "pack-b", JQ_FILE_REPORT, buffer, sizeof(buffer)), "no report packed") ||
+        !assert_true(jq_status(root, "pack-failed", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR,
+                     "status sees packed failure") ||
+        !assert_true(jq_status(root, "pack-missing", &state, &locked) == JQ_ERR_NOT_FOUND, "unknown job")) {
+        return 0;
+    }
+
+    /* A stored policy is applied by the reaper, not by the finalize itself. */
+    jq_retention_options_t stored;
+    jq_retention_options_init(&options);
+    options.max_loose = 1;
+    if (!assert_true(create_job_files(root, "auto-a", 0) && create_job_files(root, "auto-b", 0) &&
+                         create_job_files(root, "auto-c", 0),
+                     "create jobs to pack automatically") ||
+        !assert_true(jq_move(root, "auto-a", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK &&
+                         jq_move(root, "auto-b", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finish jobs before a policy") ||
+        !assert_true(jq_retention_configure(root, &options) == JQ_OK, "configure retention") ||
+        !assert_true(jq_read_retention(root, &stored) == JQ_OK && stored.max_loose == 1 &&
+                         stored.max_age_seconds == 0 && !stored.pack_pdf,
+                     "read retention back") ||
+        !assert_true(jq_claim_next(root, 0, buffer, sizeof(buffer), &state) == JQ_OK &&
+                         strcmp(buffer, "auto-c") == 0 &&
+                         jq_finalize(root, "auto-c", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finalize with retention due") ||
+        !assert_true(jq_collect_stats(root, &stats) == JQ_OK && stats.states[JQ_STATE_COMPLETE].pdf_jobs == 3,
+                     "finalize leaves packing to the reaper") ||
+        !assert_true(jq_reap_expired(root, 0, NULL) == JQ_OK && jq_collect_stats(root, &stats) == JQ_OK &&
+                         stats.states[JQ_STATE_COMPLETE].pdf_jobs == 1,
+                     "reaper packed all but one")) {
+        return 0;
+    }
+    return assert_true(jq_retention_disable(root) == JQ_OK && jq_read_retention(root, &stored) == JQ_ERR_NOT_FOUND &&
+                           jq_retention_disable(root) == JQ_ERR_NOT_FOUND,
+                       "disable retention");
+}
+
 static int test_finalize_creates_destination_dir(void) {
     char template[] = "/tmp/pap_test_finalize_missing_dir_XXXXXX";
     char *root = mkdtemp(template);
@@ -1415,6 +3875,301 @@ static int test_status_unlocked_and_locked(void) {
     return 1;
 }
 
+static int test_status_index(void) {
+    char template[] = "/tmp/pap_test_status_index_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for status index") ||
+        !assert_true(create_job_files(root, "indexed", 0), "create indexed job")) {
+        return 0;
+    }
+
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/.jq/status", root);
+    struct stat initial;
+    if (!assert_true(stat(index_path, &initial) == 0, "submit creates status index")) {
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state;
+    int locked = 0;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim indexed job") ||
+        !assert_true(jq_status(root, "indexed", &state, &locked) == JQ_OK && state == JQ_STATE_JOBS && locked,
+                     "index follows claim")) {
+        return 0;
+    }
+
+    /* A hit is checked against the pdf, so an outside rename is caught by the probe. */
+    char pdf_locked[PATH_MAX];
+    char metadata_locked[PATH_MAX];
+    char pdf_error[PATH_MAX];
+    char metadata_error[PATH_MAX];
+    snprintf(pdf_locked, sizeof(pdf_locked), "%s/jobs/indexed.pdf.job.lock", root);
+    snprintf(metadata_locked, sizeof(metadata_locked), "%s/jobs/indexed.metadata.job.lock", root);
+    snprintf(pdf_error, sizeof(pdf_error), "%s/error/indexed.pdf.job", root);
+    snprintf(metadata_error, sizeof(metadata_error), "%s/error/indexed.metadata.job", root);
+    if (!assert_true(rename(pdf_locked, pdf_error) == 0 && rename(metadata_locked, metadata_error) == 0,
+                     "move job behind the index") ||
+        !assert_true(jq_status(root, "indexed", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR && !locked,
+                     "stale index hit falls back to probe")) {
+        return 0;
+    }
+    jq_fsck_options_t fsck_options;
+    jq_fsck_options_init(&fsck_options);
+    fsck_options.repair = 1;
+    jq_fsck_report_t fsck_report;
+    if (!assert_true(jq_fsck(root, &fsck_options, &fsck_report) == JQ_OK && stat(index_path, &initial) != 0,
+                     "fsck repair drops the index") ||
+        !assert_true(jq_status(root, "indexed", &state, &locked) == JQ_OK && state == JQ_STATE_ERROR && !locked,
+                     "dropped index falls back to probe") ||
+        !assert_true(stat(index_path, &initial) == 0, "probe starts a fresh index")) {
+        return 0;
+    }
+
+    /* A cancelled job leaves a tombstone, not a stale hit. */
+    if (!assert_true(create_job_files(root, "discarded", 0) &&
+                         jq_status(root, "discarded", &state, &locked) == JQ_OK && state == JQ_STATE_JOBS,
+                     "index records a new job") ||
+        !assert_true(jq_cancel(root, "discarded") == JQ_OK &&
+                         jq_status(root, "discarded", &state, &locked) == JQ_ERR_NOT_FOUND,
+                     "cancelled job is not found")) {
+        return 0;
+    }
+
+    /* Jobs the index has never seen are found by the probe and recorded, growing the table. */
+    enum { UNINDEXED_JOBS = 3200 };
+    for (int i = 0; i < UNINDEXED_JOBS; ++i) {
+        char pdf_path[PATH_MAX];
+        char metadata_path[PATH_MAX];
+        snprintf(pdf_path, sizeof(pdf_path), "%s/complete/outside-%d.pdf.job", root, i);
+        snprintf(metadata_path, sizeof(metadata_path), "%s/complete/outside-%d.metadata.job", root, i);
+        if (!write_file(pdf_path, "pdf") || !write_file(metadata_path, "metadata")) {
+            return assert_true(0, "write outside job");
+        }
+        snprintf(uuid, sizeof(uuid), "outside-%d", i);
+        if (jq_status(root, uuid, &state, &locked) != JQ_OK || state != JQ_STATE_COMPLETE || locked) {
+            return assert_true(0, "status of outside job");
+        }
+    }
+
+    struct stat grown;
+    if (!assert_true(stat(index_path, &grown) == 0 && grown.st_size > initial.st_size, "status index grows")) {
+        return 0;
+    }
+    for (int i = 0; i < UNINDEXED_JOBS; i += 97) {
+        snprintf(uuid, sizeof(uuid), "outside-%d", i);
+        if (jq_status(root, uuid, &state, &locked) != JQ_OK || state != JQ_STATE_COMPLETE) {
+            return assert_true(0, "status after growth");
+        }
+    }
+    return assert_true(jq_status(root, "never-submitted", &state, &locked) == JQ_ERR_NOT_FOUND,
+                       "unknown uuid not found");
+}
+
+static int claim_expect(const char *root, const char *expected, const char *message) {
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    return assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK && strcmp(uuid, expected) == 0,
+                       message);
+}
+
+static int test_ready_ring(void) {
+    char template[] = "/tmp/pap_test_ring_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "jq_init for ring") ||
+        !assert_true(jq_ring_enable(root, 3) == JQ_ERR_INVALID_ARGUMENT, "ring capacity must be a power of two") ||
+        !assert_true(jq_ring_disable(root) == JQ_ERR_NOT_FOUND, "no ring to disable")) {
+        return 0;
+    }
+
+    /* Jobs queued before the ring existed are loaded from the logs. */
+    char ring_path[PATH_MAX];
+    snprintf(ring_path, sizeof(ring_path), "%s/.jq/ready.ring", root);
+    if (!assert_true(create_job_files(root, "ring-early", 0), "create early job") ||
+        !assert_true(jq_ring_enable(root, 4) == JQ_OK && access(ring_path, F_OK) == 0, "enable ring") ||
+        !assert_true(create_level_job(root, "ring-low", 0), "create low job") ||
+        !assert_true(create_level_job(root, "ring-high", 3), "create high job") ||
+        !assert_true(create_job_files(root, "ring-priority", 1), "create priority job") ||
+        !assert_true(create_job_files(root, "ring-cancelled", 0), "create cancelled job") ||
+        !assert_true(jq_cancel(root, "ring-cancelled") == JQ_OK, "cancel queued ring job")) {
+        return 0;
+    }
+    if (!claim_expect(root, "ring-high", "ring claims highest level first") ||
+        !claim_expect(root, "ring-early", "ring keeps fifo within a level") ||
+        !claim_expect(root, "ring-low", "ring claims lower level next") ||
+        !claim_expect(root, "ring-priority", "ring claims priority state last")) {
+        return 0;
+    }
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND,
+                     "cancelled job skipped in ring")) {
+        return 0;
+    }
+
+    /* A full lane turns dirty and the logs keep order until claims drain it. */
+    struct stat before;
+    struct stat after;
+    if (!assert_true(jq_ring_enable(root, 2) == JQ_OK && stat(ring_path, &before) == 0, "shrink ring") ||
+        !assert_true(create_job_files(root, "ring-1", 0) && create_job_files(root, "ring-2", 0) &&
+                         create_job_files(root, "ring-3", 0),
+                     "overfill ring lane") ||
+        !claim_expect(root, "ring-1", "overfilled lane claims first job") ||
+        !claim_expect(root, "ring-2", "overfilled lane claims second job") ||
+        !claim_expect(root, "ring-3", "overfilled lane claims job past the ring") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_ERR_NOT_FOUND, "lane drained") ||
+        !assert_true(stat(ring_path, &after) == 0 && after.st_ino != before.st_ino, "drained dirty ring rebuilt")) {
+        return 0;
+    }
+
+    /* Handles keep the ring mapped and follow it across rebuilds. */
+    jq_handle_t *handle = jq_open(root);
+    int ok = assert_true(handle != NULL, "open ring handle") &&
+             assert_true(create_job_files(root, "ring-handle-1", 0), "create handle job") &&
+             assert_true(jq_handle_claim(handle, NULL, uuid, sizeof(uuid), &state) == JQ_OK &&
+                             strcmp(uuid, "ring-handle-1") == 0,
+                         "handle claims from ring") &&
+             assert_true(jq_ring_enable(root, 8) == JQ_OK, "rebuild ring under handle") &&
+             assert_true(create_job_files(root, "ring-handle-2", 0), "create second handle job") &&
+             assert_true(jq_handle_claim(handle, NULL, uuid, sizeof(uuid), &state) == JQ_OK &&
+                             strcmp(uuid, "ring-handle-2") == 0,
+                         "handle claims from rebuilt ring");
+    jq_close(handle);
+    if (!ok) {
+        return 0;
+    }
+
+    /* Concurrent claimers split the ring without losing or repeating jobs. */
+    const int jobs = 48;
+    const int workers = 4;
+    for (int i = 0; i < jobs; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "ring-burst-%02d", i);
+        if (!assert_true(create_job_files(root, name, 0), "create burst job")) {
+            return 0;
+        }
+    }
+    pid_t pids[4];
+    for (int i = 0; i < workers; ++i) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            int claimed = 0;
+            char child_uuid[JQ_UUID_MAX];
+            jq_state_t child_state;
+            while (jq_claim_next(root, 0, child_uuid, sizeof(child_uuid), &child_state) == JQ_OK) {
+                claimed++;
+            }
+            _exit(claimed);
+        }
+    }
+    int total = 0;
+    for (int i = 0; i < workers; ++i) {
+        int status = 0;
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status)) {
+            total += WEXITSTATUS(status);
+        }
+    }
+    jq_stats_t stats;
+    if (!assert_true(total == jobs, "every burst job claimed once") ||
+        !assert_true(jq_read_stats(root, &stats) == JQ_OK && stats.total_locked == 2 * (size_t)(jobs + 9),
+                     "stats count every ring claim")) {
+        return 0;
+    }
+
+    return assert_true(jq_replay_journal(root, NULL) == JQ_OK, "recovery rebuilds ring") &&
+           assert_true(jq_ring_disable(root) == JQ_OK && access(ring_path, F_OK) != 0, "disable ring") &&
+           assert_true(create_job_files(root, "ring-off", 0), "create job without ring") &&
+           claim_expect(root, "ring-off", "claims work without ring");
+}
+
+static int test_handle_api(void) {
+    char template[] = "/tmp/pap_test_handle_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    if (!assert_true(jq_open(NULL) == NULL, "jq_open rejects null root")) {
+        return 0;
+    }
+    jq_handle_t *handle = jq_open(root);
+    if (!assert_true(handle != NULL, "jq_open") ||
+        !assert_true(create_job_files(root, "handled", 0), "create handled job")) {
+        jq_close(handle);
+        return 0;
+    }
+
+    char uuid[64];
+    jq_state_t state;
+    int locked = 0;
+    int ok = assert_true(jq_handle_claim(handle, NULL, uuid, sizeof(uuid), &state) == JQ_OK &&
+                             strcmp(uuid, "handled") == 0 && state == JQ_STATE_JOBS,
+                         "handle claim") &&
+             assert_true(jq_handle_status(handle, "handled", &state, &locked) == JQ_OK && locked,
+                         "handle status sees lock") &&
+             assert_true(jq_handle_finalize(handle, "handled", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                         "handle finalize") &&
+             assert_true(jq_status(root, "handled", &state, &locked) == JQ_OK && state == JQ_STATE_COMPLETE &&
+                             !locked,
+                         "path status agrees with handle");
+
+    /* A stray pair already at the destination is never overwritten. */
+    char stray_pdf[PATH_MAX];
+    char stray_metadata[PATH_MAX];
+    snprintf(stray_pdf, sizeof(stray_pdf), "%s/complete/clash.pdf.job", root);
+    snprintf(stray_metadata, sizeof(stray_metadata), "%s/complete/clash.metadata.job", root);
+    char contents[32];
+    ok = ok && assert_true(create_job_files(root, "clash", 0), "create clash job") &&
+         assert_true(write_file(stray_pdf, "stray") && write_file(stray_metadata, "stray"), "write stray pair") &&
+         assert_true(jq_handle_claim(handle, NULL, uuid, sizeof(uuid), &state) == JQ_OK &&
+                         strcmp(uuid, "clash") == 0,
+                     "claim clash job") &&
+         assert_true(jq_handle_finalize(handle, "clash", JQ_STATE_JOBS, JQ_STATE_COMPLETE) != JQ_OK,
+                     "finalize refuses to replace") &&
+         assert_true(read_file(stray_pdf, contents, sizeof(contents)) && strcmp(contents, "stray") == 0,
+                     "stray pdf kept") &&
+         assert_true(jq_handle_release(handle, "clash", JQ_STATE_JOBS) == JQ_OK, "handle release") &&
+         assert_true(jq_handle_status(handle, "clash", &state, &locked) == JQ_OK && state == JQ_STATE_JOBS &&
+                         !locked,
+                     "released clash job");
+
+    /* The handle follows a layout change made through the path API. */
+    size_t moved = 0;
+    size_t remaining = 0;
+    char pdf_path[PATH_MAX];
+    char metadata_path[PATH_MAX];
+    ok = ok && assert_true(jq_migrate_layout(root, &moved, &remaining) == JQ_OK, "migrate under handle") &&
+         assert_true(create_job_files(root, "sharded-job", 1), "create sharded job") &&
+         assert_true(jq_handle_move(handle, "sharded-job", JQ_STATE_PRIORITY, JQ_STATE_ERROR) == JQ_OK,
+                     "handle move in sharded root") &&
+         assert_true(jq_job_paths(root, "sharded-job", JQ_STATE_ERROR, pdf_path, sizeof(pdf_path), metadata_path,
+                                  sizeof(metadata_path)) == JQ_OK &&
+                         file_exists(pdf_path) && file_exists(metadata_path),
+                     "moved into error shard") &&
+         assert_true(jq_handle_status(handle, "sharded-job", &state, &locked) == JQ_OK &&
+                         state == JQ_STATE_ERROR,
+                     "handle status in sharded root");
+
+    /* The journal the handle keeps open survives a replay truncating it. */
+    size_t repaired = 0;
+    ok = ok && assert_true(jq_replay_journal(root, &repaired) == JQ_OK && repaired == 0, "replay under handle") &&
+         assert_true(create_job_files(root, "after-replay", 0) &&
+                         jq_handle_move(handle, "after-replay", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "handle move after replay") &&
+         assert_true(jq_replay_journal(root, &repaired) == JQ_OK && repaired == 0, "handle journal replays clean");
+    jq_close(handle);
+    return ok;
+}
+
 static int test_status_not_found(void) {
     char template[] = "/tmp/pap_test_status_missing_XXXXXX";
     char *root = mkdtemp(template);
@@ -1490,6 +4245,8 @@ int main(void) {
     passed &= test_collect_stats_invalid();
     passed &= test_job_paths_overflow();
     passed &= test_collect_stats();
+    passed &= test_collect_stats_large_dir();
+    passed &= test_incremental_stats();
     passed &= test_submit_and_move();
     passed &= test_submit_missing_source();
     passed &= test_submit_metadata_cleanup();
@@ -1497,6 +4254,9 @@ int main(void) {
     passed &= test_move_partial_pair();
     passed &= test_submit_invalid_args();
     passed &= test_submit_large_files();
+    passed &= test_submit_link_mode();
+    passed &= test_blob_store();
+    passed &= test_submit_batch();
     passed &= test_submit_atomic_cleanup();
     passed &= test_submit_missing_dir_cleanup();
     passed &= test_job_paths_invalid_state();
@@ -1504,7 +4264,30 @@ int main(void) {
     passed &= test_claim_uuid_too_small();
     passed &= test_claim_priority();
     passed &= test_claim_no_jobs();
+    passed &= test_claim_index_order();
+    passed &= test_claim_index_rebuild();
+    passed &= test_claim_index_recovery();
+    passed &= test_claim_fifo_order();
+    passed &= test_claim_batch();
+    passed &= test_claim_wait();
+    passed &= test_priority_levels();
+    passed &= test_claim_weighted();
+    passed &= test_claim_by_size();
+    passed &= test_claim_by_size_tenants();
+    passed &= test_tenant_fair_share();
+    passed &= test_sharded_layout_migration();
+    passed &= test_job_dir_layout();
+    passed &= test_claim_leases();
+    passed &= test_retry_backoff();
+    passed &= test_retry_checks();
+    passed &= test_cancel();
+    passed &= test_progress();
+    passed &= test_events();
+    passed &= test_event_retention();
     passed &= test_release_and_finalize();
+    passed &= test_journal_replay();
+    passed &= test_fsck();
+    passed &= test_compact();
     passed &= test_finalize_creates_destination_dir();
     passed &= test_release_rolls_back_on_missing_metadata();
     passed &= test_claim_invalid_args();
@@ -1520,6 +4303,9 @@ int main(void) {
     passed &= test_report_moves_on_move();
     passed &= test_status_invalid_args();
     passed &= test_status_unlocked_and_locked();
+    passed &= test_status_index();
+    passed &= test_handle_api();
+    passed &= test_ready_ring();
     passed &= test_status_not_found();
     passed &= test_status_partial_pair();
     passed &= test_finalize_rolls_back_on_missing_metadata();
@@ -141,6 +141,11 @@ static int test_cli_claim_empty(void) {
         return 0;
     }
 
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --wait 50", root);
+    if (!assert_true(run_command(command) == 2, "cli claim --wait times out with 2")) {
+        return 0;
+    }
+
     return 1;
 }
 
@@ -200,6 +205,120 @@ static int test_cli_release(void) {
     return 1;
 }
 
+static int test_cli_lease(void) {
+    char template[] = "/tmp/pap_test_cli_lease_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "init for lease")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"),
+                     "write lease sources")) {
+        return 0;
+    }
+    if (!assert_true(jq_submit(root, "job-lease", pdf_src, metadata_src, 0) == JQ_OK, "submit lease job")) {
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --owner cli-worker --lease 60", root);
+    if (!assert_true(run_command(command) == 0, "claim with owner and lease")) {
+        return 0;
+    }
+
+    jq_lease_t lease;
+    if (!assert_true(jq_lease_info(root, "job-lease", &lease) == JQ_OK &&
+                         strcmp(lease.owner, "cli-worker") == 0 && lease.lease_seconds == 60,
+                     "claim records lease")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli heartbeat %s job-lease jobs --owner cli-worker", root);
+    if (!assert_true(run_command(command) == 0, "heartbeat by owner")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli heartbeat %s job-lease jobs --owner other-worker", root);
+    if (!assert_true(run_command(command) == 2, "heartbeat by another owner refused")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli heartbeat %s job-lease jobs", root);
+    if (!assert_true(run_command(command) == 2, "heartbeat without owner refused")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli heartbeat %s job-lease priority --owner cli-worker", root);
+    if (!assert_true(run_command(command) == 2, "heartbeat in wrong state refused")) {
+        return 0;
+    }
+
+    char output[64];
+    snprintf(command, sizeof(command), "./job_queue_cli reap %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "reap via cli")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(output, "requeued=0\n") == 0, "reap keeps live lease")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli release %s job-lease jobs", root);
+    if (!assert_true(run_command(command) == 0, "release leased job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli heartbeat %s job-lease jobs --owner cli-worker", root);
+    return assert_true(run_command(command) == 2, "heartbeat after release not found");
+}
+
+static int test_cli_retry(void) {
+    char template[] = "/tmp/pap_test_cli_retry_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "init for retry")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"),
+                     "write retry sources")) {
+        return 0;
+    }
+    if (!assert_true(jq_submit(root, "job-retry", pdf_src, metadata_src, 0) == JQ_OK, "submit retry job")) {
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --owner cli-worker", root);
+    if (!assert_true(run_command(command) == 0, "claim for retry")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli retry %s job-retry jobs", root);
+    if (!assert_true(run_command(command) == 2, "retry without the owner refused")) {
+        return 0;
+    }
+
+    char output[64];
+    snprintf(command, sizeof(command), "./job_queue_cli retry %s job-retry jobs --owner cli-worker", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "retry via cli")) {
+        return 0;
+    }
+    return assert_true(strncmp(output, "attempts=1 not_before=", 22) == 0, "retry counts first attempt");
+}
+
 static int test_cli_stats(void) {
     char template[] = "/tmp/pap_test_cli_stats_XXXXXX";
     char *root = mkdtemp(template);
@@ -240,16 +359,696 @@ static int test_cli_stats(void) {
     if (!assert_true(strstr(output, "totals:") != NULL, "stats output has totals")) {
         return 0;
     }
+    if (!assert_true(strstr(output, "waiting: oldest_mtime=") != NULL, "stats output has waiting age")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli stats %s --reconcile", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli reconcile stats output")) {
+        return 0;
+    }
+    if (!assert_true(strstr(output, "counters: reconciled_at=") != NULL &&
+                         strstr(output, " events_dropped=0\n") != NULL,
+                     "stats output has reconcile time and dropped events")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --fifo", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli fifo claim output")) {
+        return 0;
+    }
+    if (!assert_true(strncmp(output, "job-stats jobs", strlen("job-stats jobs")) == 0, "fifo claim output")) {
+        return 0;
+    }
 
     return 1;
 }
 
+static int test_cli_claim_batch(void) {
+    char template[] = "/tmp/pap_test_cli_batch_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init batch")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data"), "write pdf source") ||
+        !assert_true(write_file(metadata_src, "metadata"), "write metadata source")) {
+        return 0;
+    }
+
+    const char *uuids[] = {"job-batch-1", "job-batch-2", "job-batch-3"};
+    for (size_t i = 0; i < sizeof(uuids) / sizeof(uuids[0]); ++i) {
+        snprintf(command, sizeof(command), "./job_queue_cli submit %s %s %s %s", root, uuids[i], pdf_src,
+                 metadata_src);
+        if (!assert_true(run_command(command) == 0, "cli submit batch job")) {
+            return 0;
+        }
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --batch 2", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli batch claim output")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(output, "job-batch-1 jobs\njob-batch-2 jobs\n") == 0, "batch claim output")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --batch 0 > /dev/null", root);
+    if (!assert_true(run_command(command) == 1, "cli batch rejects zero")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --batch 5", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli batch claim rest")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "job-batch-3 jobs\n") == 0, "batch claim returns remaining job");
+}
+
+static int test_cli_submit_batch(void) {
+    char template[] = "/tmp/pap_test_cli_batch_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init batch")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    char manifest[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    snprintf(manifest, sizeof(manifest), "%s/manifest.txt", root);
+    char contents[8 * PATH_MAX];
+    snprintf(contents, sizeof(contents),
+             "# nightly ingest\n"
+             "batch-a %s %s\n"
+             "\n"
+             "batch-b %s %s 7\n"
+             "batch-missing %s/missing.pdf %s\n",
+             pdf_src, metadata_src, pdf_src, metadata_src, root, metadata_src);
+    if (!assert_true(write_file(pdf_src, "pdf data"), "write pdf source") ||
+        !assert_true(write_file(metadata_src, "metadata"), "write metadata source") ||
+        !assert_true(write_file(manifest, contents), "write manifest")) {
+        return 0;
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli submit-batch %s %s --threads 2; echo exit=$?", root,
+             manifest);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli submit-batch output") ||
+        !assert_true(strcmp(output, "batch-missing not_found\nsubmitted=2 failed=1\nexit=1\n") == 0,
+                     "cli submit-batch reports per job results")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --prefer-priority", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli claim batch job")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "batch-b priority\n") == 0, "manifest level honored");
+}
+
+static int test_cli_levels(void) {
+    char template[] = "/tmp/pap_test_cli_levels_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init levels")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data"), "write pdf source") ||
+        !assert_true(write_file(metadata_src, "metadata"), "write metadata source")) {
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-bulk %s %s --level 0", root, pdf_src,
+             metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit bulk level")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-urgent %s %s --level 7", root, pdf_src,
+             metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit urgent level")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-bad %s %s --level 8 > /dev/null", root,
+             pdf_src, metadata_src);
+    if (!assert_true(run_command(command) == 1, "cli rejects out of range level")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --weighted --weights 1,2 > /dev/null", root);
+    if (!assert_true(run_command(command) == 1, "cli rejects short weights")) {
+        return 0;
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --weighted --weights 1,0,0,0,0,0,0,0", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli weighted claim output")) {
+        return 0;
+    }
+    if (!assert_true(strcmp(output, "job-bulk jobs\n") == 0, "weighted claim picks weighted level")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --weighted --weights 1,0,0,0,0,0,0,0", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli weighted claim fallback")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "job-urgent priority\n") == 0, "weighted claim falls back to other levels");
+}
+
+static int test_cli_claim_size(void) {
+    char template[] = "/tmp/pap_test_cli_size_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char large_pdf[PATH_MAX];
+    char small_pdf[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(large_pdf, sizeof(large_pdf), "%s/large.pdf", root);
+    snprintf(small_pdf, sizeof(small_pdf), "%s/small.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(large_pdf, "pdf data") && truncate(large_pdf, 2 << 20) == 0 &&
+                         write_file(small_pdf, "pdf data") && write_file(metadata_src, "metadata"),
+                     "write sized sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init size")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-large %s %s", root, large_pdf, metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit large job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-small %s %s", root, small_pdf, metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit small job")) {
+        return 0;
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --smallest-first", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, "job-small jobs\n") == 0,
+                     "cli claims smallest first")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --max-bytes 1048576 > /dev/null 2>&1", root);
+    if (!assert_true(run_command(command) == 2, "cli cap leaves large job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s --max-bytes 0 > /dev/null 2>&1", root);
+    return assert_true(run_command(command) == 1, "cli rejects zero cap");
+}
+
+static int test_cli_migrate(void) {
+    char template[] = "/tmp/pap_test_cli_migrate_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init migrate")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data"), "write pdf source") ||
+        !assert_true(write_file(metadata_src, "metadata"), "write metadata source")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-flat %s %s", root, pdf_src, metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit before migrate")) {
+        return 0;
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli migrate %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli migrate output") ||
+        !assert_true(strcmp(output, "moved=2 remaining=0 layout=sharded\n") == 0, "cli migrate moves job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli claim after migrate")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "job-flat jobs\n") == 0, "migrated job is claimable");
+}
+
+static int test_cli_migrate_job_dirs(void) {
+    char template[] = "/tmp/pap_test_cli_job_dirs_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init job dir migrate")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-dir %s %s", root, pdf_src, metadata_src);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources") ||
+        !assert_true(run_command(command) == 0, "cli submit before job dir migrate")) {
+        return 0;
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli migrate %s --job-dirs", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli job dir migrate output") ||
+        !assert_true(strcmp(output, "moved=2 remaining=0 layout=directories\n") == 0, "cli migrates into job dirs")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli claim %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli claim after job dir migrate")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "job-dir jobs\n") == 0, "job dir is claimable");
+}
+
+static int test_cli_blob_submit(void) {
+    char template[] = "/tmp/pap_test_cli_blob_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init blob submit")) {
+        return 0;
+    }
+    for (int i = 0; i < 2; ++i) {
+        snprintf(command, sizeof(command), "./job_queue_cli submit %s job-blob-%d %s %s --blob", root, i, pdf_src,
+                 metadata_src);
+        if (!assert_true(run_command(command) == 0, "cli blob submit")) {
+            return 0;
+        }
+    }
+
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli gc-blobs %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli gc-blobs output")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "removed=0\n") == 0, "referenced blobs kept");
+}
+
+static int test_cli_tenants(void) {
+    char template[] = "/tmp/pap_test_cli_tenant_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init tenants")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-tenant %s %s --tenant acme", root, pdf_src,
+             metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli tenant submit")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-bad-tenant %s %s --tenant a/b", root, pdf_src,
+             metadata_src);
+    if (!assert_true(run_command(command) != 0, "cli rejects invalid tenant")) {
+        return 0;
+    }
+
+    char output[1024];
+    snprintf(command, sizeof(command), "./job_queue_cli tenant %s acme --max-in-flight 1", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "tenant=acme max_in_flight=1 weight=1\n") == 0,
+                     "cli tenant cap")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli stats %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli tenant stats output")) {
+        return 0;
+    }
+    return assert_true(strstr(output, "tenant acme: depth=1 in_flight=0 max_in_flight=1 weight=1") != NULL,
+                       "stats output has tenant");
+}
+
+static int test_cli_ring(void) {
+    char template[] = "/tmp/pap_test_cli_ring_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init ring")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli ring %s --capacity 5 > /dev/null 2>&1", root);
+    if (!assert_true(run_command(command) != 0, "cli ring rejects capacity")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli ring %s --capacity 64", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, "ring=enabled\n") == 0,
+                     "cli enables ring")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli ring %s --disable", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, "ring=disabled\n") == 0,
+                     "cli disables ring")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli ring %s --disable > /dev/null 2>&1", root);
+    return assert_true(run_command(command) == 2, "cli disable without ring is not found");
+}
+
+static int test_cli_tail(void) {
+    char template[] = "/tmp/pap_test_cli_tail_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init tail")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-tail %s %s", root, pdf_src, metadata_src);
+    jq_state_t state;
+    char uuid[JQ_UUID_MAX];
+    if (!assert_true(run_command(command) == 0, "cli submit tail job") ||
+        !assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim tail job") ||
+        !assert_true(jq_finalize(root, uuid, state, JQ_STATE_ERROR) == JQ_OK, "fail tail job")) {
+        return 0;
+    }
+
+    /* The second column is a wall-clock timestamp, so it is cut before comparing. */
+    char output[512];
+    snprintf(command, sizeof(command), "./job_queue_cli tail %s | cut -d' ' -f1,3-", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output,
+                                "0 submit job-tail none jobs 16\n"
+                                "1 claim job-tail jobs jobs 16\n"
+                                "2 finalize job-tail jobs error 16\n") == 0,
+                     "cli tails every transition")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli tail %s --from 2 | cut -d' ' -f1,3-", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "2 finalize job-tail jobs error 16\n") == 0,
+                     "cli tails from a cursor")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli tail %s --from next > /dev/null 2>&1", root);
+    return assert_true(run_command(command) == 1, "cli tail rejects cursor");
+}
+
+static int test_cli_cancel(void) {
+    char template[] = "/tmp/pap_test_cli_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init cancel")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-queued %s %s", root, pdf_src, metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit queued job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli submit %s job-running %s %s", root, pdf_src, metadata_src);
+    if (!assert_true(run_command(command) == 0, "cli submit running job")) {
+        return 0;
+    }
+    jq_state_t state;
+    char uuid[JQ_UUID_MAX];
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim one job")) {
+        return 0;
+    }
+    const char *queued = strcmp(uuid, "job-queued") == 0 ? "job-running" : "job-queued";
+
+    char output[256];
+    char expected[JQ_UUID_MAX + 16];
+    snprintf(command, sizeof(command), "./job_queue_cli cancel %s %s", root, queued);
+    snprintf(expected, sizeof(expected), "cancelled %s\n", queued);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, expected) == 0,
+                     "cli cancels waiting job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli cancel %s %s", root, uuid);
+    snprintf(expected, sizeof(expected), "cancelling %s\n", uuid);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, expected) == 0,
+                     "cli flags running job")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli cancel %s %s > /dev/null 2>&1", root, queued);
+    return assert_true(run_command(command) == 2, "cli cancel of removed job is not found");
+}
+
+static int test_cli_recover(void) {
+    char template[] = "/tmp/pap_test_cli_recover_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[256];
+    snprintf(command, sizeof(command), "./job_queue_cli recover %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli recover output")) {
+        return 0;
+    }
+    return assert_true(strcmp(output, "repaired=0\n") == 0, "cli recover on clean root");
+}
+
+static int test_cli_fsck(void) {
+    char template[] = "/tmp/pap_test_cli_fsck_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[256];
+    char path[PATH_MAX];
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init for fsck")) {
+        return 0;
+    }
+    const char *leftovers[] = {"jobs/cli-fsck.pdf.job.tmp.Xy34Zw", "jobs/cli-fsck-lonely.pdf.job"};
+    for (size_t i = 0; i < sizeof(leftovers) / sizeof(leftovers[0]); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, leftovers[i]);
+        if (!assert_true(write_file(path, "leftover"), "write fsck leftover")) {
+            return 0;
+        }
+    }
+
+    /* The temp file was just written, so even a repair keeps it. */
+    snprintf(command, sizeof(command), "./job_queue_cli fsck %s --repair --threads 2", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "cli fsck output") ||
+        !assert_true(strcmp(output, "entries=2 temp_files=1 stale_locks=0 split_pairs=0 stray_reports=0 orphans=1 "
+                                    "busy=1 repaired=0\n") == 0,
+                     "cli fsck summary")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli fsck %s --threads 0 > /dev/null 2>&1", root);
+    return assert_true(run_command(command) == 1, "cli fsck rejects zero threads");
+}
+
+static int test_cli_compact(void) {
+    char template[] = "/tmp/pap_test_cli_compact_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[256];
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli init %s", root);
+    if (!assert_true(run_command(command) == 0, "cli init compact")) {
+        return 0;
+    }
+    const char *uuids[] = {"cli-pack-a", "cli-pack-b", "cli-pack-c"};
+    for (size_t i = 0; i < sizeof(uuids) / sizeof(uuids[0]); ++i) {
+        snprintf(command, sizeof(command),
+                 "./job_queue_cli submit %s %s %s %s && ./job_queue_cli move %s %s jobs complete", root, uuids[i],
+                 pdf_src, metadata_src, root, uuids[i]);
+        if (!assert_true(run_command(command) == 0, "cli finish job to pack")) {
+            return 0;
+        }
+    }
+
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "retention=disabled\n") == 0,
+                     "cli retention starts disabled")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli compact %s > /dev/null 2>&1", root);
+    if (!assert_true(run_command(command) == 2, "cli compact without a policy is not found")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s --keep 1 --pack-pdf", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "retention max_age=0 keep=1 pack_pdf=1 event_segments=0\n") == 0,
+                     "cli retention sets policy")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s --max-age 3600", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "retention max_age=3600 keep=1 pack_pdf=1 event_segments=0\n") == 0,
+                     "cli retention keeps options left out")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s --keep-event-segments 4", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "retention max_age=3600 keep=1 pack_pdf=1 event_segments=4\n") == 0,
+                     "cli retention keeps event segments")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli compact %s", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, "packed=2\n") == 0,
+                     "cli compact packs all but one")) {
+        return 0;
+    }
+    int archived = 0;
+    for (size_t i = 0; i < sizeof(uuids) / sizeof(uuids[0]); ++i) {
+        jq_state_t state;
+        int locked = 1;
+        if (!assert_true(jq_status(root, uuids[i], &state, &locked) == JQ_OK && state == JQ_STATE_COMPLETE,
+                         "status of job after cli compact")) {
+            return 0;
+        }
+        char path[PATH_MAX];
+        unsigned long long offset = 0;
+        unsigned long long length = 0;
+        archived += jq_archive_locate(root, uuids[i], JQ_FILE_PDF, &state, path, sizeof(path), &offset, &length) ==
+                    JQ_OK;
+    }
+    if (!assert_true(archived == 2, "cli compact archived two jobs")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s --disable", root);
+    if (!assert_true(read_command_output(command, output, sizeof(output)) &&
+                         strcmp(output, "retention=disabled\n") == 0,
+                     "cli retention disable")) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./job_queue_cli retention %s --keep x > /dev/null 2>&1", root);
+    return assert_true(run_command(command) == 1, "cli retention rejects bad count");
+}
+
 int main(void) {
     int passed = 1;
     passed &= test_cli_submit_claim_finalize();
     passed &= test_cli_claim_empty();
     passed &= test_cli_release();
+    passed &= test_cli_lease();
+    passed &= test_cli_retry();
     passed &= test_cli_stats();
+    passed &= test_cli_claim_batch();
+    passed &= test_cli_submit_batch();
+    passed &= test_cli_levels();
+    passed &= test_cli_claim_size();
+    passed &= test_cli_migrate();
+    passed &= test_cli_migrate_job_dirs();
+    passed &= test_cli_blob_submit();
+    passed &= test_cli_tenants();
+    passed &= test_cli_cancel();
+    passed &= test_cli_ring();
+    passed &= test_cli_tail();
+    passed &= test_cli_recover();
+    passed &= test_cli_fsck();
+    passed &= test_cli_compact();
 
     if (!passed) {
         fprintf(stderr, "Some CLI tests failed.\n");
@@ -291,6 +291,74 @@ static int test_http_retrieve_report(void) {
     return 1;
 }
 
+static int test_http_retrieve_archived(void) {
+    char template[] = "/tmp/pap_test_http_archived_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    char report_path[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(jq_init(root) == JQ_OK, "init root for archived retrieve") ||
+        !assert_true(write_file(pdf_src, "archived pdf") && write_file(metadata_src, "{\"archived\":true}"),
+                     "write archived sources") ||
+        !assert_true(jq_submit(root, "archived-job", pdf_src, metadata_src, 0) == JQ_OK &&
+                         jq_move(root, "archived-job", JQ_STATE_JOBS, JQ_STATE_COMPLETE) == JQ_OK,
+                     "finish job to archive") ||
+        !assert_true(jq_job_report_paths(root, "archived-job", JQ_STATE_COMPLETE, report_path,
+                                         sizeof(report_path)) == JQ_OK &&
+                         write_file(report_path, "<html>archived</html>"),
+                     "write report to archive")) {
+        return 0;
+    }
+    jq_retention_options_t options;
+    jq_retention_options_init(&options);
+    options.max_age_seconds = 1;
+    options.pack_pdf = 1;
+    size_t packed = 0;
+    if (!assert_true(jq_compact(root, &options, time(NULL) + 10, &packed) == JQ_OK && packed == 1 &&
+                         !file_exists(report_path),
+                     "pack job into archive")) {
+        return 0;
+    }
+
+    pid_t pid = 0;
+    int port = 9122;
+    if (!assert_true(start_server(root, port, NULL, &pid), "start server for archived retrieve")) {
+        return 0;
+    }
+    const char *kinds[][2] = {{"pdf", "archived pdf"}, {"metadata", "{\"archived\":true}"},
+                              {"report", "<html>archived</html>"}};
+    char command[COMMAND_BUFFER];
+    char output[RESPONSE_BUFFER];
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+        snprintf(command, sizeof(command),
+                 "curl -s 'http://127.0.0.1:%d/retrieve?uuid=archived-job&state=complete&kind=%s'", port,
+                 kinds[i][0]);
+        if (!assert_true(read_command_output(command, output, sizeof(output)) && strcmp(output, kinds[i][1]) == 0,
+                         "retrieve serves archived file")) {
+            stop_server(pid);
+            return 0;
+        }
+    }
+
+    char status_buffer[64];
+    snprintf(command, sizeof(command),
+             "curl -s -w \"%s\" -o /dev/null "
+             "'http://127.0.0.1:%d/retrieve?uuid=archived-job&state=error&kind=pdf'",
+             "%{http_code}", port);
+    int ok = assert_true(read_http_status(command, status_buffer, sizeof(status_buffer)) &&
+                             strstr(status_buffer, "404") != NULL,
+                         "archived job in another state is not found");
+    stop_server(pid);
+    return ok;
+}
+
 static int test_http_release_and_errors(void) {
     char template[] = "/tmp/pap_test_http_release_XXXXXX";
     char *root = mkdtemp(template);
@@ -372,6 +440,108 @@ static int test_http_release_and_errors(void) {
     return 1;
 }
 
+static int test_http_cancel(void) {
+    char template[] = "/tmp/pap_test_http_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(jq_init(root) == JQ_OK, "init root") ||
+        !assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources") ||
+        !assert_true(jq_submit(root, "cancel-running", pdf_src, metadata_src, 0) == JQ_OK, "submit running job")) {
+        return 0;
+    }
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim running job") ||
+        !assert_true(jq_submit(root, "cancel-queued", pdf_src, metadata_src, 0) == JQ_OK, "submit queued job")) {
+        return 0;
+    }
+
+    pid_t pid = 0;
+    int port = 9119;
+    if (!assert_true(start_server(root, port, NULL, &pid), "start server")) {
+        return 0;
+    }
+
+    const char *cases[][2] = {
+        {"cancel-queued", "200"},
+        {"cancel-running", "202"},
+        {"cancel-queued", "404"},
+    };
+    char command[COMMAND_BUFFER];
+    char status_buffer[64];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        snprintf(command, sizeof(command),
+                 "curl -s -w \"%s\" -o /dev/null 'http://127.0.0.1:%d/cancel?uuid=%s'",
+                 "%{http_code}", port, cases[i][0]);
+        if (!assert_true(read_http_status(command, status_buffer, sizeof(status_buffer)) &&
+                             strstr(status_buffer, cases[i][1]) != NULL,
+                         "cancel status")) {
+            stop_server(pid);
+            return 0;
+        }
+    }
+
+    char output[RESPONSE_BUFFER];
+    snprintf(command, sizeof(command), "curl -s 'http://127.0.0.1:%d/status?uuid=cancel-running'", port);
+    int flagged = read_command_output(command, output, sizeof(output)) && strstr(output, "cancelled=1") != NULL;
+    stop_server(pid);
+    return assert_true(flagged, "status shows cancel flag");
+}
+
+static int test_http_status_progress(void) {
+    char template[] = "/tmp/pap_test_http_progress_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(jq_init(root) == JQ_OK, "init root") ||
+        !assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"), "write sources") ||
+        !assert_true(jq_submit(root, "progress-job", pdf_src, metadata_src, 0) == JQ_OK, "submit job")) {
+        return 0;
+    }
+    char uuid[JQ_UUID_MAX];
+    jq_state_t state;
+    if (!assert_true(jq_claim_next(root, 0, uuid, sizeof(uuid), &state) == JQ_OK, "claim job")) {
+        return 0;
+    }
+    jq_progress_slot_t *slot = jq_progress_begin(root, uuid, "redact", 8);
+    if (!assert_true(slot != NULL, "progress slot opens")) {
+        return 0;
+    }
+    jq_progress_update(slot, 4);
+    jq_progress_end(slot);
+
+    pid_t pid = 0;
+    int port = 9121;
+    if (!assert_true(start_server(root, port, NULL, &pid), "start server")) {
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[RESPONSE_BUFFER];
+    snprintf(command, sizeof(command), "curl -s 'http://127.0.0.1:%d/status?uuid=progress-job'", port);
+    int read_ok = read_command_output(command, output, sizeof(output));
+    stop_server(pid);
+    return assert_true(read_ok && strstr(output, " phase=redact bytes_done=4 bytes_total=8 ") != NULL,
+                       "status shows progress") &&
+           assert_true(strstr(output, " bytes_per_second=") != NULL && strstr(output, " eta_seconds=") != NULL,
+                       "status shows throughput and eta");
+}
+
 static int test_http_invalid_method_and_not_found(void) {
     char template[] = "/tmp/pap_test_http_misc_XXXXXX";
     char *root = mkdtemp(template);
@@ -1071,6 +1241,88 @@ static int test_http_status_and_retrieve(void) {
     return 1;
 }
 
+static int test_http_lease(void) {
+    char template[] = "/tmp/pap_test_http_lease_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+
+    if (!assert_true(jq_init(root) == JQ_OK, "init root for lease")) {
+        return 0;
+    }
+
+    char pdf_src[PATH_MAX];
+    char metadata_src[PATH_MAX];
+    snprintf(pdf_src, sizeof(pdf_src), "%s/source.pdf", root);
+    snprintf(metadata_src, sizeof(metadata_src), "%s/source.metadata", root);
+    if (!assert_true(write_file(pdf_src, "pdf data") && write_file(metadata_src, "metadata"),
+                     "write lease sources")) {
+        return 0;
+    }
+    if (!assert_true(jq_submit(root, "lease-job", pdf_src, metadata_src, 0) == JQ_OK, "submit lease job")) {
+        return 0;
+    }
+
+    pid_t pid = 0;
+    int port = 9123;
+    if (!assert_true(start_server(root, port, NULL, &pid), "start server for lease")) {
+        return 0;
+    }
+
+    char command[COMMAND_BUFFER];
+    char output[RESPONSE_BUFFER];
+    snprintf(command, sizeof(command), "curl -s 'http://127.0.0.1:%d/claim?owner=http-worker&lease=60'", port);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "claim with owner and lease")) {
+        stop_server(pid);
+        return 0;
+    }
+
+    snprintf(command, sizeof(command), "curl -s http://127.0.0.1:%d/status?uuid=lease-job", port);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "status leased request")) {
+        stop_server(pid);
+        return 0;
+    }
+    if (!assert_true(strstr(output, "owner=http-worker expires_at=") != NULL, "status lease response")) {
+        stop_server(pid);
+        return 0;
+    }
+
+    const char *heartbeats[][2] = {
+        {"&owner=http-worker", "200"},
+        {"&owner=other-worker", "404"},
+        {"", "404"},
+    };
+    for (size_t i = 0; i < sizeof(heartbeats) / sizeof(heartbeats[0]); ++i) {
+        char status_buffer[RESPONSE_BUFFER];
+        snprintf(command, sizeof(command),
+                 "curl -s -w \"%s\" -o /dev/null 'http://127.0.0.1:%d/heartbeat?uuid=lease-job&state=jobs%s'",
+                 "%{http_code}", port, heartbeats[i][0]);
+        if (!assert_true(read_http_status(command, status_buffer, sizeof(status_buffer)), "heartbeat request")) {
+            stop_server(pid);
+            return 0;
+        }
+        if (!assert_true(strstr(status_buffer, heartbeats[i][1]) != NULL, "heartbeat checks owner")) {
+            stop_server(pid);
+            return 0;
+        }
+    }
+
+    snprintf(command, sizeof(command), "curl -s http://127.0.0.1:%d/reap", port);
+    if (!assert_true(read_command_output(command, output, sizeof(output)), "reap request")) {
+        stop_server(pid);
+        return 0;
+    }
+    if (!assert_true(strncmp(output, "requeued=0", strlen("requeued=0")) == 0, "reap keeps live lease")) {
+        stop_server(pid);
+        return 0;
+    }
+
+    stop_server(pid);
+    return 1;
+}
+
 static int test_http_auth_token(void) {
     char template[] = "/tmp/pap_test_http_auth_XXXXXX";
     char *root = mkdtemp(template);
@@ -1493,7 +1745,10 @@ int main(void) {
     int passed = 1;
     passed &= test_http_submit_claim_finalize();
     passed &= test_http_retrieve_report();
+    passed &= test_http_retrieve_archived();
     passed &= test_http_release_and_errors();
+    passed &= test_http_cancel();
+    passed &= test_http_status_progress();
     passed &= test_http_invalid_method_and_not_found();
     passed &= test_http_missing_params();
     passed &= test_http_submit_missing_file();
@@ -1507,6 +1762,7 @@ int main(void) {
     passed &= test_http_finalize_missing_job();
     passed &= test_http_release_missing_job();
     passed &= test_http_status_and_retrieve();
+    passed &= test_http_lease();
     passed &= test_http_auth_token();
     passed &= test_http_url_decoding();
     passed &= test_http_invalid_uuid_and_path();
@@ -489,6 +489,120 @@ static int test_analyze_chunk_boundary_values(void) {
            assert_true(report.issue_count == 0, "boundary has no issues");
 }
 
+/* Lets the first `budget` polls through, then asks to stop. */
+static int cancel_after(void *user_data) {
+    size_t *budget = user_data;
+    if (*budget == 0) {
+        return 1;
+    }
+    (*budget)--;
+    return 0;
+}
+
+static int test_analyze_cancel(void) {
+    char template[] = "/tmp/pap_pdfa_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cancel.pdf", root);
+
+    size_t file_len = (size_t)PDFA_SCAN_CHUNK_SIZE * 3;
+    size_t buffer_len = file_len + 1;
+    char *buffer = calloc(buffer_len, 1);
+    if (!buffer) {
+        perror("calloc failed");
+        return 0;
+    }
+    size_t offset = 0;
+    int built = append_text(buffer, buffer_len, &offset, "%PDF-1.7\n<< /Type /Catalog >>\n") &&
+                append_padding(buffer, buffer_len, &offset, file_len - offset, 'A');
+    int wrote = built && write_buffer(path, buffer, offset);
+    free(buffer);
+    if (!assert_true(wrote, "write cancel pdf")) {
+        return 0;
+    }
+
+    pdfa_report_t report;
+    size_t budget = 1;
+    if (!assert_true(pdfa_analyze_file_with_cancel(path, &report, cancel_after, &budget) == PDFA_ERR_CANCELLED,
+                     "analysis stops when cancelled") ||
+        !assert_true(report.bytes_scanned == PDFA_SCAN_CHUNK_SIZE, "cancel polled once per chunk")) {
+        return 0;
+    }
+    budget = 16;
+    return assert_true(pdfa_analyze_file_with_cancel(path, &report, cancel_after, &budget) == PDFA_OK,
+                       "analysis completes when not cancelled") &&
+           assert_true(report.bytes_scanned == file_len && report.has_catalog, "uncancelled scan is whole") &&
+           assert_true(strcmp(pdfa_result_str(PDFA_ERR_CANCELLED), "cancelled") == 0, "result cancelled");
+}
+
+typedef struct {
+    size_t budget;
+    size_t calls;
+    size_t last_done;
+    size_t last_total;
+} progress_probe_t;
+
+/* Records each progress report and lets the first `budget` through before asking to stop. */
+static int progress_probe(size_t bytes_done, size_t bytes_total, void *user_data) {
+    progress_probe_t *probe = user_data;
+    probe->calls++;
+    probe->last_done = bytes_done;
+    probe->last_total = bytes_total;
+    if (probe->budget == 0) {
+        return 1;
+    }
+    probe->budget--;
+    return 0;
+}
+
+static int test_analyze_progress(void) {
+    char template[] = "/tmp/pap_pdfa_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cancel.pdf", root);
+
+    size_t file_len = (size_t)PDFA_SCAN_CHUNK_SIZE * 3;
+    size_t buffer_len = file_len + 1;
+    char *buffer = calloc(buffer_len, 1);
+    if (!buffer) {
+        perror("calloc failed");
+        return 0;
+    }
+    size_t offset = 0;
+    int built = append_text(buffer, buffer_len, &offset, "%PDF-1.7\n<< /Type /Catalog >>\n") &&
+                append_padding(buffer, buffer_len, &offset, file_len - offset, 'A');
+    int wrote = built && write_buffer(path, buffer, offset);
+    free(buffer);
+    if (!assert_true(wrote, "write cancel pdf")) {
+        return 0;
+    }
+
+    pdfa_report_t report;
+    progress_probe_t probe = { 1, 0, 0, 0 };
+    if (!assert_true(pdfa_analyze_file_with_progress(path, &report, progress_probe, &probe) == PDFA_ERR_CANCELLED,
+                     "analysis stops when cancelled") ||
+        !assert_true(report.bytes_scanned == 2 * (size_t)PDFA_SCAN_CHUNK_SIZE && probe.calls == 2,
+                     "progress reported once per chunk") ||
+        !assert_true(probe.last_done == report.bytes_scanned && probe.last_total == file_len,
+                     "progress carries bytes done and total")) {
+        return 0;
+    }
+    probe = (progress_probe_t){ 16, 0, 0, 0 };
+    return assert_true(pdfa_analyze_file_with_progress(path, &report, progress_probe, &probe) == PDFA_OK,
+                       "analysis completes when not cancelled") &&
+           assert_true(report.bytes_scanned == file_len && report.has_catalog, "uncancelled scan is whole") &&
+           assert_true(probe.calls == 3 && probe.last_done == file_len, "final progress covers the file") &&
+           assert_true(strcmp(pdfa_result_str(PDFA_ERR_CANCELLED), "cancelled") == 0, "result cancelled");
+}
+
 static int test_analyze_fixture_pdfs(void) {
     const char *missing_path = "tests/fixtures/problem_document.pdf";
     pdfa_report_t report;
@@ -800,6 +914,8 @@ int main(void) {
     ok &= test_analyze_text_alternatives_variants();
     ok &= test_analyze_lang_requires_value();
     ok &= test_analyze_chunk_boundary_values();
+    ok &= test_analyze_cancel();
+    ok &= test_analyze_progress();
     ok &= test_analyze_fixture_pdfs();
     ok &= test_json_invalid_args();
     ok &= test_json_buffer_too_small();
@@ -217,6 +217,107 @@ static int test_scan_handwriting_boundary(void) {
            assert_true(report.handwriting_confidence == 30, "boundary confidence computed");
 }
 
+static int cancel_after(void *user_data) {
+    size_t *budget = user_data;
+    if (*budget == 0) {
+        return 1;
+    }
+    (*budget)--;
+    return 0;
+}
+
+static int test_scan_cancel(void) {
+    char template[] = "/tmp/pap_ocr_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char path[PATH_MAX];
+    size_t length = 3 * 4096;
+    char *contents = malloc(length + 1);
+    if (!contents) {
+        return assert_true(0, "malloc cancel pdf failed");
+    }
+    memset(contents, 'A', length);
+    memcpy(contents, "%PDF-1.7\n", strlen("%PDF-1.7\n"));
+    memcpy(contents + length - strlen("InkList"), "InkList", strlen("InkList"));
+    contents[length] = '\0';
+    snprintf(path, sizeof(path), "%s/cancel.pdf", root);
+    int wrote = write_file(path, contents);
+    free(contents);
+    if (!assert_true(wrote, "write cancel pdf")) {
+        return 0;
+    }
+
+    pocr_report_t report;
+    size_t budget = 1;
+    pocr_set_cancel(cancel_after, &budget);
+    pocr_result_t cancelled = pocr_scan_file(path, &report);
+    budget = 16;
+    pocr_result_t completed = pocr_scan_file(path, &report);
+    pocr_set_cancel(NULL, NULL);
+    return assert_true(cancelled == POCR_ERR_CANCELLED, "scan stops when cancelled") &&
+           assert_true(completed == POCR_OK && report.handwriting_marker_hits == 1,
+                       "scan completes when not cancelled") &&
+           assert_true(!pocr_cancel_requested(), "no cancel callback after reset") &&
+           assert_true(strcmp(pocr_result_str(POCR_ERR_CANCELLED), "cancelled") == 0, "result string for cancelled");
+}
+
+typedef struct {
+    size_t budget;
+    size_t last_done;
+    size_t last_total;
+} progress_probe_t;
+
+static int progress_probe(size_t bytes_done, size_t bytes_total, void *user_data) {
+    progress_probe_t *probe = user_data;
+    probe->last_done = bytes_done;
+    probe->last_total = bytes_total;
+    if (probe->budget == 0) {
+        return 1;
+    }
+    probe->budget--;
+    return 0;
+}
+
+static int test_scan_progress(void) {
+    char template[] = "/tmp/pap_ocr_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char path[PATH_MAX];
+    size_t length = 3 * 4096;
+    char *contents = malloc(length + 1);
+    if (!contents) {
+        return assert_true(0, "malloc cancel pdf failed");
+    }
+    memset(contents, 'A', length);
+    memcpy(contents, "%PDF-1.7\n", strlen("%PDF-1.7\n"));
+    memcpy(contents + length - strlen("InkList"), "InkList", strlen("InkList"));
+    contents[length] = '\0';
+    snprintf(path, sizeof(path), "%s/cancel.pdf", root);
+    int wrote = write_file(path, contents);
+    free(contents);
+    if (!assert_true(wrote, "write cancel pdf")) {
+        return 0;
+    }
+
+    pocr_report_t report;
+    progress_probe_t probe = { 1, 0, 0 };
+    pocr_result_t cancelled = pocr_scan_file_with_progress(NULL, path, &report, progress_probe, &probe);
+    probe.budget = 16;
+    pocr_result_t completed = pocr_scan_file_with_progress(NULL, path, &report, progress_probe, &probe);
+    return assert_true(cancelled == POCR_ERR_CANCELLED, "scan stops when cancelled") &&
+           assert_true(completed == POCR_OK && report.handwriting_marker_hits == 1,
+                       "scan completes when not cancelled") &&
+           assert_true(probe.last_done == length && probe.last_total == length, "final progress covers the file") &&
+           assert_true(!pocr_report_progress(0, length), "no progress callback outside a scan") &&
+           assert_true(strcmp(pocr_result_str(POCR_ERR_CANCELLED), "cancelled") == 0, "result string for cancelled");
+}
+
 static int test_report_to_json(void) {
     pocr_report_t report;
     if (!assert_true(pocr_report_init(&report) == POCR_OK, "init report")) {
@@ -544,6 +645,8 @@ int main(void) {
     passed &= test_scan_handwriting_markers();
     passed &= test_scan_handwriting_case_insensitive();
     passed &= test_scan_handwriting_boundary();
+    passed &= test_scan_cancel();
+    passed &= test_scan_progress();
     passed &= test_report_to_json();
     passed &= test_report_to_json_success();
     passed &= test_report_to_json_no_handwriting();
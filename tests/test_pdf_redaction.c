@@ -164,6 +164,84 @@ static int test_apply_empty_plan(void) {
            assert_true(report.bytes_redacted == 0, "no bytes redacted");
 }
 
+static int cancel_always(void *user_data) {
+    int *polls = user_data;
+    (*polls)++;
+    return 1;
+}
+
+static int test_apply_cancel(void) {
+    char template[] = "/tmp/pap_redact_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char input[PATH_MAX];
+    char output[PATH_MAX];
+    snprintf(input, sizeof(input), "%s/input.pdf", root);
+    snprintf(output, sizeof(output), "%s/output.pdf", root);
+
+    const char *contents = "%PDF-1.7\nSSN 123-45-6789";
+    if (!assert_true(write_buffer(input, contents, strlen(contents)), "write input pdf")) {
+        return 0;
+    }
+
+    pdrx_plan_t plan;
+    pdrx_report_t report;
+    pdrx_plan_init(&plan);
+    int polls = 0;
+    return assert_true(pdrx_apply_file_with_cancel(input, output, &plan, &report, cancel_always, &polls) ==
+                           PDRX_ERR_CANCELLED,
+                       "apply stops when cancelled") &&
+           assert_true(polls == 1 && report.match_count == 0, "cancelled before the first chunk is redacted") &&
+           assert_true(strcmp(pdrx_result_str(PDRX_ERR_CANCELLED), "cancelled") == 0, "result string for cancelled");
+}
+
+typedef struct {
+    int polls;
+    size_t last_done;
+    size_t last_total;
+} progress_probe_t;
+
+static int progress_stop(size_t bytes_done, size_t bytes_total, void *user_data) {
+    progress_probe_t *probe = user_data;
+    probe->polls++;
+    probe->last_done = bytes_done;
+    probe->last_total = bytes_total;
+    return 1;
+}
+
+static int test_apply_progress(void) {
+    char template[] = "/tmp/pap_redact_cancel_XXXXXX";
+    char *root = mkdtemp(template);
+    if (!root) {
+        perror("mkdtemp failed");
+        return 0;
+    }
+    char input[PATH_MAX];
+    char output[PATH_MAX];
+    snprintf(input, sizeof(input), "%s/input.pdf", root);
+    snprintf(output, sizeof(output), "%s/output.pdf", root);
+
+    const char *contents = "%PDF-1.7\nSSN 123-45-6789";
+    if (!assert_true(write_buffer(input, contents, strlen(contents)), "write input pdf")) {
+        return 0;
+    }
+
+    pdrx_plan_t plan;
+    pdrx_report_t report;
+    pdrx_plan_init(&plan);
+    progress_probe_t probe = { 0, 0, 0 };
+    return assert_true(pdrx_apply_file_with_progress(input, output, &plan, &report, progress_stop, &probe) ==
+                           PDRX_ERR_CANCELLED,
+                       "apply stops when cancelled") &&
+           assert_true(probe.polls == 1 && report.match_count == 0, "cancelled before the tail is redacted") &&
+           assert_true(probe.last_done == strlen(contents) && probe.last_total == strlen(contents),
+                       "progress carries bytes done and total") &&
+           assert_true(strcmp(pdrx_result_str(PDRX_ERR_CANCELLED), "cancelled") == 0, "result string for cancelled");
+}
+
 static int test_apply_boundary_redaction(void) {
     char template[] = "/tmp/pap_redact_boundary_XXXXXX";
     char *root = mkdtemp(template);
@@ -385,6 +463,8 @@ int main(void) {
     passed &= test_apply_invalid();
     passed &= test_apply_missing_file();
     passed &= test_apply_empty_plan();
+    passed &= test_apply_cancel();
+    passed &= test_apply_progress();
     passed &= test_apply_boundary_redaction();
     passed &= test_apply_pii_redaction();
     passed &= test_apply_pii_invalid();